@@ -0,0 +1,55 @@
+include_guard(GLOBAL)
+
+# Profile-guided optimization support.
+#
+# DG_CAT_PGO_PHASE selects the phase applied to targets passed to target_pgo():
+#
+#   (empty)    No PGO flags.
+#   GENERATE   Instrument the build to write profiles to DG_CAT_PGO_PROFILE_DIR.
+#   USE        Optimize with the profiles in DG_CAT_PGO_PROFILE_DIR, with link-time optimization.
+#
+# GCC locates profiles by object file path, so both phases must be built in the same build tree. The
+# dg_cat_pgo target (see cmake/DgCatPgoBuild.cmake) runs the whole flow.
+
+set(DG_CAT_PGO_PHASE "" CACHE STRING "Profile-guided optimization phase: empty, GENERATE or USE")
+set_property(CACHE DG_CAT_PGO_PHASE PROPERTY STRINGS "" GENERATE USE)
+set(DG_CAT_PGO_PROFILE_DIR "${CMAKE_BINARY_DIR}/pgo-profile" CACHE PATH "Directory for profile-guided optimization profiles")
+
+if(DG_CAT_PGO_PHASE AND NOT DG_CAT_PGO_PHASE MATCHES "^(GENERATE|USE)$")
+  message(FATAL_ERROR "Invalid DG_CAT_PGO_PHASE: ${DG_CAT_PGO_PHASE} (must be empty, GENERATE or USE)")
+endif()
+
+if(DG_CAT_PGO_PHASE STREQUAL "USE")
+  include(CheckIPOSupported)
+  check_ipo_supported(RESULT DG_CAT_IPO_SUPPORTED OUTPUT DG_CAT_IPO_OUTPUT LANGUAGES CXX)
+  if(NOT DG_CAT_IPO_SUPPORTED)
+    message(WARNING "Link-time optimization is not supported; building with PGO only: ${DG_CAT_IPO_OUTPUT}")
+  endif()
+endif()
+
+function(target_pgo TARGET)
+  if(NOT DG_CAT_PGO_PHASE)
+    return()
+  endif()
+  if(NOT CMAKE_CXX_COMPILER_ID MATCHES "GNU|Clang")
+    message(WARNING "Profile-guided optimization is only supported with GCC and Clang")
+    return()
+  endif()
+
+  if(DG_CAT_PGO_PHASE STREQUAL "GENERATE")
+    # The copier runs sources and destinations on separate threads, so counters must be updated atomically
+    set(PGO_FLAGS -fprofile-generate=${DG_CAT_PGO_PROFILE_DIR} -fprofile-update=atomic)
+  elseif(CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+    # Clang profiles must be merged with llvm-profdata first; DgCatPgoBuild.cmake does this
+    set(PGO_FLAGS -fprofile-use=${DG_CAT_PGO_PROFILE_DIR}/default.profdata -Wno-profile-instr-unprofiled)
+  else()
+    set(PGO_FLAGS -fprofile-use=${DG_CAT_PGO_PROFILE_DIR} -fprofile-correction -Wno-missing-profile)
+  endif()
+
+  target_compile_options(${TARGET} PRIVATE ${PGO_FLAGS})
+  # PUBLIC, so that anything linking an instrumented library also links the profiling runtime
+  target_link_options(${TARGET} PUBLIC ${PGO_FLAGS})
+  if(DG_CAT_PGO_PHASE STREQUAL "USE" AND DG_CAT_IPO_SUPPORTED)
+    set_property(TARGET ${TARGET} PROPERTY INTERPROCEDURAL_OPTIMIZATION TRUE)
+  endif()
+endfunction()
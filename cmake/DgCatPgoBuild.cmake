@@ -0,0 +1,60 @@
+# Script run by the dg_cat_pgo target (cmake -P) to produce a profile-guided, link-time optimized dg-cat:
+#
+#   1. Configure and build an instrumented dg-cat in PGO_BINARY_DIR (DG_CAT_PGO_PHASE=GENERATE).
+#   2. Run scripts/pgo-train.sh against it to collect profiles.
+#   3. Reconfigure and rebuild the same tree with DG_CAT_PGO_PHASE=USE.
+#
+# Required variables: SOURCE_DIR, PGO_BINARY_DIR, GENERATOR, CXX_COMPILER, CXX_COMPILER_ID.
+# Optional: PREFIX_PATH (forwarded as CMAKE_PREFIX_PATH).
+
+foreach(VAR SOURCE_DIR PGO_BINARY_DIR GENERATOR CXX_COMPILER CXX_COMPILER_ID)
+  if(NOT DEFINED ${VAR})
+    message(FATAL_ERROR "DgCatPgoBuild.cmake requires -D${VAR}=...")
+  endif()
+endforeach()
+
+set(PROFILE_DIR ${PGO_BINARY_DIR}/pgo-profile)
+set(COMMON_ARGS
+  -S ${SOURCE_DIR}
+  -B ${PGO_BINARY_DIR}
+  -G ${GENERATOR}
+  -D CMAKE_BUILD_TYPE=Release
+  -D CMAKE_CXX_COMPILER=${CXX_COMPILER}
+  -D DG_CAT_PGO_PROFILE_DIR=${PROFILE_DIR}
+  -D BUILD_TESTING=OFF
+)
+if(PREFIX_PATH)
+  list(APPEND COMMON_ARGS "-DCMAKE_PREFIX_PATH=${PREFIX_PATH}")
+endif()
+
+function(run_step DESCRIPTION)
+  message(STATUS "PGO: ${DESCRIPTION}")
+  execute_process(COMMAND ${ARGN} RESULT_VARIABLE RESULT)
+  if(NOT RESULT EQUAL 0)
+    message(FATAL_ERROR "PGO: ${DESCRIPTION} failed (${RESULT})")
+  endif()
+endfunction()
+
+file(REMOVE_RECURSE ${PROFILE_DIR})
+file(MAKE_DIRECTORY ${PROFILE_DIR})
+
+run_step("configuring instrumented build"
+  ${CMAKE_COMMAND} ${COMMON_ARGS} -D DG_CAT_PGO_PHASE=GENERATE)
+run_step("building instrumented dg-cat"
+  ${CMAKE_COMMAND} --build ${PGO_BINARY_DIR} --target dg_cat_exe)
+run_step("running training workload"
+  ${SOURCE_DIR}/scripts/pgo-train.sh ${PGO_BINARY_DIR}/dg-cat)
+
+if(CXX_COMPILER_ID MATCHES "Clang")
+  file(GLOB PROFRAW_FILES ${PROFILE_DIR}/*.profraw)
+  find_program(LLVM_PROFDATA NAMES llvm-profdata REQUIRED)
+  run_step("merging profiles"
+    ${LLVM_PROFDATA} merge -o ${PROFILE_DIR}/default.profdata ${PROFRAW_FILES})
+endif()
+
+run_step("configuring optimized build"
+  ${CMAKE_COMMAND} ${COMMON_ARGS} -D DG_CAT_PGO_PHASE=USE)
+run_step("building optimized dg-cat"
+  ${CMAKE_COMMAND} --build ${PGO_BINARY_DIR} --target dg_cat_exe)
+
+message(STATUS "PGO: optimized binary is ${PGO_BINARY_DIR}/dg-cat")
@@ -0,0 +1,389 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <boost/log/trivial.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "arrow_ipc.hpp"
+#include "buffer_queue.hpp"
+#include "datagram_destination.hpp"
+#include "datagram_metadata.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "object_closer.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Datagram Destination that writes datagrams as Arrow IPC stream-format record batches.
+ *
+ * Each row holds the columns:
+ *
+ *     timestamp  timestamp[ns, tz=UTC]  Receive time. Null unless metadata is enabled.
+ *     length     uint32                 Payload length in bytes.
+ *     source     utf8                   Sender "<addr>:<port>". Null unless metadata is enabled and the sender is known.
+ *     payload    binary                 Datagram payload.
+ *
+ * Rows are accumulated from the BufferQueue and written as one record batch when the configured row or
+ * byte limit is reached, when the input has been idle for DEFAULT_POLLING_INTERVAL, or at EOF.
+ *
+ * Path format: "arrow://<filename>[?rows=<max-rows-per-batch>][&bytes=<max-payload-bytes-per-batch>]",
+ * where <filename> may be "-" or "stdout".
+ */
+class ArrowDatagramDestination : public DatagramDestination {
+private:
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _filename;
+    int _fd = -1;
+    bool _closed = false;
+    size_t _max_batch_rows = DEFAULT_ARROW_BATCH_ROWS;
+    size_t _max_batch_bytes = DEFAULT_ARROW_BATCH_BYTES;
+    DgDestinationStats _stats;
+
+    // Column builders for the pending record batch
+    size_t _n_rows = 0;
+    size_t _n_null_timestamps = 0;
+    size_t _n_null_sources = 0;
+    std::vector<int64_t> _timestamps;
+    std::vector<uint8_t> _timestamp_validity;
+    std::vector<uint32_t> _lengths;
+    std::vector<int32_t> _source_offsets;
+    std::vector<uint8_t> _source_validity;
+    std::string _source_data;
+    std::vector<int32_t> _payload_offsets;
+    std::vector<char> _payload_data;
+
+public:
+    ArrowDatagramDestination(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path)
+    {
+        ObjectCloser fd_closer(this);
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(path, "arrow://", args);
+        for (auto& arg : args) {
+            if (arg.first == "rows") {
+                _max_batch_rows = std::stoul(arg.second);
+            } else if (arg.first == "bytes") {
+                _max_batch_bytes = std::stoul(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to arrow://: " + arg.first);
+            }
+        }
+        if (_max_batch_rows == 0) {
+            throw std::runtime_error("arrow:// rows must be > 0");
+        }
+        // Binary column offsets are 32-bit
+        _max_batch_bytes = std::min(_max_batch_bytes, (size_t)INT32_MAX);
+
+        if (_filename == "-" || _filename == "stdout") {
+            _filename = "stdout";
+            _fd = dup(STDOUT_FILENO);
+        } else {
+            int oflags = O_WRONLY | O_CREAT | O_TRUNC;
+            _fd = ::open(_filename.c_str(), oflags, 0666);
+        }
+        if (_fd == -1) {
+            throw std::runtime_error("Failed to open file: " + path + ": " + strerror(errno));
+        }
+        reset_batch();
+        fd_closer.detach();
+    }
+
+    ~ArrowDatagramDestination() override {
+        close();
+    }
+
+    /**
+     * @brief Copy datagrams from the BufferQueue until an EOF is encountered.
+     *
+     * On exit the file handle will be closed, even on exception.
+     *
+     * @param buffer_queue The buffer queue to read datagrams from.
+     * @param stats        The threadsafe stats object to update with real-time progress.
+     */
+    void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
+        ObjectCloser fd_closer(this);  // close the file descriptor before returning
+        auto idle_interval = std::chrono::nanoseconds(static_cast<int64_t>(DEFAULT_POLLING_INTERVAL * 1e9));
+        size_t metadata_len = _config.metadata ? METADATA_LEN : 0;
+
+        write_schema();
+
+        size_t n_min = PREFIX_LEN;
+        while (true) {
+            auto deadline = std::chrono::steady_clock::now() + idle_interval;
+            BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(deadline, n_min);
+            size_t n_consumed = 0;
+            while (batch.n >= PREFIX_LEN) {
+                BufferQueue::ConsumerBatch record = batch;
+                uint32_t nbo_prefix;
+                record.copy_and_remove_bytes(&nbo_prefix, PREFIX_LEN);
+                size_t nb_record = ntohl(nbo_prefix);
+                if (record.n < nb_record) {
+                    break;
+                }
+                if (nb_record < metadata_len) {
+                    throw std::runtime_error("Datagram record too short to contain metadata: " + std::to_string(nb_record) + " bytes");
+                }
+                DatagramMetadata metadata;
+                bool has_metadata = false;
+                if (metadata_len != 0) {
+                    char metadata_buffer[METADATA_LEN];
+                    record.copy_and_remove_bytes(metadata_buffer, METADATA_LEN);
+                    metadata = DatagramMetadata::decode(metadata_buffer);
+                    has_metadata = true;
+                }
+                size_t nb_payload = nb_record - metadata_len;
+                if (_n_rows > 0 && _payload_data.size() + nb_payload > _max_batch_bytes) {
+                    write_batch();
+                }
+                if (nb_payload > _max_batch_bytes) {
+                    throw std::runtime_error("Datagram too large for arrow record batch: " + std::to_string(nb_payload) + " bytes");
+                }
+                size_t payload_pos = _payload_data.size();
+                _payload_data.resize(payload_pos + nb_payload);
+                record.copy_and_remove_bytes(_payload_data.data() + payload_pos, nb_payload);
+                append_row(has_metadata ? &metadata : nullptr, nb_payload);
+
+                n_consumed += PREFIX_LEN + nb_record;
+                batch = record;
+                if (_n_rows >= _max_batch_rows) {
+                    write_batch();
+                }
+            }
+            buffer_queue.consumer_commit_batch(n_consumed);
+
+            if (n_consumed == 0) {
+                if (batch.n >= PREFIX_LEN) {
+                    // Wait for the rest of a partially buffered datagram
+                    uint32_t nbo_prefix;
+                    batch.copy_and_remove_bytes(&nbo_prefix, PREFIX_LEN);
+                    n_min = PREFIX_LEN + ntohl(nbo_prefix);
+                }
+                if (buffer_queue.is_eof()) {
+                    // EOF is only set after the final datagram, so the queue can no longer grow
+                    auto final_batch = buffer_queue.consumer_start_batch(0);
+                    if (final_batch.n < n_min) {
+                        if (final_batch.n != 0) {
+                            BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
+                        }
+                        break;
+                    }
+                    continue;
+                }
+                // Input is idle; don't hold on to a partial record batch
+                write_batch();
+            } else {
+                n_min = PREFIX_LEN;
+            }
+            publish_stats(stats);
+        }
+        write_batch();
+        write_end_of_stream();
+        fsync(_fd);
+        publish_stats(stats);
+    }
+
+    /**
+     * @brief Close the file descriptor.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_closed) {
+            _closed = true;
+            if (_fd != -1) {
+                ::close(_fd);
+                _fd = -1;
+            }
+        }
+    }
+
+    /**
+     * @brief static factory method to create a typed DatagramDestination based on a pathname
+     *
+     * @param config   The configuration object
+     * @param path     The path to the destination
+     *
+     * @return unique_ptr<DatagramDestination>
+     */
+    static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<ArrowDatagramDestination>(config, path);
+    }
+
+protected:
+    void reset_batch() {
+        _n_rows = 0;
+        _n_null_timestamps = 0;
+        _n_null_sources = 0;
+        _timestamps.clear();
+        _timestamp_validity.clear();
+        _lengths.clear();
+        _source_offsets.assign(1, 0);
+        _source_validity.clear();
+        _source_data.clear();
+        _payload_offsets.assign(1, 0);
+        _payload_data.clear();
+    }
+
+    /**
+     * @brief Append a row whose payload has already been copied to the end of _payload_data.
+     */
+    void append_row(const DatagramMetadata *metadata, size_t nb_payload) {
+        if ((_n_rows & 7) == 0) {
+            _timestamp_validity.push_back(0);
+            _source_validity.push_back(0);
+        }
+        uint8_t bit = (uint8_t)(1 << (_n_rows & 7));
+        if (metadata != nullptr && metadata->timestamp_ns != 0) {
+            _timestamp_validity.back() |= bit;
+            _timestamps.push_back(metadata->timestamp_ns);
+        } else {
+            _timestamps.push_back(0);
+            _n_null_timestamps++;
+        }
+        if (metadata != nullptr && metadata->has_sender()) {
+            _source_validity.back() |= bit;
+            _source_data += metadata->sender_string();
+        } else {
+            _n_null_sources++;
+        }
+        _source_offsets.push_back((int32_t)_source_data.size());
+        _lengths.push_back((uint32_t)nb_payload);
+        _payload_offsets.push_back((int32_t)_payload_data.size());
+        _n_rows++;
+    }
+
+    void write_schema() {
+        using namespace arrow_ipc;
+        std::vector<Column> columns = {
+            { "timestamp", true, { TYPE_TIMESTAMP, 0, false, "UTC" } },
+            { "length", false, { TYPE_INT, 32, false, "" } },
+            { "source", true, { TYPE_UTF8, 0, false, "" } },
+            { "payload", false, { TYPE_BINARY, 0, false, "" } },
+        };
+        auto message = schema_message(columns);
+        char prefix[8];
+        encode_message_prefix(message.size(), prefix);
+        struct iovec iov[2] = {
+            { prefix, sizeof(prefix) },
+            { (void *)message.data(), message.size() },
+        };
+        write_all(iov, 2);
+    }
+
+    void write_end_of_stream() {
+        char eos[8];
+        arrow_ipc::encode_message_prefix(0, eos);
+        struct iovec iov = { eos, sizeof(eos) };
+        write_all(&iov, 1);
+    }
+
+    /**
+     * @brief Write the pending rows as a record batch message, and start a new batch.
+     */
+    void write_batch() {
+        using namespace arrow_ipc;
+        if (_n_rows == 0) {
+            return;
+        }
+        static const char padding[8] = { 0 };
+        std::vector<FieldNode> nodes;
+        std::vector<Buffer> buffers;
+        std::vector<struct iovec> body;
+        int64_t body_length = 0;
+
+        // Buffers are written back-to-back, each padded to 8 bytes. A zero-length validity
+        // buffer means that every value in the column is valid.
+        auto add_buffer = [&](const void *data, size_t len) {
+            buffers.push_back(Buffer{ body_length, (int64_t)len });
+            if (len > 0) {
+                body.push_back({ (void *)data, len });
+            }
+            size_t n_pad = (8 - (len & 7)) & 7;
+            if (n_pad > 0) {
+                body.push_back({ (void *)padding, n_pad });
+            }
+            body_length += (int64_t)(len + n_pad);
+        };
+        auto add_validity = [&](const std::vector<uint8_t>& validity, size_t null_count) {
+            add_buffer(validity.data(), (null_count == 0) ? 0 : validity.size());
+        };
+
+        nodes.push_back(FieldNode{ (int64_t)_n_rows, (int64_t)_n_null_timestamps });
+        add_validity(_timestamp_validity, _n_null_timestamps);
+        add_buffer(_timestamps.data(), _timestamps.size() * sizeof(int64_t));
+
+        nodes.push_back(FieldNode{ (int64_t)_n_rows, 0 });
+        add_buffer(nullptr, 0);
+        add_buffer(_lengths.data(), _lengths.size() * sizeof(uint32_t));
+
+        nodes.push_back(FieldNode{ (int64_t)_n_rows, (int64_t)_n_null_sources });
+        add_validity(_source_validity, _n_null_sources);
+        add_buffer(_source_offsets.data(), _source_offsets.size() * sizeof(int32_t));
+        add_buffer(_source_data.data(), _source_data.size());
+
+        nodes.push_back(FieldNode{ (int64_t)_n_rows, 0 });
+        add_buffer(nullptr, 0);
+        add_buffer(_payload_offsets.data(), _payload_offsets.size() * sizeof(int32_t));
+        add_buffer(_payload_data.data(), _payload_data.size());
+
+        auto message = record_batch_message((int64_t)_n_rows, nodes, buffers, body_length);
+        char prefix[8];
+        encode_message_prefix(message.size(), prefix);
+        std::vector<struct iovec> iov;
+        iov.push_back({ prefix, sizeof(prefix) });
+        iov.push_back({ (void *)message.data(), message.size() });
+        iov.insert(iov.end(), body.begin(), body.end());
+        write_all(iov.data(), iov.size());
+
+        BOOST_LOG_TRIVIAL(debug) << "Wrote arrow record batch: rows=" << _n_rows << ", body_length=" << body_length << "\n";
+        _stats.n_arrow_batches++;
+        _stats.n_arrow_rows += _n_rows;
+        reset_batch();
+    }
+
+    void publish_stats(LockableDgDestinationStats& stats) {
+        std::lock_guard<std::mutex> lock(stats._mutex);
+        stats = _stats;
+    }
+
+    /**
+     * @brief Write an iovec list completely, in as many writev() calls as necessary.
+     */
+    void write_all(struct iovec *iov, size_t n_iovecs) {
+        auto max_iovecs = (size_t)sysconf(_SC_IOV_MAX);
+        while (n_iovecs > 0) {
+            ssize_t ret = writev(_fd, iov, (int)std::min(n_iovecs, max_iovecs));
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "writev() failed");
+            }
+            size_t nb = (size_t)ret;
+            while (n_iovecs > 0 && nb >= iov->iov_len) {
+                nb -= iov->iov_len;
+                ++iov;
+                --n_iovecs;
+            }
+            if (n_iovecs > 0) {
+                iov->iov_base = (char *)iov->iov_base + nb;
+                iov->iov_len -= nb;
+            }
+        }
+    }
+};
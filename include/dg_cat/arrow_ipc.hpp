@@ -0,0 +1,392 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/endian/conversion.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * @brief A minimal FlatBuffers encoder, sufficient to produce Arrow IPC metadata messages without
+ *        depending on the FlatBuffers or Arrow libraries.
+ *
+ * Objects are appended in parent-before-child order, so every uoffset_t points forward as the
+ * FlatBuffers format requires. Offset fields of a table or vector are returned as "slots" that are
+ * patched with link() once the child object has been appended. All values are little-endian, and
+ * scalars are naturally aligned relative to the start of the buffer.
+ */
+class FlatBufferEncoder {
+public:
+    /**
+     * @brief A table field. If is_offset is true, the field is a 4-byte reference to a child object,
+     *        and value is ignored.
+     */
+    struct Field {
+        uint16_t id;
+        uint8_t size;
+        uint64_t value;
+        bool is_offset;
+    };
+
+    static Field scalar(uint16_t id, uint8_t size, uint64_t value) {
+        return Field{id, size, value, false};
+    }
+
+    static Field offset(uint16_t id) {
+        return Field{id, 4, 0, true};
+    }
+
+    /**
+     * @brief Positions of the offset slots of an appended table, indexed by field id (0 if not an offset field).
+     */
+    typedef std::vector<size_t> Slots;
+
+private:
+    std::vector<uint8_t> _buf;
+
+public:
+    FlatBufferEncoder() {
+        // Placeholder for the root table offset
+        put_le<uint32_t>(0);
+    }
+
+    /**
+     * @brief Append a table, preceded by its vtable.
+     *
+     * @param fields  The fields of the table. Absent fields take their schema default.
+     * @param slots   Receives the positions of offset fields, indexed by field id.
+     * @return size_t The position of the table.
+     */
+    size_t table(const std::vector<Field>& fields, Slots *slots=nullptr) {
+        size_t n_ids = 0;
+        size_t table_align = 4;
+        for (auto& f : fields) {
+            n_ids = std::max(n_ids, (size_t)f.id + 1);
+            table_align = std::max(table_align, (size_t)f.size);
+        }
+
+        // Lay out inline fields largest-first after the 4-byte vtable offset
+        std::vector<Field> ordered(fields);
+        std::stable_sort(ordered.begin(), ordered.end(), [](const Field& a, const Field& b) { return a.size > b.size; });
+        std::vector<uint16_t> field_offsets(n_ids, 0);
+        size_t inline_size = 4;
+        for (auto& f : ordered) {
+            inline_size = align_up(inline_size, f.size);
+            field_offsets[f.id] = (uint16_t)inline_size;
+            inline_size += f.size;
+        }
+        inline_size = align_up(inline_size, 4);
+
+        pad_to(2);
+        size_t vtable_pos = _buf.size();
+        put_le<uint16_t>((uint16_t)(4 + 2 * n_ids));
+        put_le<uint16_t>((uint16_t)inline_size);
+        for (auto off : field_offsets) {
+            put_le<uint16_t>(off);
+        }
+
+        pad_to(table_align);
+        size_t table_pos = _buf.size();
+        _buf.resize(table_pos + inline_size, 0);
+        store_le<int32_t>(table_pos, (int32_t)(table_pos - vtable_pos));
+        if (slots != nullptr) {
+            slots->assign(n_ids, 0);
+        }
+        for (auto& f : ordered) {
+            size_t pos = table_pos + field_offsets[f.id];
+            if (f.is_offset) {
+                if (slots != nullptr) {
+                    (*slots)[f.id] = pos;
+                }
+            } else {
+                switch (f.size) {
+                    case 1: store_le<uint8_t>(pos, (uint8_t)f.value); break;
+                    case 2: store_le<uint16_t>(pos, (uint16_t)f.value); break;
+                    case 4: store_le<uint32_t>(pos, (uint32_t)f.value); break;
+                    case 8: store_le<uint64_t>(pos, f.value); break;
+                    default: throw std::runtime_error("Invalid FlatBuffers scalar size: " + std::to_string(f.size));
+                }
+            }
+        }
+        return table_pos;
+    }
+
+    /**
+     * @brief Append a vector of structs. Each struct is elem_size bytes of little-endian data with the given alignment.
+     *
+     * @return size_t The position of the vector.
+     */
+    size_t struct_vector(const void *data, size_t count, size_t elem_size, size_t elem_align) {
+        pad_to(4);
+        while ((_buf.size() + 4) % elem_align != 0) {
+            _buf.push_back(0);
+        }
+        size_t pos = _buf.size();
+        put_le<uint32_t>((uint32_t)count);
+        const uint8_t *p = (const uint8_t *)data;
+        _buf.insert(_buf.end(), p, p + count * elem_size);
+        return pos;
+    }
+
+    /**
+     * @brief Append a vector of references to child objects (e.g., tables).
+     *
+     * @param count   The number of elements
+     * @param slots   Receives the positions of the element slots, to be patched with link()
+     * @return size_t The position of the vector.
+     */
+    size_t offset_vector(size_t count, Slots *slots=nullptr) {
+        pad_to(4);
+        size_t pos = _buf.size();
+        put_le<uint32_t>((uint32_t)count);
+        if (slots != nullptr) {
+            slots->clear();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (slots != nullptr) {
+                slots->push_back(_buf.size());
+            }
+            put_le<uint32_t>(0);
+        }
+        return pos;
+    }
+
+    /**
+     * @brief Append a NUL-terminated string.
+     *
+     * @return size_t The position of the string.
+     */
+    size_t string(const std::string& s) {
+        pad_to(4);
+        size_t pos = _buf.size();
+        put_le<uint32_t>((uint32_t)s.size());
+        _buf.insert(_buf.end(), s.begin(), s.end());
+        _buf.push_back(0);
+        return pos;
+    }
+
+    /**
+     * @brief Patch an offset slot to refer to an object appended after it.
+     */
+    void link(size_t slot, size_t target) {
+        if (slot == 0 || target <= slot) {
+            throw std::runtime_error("Invalid FlatBuffers forward reference");
+        }
+        store_le<uint32_t>(slot, (uint32_t)(target - slot));
+    }
+
+    /**
+     * @brief Set the root table and return the finished buffer, padded to a multiple of 8 bytes.
+     */
+    const std::vector<uint8_t>& finish(size_t root_table) {
+        store_le<uint32_t>(0, (uint32_t)root_table);
+        pad_to(8);
+        return _buf;
+    }
+
+private:
+    static size_t align_up(size_t n, size_t align) {
+        return (n + align - 1) / align * align;
+    }
+
+    void pad_to(size_t align) {
+        _buf.resize(align_up(_buf.size(), align), 0);
+    }
+
+    template<typename _T> void put_le(_T v) {
+        size_t pos = _buf.size();
+        _buf.resize(pos + sizeof(_T));
+        store_le<_T>(pos, v);
+    }
+
+    template<typename _T> void store_le(size_t pos, _T v) {
+        auto le = boost::endian::native_to_little(v);
+        memcpy(&_buf[pos], &le, sizeof(le));
+    }
+};
+
+/**
+ * @brief Constants and message builders for the Arrow IPC streaming format (metadata version V5).
+ *
+ * Each message is framed as a 0xFFFFFFFF continuation marker, a little-endian int32 metadata length,
+ * the FlatBuffers-encoded Message (padded to 8 bytes), and the message body. The stream ends with
+ * a continuation marker followed by a zero length.
+ */
+namespace arrow_ipc {
+
+static const int16_t METADATA_VERSION_V5 = 4;
+
+static const uint8_t MESSAGE_HEADER_SCHEMA = 1;
+static const uint8_t MESSAGE_HEADER_RECORD_BATCH = 3;
+
+static const uint8_t TYPE_INT = 2;
+static const uint8_t TYPE_BINARY = 4;
+static const uint8_t TYPE_UTF8 = 5;
+static const uint8_t TYPE_TIMESTAMP = 10;
+
+static const int16_t TIME_UNIT_NANOSECOND = 3;
+
+static const uint32_t CONTINUATION_MARKER = 0xffffffff;
+
+/**
+ * @brief The type of a column in a flat (non-nested) schema.
+ */
+struct ColumnType {
+    uint8_t type;           // TYPE_INT, TYPE_BINARY, TYPE_UTF8, or TYPE_TIMESTAMP
+    int32_t bit_width;      // For TYPE_INT
+    bool is_signed;         // For TYPE_INT
+    std::string timezone;   // For TYPE_TIMESTAMP (always nanosecond resolution)
+};
+
+struct Column {
+    std::string name;
+    bool nullable;
+    ColumnType type;
+};
+
+/**
+ * @brief Field node of a record batch (one per column): the row count and null count.
+ */
+struct FieldNode {
+    int64_t length;
+    int64_t null_count;
+};
+
+/**
+ * @brief Location of a buffer in the record batch body.
+ */
+struct Buffer {
+    int64_t offset;
+    int64_t length;
+};
+
+/**
+ * @brief Encode the 8-byte prefix that frames a message with the given (8-byte padded) metadata length.
+ */
+inline void encode_message_prefix(size_t metadata_len, char *buffer) {
+    auto marker = boost::endian::native_to_little(CONTINUATION_MARKER);
+    auto len = boost::endian::native_to_little((int32_t)metadata_len);
+    memcpy(buffer, &marker, 4);
+    memcpy(buffer + 4, &len, 4);
+}
+
+/**
+ * @brief Build the FlatBuffers-encoded Schema message for a flat list of columns.
+ */
+inline std::vector<uint8_t> schema_message(const std::vector<Column>& columns) {
+    typedef FlatBufferEncoder E;
+    E enc;
+    E::Slots message_slots;
+    size_t message = enc.table({
+            E::scalar(0, 2, (uint16_t)METADATA_VERSION_V5),
+            E::scalar(1, 1, MESSAGE_HEADER_SCHEMA),
+            E::offset(2),
+            E::scalar(3, 8, 0),
+        }, &message_slots);
+
+    E::Slots schema_slots;
+    enc.link(message_slots[2], enc.table({ E::offset(1) }, &schema_slots));
+
+    E::Slots field_slots;
+    enc.link(schema_slots[1], enc.offset_vector(columns.size(), &field_slots));
+
+    for (size_t i = 0; i < columns.size(); ++i) {
+        auto& column = columns[i];
+        E::Slots slots;
+        enc.link(field_slots[i], enc.table({
+                E::offset(0),
+                E::scalar(1, 1, column.nullable ? 1 : 0),
+                E::scalar(2, 1, column.type.type),
+                E::offset(3),
+                E::offset(5),
+            }, &slots));
+        enc.link(slots[0], enc.string(column.name));
+        switch (column.type.type) {
+            case TYPE_INT:
+                enc.link(slots[3], enc.table({
+                        E::scalar(0, 4, (uint32_t)column.type.bit_width),
+                        E::scalar(1, 1, column.type.is_signed ? 1 : 0),
+                    }));
+                break;
+            case TYPE_TIMESTAMP: {
+                E::Slots ts_slots;
+                enc.link(slots[3], enc.table({
+                        E::scalar(0, 2, (uint16_t)TIME_UNIT_NANOSECOND),
+                        E::offset(1),
+                    }, &ts_slots));
+                enc.link(ts_slots[1], enc.string(column.type.timezone));
+                break;
+            }
+            case TYPE_BINARY:
+            case TYPE_UTF8:
+                enc.link(slots[3], enc.table({}));
+                break;
+            default:
+                throw std::runtime_error("Unsupported Arrow column type: " + std::to_string(column.type.type));
+        }
+        // Arrow readers require a (possibly empty) children vector
+        enc.link(slots[5], enc.offset_vector(0));
+    }
+
+    return enc.finish(message);
+}
+
+/**
+ * @brief Build the FlatBuffers-encoded RecordBatch message header. The body follows the message.
+ *
+ * @param length       The number of rows in the batch
+ * @param nodes        One field node per column
+ * @param buffers      The body buffers, in column order (validity, then offsets and/or data, per column)
+ * @param body_length  The total length of the body, a multiple of 8
+ */
+inline std::vector<uint8_t> record_batch_message(
+        int64_t length,
+        const std::vector<FieldNode>& nodes,
+        const std::vector<Buffer>& buffers,
+        int64_t body_length
+    )
+{
+    typedef FlatBufferEncoder E;
+    E enc;
+    E::Slots message_slots;
+    size_t message = enc.table({
+            E::scalar(0, 2, (uint16_t)METADATA_VERSION_V5),
+            E::scalar(1, 1, MESSAGE_HEADER_RECORD_BATCH),
+            E::offset(2),
+            E::scalar(3, 8, (uint64_t)body_length),
+        }, &message_slots);
+
+    E::Slots batch_slots;
+    enc.link(message_slots[2], enc.table({
+            E::scalar(0, 8, (uint64_t)length),
+            E::offset(1),
+            E::offset(2),
+        }, &batch_slots));
+
+    // FieldNode and Buffer are structs of two little-endian int64 values
+    std::vector<int64_t> node_data;
+    for (auto& node : nodes) {
+        node_data.push_back(boost::endian::native_to_little(node.length));
+        node_data.push_back(boost::endian::native_to_little(node.null_count));
+    }
+    enc.link(batch_slots[1], enc.struct_vector(node_data.data(), nodes.size(), 16, 8));
+
+    std::vector<int64_t> buffer_data;
+    for (auto& buffer : buffers) {
+        buffer_data.push_back(boost::endian::native_to_little(buffer.offset));
+        buffer_data.push_back(boost::endian::native_to_little(buffer.length));
+    }
+    enc.link(batch_slots[2], enc.struct_vector(buffer_data.data(), buffers.size(), 16, 8));
+
+    return enc.finish(message);
+}
+
+} // namespace arrow_ipc
@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief splitmix64 finalizer; a cheap, well-mixed 64-bit hash.
+ */
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Default hash for BoundedHashTable keys: the key's own hash() method.
+ */
+template<class _K> struct BoundedHashTableHash {
+    uint64_t operator()(const _K& key) const {
+        return key.hash();
+    }
+};
+
+template<> struct BoundedHashTableHash<uint64_t> {
+    uint64_t operator()(uint64_t key) const {
+        return splitmix64(key);
+    }
+};
+
+/**
+ * @brief A bounded open-addressing (linear probing) hash table, used to look up per-key state on every datagram
+ *        without allocation once a key has been seen.
+ *
+ * The table grows to keep the load factor at or below 1/2, and holds at most max_entries entries. Entries are
+ * only removed all at once by clear(), which keeps the table's memory, so values are stored in insertion order
+ * and indices remain stable. Pointers returned by find() and find_or_insert() are only valid until the next
+ * insertion or clear().
+ *
+ * @tparam _K     The key type. Must be equality-comparable.
+ * @tparam _V     The value type. Must be default-constructible.
+ * @tparam _Hash  Function object returning a uint64_t hash of a key.
+ */
+template<class _K, class _V, class _Hash = BoundedHashTableHash<_K>> class BoundedHashTable {
+public:
+    struct Entry {
+        _K key;
+        _V value;
+    };
+
+private:
+    static const uint32_t EMPTY = UINT32_MAX;
+
+    size_t _max_entries;
+    std::vector<uint32_t> _slots;     // Index into _entries, or EMPTY
+    std::vector<Entry> _entries;
+    _Hash _hash;
+
+public:
+    explicit BoundedHashTable(size_t max_entries) :
+        _max_entries(max_entries),
+        _slots(16, EMPTY)
+    {
+    }
+
+    size_t size() const {
+        return _entries.size();
+    }
+
+    size_t max_entries() const {
+        return _max_entries;
+    }
+
+    /**
+     * @brief Look up a key.
+     *
+     * @return _V*  The value, or nullptr if the key is not in the table.
+     */
+    _V *find(const _K& key) {
+        size_t mask = _slots.size() - 1;
+        for (size_t i = _hash(key) & mask; ; i = (i + 1) & mask) {
+            uint32_t index = _slots[i];
+            if (index == EMPTY) {
+                return nullptr;
+            }
+            if (_entries[index].key == key) {
+                return &_entries[index].value;
+            }
+        }
+    }
+
+    /**
+     * @brief Look up a key, inserting a default-constructed value if it is new.
+     *
+     * @param key       The key
+     * @param inserted  Set to true if a new entry was inserted
+     *
+     * @return _V*  The value, or nullptr if the key is new and the table is full.
+     */
+    _V *find_or_insert(const _K& key, bool& inserted) {
+        inserted = false;
+        size_t mask = _slots.size() - 1;
+        size_t i = _hash(key) & mask;
+        for (; ; i = (i + 1) & mask) {
+            uint32_t index = _slots[i];
+            if (index == EMPTY) {
+                break;
+            }
+            if (_entries[index].key == key) {
+                return &_entries[index].value;
+            }
+        }
+        if (_entries.size() >= _max_entries) {
+            return nullptr;
+        }
+        if ((_entries.size() + 1) * 2 > _slots.size()) {
+            grow();
+            mask = _slots.size() - 1;
+            for (i = _hash(key) & mask; _slots[i] != EMPTY; i = (i + 1) & mask) {
+            }
+        }
+        _slots[i] = (uint32_t)_entries.size();
+        _entries.push_back(Entry{key, _V()});
+        inserted = true;
+        return &_entries.back().value;
+    }
+
+    /**
+     * @brief All entries, in insertion order. Entries may be reordered in place, e.g. sorted for output, but
+     *        only before clear() is called, since the slots refer to them by index.
+     */
+    std::vector<Entry>& entries() {
+        return _entries;
+    }
+
+    const std::vector<Entry>& entries() const {
+        return _entries;
+    }
+
+    /**
+     * @brief Remove all entries, keeping the memory of the table for reuse.
+     */
+    void clear() {
+        if (!_entries.empty()) {
+            std::fill(_slots.begin(), _slots.end(), EMPTY);
+            _entries.clear();
+        }
+    }
+
+protected:
+    void grow() {
+        std::vector<uint32_t> slots(_slots.size() * 2, EMPTY);
+        size_t mask = slots.size() - 1;
+        for (size_t index = 0; index < _entries.size(); ++index) {
+            size_t i = _hash(_entries[index].key) & mask;
+            while (slots[i] != EMPTY) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = (uint32_t)index;
+        }
+        _slots.swap(slots);
+    }
+};
+
+template<class _K, class _V, class _Hash> const uint32_t BoundedHashTable<_K, _V, _Hash>::EMPTY;
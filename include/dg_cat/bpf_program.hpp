@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <netinet/in.h>
+
+/**
+ * @brief A small assembler for classic BPF socket filters, with forward-only symbolic jump labels.
+ *
+ * Example:
+ *
+ *     BpfProgram prog;
+ *     auto reject = prog.new_label();
+ *     prog.stmt(BPF_LD | BPF_B | BPF_ABS, 9);
+ *     prog.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, BpfProgram::NEXT, reject);
+ *     prog.ret(0xffffffff);
+ *     prog.bind(reject);
+ *     prog.ret(0);
+ *     prog.attach(sock);
+ */
+class BpfProgram {
+public:
+    typedef size_t Label;
+
+    /**
+     * @brief A pseudo-label that refers to the instruction immediately following a jump.
+     */
+    static constexpr Label NEXT = SIZE_MAX;
+
+private:
+    struct Fixup {
+        size_t insn;      // Index of the jump instruction
+        Label jt;
+        Label jf;
+    };
+
+    std::vector<struct sock_filter> _insns;
+    std::vector<size_t> _label_targets;    // Instruction index for each bound label, or SIZE_MAX if unbound
+    std::vector<Fixup> _fixups;
+
+public:
+    BpfProgram() = default;
+
+    size_t size() const {
+        return _insns.size();
+    }
+
+    /**
+     * @brief Allocate a new, unbound label.
+     */
+    Label new_label() {
+        _label_targets.push_back(SIZE_MAX);
+        return _label_targets.size() - 1;
+    }
+
+    /**
+     * @brief Bind a label to the next instruction to be emitted.
+     */
+    void bind(Label label) {
+        _label_targets.at(label) = _insns.size();
+    }
+
+    /**
+     * @brief Emit a non-jump instruction.
+     */
+    void stmt(uint16_t code, uint32_t k) {
+        _insns.push_back(BPF_STMT(code, k));
+    }
+
+    /**
+     * @brief Emit a conditional jump. Targets must be labels bound later in the program (or NEXT).
+     */
+    void jump(uint16_t code, uint32_t k, Label jt, Label jf) {
+        _fixups.push_back(Fixup{_insns.size(), jt, jf});
+        _insns.push_back(BPF_JUMP(code, k, 0, 0));
+    }
+
+    /**
+     * @brief Emit an unconditional jump to a label bound later in the program.
+     */
+    void jump_always(Label target) {
+        _fixups.push_back(Fixup{_insns.size(), target, NEXT});
+        _insns.push_back(BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0));
+    }
+
+    /**
+     * @brief Emit a return instruction. 0 rejects the packet; any other value accepts up to that many bytes.
+     */
+    void ret(uint32_t k) {
+        stmt(BPF_RET | BPF_K, k);
+    }
+
+    /**
+     * @brief Resolve labels and return the finished program.
+     */
+    std::vector<struct sock_filter> finish() const {
+        std::vector<struct sock_filter> result(_insns);
+        for (auto& fixup : _fixups) {
+            auto& insn = result[fixup.insn];
+            if (BPF_OP(insn.code) == BPF_JA) {
+                insn.k = (uint32_t)offset_to(fixup.insn, fixup.jt, UINT32_MAX);
+            } else {
+                insn.jt = (uint8_t)offset_to(fixup.insn, fixup.jt, UINT8_MAX);
+                insn.jf = (uint8_t)offset_to(fixup.insn, fixup.jf, UINT8_MAX);
+            }
+        }
+        if (result.empty() || result.size() > BPF_MAXINSNS) {
+            throw std::runtime_error("Invalid BPF program length: " + std::to_string(result.size()) + " instructions");
+        }
+        return result;
+    }
+
+    /**
+     * @brief Attach the finished program to a socket as a classic socket filter (SO_ATTACH_FILTER).
+     */
+    void attach(int sock) const {
+        auto insns = finish();
+        struct sock_fprog fprog;
+        fprog.len = (unsigned short)insns.size();
+        fprog.filter = insns.data();
+        if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+            throw std::system_error(errno, std::system_category(), "setsockopt(SO_ATTACH_FILTER) failed");
+        }
+    }
+
+    /**
+     * @brief Build a filter for packets that begin at the network header (e.g., an AF_PACKET SOCK_DGRAM socket),
+     *        accepting unfragmented IPv4 or IPv6 UDP datagrams with the given destination port (any port if 0).
+     *        Packets sent by this host are rejected, so that they are not seen twice on loopback.
+     *        IPv6 datagrams are only recognized if UDP is the first next header.
+     */
+    static BpfProgram udp_dst_port_filter(uint16_t port) {
+        BpfProgram prog;
+        auto reject = prog.new_label();
+        auto ipv6 = prog.new_label();
+        auto check_v4_port = prog.new_label();
+        auto check_v6_port = prog.new_label();
+
+        prog.stmt(BPF_LD | BPF_B | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_PKTTYPE));
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, reject, NEXT);
+
+        prog.stmt(BPF_LD | BPF_B | BPF_ABS, 0);
+        prog.stmt(BPF_ALU | BPF_AND | BPF_K, 0xf0);
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, 0x40, NEXT, ipv6);
+
+        // IPv4: protocol is UDP, and neither MF nor a fragment offset is set
+        prog.stmt(BPF_LD | BPF_B | BPF_ABS, 9);
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, NEXT, reject);
+        prog.stmt(BPF_LD | BPF_H | BPF_ABS, 6);
+        prog.jump(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, reject, check_v4_port);
+
+        prog.bind(ipv6);
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, 0x60, NEXT, reject);
+        prog.stmt(BPF_LD | BPF_B | BPF_ABS, 6);
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, check_v6_port, reject);
+
+        prog.bind(check_v4_port);
+        if (port != 0) {
+            prog.stmt(BPF_LDX | BPF_B | BPF_MSH, 0);
+            prog.stmt(BPF_LD | BPF_H | BPF_IND, 2);
+            prog.jump(BPF_JMP | BPF_JEQ | BPF_K, port, NEXT, reject);
+        }
+        prog.ret(0xffffffff);
+
+        prog.bind(check_v6_port);
+        if (port != 0) {
+            prog.stmt(BPF_LD | BPF_H | BPF_ABS, 40 + 2);
+            prog.jump(BPF_JMP | BPF_JEQ | BPF_K, port, NEXT, reject);
+        }
+        prog.ret(0xffffffff);
+
+        prog.bind(reject);
+        prog.ret(0);
+        return prog;
+    }
+
+protected:
+    size_t offset_to(size_t insn, Label label, size_t max_offset) const {
+        if (label == NEXT) {
+            return 0;
+        }
+        size_t target = _label_targets.at(label);
+        if (target == SIZE_MAX || target <= insn) {
+            throw std::runtime_error("BPF jump to unbound or backward label");
+        }
+        size_t offset = target - insn - 1;
+        if (offset > max_offset) {
+            throw std::runtime_error("BPF jump offset out of range: " + std::to_string(offset));
+        }
+        return offset;
+    }
+};
@@ -7,9 +7,15 @@
 
 
 #include "constants.hpp"
+#include "config.hpp"
+#include "datagram_filter.hpp"
+#include "datagram_metadata.hpp"
 #include "stats.hpp"
+#include "stream_copy.hpp"
+#include "tsc_clock.hpp"
 
 #include <boost/endian/conversion.hpp>
+#include <boost/log/trivial.hpp>
 #include <iostream>
 #include <vector>
 #include <mutex>
@@ -19,6 +25,7 @@
 
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <time.h>
 
 class BufferQueue {
     /**
@@ -44,6 +51,34 @@ protected:
     DgBufferStats _stats;
     size_t _n;                // Number of bytes in the queue
     bool _is_eof;
+    size_t _metadata_len;     // Length of the per-datagram metadata header (0 if metadata is disabled)
+
+    // Flight recorder mode (see arm_history())
+    bool _overwrite = false;          // If true, the producer discards the oldest records instead of waiting for space
+    size_t _history_max_n = 0;        // In overwrite mode, the backlog is trimmed to at most this many bytes
+    int64_t _history_max_ns = 0;      // In overwrite mode, if nonzero, records this much older than the newest are discarded
+    std::shared_ptr<const DatagramFilter> _trigger_filter;  // In overwrite mode, datagrams that match this trigger a dump
+    bool _triggered = false;          // Set when overwrite mode is ended by a trigger; cleared by consumer_wait_trigger()
+
+    // Runtime control (see consumer_set_paused() and consumer_wakeup())
+    bool _consumer_paused = false;    // If true, consumer_start_batch() returns no data until resumed
+    bool _consumer_wakeup = false;    // Set to make a waiting consumer_start_batch() return early
+
+    // Backlog residency (see record_residency_locked())
+    struct ResidencyStamp {
+        uint64_t end_pos;             // Stream position just past the last record stamped with this time
+        uint64_t ticks;               // TscClock ticks when the producer received the records' batch
+        uint64_t n_datagrams;         // Number of those records still in the queue
+    };
+    TscClock _clock;                  // Timestamps derived metadata. Used only by the producer.
+    std::vector<ResidencyStamp> _residency_stamps;  // Ring of stamps, oldest first, covering every record in the queue
+    size_t _residency_first = 0;      // Index of the oldest stamp in _residency_stamps
+    size_t _n_residency_stamps = 0;   // Number of stamps in _residency_stamps
+    uint64_t _produced_pos = 0;       // Total bytes ever added to the queue
+    uint64_t _consumed_pos = 0;       // Total bytes ever removed from the queue (consumed or overwritten)
+    Histogram _residency_ns;          // Times from enqueue to consume of all consumed datagrams
+    uint64_t _residency_publish_ticks = 0;     // Ticks when _residency_ns was last copied to the shared stats
+    uint64_t _residency_publish_interval;      // Minimum ticks between copies of _residency_ns to the shared stats
 
 public:
 
@@ -98,23 +133,53 @@ public:
             }
         }
 
+        /**
+         * @brief Copy nb bytes starting offset bytes into the batch, without removing them.
+         */
+        void peek(size_t offset, void *buffer, size_t nb) const {
+            if (offset + nb > n) {
+                throw std::runtime_error("Consumer tried to peek past the end of a batch: " + std::to_string(offset + nb) + " bytes, " + std::to_string(n) + " bytes available");
+            }
+            size_t n0 = iov[0].iov_len;
+            if (offset + nb <= n0) {
+                memcpy(buffer, (const char *)iov[0].iov_base + offset, nb);
+            } else if (offset >= n0) {
+                memcpy(buffer, (const char *)iov[1].iov_base + (offset - n0), nb);
+            } else {
+                size_t n1 = n0 - offset;
+                memcpy(buffer, (const char *)iov[0].iov_base + offset, n1);
+                memcpy((char *)buffer + n1, iov[1].iov_base, nb - n1);
+            }
+        }
+
         void copy_and_remove_bytes(void *buffer, size_t nb) {
             if (nb > 0) {
                 if (nb > n) {
                     throw std::runtime_error("Consumer tried to copy and remove too many bytes: " + std::to_string(nb) + " bytes, " + std::to_string(n) + " bytes available");
                 }
-                char *buff = (char *)buffer;
+                peek(0, buffer, nb);
+                remove_bytes(nb);
+            }
+        }
+
+        /**
+         * @brief Remove nb bytes from the start of the batch without copying them, e.g., to skip to the next
+         *        record after handing the batch's iovecs to a system call.
+         */
+        void remove_bytes(size_t nb) {
+            if (nb > 0) {
+                if (nb > n) {
+                    throw std::runtime_error("Consumer tried to remove too many bytes: " + std::to_string(nb) + " bytes, " + std::to_string(n) + " bytes available");
+                }
                 size_t n1 = std::min(nb, iov[0].iov_len);
-                memcpy(buff, iov[0].iov_base, n1);
                 iov[0].iov_base = (char *)(iov[0].iov_base) + n1;
                 iov[0].iov_len -= n1;
                 n -= n1;
                 if (nb > n1) {
-                    buff += n1;
-                    memcpy(buff, iov[1].iov_base, nb);
-                    iov[1].iov_base = (char *)(iov[1].iov_base) + nb;
-                    iov[1].iov_len -= nb;
-                    n -= nb;
+                    size_t n2 = nb - n1;
+                    iov[1].iov_base = (char *)(iov[1].iov_base) + n2;
+                    iov[1].iov_len -= n2;
+                    n -= n2;
                 }
                 if (iov[0].iov_len == 0) {
                     iov[0] = iov[1];
@@ -141,9 +206,13 @@ public:
         _config(config),
         _shared_stats(stats),
         _n(0),
-        _is_eof(false)
+        _is_eof(false),
+        _metadata_len(config.metadata ? METADATA_LEN : 0),
+        _residency_publish_interval((uint64_t)(DEFAULT_RESIDENCY_PUBLISH_SECS * TscClock::ticks_per_sec()))
     {
         _data.resize(_max_n);
+        _residency_stamps.resize(DEFAULT_RESIDENCY_MAX_STAMPS);
+        BOOST_LOG_TRIVIAL(debug) << "Backlog copies use " << stream_copy_kernel_name() << " non-temporal stores beyond " << DEFAULT_STREAM_COPY_MIN_BACKLOG << " bytes of backlog\n";
     }
 
     /**
@@ -232,9 +301,16 @@ public:
      * @param mmsg_hdrs     Array of mmsghdr structures returned by recvmmsg() that indicate the datagrams received.
      *                      Entries that are ancillary data or truncated datagrams are replaced with 0-length iovecs.
      * @param n_buffers     Length of the mmsg_hdrs array as returned by recvmmsg().
+     * @param metadata      If metadata is enabled, an optional array of n_buffers metadata headers to store with
+     *                      the datagrams. If nullptr, metadata is derived from msg_name and the current time.
      */
-    void producer_commit_batch(const struct mmsghdr *mmsg_hdrs, size_t n_buffers) {
+    void producer_commit_batch(const struct mmsghdr *mmsg_hdrs, size_t n_buffers, const DatagramMetadata *metadata=nullptr) {
         if (n_buffers > 0) {
+            uint64_t batch_ticks = TscClock::ticks();
+            struct timespec batch_time{};
+            if (_metadata_len != 0 && metadata == nullptr) {
+                batch_time = _clock.realtime(batch_ticks);
+            }
 
             std::unique_lock<std::mutex> lock(_mutex);
             if (_is_eof) {
@@ -258,10 +334,14 @@ public:
                     need_update_stats = true;
                     continue;
                 }
-                if (_max_n < dg_len + PREFIX_LEN) {
-                    throw std::runtime_error("Datagram + PREFIX too large for buffer: " + std::to_string(dg_len) + " + 4 bytes, max=" + std::to_string(_max_n) + " bytes");
+                size_t record_len = PREFIX_LEN + _metadata_len + dg_len;
+                if (_max_n < record_len) {
+                    throw std::runtime_error("Datagram + PREFIX too large for buffer: " + std::to_string(dg_len) + " + " + std::to_string(record_len - dg_len) + " bytes, max=" + std::to_string(_max_n) + " bytes");
                 }
-                if (n_free_locked() < dg_len + PREFIX_LEN) {
+                if (_overwrite) {
+                    discard_history_locked(record_len);
+                }
+                if (n_free_locked() < record_len) {
                     if (need_update_stats) {
                          _shared_stats = _stats;
                         need_update_stats = false;
@@ -272,27 +352,22 @@ public:
                     }
                     _cv.wait(
                         lock,
-                        [this, dg_len]()
+                        [this, record_len]()
                             {
-                                return _n + dg_len + PREFIX_LEN <= _max_n;
+                                return _n + record_len <= _max_n;
                             }
                     );
-                    assert (_n + dg_len + PREFIX_LEN <= _max_n);
+                    assert (_n + record_len <= _max_n);
                 }
-                const char *dg_data = (const char *)msg_hdr.msg_iov->iov_base;
-                uint32_t len_network_byte_order = boost::endian::native_to_big((uint32_t)dg_len);
                 need_notify = true;
-                put_data_locked_no_notify((const char *)&len_network_byte_order, PREFIX_LEN);
-                put_data_locked_no_notify(dg_data, dg_len);
+                put_datagram_locked_no_notify(mmsg_hdr, (metadata == nullptr) ? nullptr : &metadata[i], batch_time);
+                stamp_residency_locked(batch_ticks);
                 _stats.max_backlog_bytes = std::max(_stats.max_backlog_bytes, _n);
-                _stats.max_datagram_size = std::max(_stats.max_datagram_size, dg_len);
-                _stats.min_datagram_size = (_stats.n_datagrams == 0) ? dg_len : std::min(_stats.min_datagram_size, dg_len);
-                if (_stats.n_datagrams == 0) {
-                    _stats.first_datagram_size = dg_len;
-                }
-                _stats.n_datagrams++;
-                _stats.n_datagram_bytes += dg_len;
+                _stats.add_datagram(dg_len);
                 need_update_stats = true;
+                if (_overwrite) {
+                    update_history_locked(mmsg_hdr, (metadata == nullptr) ? nullptr : &metadata[i], batch_time);
+                }
             }
             if (need_update_stats) {
                  _shared_stats = _stats;
@@ -311,13 +386,26 @@ public:
      *                      Entries that are ancillary data or truncated datagrams are replaced with 0-length iovecs.
      * @param n_buffers     Length of the mmsg_hdrs array as returned by recvmmsg().
      * @param __atime       The time point at which to stop waiting for buffers. If the timeout occurs, the function will return early.
+     * @param metadata      If metadata is enabled, an optional array of n_buffers metadata headers to store with
+     *                      the datagrams. If nullptr, metadata is derived from msg_name and the current time.
      * 
      * @return size_t       The number of buffers successfully committed. May be less than n_buffers if a timeout occurs.
      */
     template<typename _Clock, typename _Duration>
-    size_t producer_commit_batch(const struct mmsghdr *mmsg_hdrs, size_t n_buffers, const std::chrono::time_point<_Clock, _Duration>& __atime) {
+    size_t producer_commit_batch(
+            const struct mmsghdr *mmsg_hdrs,
+            size_t n_buffers,
+            const std::chrono::time_point<_Clock, _Duration>& __atime,
+            const DatagramMetadata *metadata=nullptr
+        )
+    {
         size_t n_buffers_committed = 0;
         if (n_buffers > 0) {
+            uint64_t batch_ticks = TscClock::ticks();
+            struct timespec batch_time{};
+            if (_metadata_len != 0 && metadata == nullptr) {
+                batch_time = _clock.realtime(batch_ticks);
+            }
 
             std::unique_lock<std::mutex> lock(_mutex);
             if (_is_eof) {
@@ -342,10 +430,14 @@ public:
                     n_buffers_committed++;
                     continue;
                 }
-                if (_max_n < dg_len + PREFIX_LEN) {
-                    throw std::runtime_error("Datagram + PREFIX too large for buffer: " + std::to_string(dg_len) + " + 4 bytes, max=" + std::to_string(_max_n) + " bytes");
+                size_t record_len = PREFIX_LEN + _metadata_len + dg_len;
+                if (_max_n < record_len) {
+                    throw std::runtime_error("Datagram + PREFIX too large for buffer: " + std::to_string(dg_len) + " + " + std::to_string(record_len - dg_len) + " bytes, max=" + std::to_string(_max_n) + " bytes");
                 }
-                if (n_free_locked() < dg_len + PREFIX_LEN) {
+                if (_overwrite) {
+                    discard_history_locked(record_len);
+                }
+                if (n_free_locked() < record_len) {
                     if (need_update_stats) {
                          _shared_stats = _stats;
                         need_update_stats = false;
@@ -357,29 +449,24 @@ public:
                     _cv.wait_until(
                         lock,
                         __atime,
-                        [this, dg_len]()
+                        [this, record_len]()
                             {
-                                return _n + dg_len + PREFIX_LEN <= _max_n;
+                                return _n + record_len <= _max_n;
                             }
                     );
-                    if (_n + dg_len + PREFIX_LEN > _max_n) {
+                    if (_n + record_len > _max_n) {
                         break;
                     }
                 }
-                const char *dg_data = (const char *)msg_hdr.msg_iov->iov_base;
-                uint32_t len_network_byte_order = boost::endian::native_to_big((uint32_t)dg_len);
                 need_notify = true;
-                put_data_locked_no_notify((const char *)&len_network_byte_order, PREFIX_LEN);
-                put_data_locked_no_notify(dg_data, dg_len);
+                put_datagram_locked_no_notify(mmsg_hdr, (metadata == nullptr) ? nullptr : &metadata[i], batch_time);
+                stamp_residency_locked(batch_ticks);
                 n_buffers_committed++;
-                _stats.max_datagram_size = std::max(_stats.max_datagram_size, dg_len);
-                _stats.min_datagram_size = (_stats.n_datagrams == 0) ? dg_len : std::min(_stats.min_datagram_size, dg_len);
-                if (_stats.n_datagrams == 0) {
-                    _stats.first_datagram_size = dg_len;
-                }
-                _stats.n_datagrams++;
-                _stats.n_datagram_bytes += dg_len;
+                _stats.add_datagram(dg_len);
                 need_update_stats = true;
+                if (_overwrite) {
+                    update_history_locked(mmsg_hdr, (metadata == nullptr) ? nullptr : &metadata[i], batch_time);
+                }
             }
             if (need_update_stats) {
                     _shared_stats = _stats;
@@ -408,16 +495,16 @@ public:
             throw std::runtime_error("Consumer requested too many bytes: " + std::to_string(n_min) + " bytes, max=" + std::to_string(_max_n) + " bytes");
         }
         std::unique_lock<std::mutex> lock(_mutex);
-        if (_n < n_min) {
+        if (!consumer_ready_locked(n_min)) {
             _cv.wait(
                 lock,
                 [this, n_min]()
                     {
-                        return _is_eof || _n >= n_min;
+                        return consumer_ready_locked(n_min) || _consumer_wakeup;
                     }
             );
         }
-        return get_data_locked(n_max);
+        return get_ready_data_locked(n_max);
     }
 
     /**
@@ -433,17 +520,17 @@ public:
     template<typename _Clock, typename _Duration>
     ConsumerBatch consumer_start_batch(const std::chrono::time_point<_Clock, _Duration>& __atime, size_t n_min=1, size_t n_max=SIZE_MAX) {
         std::unique_lock<std::mutex> lock(_mutex);
-        if (_n < n_min) {
+        if (!consumer_ready_locked(n_min)) {
             _cv.wait_until(
                 lock,
                 __atime,
                 [this, n_min]()
                     {
-                        return _is_eof || _n >= n_min;
+                        return consumer_ready_locked(n_min) || _consumer_wakeup;
                     }
             );
         }
-        return get_data_locked(n_max);
+        return get_ready_data_locked(n_max);
     }
 
     void consumer_copy_bytes(void *buffer, size_t n) {
@@ -478,6 +565,8 @@ public:
             }
             _consumer_index = (_consumer_index + n) % _max_n;
             _n -= n;
+            _consumed_pos += n;
+            record_residency_locked();
             _cv.notify_all();
         }
     }
@@ -487,7 +576,139 @@ public:
         return _is_eof;
     }
 
+    /**
+     * @brief The total number of bytes ever added to the queue. Producers only commit whole records, so this is
+     *        always a record boundary in the queue's byte stream. May be called from any thread.
+     */
+    uint64_t produced_pos() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _produced_pos;
+    }
+
+    /**
+     * @brief The total number of bytes ever removed from the queue (consumed or overwritten), i.e., the stream
+     *        position of the start of the next ConsumerBatch.
+     */
+    uint64_t consumed_pos() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _consumed_pos;
+    }
+
+    /**
+     * @brief Copy the backlog residency histogram to the shared stats now. The consumer publishes it at most every
+     *        DEFAULT_RESIDENCY_PUBLISH_SECS as it commits, so this should be called once it has finished.
+     */
+    void publish_residency() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        publish_residency_locked(TscClock::ticks());
+    }
+
+    /**
+     * @brief Pause or resume the consumer. While paused, consumer_start_batch() returns no data (it waits, up to
+     *        its timeout), so the destination stops writing while the producer keeps filling the backlog; when
+     *        the backlog is full the producer stalls as usual. The pause also holds after eof, until resumed.
+     *        May be called from any thread.
+     */
+    void consumer_set_paused(bool paused) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _consumer_paused = paused;
+        _cv.notify_all();
+    }
+
+    bool is_consumer_paused() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _consumer_paused;
+    }
+
+    /**
+     * @brief Make a consumer waiting in consumer_start_batch() return (possibly with no data) so that it can act on
+     *        a request made from another thread, such as an output rotation. May be called from any thread.
+     */
+    void consumer_wakeup() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _consumer_wakeup = true;
+        _cv.notify_all();
+    }
+
+    /**
+     * @brief Put the queue in flight recorder (overwrite) mode, in which it holds a rolling history of the most
+     *        recent datagrams: rather than waiting for the consumer, the producer discards the oldest whole records
+     *        to keep the backlog within max_bytes and (if max_secs is nonzero) within max_secs of the newest record.
+     *        The mode ends when trigger() is called or a datagram matches trigger_filter; the producer then
+     *        stops discarding, and consumer_wait_trigger() returns so the consumer can dump the history.
+     *
+     *        The consumer must not hold a ConsumerBatch while the queue is in overwrite mode.
+     *
+     * @param max_bytes       Maximum bytes of history (including prefixes and metadata). Should leave room below
+     *                        max_backlog for datagrams that arrive after a trigger.
+     * @param max_secs        Maximum age of history relative to the newest record, by metadata timestamp. 0 for
+     *                        no limit. Requires metadata.
+     * @param trigger_filter  Optional filter that triggers a dump when a datagram matches it.
+     */
+    void arm_history(size_t max_bytes, double max_secs, std::shared_ptr<const DatagramFilter> trigger_filter=nullptr) {
+        if (max_secs > 0.0 && _metadata_len == 0) {
+            throw std::runtime_error("A time-limited history requires metadata");
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _overwrite = true;
+        _triggered = false;
+        _history_max_n = std::min(max_bytes, _max_n);
+        _history_max_ns = (int64_t)(max_secs * 1.0e9);
+        _trigger_filter = trigger_filter;
+        discard_history_locked(0);
+        _shared_stats = _stats;
+        _cv.notify_all();
+    }
+
+    /**
+     * @brief End overwrite mode and wake a consumer waiting in consumer_wait_trigger(). May be called from any
+     *        thread (e.g., on a signal). Returns false if the queue was not in overwrite mode.
+     */
+    bool trigger() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_overwrite) {
+            return false;
+        }
+        trigger_locked();
+        _shared_stats = _stats;
+        _cv.notify_all();
+        return true;
+    }
+
+    /**
+     * @brief Wait until overwrite mode is ended by a trigger, or eof is set. Returns true if triggered.
+     */
+    bool consumer_wait_trigger() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(
+            lock,
+            [this]()
+                {
+                    return _triggered || _is_eof;
+                }
+        );
+        bool triggered = _triggered;
+        _triggered = false;
+        return triggered;
+    }
+
 protected:
+    inline bool consumer_ready_locked(size_t n_min) const {
+        return !_consumer_paused && (_is_eof || _n >= n_min);
+    }
+
+    /**
+     * @brief Return the data available to the consumer at the end of a wait in consumer_start_batch(): none if
+     *        paused, and whatever is available otherwise (which may be less than n_min on timeout, wakeup or eof).
+     */
+    inline ConsumerBatch get_ready_data_locked(size_t n_max) {
+        _consumer_wakeup = false;
+        if (_consumer_paused) {
+            return ConsumerBatch(nullptr, 0);
+        }
+        return get_data_locked(n_max);
+    }
+
     inline ConsumerBatch get_data_locked(size_t n_max=SIZE_MAX) {
         size_t n = std::min(_n, n_max);
         if (n == 0) {
@@ -507,25 +728,205 @@ protected:
     }
 
 
+    /**
+     * @brief Copy bytes into the ring. When the backlog is deep, the bytes won't be read until long after they
+     *        would have been evicted from the cache anyway, so large copies use non-temporal stores to avoid
+     *        evicting the producer's hot working set. When the consumer is keeping up, an ordinary copy leaves
+     *        the data in cache for it.
+     */
+    inline void copy_in_locked(char *dst, const char *src, size_t n) {
+        if (n >= DEFAULT_STREAM_COPY_MIN_LEN && _n >= DEFAULT_STREAM_COPY_MIN_BACKLOG) {
+            stream_copy(dst, src, n);
+        } else {
+            memcpy(dst, src, n);
+        }
+    }
+
     inline void put_data_locked_no_notify(const char *data, size_t n) {
         if (n > 0) {
             assert (n_free_locked() >= n);
             assert (_producer_index < _max_n);
             auto n_rem = n;
             size_t n1 = std::min(n_rem, _max_n - _producer_index);
-            memcpy(&_data[_producer_index], data, n1);
+            copy_in_locked(&_data[_producer_index], data, n1);
             _producer_index = (_producer_index + n1) % _max_n;
             n_rem -= n1;
             if (n_rem > 0) {
-                memcpy(&_data[_producer_index], data + n1, n_rem);
+                copy_in_locked(&_data[_producer_index], data + n1, n_rem);
                 _producer_index = (_producer_index + n_rem) % _max_n;
             }
             _n += n;
+            _produced_pos += n;
+        }
+    }
+
+    /**
+     * @brief Writes a single length-prefixed datagram record (with its metadata header, if enabled) to the queue.
+     *        The caller must have verified that there is room for the entire record.
+     */
+    inline void put_datagram_locked_no_notify(const struct mmsghdr& mmsg_hdr, const DatagramMetadata *metadata, const struct timespec& batch_time) {
+        const struct msghdr& msg_hdr = mmsg_hdr.msg_hdr;
+        size_t dg_len = mmsg_hdr.msg_len;
+        uint32_t len_network_byte_order = boost::endian::native_to_big((uint32_t)(_metadata_len + dg_len));
+        put_data_locked_no_notify((const char *)&len_network_byte_order, PREFIX_LEN);
+        if (_metadata_len != 0) {
+            char metadata_buffer[METADATA_LEN];
+            if (metadata != nullptr) {
+                metadata->encode(metadata_buffer);
+            } else {
+                DatagramMetadata derived_metadata;
+                derived_metadata.set_timestamp(batch_time);
+                derived_metadata.set_sender(msg_hdr.msg_name, msg_hdr.msg_namelen);
+                derived_metadata.encode(metadata_buffer);
+            }
+            put_data_locked_no_notify(metadata_buffer, METADATA_LEN);
+        }
+        // Gather the datagram from as many of the message's iovecs as it filled
+        size_t n_rem = dg_len;
+        for (size_t i = 0; n_rem > 0 && i < msg_hdr.msg_iovlen; ++i) {
+            size_t n = std::min(n_rem, msg_hdr.msg_iov[i].iov_len);
+            put_data_locked_no_notify((const char *)msg_hdr.msg_iov[i].iov_base, n);
+            n_rem -= n;
         }
     }
 
     inline size_t n_free_locked() {
         return _max_n - _n;
     }
+
+    /**
+     * @brief Copy bytes from the ring, starting offset bytes past the consumer index.
+     */
+    inline void peek_locked(size_t offset, void *buffer, size_t n) {
+        size_t i = (_consumer_index + offset) % _max_n;
+        size_t n1 = std::min(n, _max_n - i);
+        memcpy(buffer, &_data[i], n1);
+        if (n > n1) {
+            memcpy((char *)buffer + n1, &_data[0], n - n1);
+        }
+    }
+
+    inline void discard_oldest_record_locked() {
+        uint32_t len_network_byte_order;
+        peek_locked(0, &len_network_byte_order, PREFIX_LEN);
+        size_t record_len = PREFIX_LEN + boost::endian::big_to_native(len_network_byte_order);
+        _consumer_index = (_consumer_index + record_len) % _max_n;
+        _n -= record_len;
+        _consumed_pos += record_len;
+        _stats.n_datagrams_overwritten++;
+        // The oldest stamp covers the oldest record; overwritten datagrams never reach the consumer
+        if (_n_residency_stamps != 0) {
+            ResidencyStamp& stamp = _residency_stamps[_residency_first];
+            stamp.n_datagrams--;
+            if (stamp.end_pos <= _consumed_pos) {
+                pop_residency_stamp_locked();
+            }
+        }
+    }
+
+    /**
+     * @brief Stamp the record just added to the queue with the ticks at which its batch was received. Records of
+     *        the same batch share a stamp. If the ring of stamps is full, later batches are folded into the newest
+     *        stamp, which takes the time of the latest batch. The newest stamp is the last to be consumed, so it
+     *        only absorbs batches until the consumer retires the oldest stamp and frees a slot. The residency of a
+     *        folded batch is therefore understated by at most the time between the consumer retiring stamps while
+     *        the ring is full, rather than overstated without bound.
+     */
+    inline void stamp_residency_locked(uint64_t ticks) {
+        if (_n_residency_stamps != 0) {
+            ResidencyStamp& last = _residency_stamps[(_residency_first + _n_residency_stamps - 1) % _residency_stamps.size()];
+            if (last.ticks == ticks || _n_residency_stamps == _residency_stamps.size()) {
+                last.end_pos = _produced_pos;
+                last.ticks = ticks;
+                last.n_datagrams++;
+                return;
+            }
+        }
+        _residency_stamps[(_residency_first + _n_residency_stamps) % _residency_stamps.size()] = ResidencyStamp{_produced_pos, ticks, 1};
+        _n_residency_stamps++;
+    }
+
+    inline void pop_residency_stamp_locked() {
+        _residency_first = (_residency_first + 1) % _residency_stamps.size();
+        _n_residency_stamps--;
+    }
+
+    /**
+     * @brief After the consumer commits, record the residency of each datagram it has now consumed entirely: the
+     *        time from the producer receiving the datagram's batch to the consumer finishing with it (e.g., after
+     *        the write or send returned). A datagram is counted when the last byte of its stamp's range is
+     *        consumed, so at most one TSC read is needed per commit.
+     */
+    inline void record_residency_locked() {
+        if (_n_residency_stamps == 0 || _residency_stamps[_residency_first].end_pos > _consumed_pos) {
+            return;
+        }
+        uint64_t now = TscClock::ticks();
+        do {
+            const ResidencyStamp& stamp = _residency_stamps[_residency_first];
+            // Guard against a slightly smaller count read on another CPU
+            uint64_t delta_ticks = (now > stamp.ticks) ? now - stamp.ticks : 0;
+            _residency_ns.record(TscClock::ticks_to_ns(delta_ticks), stamp.n_datagrams);
+            pop_residency_stamp_locked();
+        } while (_n_residency_stamps != 0 && _residency_stamps[_residency_first].end_pos <= _consumed_pos);
+        if (now - _residency_publish_ticks >= _residency_publish_interval) {
+            publish_residency_locked(now);
+        }
+    }
+
+    inline void publish_residency_locked(uint64_t now) {
+        _stats.residency_ns = std::make_shared<const Histogram>(_residency_ns);
+        _shared_stats = _stats;
+        _residency_publish_ticks = now;
+    }
+
+    /**
+     * @brief In overwrite mode, discard the oldest records until a record of n_needed bytes fits in the history.
+     */
+    inline void discard_history_locked(size_t n_needed) {
+        while (_n > 0 && _n + n_needed > _history_max_n) {
+            discard_oldest_record_locked();
+        }
+    }
+
+    /**
+     * @brief In overwrite mode, after a record has been added: discard records that have aged out of the history,
+     *        and end overwrite mode if the record matches the trigger filter.
+     */
+    inline void update_history_locked(const struct mmsghdr& mmsg_hdr, const DatagramMetadata *metadata, const struct timespec& batch_time) {
+        if (_history_max_ns != 0) {
+            int64_t newest_ns = (metadata != nullptr) ? metadata->timestamp_ns :
+                                (int64_t)batch_time.tv_sec * 1000000000 + (int64_t)batch_time.tv_nsec;
+            while (_n > 0) {
+                int64_t ts_nbo;
+                peek_locked(PREFIX_LEN, &ts_nbo, sizeof(ts_nbo));
+                if (newest_ns - boost::endian::big_to_native(ts_nbo) <= _history_max_ns) {
+                    break;
+                }
+                discard_oldest_record_locked();
+            }
+        }
+        if (_trigger_filter) {
+            const struct msghdr& msg_hdr = mmsg_hdr.msg_hdr;
+            DatagramMetadata derived_metadata;
+            if (metadata == nullptr) {
+                derived_metadata.set_sender(msg_hdr.msg_name, msg_hdr.msg_namelen);
+                metadata = &derived_metadata;
+            }
+            // Payload terms are matched against the first iovec, which holds at least a receive slot's worth
+            size_t n_payload = (msg_hdr.msg_iovlen == 0) ? 0 : std::min((size_t)mmsg_hdr.msg_len, msg_hdr.msg_iov[0].iov_len);
+            const char *payload = (n_payload == 0) ? nullptr : (const char *)msg_hdr.msg_iov[0].iov_base;
+            if (_trigger_filter->matches(payload, n_payload, mmsg_hdr.msg_len, *metadata)) {
+                BOOST_LOG_TRIVIAL(info) << "Flight recorder triggered by a matching datagram\n";
+                trigger_locked();
+            }
+        }
+    }
+
+    inline void trigger_locked() {
+        _overwrite = false;
+        _triggered = true;
+        _stats.n_triggers++;
+    }
 };
 
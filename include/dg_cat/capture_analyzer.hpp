@@ -0,0 +1,408 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "histogram.hpp"
+#include "json_writer.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Options for CaptureAnalyzer.
+ */
+struct CaptureAnalyzerOptions {
+    bool metadata = false;             // Records begin with a METADATA_LEN-byte metadata header
+    double rate_interval_secs = 1.0;   // Width of the rate-over-time bins, by metadata timestamp
+    bool seq = false;                  // Check a big-endian sequence field for gaps
+    size_t seq_offset = 0;             // Offset of the sequence field within the payload
+    size_t seq_width = 4;              // Width of the sequence field in bytes (1, 2, 4, or 8)
+    size_t max_datagram_size = DEFAULT_MAX_DATAGRAM_SIZE;  // Larger records are counted as framing errors
+};
+
+/**
+ * @brief Statistics for all or part of a capture file. Partial results for consecutive ranges of a capture can
+ *        be merged in order.
+ */
+class CaptureStats {
+public:
+    struct RateBin {
+        uint64_t n_datagrams = 0;
+        uint64_t n_bytes = 0;
+    };
+
+    uint64_t n_datagrams = 0;
+    uint64_t n_bytes = 0;                    // Payload bytes, not including prefixes or metadata
+    uint64_t n_framing_errors = 0;           // Records too short for metadata or longer than the max datagram size
+    uint64_t n_trailing_bytes = 0;           // Bytes of an incomplete record at the end of the file
+    Histogram size_histogram;
+
+    uint64_t n_timestamps = 0;               // Datagrams with a known timestamp
+    int64_t first_timestamp_ns = 0;          // Earliest timestamp
+    int64_t last_timestamp_ns = 0;           // Latest timestamp
+    std::map<int64_t, RateBin> rate_bins;    // By bin index (timestamp / interval)
+
+    uint64_t n_seq = 0;                      // Datagrams long enough to contain the sequence field
+    uint64_t first_seq = 0;
+    uint64_t last_seq = 0;
+    uint64_t n_seq_gaps = 0;                 // Number of forward jumps in the sequence
+    uint64_t n_seq_missing = 0;              // Total sequence numbers skipped by forward jumps
+    uint64_t n_seq_out_of_order = 0;         // Repeated or backward sequence numbers
+
+    /**
+     * @brief Account for the next sequence number in the capture.
+     */
+    void add_seq(uint64_t seq, uint64_t seq_mask) {
+        if (n_seq == 0) {
+            first_seq = seq;
+        } else {
+            uint64_t delta = (seq - last_seq) & seq_mask;
+            if (delta == 0 || delta > seq_mask / 2) {
+                n_seq_out_of_order++;
+            } else if (delta > 1) {
+                n_seq_gaps++;
+                n_seq_missing += delta - 1;
+            }
+        }
+        last_seq = seq;
+        n_seq++;
+    }
+
+    void add_timestamp(int64_t ts_ns, uint64_t nb, int64_t interval_ns) {
+        first_timestamp_ns = (n_timestamps == 0) ? ts_ns : std::min(first_timestamp_ns, ts_ns);
+        last_timestamp_ns = (n_timestamps == 0) ? ts_ns : std::max(last_timestamp_ns, ts_ns);
+        n_timestamps++;
+        RateBin& bin = rate_bins[ts_ns / interval_ns];
+        bin.n_datagrams++;
+        bin.n_bytes += nb;
+    }
+
+    /**
+     * @brief Merge the stats for the range of the capture that immediately follows this one.
+     */
+    void merge_following(const CaptureStats& other, uint64_t seq_mask) {
+        n_datagrams += other.n_datagrams;
+        n_bytes += other.n_bytes;
+        n_framing_errors += other.n_framing_errors;
+        n_trailing_bytes += other.n_trailing_bytes;
+        size_histogram.merge(other.size_histogram);
+        if (other.n_timestamps != 0) {
+            first_timestamp_ns = (n_timestamps == 0) ? other.first_timestamp_ns : std::min(first_timestamp_ns, other.first_timestamp_ns);
+            last_timestamp_ns = (n_timestamps == 0) ? other.last_timestamp_ns : std::max(last_timestamp_ns, other.last_timestamp_ns);
+            n_timestamps += other.n_timestamps;
+        }
+        for (auto& entry : other.rate_bins) {
+            RateBin& bin = rate_bins[entry.first];
+            bin.n_datagrams += entry.second.n_datagrams;
+            bin.n_bytes += entry.second.n_bytes;
+        }
+        if (other.n_seq != 0) {
+            // The boundary between the ranges is checked like any other pair of consecutive datagrams
+            uint64_t n_seq_before = n_seq;
+            add_seq(other.first_seq, seq_mask);
+            n_seq = n_seq_before + other.n_seq;
+            last_seq = other.last_seq;
+            n_seq_gaps += other.n_seq_gaps;
+            n_seq_missing += other.n_seq_missing;
+            n_seq_out_of_order += other.n_seq_out_of_order;
+        }
+    }
+
+    /**
+     * @brief Write the stats as the members of the current JSON object.
+     */
+    void write_json_members(JsonWriter& w, const CaptureAnalyzerOptions& options) const {
+        w.member("n_datagrams", n_datagrams);
+        w.member("n_bytes", n_bytes);
+        w.member("n_framing_errors", n_framing_errors);
+        w.member("n_trailing_bytes", n_trailing_bytes);
+
+        w.key("size").begin_object();
+        w.member("min", size_histogram.min());
+        w.member("max", size_histogram.max());
+        w.member("mean", size_histogram.mean());
+        w.member("p50", size_histogram.percentile(50.0));
+        w.member("p99", size_histogram.percentile(99.0));
+        w.key("histogram").begin_array();
+        for (unsigned i = 0; i < Histogram::N_BUCKETS; ++i) {
+            uint64_t n = size_histogram.bucket_count(i);
+            if (n != 0) {
+                w.begin_object();
+                w.member("lo", Histogram::bucket_lower_bound(i));
+                w.member("hi", Histogram::bucket_upper_bound(i));
+                w.member("n", n);
+                w.end_object();
+            }
+        }
+        w.end_array();
+        w.end_object();
+
+        if (n_timestamps != 0) {
+            double duration_secs = (double)(last_timestamp_ns - first_timestamp_ns) / 1.0e9;
+            w.key("time").begin_object();
+            w.member("first", time_t_to_utc_string((time_t)(first_timestamp_ns / 1000000000)));
+            w.member("last", time_t_to_utc_string((time_t)(last_timestamp_ns / 1000000000)));
+            w.member("duration_secs", duration_secs);
+            w.member("datagrams_per_sec", (duration_secs > 0.0) ? (double)n_timestamps / duration_secs : 0.0);
+            w.member("bytes_per_sec", (duration_secs > 0.0) ? (double)n_bytes / duration_secs : 0.0);
+            w.member("interval_secs", options.rate_interval_secs);
+            w.key("rate").begin_array();
+            int64_t interval_ns = interval_to_ns(options.rate_interval_secs);
+            for (auto& entry : rate_bins) {
+                w.begin_object();
+                w.member("t", (double)(entry.first * interval_ns) / 1.0e9);
+                w.member("n_datagrams", entry.second.n_datagrams);
+                w.member("n_bytes", entry.second.n_bytes);
+                w.end_object();
+            }
+            w.end_array();
+            w.end_object();
+        }
+
+        if (options.seq) {
+            w.key("sequence").begin_object();
+            w.member("n_datagrams", n_seq);
+            w.member("first", first_seq);
+            w.member("last", last_seq);
+            w.member("n_gaps", n_seq_gaps);
+            w.member("n_missing", n_seq_missing);
+            w.member("n_out_of_order", n_seq_out_of_order);
+            w.end_object();
+        }
+    }
+
+    static int64_t interval_to_ns(double secs) {
+        return std::max((int64_t)(secs * 1.0e9), (int64_t)1);
+    }
+};
+
+/**
+ * @brief Offline analyzer for length-prefixed capture files.
+ *
+ * The capture is memory-mapped read-only and split at byte offsets into ranges of roughly equal size, which are
+ * analyzed (sizes, timestamps, sequence numbers) on separate threads and the results merged in order. Record
+ * boundaries can only be known for certain by following the length prefixes from the start, so each thread but
+ * the first guesses where the first record of its range begins: the first offset from which
+ * DEFAULT_ANALYZE_RESYNC_RECORDS consecutive plausible records follow. Each range is analyzed through its last
+ * record that begins before the next range, so the position where range i stops is the true start of range i + 1
+ * whenever range i started at a true boundary. Ranges are checked in order, and a range whose guess was wrong is
+ * analyzed again from the true position; this is rare, and the result is always the same as a sequential pass.
+ */
+class CaptureAnalyzer {
+private:
+    CaptureAnalyzerOptions _options;
+    size_t _metadata_len;
+    uint64_t _seq_mask;
+
+public:
+    explicit CaptureAnalyzer(const CaptureAnalyzerOptions& options) :
+        _options(options),
+        _metadata_len(options.metadata ? METADATA_LEN : 0),
+        _seq_mask((options.seq_width >= 8) ? ~(uint64_t)0 : (((uint64_t)1 << (8 * options.seq_width)) - 1))
+    {
+        if (options.seq_width != 1 && options.seq_width != 2 && options.seq_width != 4 && options.seq_width != 8) {
+            throw std::runtime_error("Invalid sequence width (must be 1, 2, 4, or 8): " + std::to_string(options.seq_width));
+        }
+        if (options.rate_interval_secs <= 0.0) {
+            throw std::runtime_error("Rate interval must be positive");
+        }
+    }
+
+    const CaptureAnalyzerOptions& options() const {
+        return _options;
+    }
+
+    /**
+     * @brief Analyze a capture file using up to n_threads threads.
+     */
+    CaptureStats analyze(const std::string& filename, size_t n_threads) const {
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file: " + filename + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::system_category(), "fstat() failed");
+        }
+        if (!S_ISREG(st.st_mode)) {
+            ::close(fd);
+            throw std::runtime_error("Cannot analyze capture that is not a regular file: " + filename);
+        }
+        size_t size = (size_t)st.st_size;
+        const char *data = nullptr;
+        if (size > 0) {
+            void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::system_category(), "mmap() of capture file failed");
+            }
+            data = (const char *)p;
+            madvise(p, size, MADV_WILLNEED);
+        }
+        ::close(fd);
+
+        CaptureStats result;
+        try {
+            result = analyze_mapped(data, size, std::max(n_threads, (size_t)1));
+        } catch (...) {
+            if (data != nullptr) {
+                munmap((void *)data, size);
+            }
+            throw;
+        }
+        if (data != nullptr) {
+            munmap((void *)data, size);
+        }
+        if (result.n_trailing_bytes != 0) {
+            BOOST_LOG_TRIVIAL(warning) << "Incomplete record at end of " << filename << "; ignoring last " << result.n_trailing_bytes << " bytes\n";
+        }
+        return result;
+    }
+
+protected:
+    CaptureStats analyze_mapped(const char *data, size_t size, size_t n_threads) const {
+        size_t n_ranges = std::max(std::min(n_threads, size / DEFAULT_ANALYZE_MIN_RANGE_SIZE), (size_t)1);
+        std::vector<size_t> splits(n_ranges + 1);
+        for (size_t i = 0; i <= n_ranges; ++i) {
+            splits[i] = (size_t)((uint64_t)size * i / n_ranges);
+        }
+
+        // starts[i] is the guessed start of range i (SIZE_MAX if none was found), and ends[i] where it stopped
+        std::vector<size_t> starts(n_ranges, 0);
+        std::vector<size_t> ends(n_ranges, 0);
+        std::vector<CaptureStats> partials(n_ranges);
+        std::vector<std::exception_ptr> exceptions(n_ranges);
+        auto analyze_guessed_range = [&](size_t i) {
+            try {
+                starts[i] = (i == 0) ? 0 : find_record_boundary(data, size, splits[i], splits[i + 1]);
+                if (starts[i] != SIZE_MAX) {
+                    ends[i] = analyze_range(data, size, starts[i], splits[i + 1], partials[i]);
+                }
+            } catch (...) {
+                exceptions[i] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < n_ranges; ++i) {
+            threads.emplace_back(analyze_guessed_range, i);
+        }
+        analyze_guessed_range(0);
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        CaptureStats result;
+        size_t pos = 0;
+        for (size_t i = 0; i < n_ranges; ++i) {
+            if (starts[i] != pos) {
+                // The guess was wrong (or there was none); the range really begins where the previous one stopped
+                BOOST_LOG_TRIVIAL(debug) << "Record boundary guessed at " << starts[i] << " is not the true boundary at " << pos << "; reanalyzing\n";
+                partials[i] = CaptureStats();
+                exceptions[i] = nullptr;
+                ends[i] = analyze_range(data, size, pos, splits[i + 1], partials[i]);
+            }
+            if (exceptions[i]) {
+                std::rethrow_exception(exceptions[i]);
+            }
+            result.merge_following(partials[i], _seq_mask);
+            pos = ends[i];
+        }
+        result.n_trailing_bytes = size - pos;
+        return result;
+    }
+
+    /**
+     * @brief Guess the first record boundary in [begin, end): the first offset from which
+     *        DEFAULT_ANALYZE_RESYNC_RECORDS plausible records follow, or from which plausible records run exactly
+     *        to the end of the capture.
+     *
+     * @return size_t  The offset, or SIZE_MAX if there is none.
+     */
+    size_t find_record_boundary(const char *data, size_t size, size_t begin, size_t end) const {
+        for (size_t candidate = begin; candidate < end; ++candidate) {
+            size_t pos = candidate;
+            size_t n_records = 0;
+            while (n_records < DEFAULT_ANALYZE_RESYNC_RECORDS && pos + PREFIX_LEN <= size) {
+                size_t nb_record = read_length_prefix(data + pos);
+                if (nb_record > size - pos - PREFIX_LEN || nb_record < _metadata_len ||
+                        nb_record - _metadata_len > _options.max_datagram_size) {
+                    break;
+                }
+                pos += PREFIX_LEN + nb_record;
+                ++n_records;
+            }
+            if (n_records == DEFAULT_ANALYZE_RESYNC_RECORDS || (n_records > 0 && pos == size)) {
+                return candidate;
+            }
+        }
+        return SIZE_MAX;
+    }
+
+    /**
+     * @brief Analyze the records that begin at begin and follow it up to the first that begins at or after
+     *        split, or up to an incomplete record at the end of the mapping.
+     *
+     * @return size_t  The offset at which analysis stopped.
+     */
+    size_t analyze_range(const char *data, size_t size, size_t begin, size_t split, CaptureStats& stats) const {
+        int64_t interval_ns = CaptureStats::interval_to_ns(_options.rate_interval_secs);
+        size_t pos = begin;
+        while (pos < split && pos + PREFIX_LEN <= size) {
+            size_t nb_record = read_length_prefix(data + pos);
+            if (nb_record > size - pos - PREFIX_LEN) {
+                break;
+            }
+            const char *record = data + pos + PREFIX_LEN;
+            pos += PREFIX_LEN + nb_record;
+            if (nb_record < _metadata_len || nb_record - _metadata_len > _options.max_datagram_size) {
+                stats.n_framing_errors++;
+                continue;
+            }
+            const char *payload = record + _metadata_len;
+            size_t nb = nb_record - _metadata_len;
+            stats.n_datagrams++;
+            stats.n_bytes += nb;
+            stats.size_histogram.record(nb);
+            if (_metadata_len != 0) {
+                int64_t ts_nbo;
+                memcpy(&ts_nbo, record, sizeof(ts_nbo));
+                int64_t ts_ns = boost::endian::big_to_native(ts_nbo);
+                if (ts_ns != 0) {
+                    stats.add_timestamp(ts_ns, nb, interval_ns);
+                }
+            }
+            if (_options.seq && _options.seq_offset + _options.seq_width <= nb) {
+                const unsigned char *p = (const unsigned char *)payload + _options.seq_offset;
+                uint64_t seq = 0;
+                for (size_t j = 0; j < _options.seq_width; ++j) {
+                    seq = (seq << 8) | p[j];
+                }
+                stats.add_seq(seq, _seq_mask);
+            }
+        }
+        return pos;
+    }
+};
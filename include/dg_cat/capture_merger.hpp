@@ -0,0 +1,318 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "util.hpp"
+
+#include <boost/endian/conversion.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+/**
+ * @brief Options for CaptureMerger.
+ */
+struct CaptureMergerOptions {
+    size_t read_ahead = DEFAULT_MERGE_READ_AHEAD;          // Bytes read from each input in one read()
+    size_t max_write_size = DEFAULT_MERGE_WRITE_SIZE;      // Bytes of output accumulated before each write()
+    size_t max_datagram_size = DEFAULT_MAX_DATAGRAM_SIZE;  // Longer records are treated as corruption
+};
+
+/**
+ * @brief Statistics for a merge.
+ */
+struct CaptureMergerStats {
+    uint64_t n_inputs = 0;
+    uint64_t n_datagrams = 0;
+    uint64_t n_bytes = 0;                // Bytes written, including prefixes and metadata
+    uint64_t n_out_of_order = 0;         // Records whose timestamp is earlier than the previous one in the same input
+    uint64_t n_trailing_bytes = 0;       // Bytes of incomplete records at the ends of inputs (ignored)
+    uint64_t n_reads = 0;
+    uint64_t n_writes = 0;
+};
+
+/**
+ * @brief Sequential reader for one timestamped capture file, yielding whole records (length prefix, metadata
+ *        header and payload) in a large buffer.
+ *
+ * Each refill is a single large read(), and the kernel is asked to start reading the following chunk
+ * (POSIX_FADV_WILLNEED) while the current one is consumed, so an input is read in big sequential runs even when
+ * many inputs are interleaved.
+ */
+class CaptureReader {
+private:
+    std::string _filename;
+    int _fd = -1;
+    bool _owns_fd = true;
+    size_t _read_ahead;
+    size_t _max_record_len;
+    std::unique_ptr<char[]> _buffer;
+    size_t _buffer_size;
+    size_t _begin = 0;                   // Start of unconsumed data in _buffer
+    size_t _end = 0;                     // End of valid data in _buffer
+    uint64_t _file_offset = 0;           // File offset corresponding to _buffer[_end]
+    bool _eof = false;
+
+    const char *_record = nullptr;       // Current record, starting at its length prefix
+    size_t _record_len = 0;              // Length of the current record, including its length prefix
+    int64_t _timestamp_ns = 0;           // Timestamp of the current record
+    bool _have_previous = false;
+
+public:
+    uint64_t n_out_of_order = 0;
+    uint64_t n_trailing_bytes = 0;
+    uint64_t n_reads = 0;
+
+    /**
+     * @brief Open a capture for reading.
+     *
+     * @param filename           The capture file, or "-" for stdin.
+     * @param read_ahead         Number of bytes to read in each read() call.
+     * @param max_datagram_size  Records with longer payloads are treated as corruption.
+     */
+    CaptureReader(const std::string& filename, size_t read_ahead, size_t max_datagram_size) :
+        _filename(filename),
+        _read_ahead(std::max(read_ahead, (size_t)4096)),
+        _max_record_len(PREFIX_LEN + METADATA_LEN + max_datagram_size)
+    {
+        _buffer_size = _read_ahead + _max_record_len;
+        _buffer.reset(new char[_buffer_size]);
+        if (filename == "-") {
+            _fd = 0;
+            _owns_fd = false;
+        } else {
+            _fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (_fd == -1) {
+                throw std::runtime_error("Failed to open file: " + filename + ": " + strerror(errno));
+            }
+            // Fails harmlessly on pipes
+            posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+    }
+
+    CaptureReader(const CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    ~CaptureReader() {
+        if (_owns_fd && _fd != -1) {
+            ::close(_fd);
+        }
+    }
+
+    const std::string& filename() const {
+        return _filename;
+    }
+
+    /**
+     * @brief The current record, starting at its length prefix. Valid until the next call to next().
+     */
+    const char *record() const {
+        return _record;
+    }
+
+    size_t record_len() const {
+        return _record_len;
+    }
+
+    int64_t timestamp_ns() const {
+        return _timestamp_ns;
+    }
+
+    /**
+     * @brief Advance to the next record. Returns false at the end of the capture.
+     */
+    bool next() {
+        _begin += _record_len;
+        _record = nullptr;
+        _record_len = 0;
+        if (!ensure(PREFIX_LEN)) {
+            return false;
+        }
+        size_t nb_record = read_length_prefix(_buffer.get() + _begin);
+        if (nb_record < METADATA_LEN || PREFIX_LEN + nb_record > _max_record_len) {
+            throw std::runtime_error(
+                "Invalid record length " + std::to_string(nb_record) + " in " + _filename + " at offset " +
+                std::to_string(_file_offset - (_end - _begin)) + " (inputs must be captures made with --metadata)");
+        }
+        if (!ensure(PREFIX_LEN + nb_record)) {
+            return false;
+        }
+        _record = _buffer.get() + _begin;
+        _record_len = PREFIX_LEN + nb_record;
+        int64_t ts_nbo;
+        memcpy(&ts_nbo, _record + PREFIX_LEN, sizeof(ts_nbo));
+        int64_t timestamp_ns = boost::endian::big_to_native(ts_nbo);
+        if (_have_previous && timestamp_ns < _timestamp_ns) {
+            if (n_out_of_order == 0) {
+                BOOST_LOG_TRIVIAL(warning) << "Capture " << _filename << " is not in timestamp order; merged output will not be either\n";
+            }
+            n_out_of_order++;
+        }
+        _timestamp_ns = timestamp_ns;
+        _have_previous = true;
+        return true;
+    }
+
+protected:
+    /**
+     * @brief Make at least n unconsumed bytes available in the buffer, refilling it if necessary. Returns false
+     *        at EOF, recording any incomplete tail as trailing bytes.
+     */
+    bool ensure(size_t n) {
+        if (_end - _begin >= n) {
+            return true;
+        }
+        if (!_eof) {
+            // Slide the unconsumed tail to the front and fill the rest of the buffer
+            size_t n_remaining = _end - _begin;
+            memmove(_buffer.get(), _buffer.get() + _begin, n_remaining);
+            _begin = 0;
+            _end = n_remaining;
+            while (!_eof && _end < n) {
+                size_t nb_read = std::min(_read_ahead, _buffer_size - _end);
+                ssize_t nb = ::read(_fd, _buffer.get() + _end, nb_read);
+                if (nb < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::system_category(), "read() from " + _filename + " failed");
+                }
+                n_reads++;
+                if (nb == 0) {
+                    _eof = true;
+                    break;
+                }
+                _end += (size_t)nb;
+                _file_offset += (uint64_t)nb;
+            }
+            if (!_eof) {
+                posix_fadvise(_fd, (off_t)_file_offset, (off_t)_read_ahead, POSIX_FADV_WILLNEED);
+            }
+        }
+        if (_end - _begin >= n) {
+            return true;
+        }
+        n_trailing_bytes += _end - _begin;
+        _begin = _end;
+        return false;
+    }
+};
+
+/**
+ * @brief Offline k-way merge of timestamped capture files (made with --metadata) into one capture ordered by
+ *        timestamp.
+ *
+ * A binary min-heap holds the current record of each input, keyed by timestamp and then input index, so records
+ * with equal timestamps come out in input order and each input's own order is preserved. Selecting the next
+ * record costs O(log k). Records are copied unchanged into a large output buffer that is written with one
+ * write() when full.
+ */
+class CaptureMerger {
+private:
+    CaptureMergerOptions _options;
+
+    struct HeapEntry {
+        int64_t timestamp_ns;
+        size_t i_input;
+
+        // std heap algorithms build a max-heap, so order by "later" to get the earliest on top
+        bool operator<(const HeapEntry& other) const {
+            return (timestamp_ns != other.timestamp_ns) ? timestamp_ns > other.timestamp_ns : i_input > other.i_input;
+        }
+    };
+
+public:
+    explicit CaptureMerger(const CaptureMergerOptions& options) :
+        _options(options)
+    {
+    }
+
+    /**
+     * @brief Merge captures and write the result to a file descriptor.
+     *
+     * @param inputs        The capture files to merge ("-" for stdin, at most once).
+     * @param out_fd        The output file descriptor. Not closed.
+     * @param out_name      The name of the output, for error messages.
+     */
+    CaptureMergerStats merge(const std::vector<std::string>& inputs, int out_fd, const std::string& out_name) const {
+        CaptureMergerStats stats;
+        std::vector<std::unique_ptr<CaptureReader>> readers;
+        std::vector<HeapEntry> heap;
+        for (auto& filename : inputs) {
+            readers.emplace_back(new CaptureReader(filename, _options.read_ahead, _options.max_datagram_size));
+            if (readers.back()->next()) {
+                heap.push_back(HeapEntry{readers.back()->timestamp_ns(), readers.size() - 1});
+            }
+        }
+        stats.n_inputs = readers.size();
+        std::make_heap(heap.begin(), heap.end());
+
+        size_t out_size = std::max(_options.max_write_size, (size_t)4096);
+        std::unique_ptr<char[]> out_buffer(new char[out_size]);
+        size_t n_out = 0;
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end());
+            CaptureReader& reader = *readers[heap.back().i_input];
+            size_t nb = reader.record_len();
+            if (n_out + nb > out_size) {
+                write_all(out_fd, out_buffer.get(), n_out, out_name, stats);
+                n_out = 0;
+            }
+            if (nb > out_size) {
+                write_all(out_fd, reader.record(), nb, out_name, stats);
+            } else {
+                memcpy(out_buffer.get() + n_out, reader.record(), nb);
+                n_out += nb;
+            }
+            stats.n_datagrams++;
+            stats.n_bytes += nb;
+            if (reader.next()) {
+                heap.back().timestamp_ns = reader.timestamp_ns();
+                std::push_heap(heap.begin(), heap.end());
+            } else {
+                heap.pop_back();
+            }
+        }
+        write_all(out_fd, out_buffer.get(), n_out, out_name, stats);
+
+        for (auto& reader : readers) {
+            stats.n_out_of_order += reader->n_out_of_order;
+            stats.n_trailing_bytes += reader->n_trailing_bytes;
+            stats.n_reads += reader->n_reads;
+            if (reader->n_trailing_bytes != 0) {
+                BOOST_LOG_TRIVIAL(warning) << "Incomplete record at end of " << reader->filename() << "; ignoring last " << reader->n_trailing_bytes << " bytes\n";
+            }
+        }
+        return stats;
+    }
+
+protected:
+    static void write_all(int fd, const char *data, size_t n, const std::string& name, CaptureMergerStats& stats) {
+        while (n > 0) {
+            ssize_t nb = ::write(fd, data, n);
+            if (nb < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "write() to " + name + " failed");
+            }
+            stats.n_writes++;
+            data += nb;
+            n -= (size_t)nb;
+        }
+    }
+};
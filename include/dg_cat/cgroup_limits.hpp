@@ -0,0 +1,192 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "config.hpp"
+#include "constants.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sched.h>
+
+/**
+ * @brief Resource limits imposed on this process by its cgroup v2 hierarchy (e.g., a container's memory and CPU
+ *        limits).
+ *
+ * The limits of every ancestor cgroup apply as well, so the tightest value found walking from the process's cgroup
+ * up to the root of the cgroup2 mount is used. If there is no cgroup2 mount (or it cannot be read), no limits are
+ * reported.
+ */
+class CgroupLimits {
+public:
+    std::string path;                    // Directory of the process's cgroup, or empty if not found
+    uint64_t memory_max = 0;             // Tightest memory.max in bytes. 0 if unlimited.
+    double cpu_max = 0.0;                // Tightest cpu.max quota, in CPUs. 0.0 if unlimited.
+
+    /**
+     * @brief Find and read the limits of the calling process's cgroup.
+     */
+    static CgroupLimits detect() {
+        std::string mount_point;
+        std::string mount_root;
+        if (!find_cgroup2_mount(mount_point, mount_root)) {
+            BOOST_LOG_TRIVIAL(debug) << "No cgroup2 filesystem is mounted; not applying cgroup limits\n";
+            return CgroupLimits();
+        }
+        std::ifstream f("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(f, line)) {
+            // The unified (v2) hierarchy is listed as "0::<path>"
+            if (line.compare(0, 3, "0::") == 0) {
+                std::string cgroup_path = line.substr(3);
+                if (mount_root != "/" && cgroup_path.compare(0, mount_root.size(), mount_root) == 0) {
+                    cgroup_path = cgroup_path.substr(mount_root.size());
+                }
+                return read(mount_point, cgroup_path);
+            }
+        }
+        return CgroupLimits();
+    }
+
+    /**
+     * @brief Read the limits of a cgroup and its ancestors.
+     *
+     * @param mount_point  Where the cgroup2 filesystem is mounted (e.g., "/sys/fs/cgroup")
+     * @param cgroup_path  The path of the cgroup relative to the mount (e.g., "/system.slice/foo.service")
+     */
+    static CgroupLimits read(const std::string& mount_point, const std::string& cgroup_path) {
+        CgroupLimits limits;
+        std::string rel = cgroup_path;
+        while (!rel.empty() && rel.back() == '/') {
+            rel.pop_back();
+        }
+        limits.path = mount_point + rel;
+        while (true) {
+            std::string dir = mount_point + rel;
+            std::string value;
+            if (read_first_line(dir + "/memory.max", value) && value != "max") {
+                uint64_t memory_max = std::stoull(value);
+                if (limits.memory_max == 0 || memory_max < limits.memory_max) {
+                    limits.memory_max = memory_max;
+                }
+            }
+            if (read_first_line(dir + "/cpu.max", value)) {
+                // "<quota> <period>", or "max <period>" if unlimited
+                std::istringstream is(value);
+                std::string quota;
+                double period = 0.0;
+                is >> quota >> period;
+                if (quota != "max" && period > 0.0) {
+                    double cpus = std::stod(quota) / period;
+                    if (limits.cpu_max == 0.0 || cpus < limits.cpu_max) {
+                        limits.cpu_max = cpus;
+                    }
+                }
+            }
+            if (rel.empty()) {
+                break;
+            }
+            size_t slash_pos = rel.find_last_of('/');
+            rel = rel.substr(0, (slash_pos == std::string::npos) ? 0 : slash_pos);
+        }
+        return limits;
+    }
+
+    /**
+     * @brief The number of CPUs this process can use: the CPUs in its affinity mask, further limited by the
+     *        cgroup CPU quota (rounded up). At least 1.
+     */
+    size_t available_cpus() const {
+        size_t n_cpus = std::thread::hardware_concurrency();
+        cpu_set_t cpu_set;
+        if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0) {
+            n_cpus = (size_t)CPU_COUNT(&cpu_set);
+        }
+        if (cpu_max > 0.0) {
+            n_cpus = std::min(n_cpus, (size_t)std::ceil(cpu_max));
+        }
+        return std::max(n_cpus, (size_t)1);
+    }
+
+    /**
+     * @brief Shrink the backlog and the UDP receive batch (and with it the receive slab) of a configuration so that
+     *        they fit comfortably within the cgroup memory limit, and log the values chosen.
+     *
+     * At most DEFAULT_AUTO_SIZE_MEMORY_FRACTION of the limit is budgeted, of which up to
+     * DEFAULT_AUTO_SIZE_RECV_FRACTION goes to receive buffers (each recvmmsg() slot can need a full
+     * max-datagram-size buffer) and the rest to the backlog. Values given explicitly are left alone, but a warning is
+     * logged if they do not fit.
+     *
+     * @param config          The configuration to adjust
+     * @param fit_backlog     If true, max_backlog may be reduced
+     * @param fit_iovecs      If true, max_iovecs may be reduced
+     */
+    void fit_config(DgCatConfig& config, bool fit_backlog, bool fit_iovecs) const {
+        if (memory_max == 0) {
+            return;
+        }
+        uint64_t budget = (uint64_t)((double)memory_max * DEFAULT_AUTO_SIZE_MEMORY_FRACTION);
+        uint64_t iovec_cost = (uint64_t)config.bufsize + DEFAULT_RECV_SLOT_SIZE;
+        if (fit_iovecs) {
+            uint64_t recv_budget = (uint64_t)((double)budget * DEFAULT_AUTO_SIZE_RECV_FRACTION);
+            config.max_iovecs = (size_t)std::max((uint64_t)1, std::min((uint64_t)config.max_iovecs, recv_budget / iovec_cost));
+        }
+        uint64_t recv_bytes = config.max_iovecs * iovec_cost;
+        if (fit_backlog) {
+            uint64_t backlog_budget = (budget > recv_bytes) ? budget - recv_bytes : 0;
+            backlog_budget = std::max(backlog_budget, (uint64_t)DEFAULT_AUTO_SIZE_MIN_BACKLOG);
+            config.max_backlog = (size_t)std::min((uint64_t)config.max_backlog, backlog_budget);
+        }
+        BOOST_LOG_TRIVIAL(info) << "cgroup " << path << " memory limit is " << memory_max << " bytes; using max_backlog="
+                                << config.max_backlog << ", max_iovecs=" << config.max_iovecs << "\n";
+        if ((uint64_t)config.max_backlog + recv_bytes > memory_max) {
+            BOOST_LOG_TRIVIAL(warning) << "Backlog (" << config.max_backlog << " bytes) and receive buffers ("
+                                       << recv_bytes << " bytes) can exceed the cgroup memory limit of " << memory_max
+                                       << " bytes\n";
+        }
+    }
+
+protected:
+    /**
+     * @brief Find the mount point of the cgroup2 filesystem, and the cgroup that is mounted there (usually "/", but
+     *        e.g. a container's own cgroup if its runtime does not use a cgroup namespace).
+     */
+    static bool find_cgroup2_mount(std::string& mount_point, std::string& mount_root) {
+        std::ifstream f("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(f, line)) {
+            // "<id> <parent> <major:minor> <root> <mount-point> <options> [<optional>...] - <fstype> <source> ..."
+            size_t sep_pos = line.find(" - ");
+            if (sep_pos == std::string::npos) {
+                continue;
+            }
+            std::istringstream fs_is(line.substr(sep_pos + 3));
+            std::string fstype;
+            fs_is >> fstype;
+            if (fstype != "cgroup2") {
+                continue;
+            }
+            std::istringstream is(line.substr(0, sep_pos));
+            std::string id, parent, dev;
+            is >> id >> parent >> dev >> mount_root >> mount_point;
+            return !mount_point.empty();
+        }
+        return false;
+    }
+
+    static bool read_first_line(const std::string& filename, std::string& value) {
+        std::ifstream f(filename);
+        return (bool)std::getline(f, value);
+    }
+};
@@ -28,6 +28,9 @@ public:
                                    //   Will be limited to sysconf(_SC_IOV_MAX). 0 means use max possible.
     bool append;                   // For file output, true if existing file should be appended.
     bool handle_signals;           // If true, SIGINT will cleanly stop, and SIGUSR1 will dump stats.
+    bool metadata;                 // If true, each datagram is carried with a METADATA_LEN-byte header (timestamp and
+                                   //   sender address) in the backlog and in file inputs/outputs.
+    std::string control_socket;    // If nonempty, the path of a unix-domain socket that accepts runtime control commands.
 
     /**
      * @brief Construct a new DgCatConfig object
@@ -44,6 +47,9 @@ public:
      *                                Will be limited to sysconf(_SC_IOV_MAX). 0 means use max possible.
      * @param append              For file output, true if existing file should be appended.
      * @param handle_signals      If true, SIGINT will cleanly stop, and SIGUSR1 will dump stats.
+     * @param metadata            If true, each datagram is carried with a METADATA_LEN-byte header (timestamp and
+     *                                sender address) in the backlog and in file inputs/outputs.
+     * @param control_socket      If nonempty, the path of a unix-domain socket that accepts runtime control commands.
      */
     DgCatConfig(
             size_t bufsize = DEFAULT_MAX_DATAGRAM_SIZE,
@@ -56,7 +62,9 @@ public:
             size_t max_write_size = DEFAULT_MAX_WRITE_SIZE,
             size_t max_iovecs = DEFAULT_MAX_IOVECS,
             bool append = false,
-            bool handle_signals = true
+            bool handle_signals = true,
+            bool metadata = false,
+            const std::string& control_socket = ""
         ) :
             bufsize(bufsize),
             max_backlog(max_backlog),
@@ -67,7 +75,9 @@ public:
             max_read_size(max_read_size),
             max_write_size(max_write_size),
             append(append),
-            handle_signals(handle_signals)
+            handle_signals(handle_signals),
+            metadata(metadata),
+            control_socket(control_socket)
     {
         auto sys_max_iovecs = (size_t)sysconf(_SC_IOV_MAX);
         if (sys_max_iovecs < 0) {
@@ -96,7 +106,9 @@ public:
             "max_write_size=" + std::to_string(max_write_size) + ", "
             "max_iovecs=" + std::to_string(max_iovecs) + ", "
             "append=" + (append ? "true" : "false") + ", "
-            "handle_signals=" + (handle_signals ? "true" : "false")
+            "handle_signals=" + (handle_signals ? "true" : "false") + ", "
+            "metadata=" + (metadata ? "true" : "false") + ", "
+            "control_socket=\"" + control_socket + "\""
             + " }";
     }
 };
@@ -13,13 +13,58 @@ static const size_t DEFAULT_MAX_DATAGRAM_SIZE = 65535;                // 65535 i
 static const size_t DEFAULT_NUM_DATAGRAM_BUFFERS = 2048;              // Maximum number of datagrams that can be received in one go with recvmmsg().
                                                                       //   (Will be further restricted by the kernel's maximum iovec count.)
 static const size_t DEFAULT_MAX_BACKLOG = 2UL*1024*1024*1024;         // Maximum file buffer size (2GB)
+static const double DEFAULT_AUTO_SIZE_MEMORY_FRACTION = 0.5;          // Fraction of a cgroup memory limit that the backlog and receive buffers are sized to fit
+static const double DEFAULT_AUTO_SIZE_RECV_FRACTION = 0.125;          // Fraction of that budget that UDP receive buffers may use
+static const size_t DEFAULT_AUTO_SIZE_MIN_BACKLOG = 4*1024*1024;      // Auto-sizing never reduces the backlog below this
+static const size_t DEFAULT_STREAM_COPY_MIN_BACKLOG = 8*1024*1024;   // Backlog depth beyond which copies into the backlog bypass the cache
+static const double DEFAULT_TSC_CALIBRATION_SECS = 0.01;              // Interval over which the TSC rate is measured against CLOCK_MONOTONIC, once per process
+static const double DEFAULT_TSC_REANCHOR_SECS = 1.0;                  // Interval between re-readings of CLOCK_REALTIME by a TSC-based timestamp clock
+static const size_t DEFAULT_RESIDENCY_MAX_STAMPS = 16384;             // Maximum number of backlog batch enqueue times tracked for residency; beyond this, batches share the newest entry, which takes the latest time
+static const double DEFAULT_RESIDENCY_PUBLISH_SECS = 0.1;             // Minimum interval between snapshots of the backlog residency histogram in the stats
+static const size_t DEFAULT_STREAM_COPY_MIN_LEN = 256;                // Minimum copy length for non-temporal stores
 static const size_t DEFAULT_MAX_READ_SIZE = 256*1024;                 // Maximum number of bytes to read from a file in one system call
 static const size_t DEFAULT_MAX_WRITE_SIZE = 256*1024;                // Maximum number of bytes to write to a file in one system call
+static const size_t DEFAULT_MMAP_WINDOW_SIZE = 64*1024*1024;          // Size of the sliding mapped window for mmap file output
+static const double DEFAULT_SYNC_STATS_PUBLISH_SECS = 0.1;            // Minimum interval between snapshots of a file output's sync stats in the stats
+static const size_t DEFAULT_MERGE_READ_AHEAD = 4*1024*1024;          // Bytes read from each input of a dg-merge in one sequential read
+static const size_t DEFAULT_MERGE_WRITE_SIZE = 4*1024*1024;          // Bytes of merged output accumulated before each write
 static const size_t PREFIX_LEN = sizeof(uint32_t);                    // Length of the network-byte-order datagram-length prefix used when writing output
+static const size_t METADATA_LEN = 32;                                // Length of the optional per-datagram metadata header (timestamp and sender address)
 static const double DEFAULT_POLLING_INTERVAL = 1.0;                   // Datagram polling interval
 static const double DEFAULT_EOF_TIMEOUT_SECS = 60.0;                  // timeout waiting for datagrams on UDP before an EOF is inferred. <= 0 means no timeout.
 static const double DEFAULT_START_TIMEOUT_SECS = 0.0;                 // Timeout waiting for the first datagram on UDP. < 0 means use eof_timeout == 0 means no timeout.
 static const double DEFAULT_MAX_DATAGRAM_RATE = 0.0;                  // For UDP sender, max rate in datagrams/second. if <= 0.0, no limit.
+static const double DEFAULT_ADAPTIVE_INITIAL_RATE = 10000.0;          // Initial adaptive UDP send rate in datagrams/second, if there is no max rate
+static const double DEFAULT_ADAPTIVE_MIN_RATE = 100.0;                // Adaptive UDP send rate never drops below this (datagrams/second)
+static const double DEFAULT_ADAPTIVE_RATE_STEP = 1000.0;              // Adaptive UDP send rate additive increase (datagrams/second) per interval without backpressure
+static const double DEFAULT_ADAPTIVE_RATE_INTERVAL = 0.01;            // Adaptive UDP send rate adjustment interval in seconds
+static const double DEFAULT_ADAPTIVE_DECREASE_FACTOR = 0.5;           // Adaptive UDP send rate multiplicative decrease on backpressure
+static const double DEFAULT_SEND_MAX_CATCHUP_SECS = 0.01;             // Paced UDP sends fall behind schedule by at most this much (e.g., after a pause), limiting catch-up bursts
+static const int DEFAULT_SEND_BACKPRESSURE_POLL_MS = 10;              // Maximum time to wait for POLLOUT after a nonblocking UDP send fails with EAGAIN/ENOBUFS
+static const int DEFAULT_REPLAY_EOF_POLL_MS = 10;                     // Maximum time a paced direct replay from a mapped capture waits for a send before checking for a forced EOF
+static const size_t DEFAULT_TX_TIMESTAMP_DRAIN_SENDS = 64;            // UDP sends between reads of transmit timestamps from the socket error queue
+static const size_t DEFAULT_TX_TIMESTAMP_MAX_PENDING = 4096;          // Number of recent UDP sends whose scheduled send times are kept for matching with transmit timestamps
+static const int DEFAULT_TX_TIMESTAMP_FINAL_WAIT_MS = 100;            // Maximum time to wait for the last transmit timestamps after the final UDP send
+static const double DEFAULT_TX_TIMESTAMP_PUBLISH_SECS = 0.1;          // Minimum interval between snapshots of the transmit timestamp histograms in the stats
+static const double DEFAULT_SEND_STATS_PUBLISH_SECS = 0.1;            // Minimum interval between copies of a UDP destination's send stats to the shared stats
 static const uint64_t DEFAULT_MAX_DATAGRAMS = 0;                      // Max datagrams to copy.  0 == no limit
 static const size_t DEFAULT_MAX_IOVECS = 0;                           // Maximum number of iovecs that can be used in a single recvmmsg() call.
-                                                                      //   Will be limited to sysconf(_SC_IOV_MAX). 0 means use max possible.
\ No newline at end of file
+                                                                      //   Will be limited to sysconf(_SC_IOV_MAX). 0 means use max possible.
+static const size_t DEFAULT_RECV_SLOT_SIZE = 2048;                    // Size of each UDP receive slot; larger datagrams spill into a per-slot overflow buffer
+static const size_t DEFAULT_PACKET_BLOCK_SIZE = 1024*1024;            // Size of each block in an AF_PACKET TPACKET_V3 receive ring
+static const size_t DEFAULT_PACKET_BLOCK_COUNT = 64;                  // Number of blocks in an AF_PACKET TPACKET_V3 receive ring
+static const unsigned DEFAULT_PACKET_BLOCK_TIMEOUT_MS = 10;           // Time after which the kernel retires a partially filled TPACKET_V3 block
+static const size_t DEFAULT_XDP_FRAME_SIZE = 4096;                    // Size of each AF_XDP UMEM frame (2048 or 4096)
+static const size_t DEFAULT_XDP_NUM_FRAMES = 4096;                    // Number of AF_XDP UMEM frames (and fill/RX ring entries)
+static const size_t DEFAULT_DEMUX_MAX_OUTPUTS = 1024;                 // Maximum number of per-sender outputs for a demux:// destination
+static const size_t DEFAULT_STRIPE_CHUNK_SIZE = 8*1024*1024;          // Target size of each chunk of a stripe:// capture
+static const size_t DEFAULT_STRIPE_READ_AHEAD = 2;                    // Number of chunks per stripe read ahead by a stripe:// source
+static const size_t DEFAULT_SUMMARY_MAX_KEYS = 65536;                 // Maximum number of distinct keys counted per interval by a summary:// destination
+static const double DEFAULT_SUMMARY_INTERVAL_SECS = 1.0;              // Default summary:// aggregation interval in seconds
+static const size_t DEFAULT_MAX_TRACKED_SENDERS = 4096;               // Maximum number of sender addresses tracked by per-sender stats
+static const size_t DEFAULT_ARROW_BATCH_ROWS = 65536;                 // Maximum number of rows in an Arrow IPC record batch
+static const size_t DEFAULT_ARROW_BATCH_BYTES = 64*1024*1024;         // Maximum number of payload bytes in an Arrow IPC record batch
+static const size_t DEFAULT_CONTROL_MAX_CLIENTS = 16;                 // Maximum number of simultaneously connected control socket clients
+static const size_t DEFAULT_CONTROL_MAX_LINE = 4096;                  // Maximum length of a control socket command line
+static const size_t DEFAULT_ANALYZE_MIN_RANGE_SIZE = 1024*1024;       // Smallest part of a capture that dg-stat analyzes on its own thread
+static const size_t DEFAULT_ANALYZE_RESYNC_RECORDS = 16;              // Consecutive plausible records that dg-stat requires to accept a guessed record boundary
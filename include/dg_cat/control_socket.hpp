@@ -0,0 +1,244 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/log/trivial.hpp>
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "constants.hpp"
+
+/**
+ * @brief A unix-domain stream socket that accepts line-oriented text commands and answers each with one line,
+ *        served by a background thread.
+ *
+ * Each command line is passed to a handler, and the handler's return value is sent back followed by a newline.
+ * Several clients may be connected at once; e.g., `echo stats | socat - UNIX-CONNECT:<path>`. The socket is
+ * created with mode 0600 (commands can end the copy), a stale socket left at the path by a previous run is
+ * replaced, and the path is removed when the socket is stopped.
+ */
+class ControlSocket {
+public:
+    typedef std::function<std::string(const std::string&)> Handler;
+
+private:
+    struct Client {
+        int fd;
+        std::string input;
+    };
+
+    std::string _path;
+    Handler _handler;
+    int _listen_fd = -1;
+    int _stop_fd = -1;                   // eventfd that wakes the thread to stop
+    std::thread _thread;
+    std::vector<Client> _clients;
+
+public:
+    /**
+     * @brief Create the socket and start serving commands.
+     *
+     * @param path     The filesystem path of the socket.
+     * @param handler  Called on the serving thread with each command line (without its newline); returns the reply.
+     */
+    ControlSocket(const std::string& path, Handler handler) :
+        _path(path),
+        _handler(handler)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Invalid control socket path: " + path);
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                throw std::runtime_error("Control socket path exists and is not a socket: " + path);
+            }
+            ::unlink(path.c_str());
+        }
+
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (_listen_fd == -1) {
+            throw std::system_error(errno, std::system_category(), "socket(AF_UNIX) failed");
+        }
+        // The socket file is created by bind() with the umask applied, so a restrictive umask makes it 0600 from the
+        // start, with no window in which another user could connect. The umask is process-wide, so it is restored
+        // immediately; the socket is created before the copy threads start.
+        mode_t old_umask = umask(0177);
+        int ret = bind(_listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+        int bind_errno = errno;
+        umask(old_umask);
+        if (ret != 0) {
+            ::close(_listen_fd);
+            _listen_fd = -1;
+            throw std::system_error(bind_errno, std::system_category(), "bind() of control socket " + path + " failed");
+        }
+        if (listen(_listen_fd, 8) != 0) {
+            int err = errno;
+            close_fds();
+            throw std::system_error(err, std::system_category(), "listen() on control socket failed");
+        }
+        _stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_stop_fd == -1) {
+            int err = errno;
+            close_fds();
+            throw std::system_error(err, std::system_category(), "eventfd() failed");
+        }
+        _thread = std::thread(&ControlSocket::run, this);
+        BOOST_LOG_TRIVIAL(info) << "Listening for control commands on " << path << "\n";
+    }
+
+    ControlSocket(const ControlSocket&) = delete;
+    ControlSocket& operator=(const ControlSocket&) = delete;
+
+    ~ControlSocket() {
+        stop();
+    }
+
+    /**
+     * @brief Stop serving, disconnect clients and remove the socket. Idempotent.
+     */
+    void stop() {
+        if (_thread.joinable()) {
+            uint64_t one = 1;
+            ssize_t nb = ::write(_stop_fd, &one, sizeof(one));
+            (void)nb;
+            _thread.join();
+        }
+        close_fds();
+    }
+
+protected:
+    void close_fds() {
+        for (auto& client : _clients) {
+            ::close(client.fd);
+        }
+        _clients.clear();
+        if (_listen_fd != -1) {
+            ::close(_listen_fd);
+            _listen_fd = -1;
+            ::unlink(_path.c_str());
+        }
+        if (_stop_fd != -1) {
+            ::close(_stop_fd);
+            _stop_fd = -1;
+        }
+    }
+
+    void run() {
+        std::vector<struct pollfd> pfds;
+        while (true) {
+            pfds.clear();
+            pfds.push_back({_stop_fd, POLLIN, 0});
+            pfds.push_back({_listen_fd, POLLIN, 0});
+            for (auto& client : _clients) {
+                pfds.push_back({client.fd, POLLIN, 0});
+            }
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                BOOST_LOG_TRIVIAL(error) << "poll() on control socket failed: " << strerror(errno) << "\n";
+                break;
+            }
+            if (pfds[0].revents != 0) {
+                break;
+            }
+            // Serve existing clients first, since accepting may reallocate _clients
+            for (size_t i = _clients.size(); i > 0; --i) {
+                if (pfds[i + 1].revents != 0 && !serve_client(_clients[i - 1])) {
+                    ::close(_clients[i - 1].fd);
+                    _clients.erase(_clients.begin() + (ptrdiff_t)(i - 1));
+                }
+            }
+            if (pfds[1].revents != 0) {
+                int fd = accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (fd != -1) {
+                    if (_clients.size() >= DEFAULT_CONTROL_MAX_CLIENTS) {
+                        send_reply(fd, "error: too many control clients");
+                        ::close(fd);
+                    } else {
+                        _clients.push_back(Client{fd, std::string()});
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Read from a readable client and answer each complete command line. Returns false if the client
+     *        should be disconnected.
+     */
+    bool serve_client(Client& client) {
+        char buffer[1024];
+        ssize_t nb = ::read(client.fd, buffer, sizeof(buffer));
+        if (nb < 0) {
+            return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (nb == 0) {
+            return false;
+        }
+        client.input.append(buffer, (size_t)nb);
+        size_t pos;
+        while ((pos = client.input.find('\n')) != std::string::npos) {
+            std::string line = client.input.substr(0, pos);
+            client.input.erase(0, pos + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            std::string reply;
+            try {
+                reply = _handler(line);
+            } catch (const std::exception& e) {
+                reply = std::string("error: ") + e.what();
+            }
+            BOOST_LOG_TRIVIAL(debug) << "Control command \"" << line << "\": " << reply << "\n";
+            if (!send_reply(client.fd, reply)) {
+                return false;
+            }
+        }
+        if (client.input.size() > DEFAULT_CONTROL_MAX_LINE) {
+            send_reply(client.fd, "error: command too long");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Send a one-line reply without blocking. Returns false if it could not be sent in full.
+     */
+    static bool send_reply(int fd, std::string reply) {
+        for (auto& c : reply) {
+            if (c == '\n') {
+                c = ' ';
+            }
+        }
+        reply += '\n';
+        ssize_t nb = ::send(fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        return nb == (ssize_t)reply.size();
+    }
+};
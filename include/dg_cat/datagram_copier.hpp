@@ -6,6 +6,7 @@
 #pragma once
 
 #include <memory>
+#include <sstream>
 #include <thread>
 #include <atomic>
 #include <mutex>
@@ -15,6 +16,7 @@
 
 #include "config.hpp"
 #include "buffer_queue.hpp"
+#include "control_socket.hpp"
 #include "stats.hpp"
 #include "datagram_source.hpp"
 #include "datagram_destination.hpp"
@@ -36,6 +38,7 @@ private:
     std::thread _destination_thread;
     std::thread _signal_thread;
     bool _signal_thread_waiting = false;
+    std::unique_ptr<ControlSocket> _control_socket;
 
     /**
      * @brief An exception that was raised in a worker thread. This will be rethrown in the main thread when
@@ -108,26 +111,18 @@ public:
     void start() {
         if (_config.handle_signals) {
             mask_signals();
+        }
+        if (!_config.control_socket.empty()) {
+            // Created after the signals are masked, so its thread inherits the mask
+            _control_socket = std::make_unique<ControlSocket>(
+                _config.control_socket,
+                [this](const std::string& command) { return handle_control_command(command); });
+        }
+        if (_config.handle_signals) {
             _signal_thread = std::thread([&] {
                 handle_signals();
             });
         }
-        _destination_thread = std::thread([&] {
-            try {
-                if (_config.handle_signals) {
-                    mask_signals();
-                }
-                _destination->copy_from_buffer_queue(_buffer_queue, _stats.destination_stats);
-            } catch (...) {
-                {
-                    std::lock_guard<std::mutex> lock(_mutex);
-                    if (!_exception) {
-                        _exception = std::current_exception();
-                    }
-                }
-            }
-            _source->force_eof();
-        });
 
         try {
             _source_thread = std::thread([&] {
@@ -135,7 +130,17 @@ public:
                     if (_config.handle_signals) {
                         mask_signals();
                     }
-                    _source->copy_to_buffer_queue(_buffer_queue, _stats.source_stats);
+                    // Sources that can feed the destination directly (e.g., a preloaded capture replayed to UDP) do so
+                    // in this thread; otherwise start the destination thread and go through the BufferQueue.
+                    if (!_source->copy_direct_to_destination(
+                            *_destination,
+                            _stats.source_stats,
+                            _stats.buffer_stats,
+                            _stats.destination_stats))
+                    {
+                        start_destination_thread();
+                        _source->copy_to_buffer_queue(_buffer_queue, _stats.source_stats);
+                    }
                 } catch (...) {
                     {
                         std::lock_guard<std::mutex> lock(_mutex);
@@ -160,6 +165,9 @@ public:
         if (_destination_thread.joinable()) {
             _destination_thread.join();
         }
+        if (_control_socket) {
+            _control_socket->stop();
+        }
         if (_signal_thread.joinable()) {
             auto retry_timer = std::chrono::seconds(1);
             while (true) {
@@ -184,10 +192,80 @@ public:
 
     /**
      * @brief Force an EOF condition on the source as soon as possible. This method will be called
-     *        when an asynchronous signal is received to terminate the program cleanly.
+     *        when an asynchronous signal is received to terminate the program cleanly. Resumes a paused
+     *        destination so that the backlog drains.
      */
     void force_eof() {
         _source->force_eof();
+        _buffer_queue.consumer_set_paused(false);
+    }
+
+    /**
+     * @brief Trigger a flight recorder dump, if the destination is a flight recorder that is armed. Thread-safe.
+     *        Returns false if there was nothing to trigger.
+     */
+    bool trigger() {
+        return _buffer_queue.trigger();
+    }
+
+    /**
+     * @brief Execute a runtime control command and return a one-line reply beginning with "ok" or "error:".
+     *        Thread-safe; commands only set state that the copying threads pick up between batches, so they
+     *        never stall the data path. Commands:
+     *
+     *            rate <datagrams/sec>   Set the maximum send rate of a UDP destination (<= 0 means no limit)
+     *            pause                  Stop writing to the destination; the backlog keeps absorbing input. Holds
+     *                                   after the source ends, until resumed or until a forced EOF
+     *            resume                 Resume writing to the destination
+     *            rotate                 Close and reopen a file destination's path (after renaming the file away)
+     *            stats                  Reply with the current progress statistics
+     *            trigger                Trigger a flight recorder dump
+     *            eof                    Force an EOF on the source, draining the backlog and ending cleanly
+     *
+     *        pause does not apply to a preloaded capture sent directly to UDP, which bypasses the backlog.
+     */
+    std::string handle_control_command(const std::string& command) {
+        std::istringstream iss(command);
+        std::string verb;
+        iss >> verb;
+        if (verb == "rate") {
+            std::string rate_s;
+            iss >> rate_s;
+            if (rate_s.empty()) {
+                return "error: missing rate";
+            }
+            double rate;
+            try {
+                rate = std::stod(rate_s);
+            } catch (const std::exception&) {
+                return "error: invalid rate: " + rate_s;
+            }
+            if (!_destination->set_max_datagram_rate(rate)) {
+                return "error: destination does not support a rate limit";
+            }
+            BOOST_LOG_TRIVIAL(info) << "Max datagram rate set to " << rate << " by control command\n";
+            return "ok";
+        } else if (verb == "pause" || verb == "resume") {
+            _buffer_queue.consumer_set_paused(verb == "pause");
+            BOOST_LOG_TRIVIAL(info) << "Destination " << (verb == "pause" ? "paused" : "resumed") << " by control command\n";
+            return "ok";
+        } else if (verb == "rotate") {
+            if (!_destination->request_rotate(_buffer_queue)) {
+                return "error: destination cannot be rotated";
+            }
+            return "ok";
+        } else if (verb == "stats") {
+            return "ok " + get_stats().brief_str();
+        } else if (verb == "trigger") {
+            return trigger() ? "ok" : "error: no flight recorder is armed";
+        } else if (verb == "eof") {
+            BOOST_LOG_TRIVIAL(info) << "Forcing EOF by control command\n";
+            force_eof();
+            return "ok";
+        } else if (verb == "help") {
+            return "ok commands: rate <datagrams/sec>, pause, resume, rotate, stats, trigger, eof";
+        }
+        return "error: unknown command: " + verb;
     }
 
     void close() {
@@ -196,11 +274,36 @@ public:
     }
 
 protected:
+    /**
+     * @brief Start the thread that copies from the BufferQueue to the destination. Called from the source thread,
+     *        which is always joined before the destination thread.
+     */
+    void start_destination_thread() {
+        _destination_thread = std::thread([&] {
+            try {
+                if (_config.handle_signals) {
+                    mask_signals();
+                }
+                _destination->copy_from_buffer_queue(_buffer_queue, _stats.destination_stats);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (!_exception) {
+                        _exception = std::current_exception();
+                    }
+                }
+            }
+            _buffer_queue.publish_residency();
+            _source->force_eof();
+        });
+    }
+
     void mask_signals() {
         sigset_t sigset;
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGINT);
         sigaddset(&sigset, SIGUSR1);
+        sigaddset(&sigset, SIGUSR2);
         pthread_sigmask(SIG_BLOCK, &sigset, nullptr);
     }
 
@@ -211,6 +314,7 @@ protected:
         sigemptyset(&sigset);
         sigaddset(&sigset, SIGINT);
         sigaddset(&sigset, SIGUSR1);
+        sigaddset(&sigset, SIGUSR2);
         int n_sigint = 0;
 
         {
@@ -251,6 +355,13 @@ protected:
                     std::cerr << get_stats().brief_str() << std::endl;
                     BOOST_LOG_TRIVIAL(debug) << "Done dumping stats\n";
                     break;
+                case SIGUSR2:
+                    if (trigger()) {
+                        BOOST_LOG_TRIVIAL(info) << "Flight recorder triggered by SIGUSR2\n";
+                    } else {
+                        BOOST_LOG_TRIVIAL(warning) << "Ignoring SIGUSR2; no flight recorder is armed\n";
+                    }
+                    break;
             }
         }
 
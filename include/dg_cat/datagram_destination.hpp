@@ -5,10 +5,12 @@
  */
 #pragma once
 
+#include <chrono>
 #include <memory>
 
 #include "config.hpp"
 #include "buffer_queue.hpp"
+#include "mapped_capture_file.hpp"
 #include "stats.hpp"
 
 /**
@@ -25,6 +27,60 @@ public:
      */
     virtual void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) = 0;
 
+    /**
+     * @brief Returns true if the destination can send datagrams directly out of a memory-mapped capture with
+     *        send_mapped_datagrams(), bypassing the BufferQueue.
+     */
+    virtual bool supports_mapped_send() const {
+        return false;
+    }
+
+    /**
+     * @brief Send a range of datagrams directly out of a memory-mapped capture. May be called repeatedly (e.g.,
+     *        once per replay loop) from the thread that calls copy_from_buffer_queue() in the general case.
+     *        Only called if supports_mapped_send() returns true.
+     *
+     * @param capture   The mapped capture
+     * @param begin     Index of the first datagram to send
+     * @param end       Index past the last datagram to send
+     * @param deadline  Time after which a rate-limited send stops waiting for the next datagram to be due
+     * @param stats     The threadsafe stats object to update with real-time progress.
+     *
+     * @return size_t  Index of the next datagram to send: end, or less if the deadline passed first.
+     */
+    virtual size_t send_mapped_datagrams(const MappedCaptureFile& /*capture*/, size_t /*begin*/, size_t /*end*/,
+                                         std::chrono::steady_clock::time_point /*deadline*/, LockableDgDestinationStats& /*stats*/) {
+        throw std::runtime_error("Destination does not support sending from a mapped capture");
+    }
+
+    /**
+     * @brief Called once after the final send_mapped_datagrams(), to flush and release resources as
+     *        copy_from_buffer_queue() would on EOF.
+     */
+    virtual void finish_mapped_send(LockableDgDestinationStats& /*stats*/) {
+    }
+
+    /**
+     * @brief Change the maximum send rate while copying. May be called from any thread; the new rate is applied
+     *        before the next send. Returns false if the destination is not rate-limited.
+     *
+     * @param max_datagram_rate  The new maximum rate in datagrams/second. <= 0.0 means no limit.
+     */
+    virtual bool set_max_datagram_rate(double /*max_datagram_rate*/) {
+        return false;
+    }
+
+    /**
+     * @brief Ask the destination to close and reopen its output path (e.g., after the current file has been
+     *        renamed away), between two writes. May be called from any thread. Returns false if the destination
+     *        cannot be rotated.
+     *
+     * @param buffer_queue  The buffer queue the destination is copying from, used to wake it if it is idle.
+     */
+    virtual bool request_rotate(BufferQueue& /*buffer_queue*/) {
+        return false;
+    }
+
     /**
      * @brief static factory method to create a typed DatagramDestination based on a pathname
      * 
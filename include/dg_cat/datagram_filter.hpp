@@ -0,0 +1,413 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "bpf_program.hpp"
+#include "datagram_metadata.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/**
+ * @brief A datagram filter expression that is compiled to a classic BPF program and attached to a UDP socket,
+ *        so that unwanted datagrams are dropped in the kernel before they are copied to user space.
+ *
+ * An expression is a comma-separated list of terms that must all match. Each term is a '|'-separated list of
+ * alternatives of the same kind, any of which may match:
+ *
+ *     src=<addr>[/<prefix-len>]        Sender IPv4 or IPv6 address, optionally a network prefix
+ *     sport=<port>[-<port>]            Sender UDP port or inclusive port range
+ *     len=<n>[-<n>]                    Payload length in bytes or inclusive length range
+ *     payload@<offset>=<hex>[/<hex>]   Payload bytes at an offset, optionally under a mask of the same length
+ *
+ * For example, "src=10.1.0.0/16|10.2.0.1,sport=5000-5099,payload@0=cafe" accepts datagrams from 10.1.x.x or
+ * 10.2.0.1, sent from ports 5000-5099, whose payload starts with the bytes 0xca 0xfe.
+ *
+ * The compiled program relies on the socket filter convention for UDP sockets that packet offset 0 is the
+ * start of the UDP header, with the IP header reachable through SKF_NET_OFF.
+ *
+ * The same expression can also be evaluated in user space with matches() (e.g., as a flight recorder trigger).
+ */
+class DatagramFilter {
+private:
+    enum class Kind { SRC, SPORT, LEN, PAYLOAD };
+
+    struct Alternative {
+        Kind kind;
+        uint64_t lo = 0;                  // SPORT, LEN: inclusive range
+        uint64_t hi = 0;
+        int family = AF_UNSPEC;           // SRC
+        uint8_t addr[16];                 // SRC: address (already masked)
+        uint8_t mask[16];                 // SRC: prefix mask
+        uint32_t offset = 0;              // PAYLOAD: offset within the payload
+        std::vector<uint8_t> bytes;       // PAYLOAD: bytes to match (already masked)
+        std::vector<uint8_t> byte_mask;   // PAYLOAD: mask applied before comparing
+    };
+
+    struct Term {
+        std::vector<Alternative> alternatives;
+    };
+
+    static const uint32_t UDP_HDR_LEN = 8;
+    static const size_t MAX_NEAR_COMPARES = 64;   // Payload compares (at most 3 instructions each) per fail trampoline
+
+    std::string _expression;
+    std::vector<Term> _terms;
+
+public:
+    /**
+     * @brief Parse a filter expression. Throws std::runtime_error if it is invalid.
+     */
+    explicit DatagramFilter(const std::string& expression) :
+        _expression(expression)
+    {
+        for (auto& term_str : split(expression, ',')) {
+            if (term_str.empty()) {
+                continue;
+            }
+            size_t eq_pos = term_str.find('=');
+            if (eq_pos == std::string::npos) {
+                throw std::runtime_error("Invalid filter term (missing '='): " + term_str);
+            }
+            std::string key = term_str.substr(0, eq_pos);
+            Term term;
+            for (auto& value : split(term_str.substr(eq_pos + 1), '|')) {
+                term.alternatives.push_back(parse_alternative(key, value));
+            }
+            _terms.push_back(std::move(term));
+        }
+        if (_terms.empty()) {
+            throw std::runtime_error("Empty filter expression");
+        }
+    }
+
+    const std::string& expression() const {
+        return _expression;
+    }
+
+    /**
+     * @brief Compile the filter to a classic BPF program for a UDP socket.
+     */
+    BpfProgram compile() const {
+        BpfProgram prog;
+        auto reject = prog.new_label();
+        for (auto& term : _terms) {
+            auto term_ok = prog.new_label();
+            for (auto& alt : term.alternatives) {
+                auto next_alt = prog.new_label();
+                compile_alternative(prog, alt, term_ok, next_alt);
+                prog.bind(next_alt);
+            }
+            prog.jump_always(reject);
+            prog.bind(term_ok);
+        }
+        prog.ret(0xffffffff);
+        prog.bind(reject);
+        prog.ret(0);
+        return prog;
+    }
+
+    /**
+     * @brief Compile the filter and attach it to a UDP socket with SO_ATTACH_FILTER.
+     */
+    void attach(int sock) const {
+        compile().attach(sock);
+    }
+
+    /**
+     * @brief Evaluate the filter in user space against a datagram.
+     *
+     * @param payload    The start of the datagram payload
+     * @param n_payload  The number of payload bytes available at payload (payload terms beyond it do not match)
+     * @param dg_len     The full length of the datagram
+     * @param metadata   The datagram's metadata. src and sport terms do not match if the sender is unknown.
+     */
+    bool matches(const char *payload, size_t n_payload, size_t dg_len, const DatagramMetadata& metadata) const {
+        for (auto& term : _terms) {
+            bool term_ok = false;
+            for (auto& alt : term.alternatives) {
+                if (matches_alternative(alt, (const uint8_t *)payload, n_payload, dg_len, metadata)) {
+                    term_ok = true;
+                    break;
+                }
+            }
+            if (!term_ok) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+protected:
+    static std::vector<std::string> split(const std::string& s, char sep) {
+        std::vector<std::string> result;
+        size_t start = 0;
+        while (true) {
+            size_t pos = s.find(sep, start);
+            if (pos == std::string::npos) {
+                result.push_back(s.substr(start));
+                break;
+            }
+            result.push_back(s.substr(start, pos - start));
+            start = pos + 1;
+        }
+        return result;
+    }
+
+    static uint64_t parse_uint(const std::string& s) {
+        size_t pos = 0;
+        uint64_t v = std::stoull(s, &pos);
+        if (pos != s.size()) {
+            throw std::runtime_error("Invalid filter number: " + s);
+        }
+        return v;
+    }
+
+    static void parse_range(const std::string& value, uint64_t max_value, uint64_t& lo, uint64_t& hi) {
+        size_t dash_pos = value.find('-');
+        if (dash_pos == std::string::npos) {
+            lo = hi = parse_uint(value);
+        } else {
+            lo = parse_uint(value.substr(0, dash_pos));
+            hi = parse_uint(value.substr(dash_pos + 1));
+        }
+        if (lo > hi || hi > max_value) {
+            throw std::runtime_error("Invalid filter range: " + value);
+        }
+    }
+
+    static std::vector<uint8_t> parse_hex(const std::string& hex) {
+        if (hex.empty() || hex.size() % 2 != 0) {
+            throw std::runtime_error("Invalid filter hex string (must be an even number of hex digits): " + hex);
+        }
+        std::vector<uint8_t> result;
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            size_t pos = 0;
+            auto byte_str = hex.substr(i, 2);
+            unsigned long b = std::stoul(byte_str, &pos, 16);
+            if (pos != 2) {
+                throw std::runtime_error("Invalid filter hex string: " + hex);
+            }
+            result.push_back((uint8_t)b);
+        }
+        return result;
+    }
+
+    static Alternative parse_alternative(const std::string& key, const std::string& value) {
+        Alternative alt;
+        memset(alt.addr, 0, sizeof(alt.addr));
+        memset(alt.mask, 0, sizeof(alt.mask));
+        if (key == "src") {
+            alt.kind = Kind::SRC;
+            std::string addr_s = value;
+            int prefix_len = -1;
+            size_t slash_pos = value.find('/');
+            if (slash_pos != std::string::npos) {
+                addr_s = value.substr(0, slash_pos);
+                prefix_len = (int)parse_uint(value.substr(slash_pos + 1));
+            }
+            size_t addr_len;
+            if (inet_pton(AF_INET, addr_s.c_str(), alt.addr) == 1) {
+                alt.family = AF_INET;
+                addr_len = 4;
+            } else if (inet_pton(AF_INET6, addr_s.c_str(), alt.addr) == 1) {
+                alt.family = AF_INET6;
+                addr_len = 16;
+            } else {
+                throw std::runtime_error("Invalid filter source address: " + addr_s);
+            }
+            if (prefix_len < 0) {
+                prefix_len = (int)(addr_len * 8);
+            }
+            if (prefix_len > (int)(addr_len * 8)) {
+                throw std::runtime_error("Invalid filter prefix length: " + value);
+            }
+            for (size_t i = 0; i < addr_len; ++i) {
+                int bits = std::min(std::max(prefix_len - (int)(i * 8), 0), 8);
+                alt.mask[i] = (uint8_t)(0xff00 >> bits);
+                alt.addr[i] &= alt.mask[i];
+            }
+        } else if (key == "sport") {
+            alt.kind = Kind::SPORT;
+            parse_range(value, 65535, alt.lo, alt.hi);
+        } else if (key == "len") {
+            alt.kind = Kind::LEN;
+            parse_range(value, 65535, alt.lo, alt.hi);
+        } else if (key.compare(0, 8, "payload@") == 0) {
+            alt.kind = Kind::PAYLOAD;
+            alt.offset = (uint32_t)parse_uint(key.substr(8));
+            size_t slash_pos = value.find('/');
+            alt.bytes = parse_hex(value.substr(0, slash_pos));
+            if (slash_pos == std::string::npos) {
+                alt.byte_mask.assign(alt.bytes.size(), 0xff);
+            } else {
+                alt.byte_mask = parse_hex(value.substr(slash_pos + 1));
+                if (alt.byte_mask.size() != alt.bytes.size()) {
+                    throw std::runtime_error("Filter payload mask must be the same length as the payload bytes: " + value);
+                }
+            }
+            if (alt.offset + alt.bytes.size() > 65535) {
+                throw std::runtime_error("Filter payload match is beyond the maximum datagram size: " + key);
+            }
+            for (size_t i = 0; i < alt.bytes.size(); ++i) {
+                alt.bytes[i] &= alt.byte_mask[i];
+            }
+        } else {
+            throw std::runtime_error("Invalid filter term: " + key);
+        }
+        return alt;
+    }
+
+    /**
+     * @brief Compare the accumulator, masked, with a value; fall through on a match, jump to fail otherwise.
+     */
+    static void compile_masked_compare(BpfProgram& prog, uint32_t mask, uint32_t value, uint32_t full_mask, BpfProgram::Label fail) {
+        if (mask != full_mask) {
+            prog.stmt(BPF_ALU | BPF_AND | BPF_K, mask);
+        }
+        prog.jump(BPF_JMP | BPF_JEQ | BPF_K, value, BpfProgram::NEXT, fail);
+    }
+
+    static bool matches_alternative(
+            const Alternative& alt,
+            const uint8_t *payload,
+            size_t n_payload,
+            size_t dg_len,
+            const DatagramMetadata& metadata)
+    {
+        switch (alt.kind) {
+            case Kind::SRC: {
+                if (metadata.family != alt.family) {
+                    return false;
+                }
+                size_t addr_len = (alt.family == AF_INET) ? 4 : 16;
+                for (size_t i = 0; i < addr_len; ++i) {
+                    if ((metadata.addr[i] & alt.mask[i]) != alt.addr[i]) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case Kind::SPORT:
+                return metadata.has_sender() && metadata.port >= alt.lo && metadata.port <= alt.hi;
+            case Kind::LEN:
+                return dg_len >= alt.lo && dg_len <= alt.hi;
+            case Kind::PAYLOAD:
+                if (alt.offset + alt.bytes.size() > n_payload) {
+                    return false;
+                }
+                for (size_t i = 0; i < alt.bytes.size(); ++i) {
+                    if ((payload[alt.offset + i] & alt.byte_mask[i]) != alt.bytes[i]) {
+                        return false;
+                    }
+                }
+                return true;
+        }
+        return false;
+    }
+
+    static uint32_t be_bytes(const uint8_t *p, size_t n) {
+        uint32_t v = 0;
+        for (size_t i = 0; i < n; ++i) {
+            v = (v << 8) | p[i];
+        }
+        return v;
+    }
+
+    static void compile_alternative(BpfProgram& prog, const Alternative& alt, BpfProgram::Label match, BpfProgram::Label fail) {
+        switch (alt.kind) {
+            case Kind::SRC: {
+                // IP version from the network header; IPv4 addresses only match IPv4 packets
+                prog.stmt(BPF_LD | BPF_B | BPF_ABS, (uint32_t)SKF_NET_OFF);
+                prog.stmt(BPF_ALU | BPF_RSH | BPF_K, 4);
+                prog.jump(BPF_JMP | BPF_JEQ | BPF_K, (alt.family == AF_INET) ? 4 : 6, BpfProgram::NEXT, fail);
+                uint32_t addr_offset = (alt.family == AF_INET) ? 12 : 8;
+                size_t n_words = (alt.family == AF_INET) ? 1 : 4;
+                for (size_t i = 0; i < n_words; ++i) {
+                    uint32_t mask = be_bytes(alt.mask + 4 * i, 4);
+                    if (mask == 0) {
+                        continue;
+                    }
+                    prog.stmt(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_NET_OFF + addr_offset + 4 * i));
+                    compile_masked_compare(prog, mask, be_bytes(alt.addr + 4 * i, 4), 0xffffffff, fail);
+                }
+                break;
+            }
+            case Kind::SPORT:
+                prog.stmt(BPF_LD | BPF_H | BPF_ABS, 0);
+                prog.jump(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)alt.lo, BpfProgram::NEXT, fail);
+                prog.jump(BPF_JMP | BPF_JGT | BPF_K, (uint32_t)alt.hi, fail, BpfProgram::NEXT);
+                break;
+            case Kind::LEN:
+                prog.stmt(BPF_LD | BPF_W | BPF_LEN, 0);
+                prog.jump(BPF_JMP | BPF_JGE | BPF_K, (uint32_t)alt.lo + UDP_HDR_LEN, BpfProgram::NEXT, fail);
+                prog.jump(BPF_JMP | BPF_JGT | BPF_K, (uint32_t)alt.hi + UDP_HDR_LEN, fail, BpfProgram::NEXT);
+                break;
+            case Kind::PAYLOAD: {
+                // A conditional jump reaches at most 255 instructions ahead, so a long match fails through
+                // unconditional jumps ("trampolines") placed after every MAX_NEAR_COMPARES compares
+                bool trampolines = alt.bytes.size() / 4 + 2 > MAX_NEAR_COMPARES;   // Bounds the number of compares
+                auto near_fail = trampolines ? prog.new_label() : fail;
+                size_t n_near_compares = 0;
+
+                // A load past the end of the packet would abort the whole program, so check the length first
+                uint32_t base = UDP_HDR_LEN + alt.offset;
+                prog.stmt(BPF_LD | BPF_W | BPF_LEN, 0);
+                prog.jump(BPF_JMP | BPF_JGE | BPF_K, base + (uint32_t)alt.bytes.size(), BpfProgram::NEXT, near_fail);
+                size_t i = 0;
+                while (i < alt.bytes.size()) {
+                    size_t n = std::min(alt.bytes.size() - i, (size_t)4);
+                    if (n == 3) {
+                        n = 2;
+                    }
+                    uint16_t size = (n == 4) ? BPF_W : (n == 2) ? BPF_H : BPF_B;
+                    uint32_t full_mask = (n == 4) ? 0xffffffff : (n == 2) ? 0xffff : 0xff;
+                    uint32_t mask = be_bytes(alt.byte_mask.data() + i, n);
+                    if (mask != 0) {
+                        if (trampolines && n_near_compares == MAX_NEAR_COMPARES) {
+                            near_fail = emit_trampoline(prog, near_fail, fail);
+                            n_near_compares = 0;
+                        }
+                        prog.stmt(BPF_LD | size | BPF_ABS, base + (uint32_t)i);
+                        compile_masked_compare(prog, mask, be_bytes(alt.bytes.data() + i, n), full_mask, near_fail);
+                        n_near_compares++;
+                    }
+                    i += n;
+                }
+                if (trampolines) {
+                    prog.jump_always(match);
+                    prog.bind(near_fail);
+                    prog.jump_always(fail);
+                    return;
+                }
+                break;
+            }
+        }
+        prog.jump_always(match);
+    }
+
+    /**
+     * @brief Emit a trampoline, skipped on the fall-through path, that binds near_fail and jumps on to fail.
+     *
+     * @return BpfProgram::Label  A new label for the following compares to jump to on failure.
+     */
+    static BpfProgram::Label emit_trampoline(BpfProgram& prog, BpfProgram::Label near_fail, BpfProgram::Label fail) {
+        auto skip = prog.new_label();
+        prog.jump_always(skip);
+        prog.bind(near_fail);
+        prog.jump_always(fail);
+        prog.bind(skip);
+        return prog.new_label();
+    }
+};
@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "timespec_math.hpp"
+
+#include <boost/endian/conversion.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+/**
+ * @brief Per-datagram metadata (receive timestamp and sender address) that can optionally be carried
+ *        in the BufferQueue and in capture files.
+ *
+ * When metadata is enabled, each length-prefixed record holds a METADATA_LEN-byte header followed by the
+ * datagram payload, and the length prefix covers both. The header is encoded in network byte order:
+ *
+ *     offset  size  field
+ *          0     8  timestamp, in nanoseconds since the epoch (CLOCK_REALTIME). 0 if unknown.
+ *          8     2  sender address family (AF_INET, AF_INET6, or AF_UNSPEC if unknown)
+ *         10     2  sender port
+ *         12    16  sender address. IPv4 addresses occupy the first 4 bytes.
+ *         28     4  reserved (0)
+ */
+class DatagramMetadata {
+public:
+    int64_t timestamp_ns;      // Receive time in nanoseconds since the epoch. 0 if unknown.
+    uint16_t family;           // AF_INET, AF_INET6, or AF_UNSPEC if the sender is unknown.
+    uint16_t port;             // Sender port, in host byte order.
+    uint8_t addr[16];          // Sender address. IPv4 addresses occupy the first 4 bytes.
+
+    DatagramMetadata() :
+        timestamp_ns(0),
+        family(AF_UNSPEC),
+        port(0)
+    {
+        memset(addr, 0, sizeof(addr));
+    }
+
+    DatagramMetadata(const DatagramMetadata&) = default;
+    DatagramMetadata& operator=(const DatagramMetadata&) = default;
+
+    void set_timestamp(const struct timespec& ts) {
+        timestamp_ns = (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+    }
+
+    struct timespec timestamp() const {
+        return normalize_timespec((long)(timestamp_ns / 1000000000), (long)(timestamp_ns % 1000000000));
+    }
+
+    /**
+     * @brief Set the sender address from a socket address as returned in msg_name by recvmmsg().
+     *        Unsupported or empty addresses leave the sender unknown (AF_UNSPEC).
+     */
+    void set_sender(const void *sock_addr, socklen_t sock_addr_len) {
+        family = AF_UNSPEC;
+        port = 0;
+        memset(addr, 0, sizeof(addr));
+        if (sock_addr == nullptr || sock_addr_len < sizeof(sa_family_t)) {
+            return;
+        }
+        auto sa_family = ((const struct sockaddr *)sock_addr)->sa_family;
+        if (sa_family == AF_INET && sock_addr_len >= sizeof(struct sockaddr_in)) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *)sock_addr;
+            family = AF_INET;
+            port = ntohs(sin->sin_port);
+            memcpy(addr, &sin->sin_addr, sizeof(sin->sin_addr));
+        } else if (sa_family == AF_INET6 && sock_addr_len >= sizeof(struct sockaddr_in6)) {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sock_addr;
+            family = AF_INET6;
+            port = ntohs(sin6->sin6_port);
+            memcpy(addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+        }
+    }
+
+    bool has_sender() const {
+        return family == AF_INET || family == AF_INET6;
+    }
+
+    /**
+     * @brief Return the numeric sender address without port (e.g., "10.0.0.1" or "::1"), or an empty string if unknown.
+     */
+    std::string sender_addr_string() const {
+        char buf[INET6_ADDRSTRLEN];
+        if (!has_sender() || inet_ntop(family, addr, buf, sizeof(buf)) == nullptr) {
+            return std::string();
+        }
+        return std::string(buf);
+    }
+
+    /**
+     * @brief Return the sender as "<addr>:<port>" (IPv6 addresses are bracketed), or an empty string if unknown.
+     */
+    std::string sender_string() const {
+        if (!has_sender()) {
+            return std::string();
+        }
+        if (family == AF_INET6) {
+            return "[" + sender_addr_string() + "]:" + std::to_string(port);
+        }
+        return sender_addr_string() + ":" + std::to_string(port);
+    }
+
+    /**
+     * @brief Encode the metadata into a METADATA_LEN-byte buffer in network byte order.
+     */
+    void encode(char *buffer) const {
+        auto ts_nbo = boost::endian::native_to_big(timestamp_ns);
+        auto family_nbo = boost::endian::native_to_big(family);
+        auto port_nbo = boost::endian::native_to_big(port);
+        memcpy(buffer, &ts_nbo, 8);
+        memcpy(buffer + 8, &family_nbo, 2);
+        memcpy(buffer + 10, &port_nbo, 2);
+        memcpy(buffer + 12, addr, 16);
+        memset(buffer + 28, 0, METADATA_LEN - 28);
+    }
+
+    /**
+     * @brief Decode metadata from a METADATA_LEN-byte buffer in network byte order.
+     */
+    static DatagramMetadata decode(const char *buffer) {
+        DatagramMetadata result;
+        int64_t ts_nbo;
+        uint16_t family_nbo;
+        uint16_t port_nbo;
+        memcpy(&ts_nbo, buffer, 8);
+        memcpy(&family_nbo, buffer + 8, 2);
+        memcpy(&port_nbo, buffer + 10, 2);
+        memcpy(result.addr, buffer + 12, 16);
+        result.timestamp_ns = boost::endian::big_to_native(ts_nbo);
+        result.family = boost::endian::big_to_native(family_nbo);
+        result.port = boost::endian::big_to_native(port_nbo);
+        return result;
+    }
+};
@@ -10,6 +10,7 @@
 #include "config.hpp"
 #include "buffer_queue.hpp"
 #include "stats.hpp"
+#include "datagram_destination.hpp"
 /**
  * @brief Abstract base class for datagram sources.
  */
@@ -24,6 +25,28 @@ public:
      */
     virtual void copy_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) = 0;
 
+    /**
+     * @brief Copy datagrams from the source directly to the destination without an intermediate BufferQueue,
+     *        if both support it, until an EOF is encountered or force_eof() is called. Runs in a single thread.
+     *
+     * @param destination        The destination to copy to.
+     * @param stats              The threadsafe source stats object to update with real-time progress.
+     * @param buffer_stats       The threadsafe stats object to update with datagram counts, in place of the BufferQueue.
+     * @param destination_stats  The threadsafe destination stats object passed to the destination.
+     *
+     * @return bool  false if a direct copy is not possible; nothing has been copied and copy_to_buffer_queue()
+     *               should be used instead. true if the direct copy has been completed.
+     */
+    virtual bool copy_direct_to_destination(
+            DatagramDestination& /*destination*/,
+            LockableDgSourceStats& /*stats*/,
+            LockableDgBufferStats& /*buffer_stats*/,
+            LockableDgDestinationStats& /*destination_stats*/
+        )
+    {
+        return false;
+    }
+
     /**
      * @brief Force an EOF condition on the source as soon as possible. This method will be called from a different
      *        thread than copy_to_buffer_queue(). This method will be called when an asynchronous signal is received
@@ -0,0 +1,379 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <boost/log/trivial.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "addrinfo.hpp"
+#include "buffer_queue.hpp"
+#include "datagram_destination.hpp"
+#include "datagram_metadata.hpp"
+#include "sender_table.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "object_closer.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Datagram Destination that splits datagrams by sender into separate outputs, named by expanding a
+ *        template with the sender address and port. Requires metadata to be enabled (--metadata), since the
+ *        sender is taken from each datagram's metadata header.
+ *
+ * Path format: "demux://<template>[?strip=1][&max=<max-outputs>]". In the template, "{addr}" is replaced by
+ * the sender's numeric address and "{port}" by its port ("unknown" and 0 if the sender is not known). If the
+ * expanded template begins with "udp://<host>:<port>", each sender's datagrams are sent to that UDP address;
+ * otherwise they are written to that file in the usual length-prefixed format, keeping the metadata header
+ * unless strip=1 is given. Senders beyond the first max (default 1024) are counted and discarded. A file template
+ * must contain both "{addr}" and "{port}", so that every sender has its own file; a UDP template must contain at
+ * least one of them.
+ *
+ * For example: "demux://capture-{addr}-{port}.dgs" or "demux://udp://10.0.0.9:{port}".
+ */
+class DemuxDatagramDestination : public DatagramDestination {
+private:
+    /**
+     * @brief A single per-sender output: either a buffered capture file or a connected UDP socket.
+     */
+    class Output {
+    public:
+        std::string path;
+        int fd = -1;
+        bool is_udp = false;
+        bool keep_metadata = false;
+        std::vector<char> buffer;      // Pending file output
+
+        Output(const DgCatConfig& config, const std::string& path, bool keep_metadata) :
+            path(path),
+            keep_metadata(keep_metadata)
+        {
+            if (path.compare(0, 6, "udp://") == 0) {
+                is_udp = true;
+                connect_udp(path.substr(6));
+            } else {
+                std::string filename = path;
+                if (filename.compare(0, 7, "file://") == 0) {
+                    filename.erase(0, 7);
+                }
+                int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (config.append ? O_APPEND : O_TRUNC);
+                fd = ::open(filename.c_str(), flags, 0644);
+                if (fd == -1) {
+                    throw std::runtime_error("Failed to open file: " + filename + ": " + strerror(errno));
+                }
+            }
+        }
+
+        Output(const Output&) = delete;
+        Output& operator=(const Output&) = delete;
+
+        ~Output() {
+            if (fd != -1) {
+                ::close(fd);
+            }
+        }
+
+        /**
+         * @brief Send or buffer one datagram, whose payload is the whole of a slice of the consumer's batch.
+         *        Returns false if a UDP receiver refused it.
+         */
+        bool put(const char *metadata_buffer, const BufferQueue::ConsumerBatch& payload, size_t max_write_size) {
+            if (is_udp) {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = (struct iovec *)payload.iov;
+                msg.msg_iovlen = payload.n_iov;
+                if (sendmsg(fd, &msg, 0) < 0) {
+                    if (errno == ECONNREFUSED) {
+                        return false;
+                    }
+                    throw std::system_error(errno, std::system_category(), "send() to " + path + " failed");
+                }
+                return true;
+            }
+            size_t nb_metadata = (keep_metadata && metadata_buffer != nullptr) ? METADATA_LEN : 0;
+            uint32_t nbo_prefix = htonl((uint32_t)(nb_metadata + payload.n));
+            const char *prefix = (const char *)&nbo_prefix;
+            buffer.insert(buffer.end(), prefix, prefix + PREFIX_LEN);
+            if (nb_metadata != 0) {
+                buffer.insert(buffer.end(), metadata_buffer, metadata_buffer + nb_metadata);
+            }
+            for (size_t i = 0; i < payload.n_iov; ++i) {
+                const char *p = (const char *)payload.iov[i].iov_base;
+                buffer.insert(buffer.end(), p, p + payload.iov[i].iov_len);
+            }
+            if (buffer.size() >= max_write_size) {
+                flush();
+            }
+            return true;
+        }
+
+        void flush() {
+            size_t pos = 0;
+            while (pos < buffer.size()) {
+                ssize_t nb = ::write(fd, buffer.data() + pos, buffer.size() - pos);
+                if (nb < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw std::system_error(errno, std::system_category(), "write() to " + path + " failed");
+                }
+                pos += (size_t)nb;
+            }
+            buffer.clear();
+        }
+
+    protected:
+        void connect_udp(const std::string& host_and_port) {
+            size_t colon_pos = host_and_port.rfind(':');
+            if (colon_pos == std::string::npos) {
+                throw std::runtime_error("Invalid UDP destination address format: " + path);
+            }
+            std::string addr_s = host_and_port.substr(0, colon_pos);
+            std::string port_s = host_and_port.substr(colon_pos + 1);
+            AddrInfoList addrinfo_list(addr_s.c_str(), port_s.c_str(), AI_PASSIVE, AF_UNSPEC, SOCK_DGRAM);
+            for (auto ai = addrinfo_list.begin(); ai != addrinfo_list.end(); ++ai) {
+                auto& entry = *ai;
+                fd = socket(entry->ai_family, entry->ai_socktype | SOCK_CLOEXEC, entry->ai_protocol);
+                if (fd == -1) {
+                    continue;
+                }
+                if (connect(fd, entry->ai_addr, entry->ai_addrlen) == 0) {
+                    return;
+                }
+                ::close(fd);
+                fd = -1;
+            }
+            throw std::runtime_error("Could not connect socket to any resolved addresses for " + path);
+        }
+    };
+
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _template;
+    bool _strip_metadata = false;
+    bool _closed = false;
+    SenderTable<std::unique_ptr<Output>> _outputs;
+    DgDestinationStats _stats;
+
+public:
+    DemuxDatagramDestination(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path),
+        _outputs(DEFAULT_DEMUX_MAX_OUTPUTS)
+    {
+        std::map<std::string, std::string> args;
+        _template = parse_path_args(path, "demux://", args);
+        size_t max_outputs = DEFAULT_DEMUX_MAX_OUTPUTS;
+        for (auto& arg : args) {
+            if (arg.first == "strip") {
+                _strip_metadata = std::stoul(arg.second) != 0;
+            } else if (arg.first == "max") {
+                max_outputs = std::stoul(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to demux://: " + arg.first);
+            }
+        }
+        if (!_config.metadata) {
+            throw std::runtime_error("demux:// requires --metadata, so that sender addresses are captured");
+        }
+        if (_template.empty()) {
+            throw std::runtime_error("Output template required for demux:// destination: " + path);
+        }
+        bool has_addr = _template.find("{addr}") != std::string::npos;
+        bool has_port = _template.find("{port}") != std::string::npos;
+        if (_template.compare(0, 6, "udp://") == 0) {
+            if (!has_addr && !has_port) {
+                throw std::runtime_error("demux:// UDP template must contain {addr} or {port}: " + _template);
+            }
+        } else if (!has_addr || !has_port) {
+            // Otherwise two senders would truncate and interleave writes to the same file
+            throw std::runtime_error("demux:// file template must contain both {addr} and {port}: " + _template);
+        }
+        _outputs = SenderTable<std::unique_ptr<Output>>(max_outputs);
+    }
+
+    ~DemuxDatagramDestination() override {
+        close();
+    }
+
+    /**
+     * @brief factory-invoked static method to create a DemuxDatagramDestination
+     *
+     * @param config   The configuration object
+     * @param path     The path to the destination
+     *
+     * @return unique_ptr<DatagramDestination>
+     */
+    static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<DemuxDatagramDestination>(config, path);
+    }
+
+    /**
+     * @brief Copy datagrams from the BufferQueue to their per-sender outputs until an EOF is encountered.
+     *        Buffered file output is flushed when the input is idle for DEFAULT_POLLING_INTERVAL, and at EOF.
+     *
+     * @param buffer_queue The buffer queue to read datagrams from.
+     * @param stats        The threadsafe stats object to update with real-time progress.
+     */
+    void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
+        ObjectCloser closer(this);  // close all outputs before returning
+        auto idle_interval = std::chrono::nanoseconds(static_cast<int64_t>(DEFAULT_POLLING_INTERVAL * 1e9));
+
+        size_t n_min = PREFIX_LEN;
+        while (true) {
+            auto deadline = std::chrono::steady_clock::now() + idle_interval;
+            BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(deadline, n_min);
+            size_t n_consumed = 0;
+            while (batch.n >= PREFIX_LEN) {
+                uint32_t nbo_prefix;
+                batch.peek(0, &nbo_prefix, PREFIX_LEN);
+                size_t nb_record = ntohl(nbo_prefix);
+                if (batch.n - PREFIX_LEN < nb_record) {
+                    break;
+                }
+                if (nb_record < METADATA_LEN) {
+                    throw std::runtime_error("Datagram record too short to contain metadata: " + std::to_string(nb_record) + " bytes");
+                }
+                char metadata_buffer[METADATA_LEN];
+                batch.peek(PREFIX_LEN, metadata_buffer, METADATA_LEN);
+                batch.remove_bytes(PREFIX_LEN + METADATA_LEN);
+                size_t nb_payload = nb_record - METADATA_LEN;
+                // The payload is passed to the output in place, as a slice of the batch
+                BufferQueue::ConsumerBatch payload = batch;
+                payload.limit_size(nb_payload);
+                batch.remove_bytes(nb_payload);
+
+                Output *output = output_for(metadata_buffer);
+                if (output == nullptr) {
+                    _stats.n_datagrams_unrouted++;
+                } else if (output->put(metadata_buffer, payload, _config.max_write_size)) {
+                    if (output->is_udp) {
+                        _stats.n_datagrams_sent++;
+                    }
+                } else {
+                    _stats.n_datagrams_refused++;
+                }
+
+                n_consumed += PREFIX_LEN + nb_record;
+            }
+            buffer_queue.consumer_commit_batch(n_consumed);
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats = _stats;
+            }
+
+            if (n_consumed == 0) {
+                if (batch.n >= PREFIX_LEN) {
+                    // Wait for the rest of a partially buffered datagram
+                    uint32_t nbo_prefix;
+                    batch.copy_and_remove_bytes(&nbo_prefix, PREFIX_LEN);
+                    n_min = PREFIX_LEN + ntohl(nbo_prefix);
+                }
+                if (buffer_queue.is_eof()) {
+                    // EOF is only set after the final datagram, so the queue can no longer grow
+                    auto final_batch = buffer_queue.consumer_start_batch(0);
+                    if (final_batch.n < n_min) {
+                        if (final_batch.n != 0) {
+                            BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
+                        }
+                        break;
+                    }
+                    continue;
+                }
+                // Input is idle; don't hold on to buffered output
+                flush_all();
+            } else {
+                n_min = PREFIX_LEN;
+            }
+        }
+        flush_all();
+    }
+
+    /**
+     * @brief Flush and close all outputs. Flushing is best-effort: after an error elsewhere (e.g., on an exception
+     *        exit), a failed flush is logged rather than thrown, and the remaining outputs are still flushed.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_closed) {
+            _closed = true;
+            for (auto& entry : _outputs.entries()) {
+                if (entry.value && !entry.value->buffer.empty()) {
+                    try {
+                        entry.value->flush();
+                    } catch (const std::exception& e) {
+                        BOOST_LOG_TRIVIAL(error) << "Discarding " << entry.value->buffer.size() << " buffered bytes for "
+                                                 << entry.value->path << ": " << e.what() << "\n";
+                    }
+                }
+                entry.value.reset();
+            }
+        }
+    }
+
+protected:
+    /**
+     * @brief Find the output for a datagram's sender, opening it if this is a new sender.
+     *
+     * @return Output*  The output, or nullptr if the sender is new and the output limit has been reached.
+     */
+    Output *output_for(const char *metadata_buffer) {
+        auto metadata = DatagramMetadata::decode(metadata_buffer);
+        SenderKey key(metadata);
+        bool inserted;
+        auto value = _outputs.find_or_insert(key, inserted);
+        if (value == nullptr) {
+            if (_stats.n_datagrams_unrouted == 0) {
+                BOOST_LOG_TRIVIAL(warning) << "demux:// output limit of " << _outputs.max_entries() << " reached; discarding datagrams from new senders\n";
+            }
+            return nullptr;
+        }
+        if (inserted) {
+            std::string output_path = expand_template(metadata);
+            BOOST_LOG_TRIVIAL(debug) << "Opening demux output " << output_path << " for sender " << metadata.sender_string() << "\n";
+            *value = std::make_unique<Output>(_config, output_path, !_strip_metadata);
+            _stats.n_outputs++;
+        }
+        return value->get();
+    }
+
+    std::string expand_template(const DatagramMetadata& metadata) const {
+        std::string addr = metadata.has_sender() ? metadata.sender_addr_string() : std::string("unknown");
+        std::string port = std::to_string(metadata.port);
+        std::string result;
+        size_t pos = 0;
+        while (pos < _template.size()) {
+            if (_template.compare(pos, 6, "{addr}") == 0) {
+                result += addr;
+                pos += 6;
+            } else if (_template.compare(pos, 6, "{port}") == 0) {
+                result += port;
+                pos += 6;
+            } else {
+                result += _template[pos++];
+            }
+        }
+        return result;
+    }
+
+    void flush_all() {
+        for (auto& entry : _outputs.entries()) {
+            if (entry.value && !entry.value->is_udp && !entry.value->buffer.empty()) {
+                entry.value->flush();
+            }
+        }
+    }
+};
@@ -8,10 +8,14 @@
 #include "version.hpp"
 #include "constants.hpp"
 #include "config.hpp"
+#include "cgroup_limits.hpp"
 #include "timespec_math.hpp"
+#include "tsc_clock.hpp"
 #include "util.hpp"
 #include "addrinfo.hpp"
+#include "datagram_metadata.hpp"
 #include "buffer_queue.hpp"
+#include "mapped_capture_file.hpp"
 #include "stats.hpp"
 #include "datagram_source.hpp"
 #include "datagram_destination.hpp"
@@ -5,19 +5,48 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "buffer_queue.hpp"
 #include "config.hpp"
 #include "stats.hpp"
 #include "object_closer.hpp"
+#include "group_commit_syncer.hpp"
+#include "mapped_file_writer.hpp"
+#include "framing_codec.hpp"
+#include "util.hpp"
 
 /**
  * @brief Datagram Destination that writes to a file.
+ *
+ * Path format: "[file://]<filename>[?<arg>=<value>[&...]]", or "-" / "stdout". Arguments:
+ *
+ *     durability=<policy>   When written data is synced to stable storage by a background thread:
+ *                           "none" (default; only when the output is closed), "interval:<duration>"
+ *                           (e.g., "interval:100ms") or "bytes:<size>" (e.g., "bytes:64M"). Requires a
+ *                           regular file.
+ *     mmap=1                Write through a sliding shared memory-mapped window rather than write()/writev(),
+ *                           extending the file one window at a time, so batches cost no system calls until
+ *                           a window fills. Requires a regular file on a local filesystem.
+ *     window=<size>         With mmap, the size of the mapped window (e.g., "256M"). Default 64M.
+ *     framing=<codec>       How datagrams are delimited in the output (see FramingType): be16, be32 (default),
+ *                           be64, le16, le32, le64, varint, or raw. Anything but be32 (the BufferQueue's own
+ *                           format, which is written without copying) is converted a batch at a time. raw
+ *                           cannot be combined with metadata.
+ *
+ * A file output can be rotated while copying (see request_rotate()): once the records queued before the request
+ * have been written, the current file is synced and closed, and the path is reopened for appending, so an external
+ * tool can rename the file away and then request a rotation without losing or splitting datagrams.
  */
 class FileDatagramDestination : public DatagramDestination {
 private:
@@ -27,6 +56,17 @@ private:
     std::string _filename;
     int _fd;
     bool _closed = false;
+    DurabilityPolicy _durability;
+    bool _mmap = false;
+    size_t _window_size = DEFAULT_MMAP_WINDOW_SIZE;
+    std::atomic<bool> _rotate_requested{false};
+    std::atomic<uint64_t> _rotate_pos{0};      // Queue position (a record boundary) at which to rotate
+    FramingType _framing = FramingType::BE32;
+    FramingEncoder _encoder;                   // Converts records if not be32
+    std::vector<char> _encoded;                // Converted output for one batch; only used if not be32
+
+    // Converts a batch into _encoded with the codec for _framing (see encode_batch()). nullptr for be32.
+    size_t (FileDatagramDestination::*_encode_batch)(const BufferQueue::ConsumerBatch& batch) = nullptr;
 
 public:
     FileDatagramDestination(const DgCatConfig& config, const std::string& path) :
@@ -35,24 +75,44 @@ public:
         _fd(-1)
     {
         ObjectCloser fd_closer(this);
-        if (_path == "-" || _path == "stdout") {
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(_path, "file://", args);
+        for (auto& arg : args) {
+            if (arg.first == "durability") {
+                _durability = DurabilityPolicy::parse(arg.second);
+            } else if (arg.first == "mmap") {
+                _mmap = std::stoul(arg.second) != 0;
+            } else if (arg.first == "window") {
+                _window_size = parse_byte_size(arg.second);
+                if (_window_size == 0) {
+                    throw std::runtime_error("mmap window size must be positive: " + arg.second);
+                }
+            } else if (arg.first == "framing") {
+                _framing = parse_framing_type(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to file://: " + arg.first);
+            }
+        }
+        if (_framing == FramingType::RAW && _config.metadata) {
+            throw std::runtime_error("Unframed (raw) output cannot carry metadata");
+        }
+        if (_framing != FramingType::BE32) {
+            _encoded.resize(FramingEncoder::max_encoded_len(_config.max_write_size));
+            with_framing_codec(_framing, [this](auto codec) {
+                _encode_batch = &FileDatagramDestination::encode_batch<decltype(codec)>;
+            });
+        }
+        if (_filename == "-" || _filename == "stdout") {
             _filename = "stdout";
             // duplicate the file descriptor for stdout so it can be closed without affecting the original
             _fd = dup(STDOUT_FILENO);
         } else {
-            _filename = _path;
-            if (_filename.compare(0, 7, "file://") == 0) {
-                _filename.erase(0, 7);
-            }
-            int oflags;
-            if (_config.append) {
-                oflags = O_WRONLY | O_CREAT | O_APPEND;
-            } else {
-                oflags = O_WRONLY | O_CREAT | O_TRUNC;
-            }
-            _fd = ::open(_filename.c_str(), oflags, 0666);
-            if (_fd == -1) {
-                throw std::runtime_error("Failed to open file: " + path + ": " + strerror(errno));
+            _fd = open_output(_config.append);
+        }
+        if (_durability.mode != DurabilityPolicy::Mode::NONE || _mmap) {
+            struct stat st;
+            if (fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                throw std::runtime_error(std::string(_mmap ? "mmap" : "durability") + " requires a regular file: " + path);
             }
         }
         fd_closer.detach();
@@ -72,38 +132,104 @@ public:
      */
     void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
         ObjectCloser fd_closer(this);  // close the file descriptor before returning
+        std::unique_ptr<MappedFileWriter> mapped_writer;  // Declared after fd_closer, so unmapped before the close
+        if (_mmap) {
+            struct stat st;
+            if (fstat(_fd, &st) != 0) {
+                throw std::system_error(errno, std::system_category(), "fstat() failed");
+            }
+            mapped_writer = std::make_unique<MappedFileWriter>(_fd, _window_size, (uint64_t)st.st_size);
+        }
+        std::unique_ptr<GroupCommitSyncer> syncer;  // Declared after fd_closer, so stopped before the close
+        if (_durability.mode != DurabilityPolicy::Mode::NONE) {
+            syncer = std::make_unique<GroupCommitSyncer>(_fd, _durability);
+        }
+        DgDestinationStats local_stats;
+        auto publish_time = std::chrono::steady_clock::now();
         bool done = false;
         while (!done) {
             BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(1, _config.max_write_size);
+            if (_rotate_requested.load(std::memory_order_relaxed)) {
+                uint64_t consumed_pos = buffer_queue.consumed_pos();
+                uint64_t rotate_pos = _rotate_pos.load();
+                if (consumed_pos < rotate_pos) {
+                    // Batches end at arbitrary bytes; write up to the boundary so that no record is split between files
+                    batch.limit_size((size_t)std::min(rotate_pos - consumed_pos, (uint64_t)batch.n));
+                } else if (_rotate_requested.exchange(false)) {
+                    rotate(mapped_writer, syncer, local_stats);
+                    std::lock_guard<std::mutex> lock(stats._mutex);
+                    stats = local_stats;
+                }
+            }
             const struct iovec *iov = batch.iov;
             size_t n_iovecs = batch.n_iov;
             if (n_iovecs == 0) {
-                if (buffer_queue.is_eof()) {
+                // An empty batch at eof is the end, unless it is a wakeup (e.g., to rotate) while paused
+                if (buffer_queue.is_eof() && !buffer_queue.is_consumer_paused()) {
                     done = true;
                 }
                 continue;
             }
+            struct iovec encoded_iov;
+            if (_encode_batch) {
+                encoded_iov.iov_base = _encoded.data();
+                encoded_iov.iov_len = (this->*_encode_batch)(batch);
+                iov = &encoded_iov;
+                n_iovecs = 1;
+            }
 
-            if (n_iovecs == 1) {
-                ssize_t ret = write(_fd, iov[0].iov_base, iov[0].iov_len);
+            ssize_t ret;
+            if (mapped_writer) {
+                ret = (ssize_t)mapped_writer->write(iov, n_iovecs);
+            } else if (n_iovecs == 1) {
+                ret = write(_fd, iov[0].iov_base, iov[0].iov_len);
                 if (ret < 0) {
                     throw std::system_error(errno, std::system_category(), "write() failed");
                 }
             } else {
-                ssize_t ret = writev(_fd, iov, n_iovecs);
+                ret = writev(_fd, iov, n_iovecs);
                 if (ret < 0) {
                     throw std::system_error(errno, std::system_category(), "writev() failed");
                 }
             }
             buffer_queue.consumer_commit_batch(batch.n);
 
-
-            {
-                // update stats here
-                // std::lock_guard<std::mutex> lock(stats._mutex);
+            if (syncer) {
+                syncer->add_written((size_t)ret);
+                auto now = std::chrono::steady_clock::now();
+                if (now - publish_time >= std::chrono::duration<double>(DEFAULT_SYNC_STATS_PUBLISH_SECS)) {
+                    publish_time = now;
+                    syncer->get_stats(local_stats);
+                    std::lock_guard<std::mutex> lock(stats._mutex);
+                    stats = local_stats;
+                }
             }
         }
+        if (syncer) {
+            syncer->stop();
+        }
+        if (mapped_writer) {
+            mapped_writer->finish();
+            BOOST_LOG_TRIVIAL(debug) << "Mapped output used " << mapped_writer->n_windows() << " windows of "
+                                     << mapped_writer->window_size() << " bytes\n";
+        }
         fsync(_fd);
+        if (syncer) {
+            syncer->get_stats(local_stats);
+            std::lock_guard<std::mutex> lock(stats._mutex);
+            stats = local_stats;
+        }
+    }
+
+    bool request_rotate(BufferQueue& buffer_queue) override {
+        if (_filename == "stdout") {
+            return false;
+        }
+        // Everything queued so far is whole records, so the current end of the queue is a safe place to switch files
+        _rotate_pos.store(buffer_queue.produced_pos());
+        _rotate_requested.store(true);
+        buffer_queue.consumer_wakeup();
+        return true;
     }
 
     /**
@@ -131,4 +257,69 @@ public:
     static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
         return std::make_unique<FileDatagramDestination>(config, path);
     }
+
+protected:
+    /**
+     * @brief Convert a batch of the BufferQueue to the output framing in _encoded, returning its length.
+     *        Instantiated once per framing codec.
+     */
+    template <typename Codec>
+    size_t encode_batch(const BufferQueue::ConsumerBatch& batch) {
+        size_t n_out = 0;
+        for (size_t i = 0; i < batch.n_iov; ++i) {
+            n_out += _encoder.encode<Codec>((const char *)batch.iov[i].iov_base, batch.iov[i].iov_len, _encoded.data() + n_out);
+        }
+        return n_out;
+    }
+
+    int open_output(bool append) {
+        int oflags;
+        if (_mmap) {
+            // A shared writable mapping requires the file to be open for reading as well
+            oflags = append ? (O_RDWR | O_CREAT) : (O_RDWR | O_CREAT | O_TRUNC);
+        } else if (append) {
+            oflags = O_WRONLY | O_CREAT | O_APPEND;
+        } else {
+            oflags = O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        int fd = ::open(_filename.c_str(), oflags, 0666);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file: " + _path + ": " + strerror(errno));
+        }
+        return fd;
+    }
+
+    /**
+     * @brief Finish, sync and close the current file, and reopen the path for appending. Called from the copying
+     *        thread between writes.
+     */
+    void rotate(std::unique_ptr<MappedFileWriter>& mapped_writer, std::unique_ptr<GroupCommitSyncer>& syncer, DgDestinationStats& local_stats) {
+        if (syncer) {
+            syncer->stop();
+            syncer->get_stats(local_stats);
+        }
+        if (mapped_writer) {
+            mapped_writer->finish();
+            mapped_writer.reset();
+        }
+        fsync(_fd);
+        int fd = open_output(true);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ::close(_fd);
+            _fd = fd;
+        }
+        if (_mmap) {
+            struct stat st;
+            if (fstat(_fd, &st) != 0) {
+                throw std::system_error(errno, std::system_category(), "fstat() failed");
+            }
+            mapped_writer = std::make_unique<MappedFileWriter>(_fd, _window_size, (uint64_t)st.st_size);
+        }
+        if (syncer) {
+            syncer->reopen(_fd);
+        }
+        local_stats.n_rotations++;
+        BOOST_LOG_TRIVIAL(info) << "Reopened output file " << _filename << "\n";
+    }
 };
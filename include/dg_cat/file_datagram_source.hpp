@@ -9,6 +9,10 @@
 #include "buffer_queue.hpp"
 #include "config.hpp"
 #include "timespec_math.hpp"
+#include "datagram_metadata.hpp"
+#include "mapped_capture_file.hpp"
+#include "framing_codec.hpp"
+#include "util.hpp"
 
 #include <boost/endian/conversion.hpp>
 #include <boost/log/trivial.hpp>
@@ -19,16 +23,38 @@
 #include <condition_variable>
 #include <memory>
 #include <string>
+#include <map>
 #include <cassert>
+#include <chrono>
 
 #include <arpa/inet.h>
 //#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <time.h>
 
 /**
  * @brief Datagram source that reads from a file or pipe.
+ *
+ * Path format: "[file://]<filename>[?<arg>=<value>[&...]]", or "-"/"stdin". Arguments:
+ *
+ *     preload=1         Map and index the whole capture before replaying it from memory.
+ *     lock=1            With preload, lock the capture into memory with mlock().
+ *     loop=<n>          Replay the capture n times (0 means indefinitely). Implies preload. Default 1.
+ *     seq_offset=<off>  Offset within each datagram of an unsigned big-endian sequence field that is
+ *                       advanced by the number of datagrams in the capture on each successive loop.
+ *     seq_width=<n>     Width of the sequence field in bytes (1, 2, 4, or 8). Default 4.
+ *     follow=1          At EOF, wait (with inotify) for the file to grow and keep reading, like "tail -f".
+ *                       If the file is truncated, reading restarts at the beginning; if it is replaced
+ *                       (e.g., rotated by rename), the rest of the old file is read before switching to the
+ *                       new one. A partial datagram left at the end of a truncated or replaced file is
+ *                       discarded. Only force_eof() ends the stream.
+ *     framing=<codec>   How datagrams are delimited in the stream (see FramingType): be16, be32 (default),
+ *                       be64, le16, le32, le64, varint, or raw. raw cannot be combined with metadata or preload.
  */
 class FileDatagramSource : public DatagramSource {
 private:
@@ -43,37 +69,103 @@ private:
     std::vector<char> _buffer;
     std::vector<struct mmsghdr> _msgs;
     std::vector<struct iovec> _iovs;
+    std::vector<DatagramMetadata> _metadata;   // Only used if metadata is enabled
+    std::unique_ptr<MappedCaptureFile> _capture;  // Only used if the capture is preloaded
+    uint64_t _n_loops = 1;                     // Number of times to replay a preloaded capture. 0 means forever.
+    size_t _seq_offset = 0;
+    size_t _seq_width = 0;                     // 0 means no sequence field rewriting
+    bool _follow = false;                      // Wait for the file to grow at EOF
+    int _inotify_fd = -1;                      // Only used if following
+    int _file_wd = -1;                         // inotify watch on the file being read
+    int _eof_event_fd = -1;                    // Signalled by force_eof() to wake a follower waiting for growth
+    FramingType _framing = FramingType::BE32;
+    size_t _min_record_len = PREFIX_LEN;       // Smallest number of stream bytes in one record with _framing
+
+    // Parses complete records in _buffer with the codec for _framing (see parse_records())
+    size_t (FileDatagramSource::*_parse_records)(size_t n_read, size_t& i_next_datagram, size_t& n_min) =
+        &FileDatagramSource::parse_records<Be32FramingCodec>;
+
+    enum class FollowResult {
+        RETRY,      // The file has grown; read again from the current position
+        RESTART,    // The file was truncated or replaced; discard any partial datagram and read from the start
+        STOP,       // force_eof() was called
+    };
 
 public:
     FileDatagramSource(const DgCatConfig& config, const std::string& path) :
         _config(config),
         _path(path),
-        _buffer(config.max_read_size),
-        _msgs(config.max_read_size / PREFIX_LEN),
-        _iovs(config.max_read_size / PREFIX_LEN)
+        _buffer(config.max_read_size)
     {
-        _filename = _path;
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(_path, "file://", args);
+        bool preload = false;
+        bool lock = false;
+        bool seq_offset_given = false;
+        size_t seq_width = 4;
+        for (auto& arg : args) {
+            if (arg.first == "preload") {
+                preload = std::stoul(arg.second) != 0;
+            } else if (arg.first == "lock") {
+                lock = std::stoul(arg.second) != 0;
+            } else if (arg.first == "loop") {
+                _n_loops = std::stoull(arg.second);
+                preload = true;
+            } else if (arg.first == "seq_offset") {
+                _seq_offset = std::stoul(arg.second);
+                seq_offset_given = true;
+            } else if (arg.first == "seq_width") {
+                seq_width = std::stoul(arg.second);
+                if (seq_width != 1 && seq_width != 2 && seq_width != 4 && seq_width != 8) {
+                    throw std::runtime_error("Invalid seq_width (must be 1, 2, 4, or 8): " + arg.second);
+                }
+            } else if (arg.first == "follow") {
+                _follow = std::stoul(arg.second) != 0;
+            } else if (arg.first == "framing") {
+                _framing = parse_framing_type(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to file://: " + arg.first);
+            }
+        }
+        if (seq_offset_given) {
+            _seq_width = seq_width;
+        }
+
+        if (_follow && preload) {
+            throw std::runtime_error("Cannot follow a preloaded capture");
+        }
+        if (_framing == FramingType::RAW && (preload || _config.metadata)) {
+            throw std::runtime_error("Unframed (raw) input cannot be preloaded or carry metadata");
+        }
+        with_framing_codec(_framing, [this](auto codec) {
+            typedef decltype(codec) Codec;
+            _min_record_len = Codec::MIN_RECORD_LEN;
+            _parse_records = &FileDatagramSource::parse_records<Codec>;
+        });
 
         if (_filename == "-" || _filename == "stdin") {
+            if (preload) {
+                throw std::runtime_error("Cannot preload stdin");
+            }
+            if (_follow) {
+                throw std::runtime_error("Cannot follow stdin");
+            }
             _filename = "stdin";
             // duplicate the file descriptor for stdin so it can be closed without affecting the original
             _fd = dup(STDIN_FILENO);
+        } else if (preload) {
+            _capture = std::make_unique<MappedCaptureFile>(_filename, _config.metadata, lock, _framing, _seq_width != 0, _config.bufsize);
         } else {
-            if (_filename.compare(0, 7, "file://") == 0) {
-                _filename.erase(0, 7);
-            }
             _fd = ::open(_filename.c_str(), O_RDONLY);
         }
-        if (_fd == -1) {
+        if (_fd == -1 && !_capture) {
             throw std::runtime_error("Failed to open file: " + path + ": " + strerror(errno));
         }
-
-        for (size_t i = 0; i < config.max_read_size / PREFIX_LEN; ++i) {
-            auto& msg = _msgs[i];
-            auto& iov = _iovs[i];
-            msg.msg_hdr.msg_iov = &iov;
-            msg.msg_hdr.msg_iovlen = 1;
+        if (_follow) {
+            init_follow();
         }
+
+        resize_buffer(config.max_read_size);
     }
 
     /**
@@ -92,6 +184,12 @@ public:
     ~FileDatagramSource() override
     {
         close();
+        if (_inotify_fd != -1) {
+            ::close(_inotify_fd);
+        }
+        if (_eof_event_fd != -1) {
+            ::close(_eof_event_fd);
+        }
     }
 
     /**
@@ -100,6 +198,10 @@ public:
      * @param buffer_queue The buffer queue to write datagrams to.
      */
     void copy_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) override {
+        if (_capture) {
+            copy_preloaded_to_buffer_queue(buffer_queue, stats);
+            return;
+        }
         {
             uint64_t n_datagrams = 0;
             struct timespec end_time;
@@ -107,10 +209,10 @@ public:
             time_t start_clock_time = 0;
             struct timespec *current_timeout = nullptr;
             size_t n_read = 0;
-            size_t n_min = PREFIX_LEN;
+            size_t n_min = _min_record_len;
             while (true) {
                 if (_buffer.size() < n_min) {
-                    _buffer.resize(n_min);
+                    resize_buffer(n_min);
                 }
 
                 ssize_t nb1 = ::read(_fd, _buffer.data() + n_read, _buffer.size() - n_read);
@@ -130,6 +232,22 @@ public:
                     throw std::system_error(errno, std::system_category(), "read() failed");
                 }
                 if (nb1 == 0) {
+                    if (_follow) {
+                        FollowResult result = wait_for_growth();
+                        if (result == FollowResult::RETRY) {
+                            continue;
+                        }
+                        if (result == FollowResult::RESTART) {
+                            if (n_read != 0) {
+                                BOOST_LOG_TRIVIAL(warning) << "Discarding partial datagram at end of truncated or replaced file\n";
+                            }
+                            n_read = 0;
+                            n_min = _min_record_len;
+                            continue;
+                        }
+                        BOOST_LOG_TRIVIAL(debug) << "Forced EOF while following; shutting down\n";
+                        break;
+                    }
                     if (n_read != 0) {
                         BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
                     }
@@ -141,24 +259,9 @@ public:
                     continue;
                 }
 
-                size_t n_batch_datagrams = 0;
                 size_t i_next_datagram = 0;
-                while (i_next_datagram < n_read) {
-                    uint32_t nbo_prefix;
-                    memcpy(&nbo_prefix, _buffer.data() + i_next_datagram, PREFIX_LEN);
-                    size_t nb_datagram = ntohl(nbo_prefix);
-                    _iovs[n_batch_datagrams].iov_base = _buffer.data() + i_next_datagram + PREFIX_LEN;
-                    _iovs[n_batch_datagrams].iov_len = nb_datagram;
-                    _msgs[n_batch_datagrams].msg_len = nb_datagram;
-                    if (i_next_datagram + PREFIX_LEN + nb_datagram > n_read) {
-                        break;
-                    }
-                    i_next_datagram += PREFIX_LEN + nb_datagram;
-                    ++n_batch_datagrams;
-                }
-
+                size_t n_batch_datagrams = (this->*_parse_records)(n_read, i_next_datagram, n_min);
                 if (n_batch_datagrams == 0) {
-                    n_min = _iovs[0].iov_len + PREFIX_LEN;
                     continue;
                 }
 
@@ -170,7 +273,7 @@ public:
                     BOOST_LOG_TRIVIAL(debug) << "First datagram received...\n";
                 }
 
-                buffer_queue.producer_commit_batch(_msgs.data(), n_batch_datagrams);
+                buffer_queue.producer_commit_batch(_msgs.data(), n_batch_datagrams, _config.metadata ? _metadata.data() : nullptr);
                 n_datagrams += n_batch_datagrams;
 
                 if (i_next_datagram < n_read) {
@@ -180,7 +283,7 @@ public:
                 } else {
                     n_read = 0;
                 }
-                n_min = PREFIX_LEN;
+                n_min = _min_record_len;
 
                 {
                     // update stats here
@@ -194,6 +297,151 @@ public:
         }
     }
 
+    /**
+     * @brief If the destination can send directly from a mapped capture (e.g., UDP) and the source is a regular
+     *        file, map the capture (if not already preloaded) and replay it straight from the mapping to the
+     *        destination, bypassing the BufferQueue.
+     */
+    bool copy_direct_to_destination(
+            DatagramDestination& destination,
+            LockableDgSourceStats& stats,
+            LockableDgBufferStats& buffer_stats,
+            LockableDgDestinationStats& destination_stats
+        ) override
+    {
+        if (!destination.supports_mapped_send()) {
+            return false;
+        }
+        if (!_capture) {
+            struct stat st;
+            if (_follow || _fd == -1 || _filename == "stdin" || _framing == FramingType::RAW ||
+                    fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                return false;
+            }
+            _capture = std::make_unique<MappedCaptureFile>(_filename, _config.metadata, false, _framing, _seq_width != 0, _config.bufsize);
+            ::close(_fd);
+            _fd = -1;
+        }
+        BOOST_LOG_TRIVIAL(debug) << "Replaying preloaded capture directly to destination\n";
+        DgBufferStats local_buffer_stats;
+        struct timespec end_time;
+        struct timespec start_time;
+        time_t start_clock_time = 0;
+        size_t n_capture = _capture->size();
+        // Send in chunks so that force_eof() and stats updates are handled promptly
+        size_t chunk_size = std::max(_config.max_iovecs, (size_t)1);
+        bool started = false;
+        for (uint64_t loop = 0; n_capture > 0 && (_n_loops == 0 || loop < _n_loops); ++loop) {
+            if (loop > 0 && _seq_width != 0) {
+                _capture->add_to_sequence_field(_seq_offset, _seq_width, n_capture);
+            }
+            size_t i_end;
+            for (size_t i = 0; i < n_capture; i = i_end) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (_force_eof) {
+                        BOOST_LOG_TRIVIAL(debug) << "Forced EOF; stopping replay\n";
+                        destination.finish_mapped_send(destination_stats);
+                        return true;
+                    }
+                }
+                if (!started) {
+                    clock_gettime(CLOCK_REALTIME, &start_time);
+                    start_clock_time = time(nullptr);
+                    started = true;
+                }
+                // A slow paced send returns early at the deadline, so that force_eof() is seen promptly
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DEFAULT_REPLAY_EOF_POLL_MS);
+                i_end = destination.send_mapped_datagrams(*_capture, i, std::min(i + chunk_size, n_capture), deadline, destination_stats);
+                if (i_end == i) {
+                    continue;
+                }
+                clock_gettime(CLOCK_REALTIME, &end_time);
+                for (size_t j = i; j < i_end; ++j) {
+                    local_buffer_stats.add_datagram(_capture->datagram_len(j));
+                }
+                {
+                    std::lock_guard<std::mutex> lock(buffer_stats._mutex);
+                    buffer_stats = local_buffer_stats;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(stats._mutex);
+                    stats.max_clump_size = std::max(stats.max_clump_size, i_end - i);
+                    stats.start_clock_time = start_clock_time;
+                    stats.start_time = start_time;
+                    stats.end_time = end_time;
+                }
+            }
+        }
+        destination.finish_mapped_send(destination_stats);
+        return true;
+    }
+
+    /**
+     * @brief Replay a preloaded capture from memory the configured number of times, committing datagrams
+     *        in batches of up to max_read_size bytes.
+     */
+    void copy_preloaded_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) {
+        uint64_t n_datagrams = 0;
+        struct timespec end_time;
+        struct timespec start_time;
+        time_t start_clock_time = 0;
+        size_t n_capture = _capture->size();
+        if (n_capture == 0) {
+            BOOST_LOG_TRIVIAL(debug) << "Preloaded capture is empty; EOF\n";
+            return;
+        }
+        for (uint64_t loop = 0; _n_loops == 0 || loop < _n_loops; ++loop) {
+            if (loop > 0 && _seq_width != 0) {
+                _capture->add_to_sequence_field(_seq_offset, _seq_width, n_capture);
+            }
+            BOOST_LOG_TRIVIAL(debug) << "Replaying preloaded capture, loop " << loop << "\n";
+            size_t i_next = 0;
+            while (i_next < n_capture) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (_force_eof) {
+                        BOOST_LOG_TRIVIAL(debug) << "Forced EOF; stopping replay\n";
+                        return;
+                    }
+                }
+                size_t n_batch_datagrams = 0;
+                size_t n_batch_bytes = 0;
+                while (i_next < n_capture && n_batch_datagrams < _msgs.size() && n_batch_bytes < _config.max_read_size) {
+                    size_t nb_datagram = _capture->datagram_len(i_next);
+                    _iovs[n_batch_datagrams].iov_base = (void *)_capture->datagram_data(i_next);
+                    _iovs[n_batch_datagrams].iov_len = nb_datagram;
+                    _msgs[n_batch_datagrams].msg_len = nb_datagram;
+                    if (_config.metadata) {
+                        _metadata[n_batch_datagrams] = _capture->metadata(i_next);
+                    }
+                    n_batch_bytes += PREFIX_LEN + nb_datagram;
+                    ++n_batch_datagrams;
+                    ++i_next;
+                }
+
+                clock_gettime(CLOCK_REALTIME, &end_time);
+                if (n_datagrams == 0) {
+                    start_time = end_time;
+                    start_clock_time = time(nullptr);
+
+                    BOOST_LOG_TRIVIAL(debug) << "First datagram received...\n";
+                }
+
+                buffer_queue.producer_commit_batch(_msgs.data(), n_batch_datagrams, _config.metadata ? _metadata.data() : nullptr);
+                n_datagrams += n_batch_datagrams;
+
+                {
+                    std::lock_guard<std::mutex> lock(stats._mutex);
+                    stats.max_clump_size = std::max(stats.max_clump_size, n_batch_datagrams);
+                    stats.start_clock_time = start_clock_time;
+                    stats.start_time = start_time;
+                    stats.end_time = end_time;
+                }
+            }
+        }
+    }
+
     /**
      * @brief Force an EOF condition on the source. This method will be called from a different
      *        thread than copy_to_buffer_queue().
@@ -203,6 +451,13 @@ public:
             std::unique_lock<std::mutex> lock(_mutex);
             _force_eof = true;
         }
+        if (_eof_event_fd != -1) {
+            // Wake a follower that is waiting for the file to grow
+            uint64_t one = 1;
+            if (::write(_eof_event_fd, &one, sizeof(one)) < 0) {
+                BOOST_LOG_TRIVIAL(error) << "write() to eventfd failed: " << strerror(errno) << "\n";
+            }
+        }
 
         // This will wake up the thread that is blocked on read(). It will see _force_eof and not
         // freak out about the handle being rudely closed.
@@ -228,5 +483,186 @@ public:
             _cv.notify_all();
         }
     }
+
+protected:
+    /**
+     * @brief Grow the read buffer, along with the per-datagram arrays, which must have a slot for every record
+     *        that a full buffer can hold with the current framing.
+     */
+    void resize_buffer(size_t n) {
+        _buffer.resize(n);
+        size_t max_records = with_framing_codec(_framing, [this, n](auto codec) {
+            return decltype(codec)::max_records(n, _config.bufsize);
+        });
+        if (_msgs.size() < max_records) {
+            _msgs.resize(max_records);
+            _iovs.resize(max_records);
+            if (_config.metadata) {
+                _metadata.resize(max_records);
+            }
+            for (size_t i = 0; i < max_records; ++i) {
+                _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+                _msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+    }
+
+    /**
+     * @brief Find the complete records at the start of _buffer and describe them in _msgs, _iovs and (with metadata)
+     *        _metadata. Instantiated once per framing codec, so the inner loop has no per-record dispatch.
+     *
+     * @param n_read           The number of valid bytes in _buffer
+     * @param i_next_datagram  Set to the offset of the first byte not consumed
+     * @param n_min            If no record is complete, set to the number of bytes needed to make progress
+     * @return size_t          The number of complete records found
+     */
+    template <typename Codec>
+    size_t parse_records(size_t n_read, size_t& i_next_datagram, size_t& n_min) {
+        size_t n_batch_datagrams = 0;
+        while (i_next_datagram < n_read) {
+            size_t nb_prefix;
+            size_t nb_datagram;
+            if (!Codec::decode(_buffer.data() + i_next_datagram, n_read - i_next_datagram, _config.bufsize, nb_prefix, nb_datagram)) {
+                if (n_batch_datagrams == 0) {
+                    n_min = n_read + 1;
+                }
+                break;
+            }
+            if (i_next_datagram + nb_prefix + nb_datagram > n_read) {
+                if (n_batch_datagrams == 0) {
+                    n_min = nb_prefix + nb_datagram;
+                }
+                break;
+            }
+            const char *record = _buffer.data() + i_next_datagram + nb_prefix;
+            _iovs[n_batch_datagrams].iov_base = (void *)record;
+            _iovs[n_batch_datagrams].iov_len = nb_datagram;
+            _msgs[n_batch_datagrams].msg_len = nb_datagram;
+            if (_config.metadata) {
+                // The record begins with a metadata header, which is passed separately to the queue
+                if (nb_datagram < METADATA_LEN) {
+                    throw std::runtime_error("Capture record too short to contain metadata: " + std::to_string(nb_datagram) + " bytes");
+                }
+                _metadata[n_batch_datagrams] = DatagramMetadata::decode(record);
+                _iovs[n_batch_datagrams].iov_base = (void *)(record + METADATA_LEN);
+                _iovs[n_batch_datagrams].iov_len = nb_datagram - METADATA_LEN;
+                _msgs[n_batch_datagrams].msg_len = nb_datagram - METADATA_LEN;
+            }
+            i_next_datagram += nb_prefix + nb_datagram;
+            ++n_batch_datagrams;
+        }
+        return n_batch_datagrams;
+    }
+
+    /**
+     * @brief Set up the inotify watches and eventfd used to wait for the followed file to grow. The file itself
+     *        is watched for writes, truncation, and being moved or deleted; its directory is watched for a
+     *        replacement being created or moved into place.
+     */
+    void init_follow() {
+        _eof_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_eof_event_fd == -1) {
+            throw std::system_error(errno, std::system_category(), "eventfd() failed");
+        }
+        _inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (_inotify_fd == -1) {
+            throw std::system_error(errno, std::system_category(), "inotify_init1() failed");
+        }
+        size_t slash_pos = _filename.find_last_of('/');
+        std::string dirname = (slash_pos == std::string::npos) ? "." :
+                              (slash_pos == 0) ? "/" : _filename.substr(0, slash_pos);
+        if (inotify_add_watch(_inotify_fd, dirname.c_str(), IN_CREATE | IN_MOVED_TO) == -1) {
+            throw std::system_error(errno, std::system_category(), "inotify_add_watch() failed for " + dirname);
+        }
+        watch_file();
+    }
+
+    void watch_file() {
+        _file_wd = inotify_add_watch(
+            _inotify_fd, _filename.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+        if (_file_wd == -1) {
+            throw std::system_error(errno, std::system_category(), "inotify_add_watch() failed for " + _filename);
+        }
+    }
+
+    /**
+     * @brief Called in follow mode when read() returns 0. Blocks until the file has grown past the current
+     *        position, has been truncated or replaced, or force_eof() is called.
+     *
+     * Watches are in place before the first read(), so a change made between a read() returning 0 and the
+     * wait is queued on the inotify descriptor rather than lost.
+     */
+    FollowResult wait_for_growth() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_force_eof) {
+                    return FollowResult::STOP;
+                }
+            }
+            struct stat fd_st;
+            off_t pos = (fstat(_fd, &fd_st) == 0) ? lseek(_fd, 0, SEEK_CUR) : (off_t)-1;
+            if (pos == (off_t)-1) {
+                if (errno == EBADF) {
+                    // The file handle was closed by force_eof()
+                    return FollowResult::STOP;
+                }
+                throw std::system_error(errno, std::system_category(), "fstat() failed on followed file");
+            }
+            if (fd_st.st_size > pos) {
+                return FollowResult::RETRY;
+            }
+            if (fd_st.st_size < pos) {
+                BOOST_LOG_TRIVIAL(info) << "Followed file " << _filename << " was truncated; reading from start\n";
+                if (lseek(_fd, 0, SEEK_SET) == (off_t)-1) {
+                    throw std::system_error(errno, std::system_category(), "lseek() failed on followed file");
+                }
+                return FollowResult::RESTART;
+            }
+            // At the end of the file we have open. If another file is now at the path, switch to it.
+            struct stat path_st;
+            if (stat(_filename.c_str(), &path_st) == 0 &&
+                    (path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev)) {
+                int new_fd = ::open(_filename.c_str(), O_RDONLY);
+                if (new_fd != -1) {
+                    BOOST_LOG_TRIVIAL(info) << "Followed file " << _filename << " was replaced; reopening\n";
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        if (_force_eof) {
+                            ::close(new_fd);
+                            return FollowResult::STOP;
+                        }
+                        ::close(_fd);
+                        _fd = new_fd;
+                    }
+                    inotify_rm_watch(_inotify_fd, _file_wd);
+                    watch_file();
+                    return FollowResult::RESTART;
+                }
+                if (errno != ENOENT) {
+                    throw std::system_error(errno, std::system_category(), "Failed to reopen followed file " + _filename);
+                }
+            }
+
+            struct pollfd pfds[2];
+            pfds[0].fd = _inotify_fd;
+            pfds[0].events = POLLIN;
+            pfds[1].fd = _eof_event_fd;
+            pfds[1].events = POLLIN;
+            int ret = poll(pfds, 2, -1);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "poll() failed");
+            }
+            if (pfds[0].revents & POLLIN) {
+                // Drain the queued events; the state of the file is re-examined from scratch above
+                alignas(struct inotify_event) char events[4096];
+                while (::read(_inotify_fd, events, sizeof(events)) > 0) {
+                }
+            }
+        }
+    }
 };
 
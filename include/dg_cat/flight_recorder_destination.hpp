@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <boost/log/trivial.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "buffer_queue.hpp"
+#include "config.hpp"
+#include "datagram_destination.hpp"
+#include "datagram_filter.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Datagram Destination that keeps a rolling history of recent datagrams in the BufferQueue (see
+ *        BufferQueue::arm_history()) and writes nothing until it is triggered. On a trigger, it waits for the
+ *        post-trigger window and then dumps the history plus everything received since, in one bulk write, to
+ *        a new capture file, and re-arms.
+ *
+ * Path format: "flight://<template>[?<arg>=<value>[&...]]". In the template, "{n}" is replaced by the dump
+ * number (starting at 1) and "{time}" by the UTC time of the trigger; if it contains neither, ".<n>" is
+ * appended. Arguments:
+ *
+ *     history=<size>    Maximum bytes of pre-trigger history, including length prefixes (e.g., "512M").
+ *                       Must be less than --max-backlog, which also bounds the post-trigger window. Default
+ *                       half of --max-backlog.
+ *     age=<duration>    Also discard history older than this relative to the newest datagram (e.g., "5m").
+ *                       Requires --metadata.
+ *     post=<duration>   How long to keep recording after a trigger before dumping (e.g., "30s"). Default 0.
+ *     trigger=<expr>    Trigger on a datagram that matches a filter expression (see DatagramFilter).
+ *
+ * Dumps can also be triggered with SIGUSR2, or programmatically with DatagramCopier::trigger().
+ */
+class FlightRecorderDestination : public DatagramDestination {
+private:
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _template;
+    size_t _history_bytes;
+    double _age_secs = 0.0;
+    double _post_secs = 0.0;
+    std::shared_ptr<const DatagramFilter> _trigger_filter;
+
+public:
+    FlightRecorderDestination(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path),
+        _history_bytes(config.max_backlog / 2)
+    {
+        std::map<std::string, std::string> args;
+        _template = parse_path_args(_path, "flight://", args);
+        for (auto& arg : args) {
+            if (arg.first == "history") {
+                _history_bytes = parse_byte_size(arg.second);
+                if (_history_bytes == 0 || _history_bytes >= config.max_backlog) {
+                    throw std::runtime_error("Flight recorder history must be positive and less than --max-backlog: " + arg.second);
+                }
+            } else if (arg.first == "age") {
+                _age_secs = parse_duration_secs(arg.second);
+                if (_age_secs <= 0.0) {
+                    throw std::runtime_error("Flight recorder age must be positive: " + arg.second);
+                }
+                if (!config.metadata) {
+                    throw std::runtime_error("Flight recorder age requires --metadata");
+                }
+            } else if (arg.first == "post") {
+                _post_secs = parse_duration_secs(arg.second);
+            } else if (arg.first == "trigger") {
+                _trigger_filter = std::make_shared<DatagramFilter>(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to flight://: " + arg.first);
+            }
+        }
+        if (_template.empty()) {
+            throw std::runtime_error("Missing flight recorder dump filename template: " + path);
+        }
+        if (_template.find("{n}") == std::string::npos && _template.find("{time}") == std::string::npos) {
+            _template += ".{n}";
+        }
+    }
+
+    /**
+     * @brief Record history, dumping it each time a trigger occurs, until EOF. History that has not been
+     *        dumped at EOF is discarded.
+     */
+    void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
+        DgDestinationStats local_stats;
+        // Once triggered, dump early rather than stall the producer if the backlog is about to fill
+        size_t max_record_len = PREFIX_LEN + (_config.metadata ? METADATA_LEN : 0) + _config.bufsize;
+        size_t n_dump_min = (_config.max_backlog > max_record_len) ? _config.max_backlog - max_record_len : 1;
+        while (true) {
+            buffer_queue.arm_history(_history_bytes, _age_secs, _trigger_filter);
+            if (!buffer_queue.consumer_wait_trigger()) {
+                BOOST_LOG_TRIVIAL(debug) << "EOF without a trigger; discarding flight recorder history\n";
+                break;
+            }
+            time_t trigger_time = time(nullptr);
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(_post_secs));
+            BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(deadline, n_dump_min);
+            while (batch.n == 0 && buffer_queue.is_consumer_paused()) {
+                // Paused by a control command; hold the dump until resumed
+                auto poll_deadline = std::chrono::steady_clock::now() +
+                                     std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(DEFAULT_POLLING_INTERVAL));
+                batch = buffer_queue.consumer_start_batch(poll_deadline, 1);
+            }
+
+            std::string filename = expand_template(local_stats.n_dumps + 1, trigger_time);
+            write_dump(filename, batch);
+            buffer_queue.consumer_commit_batch(batch.n);
+            BOOST_LOG_TRIVIAL(info) << "Wrote flight recorder dump " << filename << " (" << batch.n << " bytes)\n";
+
+            local_stats.n_dumps++;
+            local_stats.n_dump_bytes += batch.n;
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats = local_stats;
+            }
+            if (buffer_queue.is_eof()) {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief static factory method to create a typed DatagramDestination based on a pathname
+     *
+     * @param config   The configuration object
+     * @param path     The path to the destination
+     *
+     * @return unique_ptr<DatagramDestination>
+     */
+    static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<FlightRecorderDestination>(config, path);
+    }
+
+protected:
+    std::string expand_template(uint64_t n, time_t trigger_time) const {
+        std::string result;
+        size_t pos = 0;
+        while (pos < _template.size()) {
+            if (_template.compare(pos, 3, "{n}") == 0) {
+                result += std::to_string(n);
+                pos += 3;
+            } else if (_template.compare(pos, 6, "{time}") == 0) {
+                result += time_t_to_utc_string(trigger_time);
+                pos += 6;
+            } else {
+                result += _template[pos++];
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Write a batch (which may wrap around the end of the ring) to a new file with as few writev()
+     *        calls as possible, and sync it.
+     */
+    void write_dump(const std::string& filename, const BufferQueue::ConsumerBatch& batch) {
+        int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file: " + filename + ": " + strerror(errno));
+        }
+        struct iovec iov[2];
+        size_t n_iov = batch.n_iov;
+        for (size_t i = 0; i < n_iov; ++i) {
+            iov[i] = batch.iov[i];
+        }
+        struct iovec *next_iov = iov;
+        while (n_iov > 0) {
+            ssize_t nb = writev(fd, next_iov, (int)n_iov);
+            if (nb < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::system_category(), "writev() to " + filename + " failed");
+            }
+            // Advance past a short write
+            while (n_iov > 0 && (size_t)nb >= next_iov->iov_len) {
+                nb -= (ssize_t)next_iov->iov_len;
+                ++next_iov;
+                --n_iov;
+            }
+            if (n_iov > 0) {
+                next_iov->iov_base = (char *)next_iov->iov_base + nb;
+                next_iov->iov_len -= (size_t)nb;
+            }
+        }
+        if (fdatasync(fd) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::system_category(), "fdatasync() of " + filename + " failed");
+        }
+        if (::close(fd) != 0) {
+            throw std::system_error(errno, std::system_category(), "close() of " + filename + " failed");
+        }
+    }
+};
@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "util.hpp"
+
+#include <boost/endian/conversion.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <stdexcept>
+
+/**
+ * @brief How datagram boundaries are represented in a byte stream (file or pipe).
+ *
+ *     be16, be32, be64   2-, 4- or 8-byte big-endian (network byte order) length prefix. be32 is the native
+ *                        dg-cat capture format and the default.
+ *     le16, le32, le64   2-, 4- or 8-byte little-endian length prefix.
+ *     varint             Unsigned LEB128 length prefix (1 byte for records shorter than 128 bytes).
+ *     raw                No framing. Written records are simply concatenated; when reading, each chunk of
+ *                        data read is split into datagrams of at most the maximum datagram size.
+ *
+ * With --metadata, the length covers the metadata header as well as the payload, as in be32 captures.
+ */
+enum class FramingType {
+    BE16,
+    BE32,
+    BE64,
+    LE16,
+    LE32,
+    LE64,
+    VARINT,
+    RAW,
+};
+
+inline FramingType parse_framing_type(const std::string& s) {
+    if (s == "be16") {
+        return FramingType::BE16;
+    } else if (s == "be32") {
+        return FramingType::BE32;
+    } else if (s == "be64") {
+        return FramingType::BE64;
+    } else if (s == "le16") {
+        return FramingType::LE16;
+    } else if (s == "le32") {
+        return FramingType::LE32;
+    } else if (s == "le64") {
+        return FramingType::LE64;
+    } else if (s == "varint") {
+        return FramingType::VARINT;
+    } else if (s == "raw") {
+        return FramingType::RAW;
+    }
+    throw std::runtime_error("Invalid framing (must be be16, be32, be64, le16, le32, le64, varint, or raw): " + s);
+}
+
+/**
+ * @brief A fixed-width integer length prefix in the given byte order.
+ *
+ * Codecs are stateless and are used as template parameters of the parse and encode loops, so each framing
+ * compiles to its own specialized loop. All codecs provide:
+ *
+ *     MIN_RECORD_LEN  The smallest number of stream bytes that one record can occupy.
+ *     MAX_PREFIX_LEN  The largest number of bytes that encode() can write.
+ *     decode()        Decode the prefix at the start of n_avail bytes. Returns false if more bytes are needed.
+ *     encode()        Write the prefix for a record and return its length.
+ *     max_records()   The most records that nb stream bytes can hold.
+ */
+template <typename UInt, boost::endian::order ORDER>
+struct FixedFramingCodec {
+    static constexpr size_t MIN_RECORD_LEN = sizeof(UInt);
+    static constexpr size_t MAX_PREFIX_LEN = sizeof(UInt);
+
+    static bool decode(const char *p, size_t n_avail, size_t /*max_record_len*/, size_t& nb_prefix, size_t& nb_record) {
+        if (n_avail < sizeof(UInt)) {
+            return false;
+        }
+        UInt value;
+        memcpy(&value, p, sizeof(value));
+        value = boost::endian::conditional_reverse<ORDER, boost::endian::order::native>(value);
+        if ((uint64_t)value > 0xffffffff) {
+            throw std::runtime_error("Record length too large: " + std::to_string((uint64_t)value) + " bytes");
+        }
+        nb_prefix = sizeof(UInt);
+        nb_record = (size_t)value;
+        return true;
+    }
+
+    static size_t encode(size_t nb_record, char *p) {
+        if (nb_record > std::numeric_limits<UInt>::max()) {
+            throw std::runtime_error("Record too large for " + std::to_string(sizeof(UInt)) + "-byte length prefix: " + std::to_string(nb_record) + " bytes");
+        }
+        UInt value = boost::endian::conditional_reverse<boost::endian::order::native, ORDER>((UInt)nb_record);
+        memcpy(p, &value, sizeof(value));
+        return sizeof(UInt);
+    }
+
+    static size_t max_records(size_t nb, size_t /*max_record_len*/) {
+        return nb / sizeof(UInt);
+    }
+};
+
+typedef FixedFramingCodec<uint16_t, boost::endian::order::big> Be16FramingCodec;
+typedef FixedFramingCodec<uint32_t, boost::endian::order::big> Be32FramingCodec;
+typedef FixedFramingCodec<uint64_t, boost::endian::order::big> Be64FramingCodec;
+typedef FixedFramingCodec<uint16_t, boost::endian::order::little> Le16FramingCodec;
+typedef FixedFramingCodec<uint32_t, boost::endian::order::little> Le32FramingCodec;
+typedef FixedFramingCodec<uint64_t, boost::endian::order::little> Le64FramingCodec;
+
+/**
+ * @brief An unsigned LEB128 length prefix: 7 bits per byte, least significant first, with the high bit set on
+ *        all but the last byte. Limited to 32-bit lengths (at most 5 bytes).
+ */
+struct VarintFramingCodec {
+    static constexpr size_t MIN_RECORD_LEN = 1;
+    static constexpr size_t MAX_PREFIX_LEN = 5;
+
+    static bool decode(const char *p, size_t n_avail, size_t /*max_record_len*/, size_t& nb_prefix, size_t& nb_record) {
+        const unsigned char *up = (const unsigned char *)p;
+        uint64_t value = 0;
+        size_t n = std::min(n_avail, (size_t)MAX_PREFIX_LEN);
+        for (size_t i = 0; i < n; ++i) {
+            value |= (uint64_t)(up[i] & 0x7f) << (7 * i);
+            if ((up[i] & 0x80) == 0) {
+                if (value > 0xffffffff) {
+                    throw std::runtime_error("Record length too large: " + std::to_string(value) + " bytes");
+                }
+                nb_prefix = i + 1;
+                nb_record = (size_t)value;
+                return true;
+            }
+        }
+        if (n == MAX_PREFIX_LEN) {
+            throw std::runtime_error("Invalid varint length prefix (longer than " + std::to_string(MAX_PREFIX_LEN) + " bytes)");
+        }
+        return false;
+    }
+
+    static size_t encode(size_t nb_record, char *p) {
+        if (nb_record > 0xffffffff) {
+            throw std::runtime_error("Record too large for varint length prefix: " + std::to_string(nb_record) + " bytes");
+        }
+        unsigned char *up = (unsigned char *)p;
+        size_t i = 0;
+        while (nb_record >= 0x80) {
+            up[i++] = (unsigned char)(nb_record | 0x80);
+            nb_record >>= 7;
+        }
+        up[i++] = (unsigned char)nb_record;
+        return i;
+    }
+
+    static size_t max_records(size_t nb, size_t /*max_record_len*/) {
+        return nb;
+    }
+};
+
+/**
+ * @brief No framing. Every available byte belongs to a record of at most max_record_len bytes.
+ */
+struct RawFramingCodec {
+    static constexpr size_t MIN_RECORD_LEN = 1;
+    static constexpr size_t MAX_PREFIX_LEN = 0;
+
+    static bool decode(const char * /*p*/, size_t n_avail, size_t max_record_len, size_t& nb_prefix, size_t& nb_record) {
+        if (n_avail == 0) {
+            return false;
+        }
+        nb_prefix = 0;
+        nb_record = std::min(n_avail, max_record_len);
+        return true;
+    }
+
+    static size_t encode(size_t /*nb_record*/, char * /*p*/) {
+        return 0;
+    }
+
+    static size_t max_records(size_t nb, size_t max_record_len) {
+        // Each decode() takes all available bytes up to max_record_len
+        return nb / std::max(max_record_len, (size_t)1) + 1;
+    }
+};
+
+/**
+ * @brief Call f with a default-constructed instance of the codec for a framing type, so that f (typically a
+ *        generic lambda) is instantiated once per codec.
+ */
+template <typename F>
+inline auto with_framing_codec(FramingType framing, F&& f) -> decltype(f(Be32FramingCodec())) {
+    switch (framing) {
+    case FramingType::BE16:
+        return f(Be16FramingCodec());
+    case FramingType::BE32:
+        return f(Be32FramingCodec());
+    case FramingType::BE64:
+        return f(Be64FramingCodec());
+    case FramingType::LE16:
+        return f(Le16FramingCodec());
+    case FramingType::LE32:
+        return f(Le32FramingCodec());
+    case FramingType::LE64:
+        return f(Le64FramingCodec());
+    case FramingType::VARINT:
+        return f(VarintFramingCodec());
+    case FramingType::RAW:
+        return f(RawFramingCodec());
+    }
+    throw std::runtime_error("Invalid framing type");
+}
+
+/**
+ * @brief Converts the BufferQueue's byte stream of records (each with a PREFIX_LEN-byte big-endian length prefix)
+ *        to another framing, one chunk at a time.
+ *
+ * Consumers may take chunks of the queue at arbitrary byte boundaries, so a record (or even its prefix) can be
+ * split across chunks; the position within the current record is carried from one chunk to the next.
+ */
+class FramingEncoder {
+private:
+    char _prefix[PREFIX_LEN];
+    size_t _n_prefix = 0;                // Bytes of the current record's prefix seen so far
+    size_t _n_remaining = 0;             // Bytes of the current record's body not yet seen
+
+public:
+    /**
+     * @brief The largest total output that encode() can produce for nb bytes of input passed in one or two calls
+     *        (e.g., the two segments of a BufferQueue::ConsumerBatch).
+     */
+    static size_t max_encoded_len(size_t nb) {
+        // Each record, and one at the start of each call that began earlier, can gain a prefix of up to 8 bytes
+        return nb + (nb / PREFIX_LEN + 2) * sizeof(uint64_t);
+    }
+
+    /**
+     * @brief Convert a chunk of the queue to a codec's framing.
+     *
+     * @param data   The next chunk of the queue's byte stream
+     * @param n      The length of the chunk
+     * @param out    Receives the converted output. Must hold at least max_encoded_len(n) bytes.
+     * @return size_t  The number of bytes written to out
+     */
+    template <typename Codec>
+    size_t encode(const char *data, size_t n, char *out) {
+        size_t n_out = 0;
+        while (n > 0) {
+            if (_n_remaining == 0 && (_n_prefix != 0 || n < PREFIX_LEN)) {
+                // A prefix split across chunks
+                size_t nb = std::min(n, PREFIX_LEN - _n_prefix);
+                memcpy(_prefix + _n_prefix, data, nb);
+                _n_prefix += nb;
+                data += nb;
+                n -= nb;
+                if (_n_prefix < PREFIX_LEN) {
+                    break;
+                }
+                _n_prefix = 0;
+                _n_remaining = read_length_prefix(_prefix);
+                n_out += Codec::encode(_n_remaining, out + n_out);
+                continue;
+            }
+            if (_n_remaining == 0) {
+                _n_remaining = read_length_prefix(data);
+                data += PREFIX_LEN;
+                n -= PREFIX_LEN;
+                n_out += Codec::encode(_n_remaining, out + n_out);
+            }
+            size_t nb = std::min(n, _n_remaining);
+            memcpy(out + n_out, data, nb);
+            n_out += nb;
+            data += nb;
+            n -= nb;
+            _n_remaining -= nb;
+        }
+        return n_out;
+    }
+};
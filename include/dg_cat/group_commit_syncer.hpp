@@ -0,0 +1,221 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "histogram.hpp"
+#include "stats.hpp"
+#include "util.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <unistd.h>
+
+/**
+ * @brief When a file output is synced to stable storage, as given by a "durability=" path argument.
+ */
+struct DurabilityPolicy {
+    enum class Mode {
+        NONE,        // Only sync when the output is closed
+        INTERVAL,    // Sync written data at most interval_secs after it is written
+        BYTES,       // Sync whenever n_bytes have been written since the last sync
+    };
+
+    Mode mode = Mode::NONE;
+    double interval_secs = 0.0;
+    size_t n_bytes = 0;
+
+    /**
+     * @brief Parse "none", "interval:<duration>" (e.g., "interval:100ms") or "bytes:<size>" (e.g., "bytes:64M").
+     */
+    static DurabilityPolicy parse(const std::string& s) {
+        DurabilityPolicy policy;
+        if (s == "none") {
+            return policy;
+        }
+        size_t colon_pos = s.find(':');
+        std::string kind = s.substr(0, colon_pos);
+        std::string value = (colon_pos == std::string::npos) ? std::string() : s.substr(colon_pos + 1);
+        if (kind == "interval" && !value.empty()) {
+            policy.mode = Mode::INTERVAL;
+            policy.interval_secs = parse_duration_secs(value);
+            if (policy.interval_secs <= 0.0) {
+                throw std::runtime_error("Durability interval must be positive: " + s);
+            }
+        } else if (kind == "bytes" && !value.empty()) {
+            policy.mode = Mode::BYTES;
+            policy.n_bytes = parse_byte_size(value);
+            if (policy.n_bytes == 0) {
+                throw std::runtime_error("Durability byte count must be positive: " + s);
+            }
+        } else {
+            throw std::runtime_error("Invalid durability (must be none, interval:<duration> or bytes:<size>): " + s);
+        }
+        return policy;
+    }
+};
+
+/**
+ * @brief Background thread that group-commits a file's completed writes to stable storage with fdatasync(),
+ *        according to a DurabilityPolicy.
+ *
+ * The writer reports completed writes with add_written(); it never waits for a sync. Each fdatasync() covers
+ * every write completed before it started, so however many writes accumulate, one sync commits them all, and
+ * the amount of data that can be lost in a crash is bounded by the policy (plus one sync's latency).
+ */
+class GroupCommitSyncer {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    int _fd;
+    DurabilityPolicy _policy;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _thread;
+    bool _stop = false;
+    int _error = 0;                  // errno from a failed fdatasync(), or 0
+    uint64_t _n_written = 0;         // Bytes written by the writer
+    uint64_t _n_synced = 0;          // Bytes known to be on stable storage
+    uint64_t _n_syncs = 0;
+    uint64_t _max_unsynced_bytes = 0;
+    Histogram _sync_latency_ns;
+    std::shared_ptr<const Histogram> _sync_latency_snapshot;   // Last copy of _sync_latency_ns given to get_stats()
+    uint64_t _snapshot_n_syncs = 0;                            // _n_syncs when _sync_latency_snapshot was taken
+
+public:
+    GroupCommitSyncer(int fd, const DurabilityPolicy& policy) :
+        _fd(fd),
+        _policy(policy)
+    {
+        start();
+    }
+
+    GroupCommitSyncer(const GroupCommitSyncer&) = delete;
+    GroupCommitSyncer& operator=(const GroupCommitSyncer&) = delete;
+
+    ~GroupCommitSyncer() {
+        stop();
+    }
+
+    /**
+     * @brief Record n bytes of completed writes. Throws if a previous background sync failed.
+     */
+    void add_written(size_t n) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_error != 0) {
+            throw std::system_error(_error, std::system_category(), "fdatasync() failed");
+        }
+        _n_written += n;
+        if (_policy.mode == DurabilityPolicy::Mode::BYTES && _n_written - _n_synced >= _policy.n_bytes) {
+            _cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief Stop the background thread without a final sync. Must be called before the file is closed.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _cv.notify_all();
+        }
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    /**
+     * @brief Switch to a new file, e.g., after the output is rotated, keeping the sync stats. stop() must be
+     *        called before the old file is closed; the caller is responsible for syncing it.
+     */
+    void reopen(int fd) {
+        stop();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _fd = fd;
+            _stop = false;
+            _n_written = 0;
+            _n_synced = 0;
+        }
+        start();
+    }
+
+    /**
+     * @brief Copy the sync stats into a destination stats object. The latency histogram is only copied again
+     *        if a sync has completed since the last call.
+     */
+    void get_stats(DgDestinationStats& stats) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_sync_latency_snapshot || _snapshot_n_syncs != _n_syncs) {
+            _sync_latency_snapshot = std::make_shared<const Histogram>(_sync_latency_ns);
+            _snapshot_n_syncs = _n_syncs;
+        }
+        stats.n_syncs = _n_syncs;
+        stats.max_unsynced_bytes = _max_unsynced_bytes;
+        stats.sync_latency_ns = _sync_latency_snapshot;
+    }
+
+protected:
+    void start() {
+        if (_policy.mode != DurabilityPolicy::Mode::NONE) {
+            _thread = std::thread(&GroupCommitSyncer::run, this);
+        }
+    }
+
+    void run() {
+        auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_policy.interval_secs));
+        auto next_sync_time = Clock::now() + interval;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stop) {
+            if (_policy.mode == DurabilityPolicy::Mode::INTERVAL) {
+                _cv.wait_until(lock, next_sync_time, [this]() { return _stop; });
+                auto now = Clock::now();
+                if (now < next_sync_time) {
+                    continue;
+                }
+                next_sync_time += interval;
+                if (next_sync_time < now) {
+                    next_sync_time = now + interval;
+                }
+            } else {
+                _cv.wait(lock, [this]() { return _stop || _n_written - _n_synced >= _policy.n_bytes; });
+            }
+            if (_stop) {
+                break;
+            }
+            if (_n_written == _n_synced) {
+                continue;
+            }
+
+            uint64_t target = _n_written;
+            _max_unsynced_bytes = std::max(_max_unsynced_bytes, target - _n_synced);
+            lock.unlock();
+            auto start = Clock::now();
+            int ret = fdatasync(_fd);
+            int err = errno;
+            auto end = Clock::now();
+            lock.lock();
+            if (ret != 0) {
+                BOOST_LOG_TRIVIAL(error) << "fdatasync() failed: " << strerror(err) << "\n";
+                _error = err;
+                break;
+            }
+            _n_synced = target;
+            _n_syncs++;
+            _sync_latency_ns.record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+    }
+};
@@ -0,0 +1,161 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief A fixed-size log-linear histogram of unsigned 64-bit values (e.g., latencies in nanoseconds).
+ *
+ * Each power of 2 is split into 2^SUB_BITS linear sub-buckets, so recorded values are resolved to within 25%.
+ * Values of 2^MAX_EXP or more are counted in the last bucket. Recording is a few integer operations and no
+ * allocation, so a histogram can be updated on a hot path and copied as part of a stats object.
+ */
+class Histogram {
+public:
+    static const unsigned SUB_BITS = 2;
+    static const unsigned SUB_COUNT = 1u << SUB_BITS;
+    static const unsigned MAX_EXP = 48;          // 2^48 ns is about 3 days
+    static const unsigned N_BUCKETS = (MAX_EXP - SUB_BITS + 1) * SUB_COUNT;
+
+private:
+    std::array<uint64_t, N_BUCKETS> _buckets;
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _min;
+    uint64_t _max;
+
+public:
+    Histogram() {
+        clear();
+    }
+
+    void clear() {
+        _buckets.fill(0);
+        _count = 0;
+        _sum = 0;
+        _min = 0;
+        _max = 0;
+    }
+
+    void record(uint64_t value) {
+        _buckets[bucket_index(value)]++;
+        _min = (_count == 0) ? value : std::min(_min, value);
+        _max = std::max(_max, value);
+        _count++;
+        _sum += value;
+    }
+
+    /**
+     * @brief Record count occurrences of the same value (e.g., for a batch of datagrams that share a timestamp).
+     */
+    void record(uint64_t value, uint64_t count) {
+        if (count == 0) {
+            return;
+        }
+        _buckets[bucket_index(value)] += count;
+        _min = (_count == 0) ? value : std::min(_min, value);
+        _max = std::max(_max, value);
+        _count += count;
+        _sum += value * count;
+    }
+
+    void merge(const Histogram& other) {
+        if (other._count == 0) {
+            return;
+        }
+        for (unsigned i = 0; i < N_BUCKETS; ++i) {
+            _buckets[i] += other._buckets[i];
+        }
+        _min = (_count == 0) ? other._min : std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _count += other._count;
+        _sum += other._sum;
+    }
+
+    uint64_t count() const {
+        return _count;
+    }
+
+    uint64_t min() const {
+        return _min;
+    }
+
+    uint64_t max() const {
+        return _max;
+    }
+
+    double mean() const {
+        return (_count == 0) ? 0.0 : (double)_sum / (double)_count;
+    }
+
+    uint64_t bucket_count(unsigned i) const {
+        return _buckets[i];
+    }
+
+    /**
+     * @brief The approximate value at a percentile (0.0 to 100.0): the upper bound of the bucket containing it,
+     *        clamped to the observed range.
+     */
+    uint64_t percentile(double pct) const {
+        if (_count == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)((pct / 100.0) * (double)_count + 0.5);
+        rank = std::max(rank, (uint64_t)1);
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < N_BUCKETS; ++i) {
+            seen += _buckets[i];
+            if (seen >= rank) {
+                return std::min(std::max(bucket_upper_bound(i), _min), _max);
+            }
+        }
+        return _max;
+    }
+
+    /**
+     * @brief Summarize the histogram, scaling values by 1/divisor (e.g., 1000 to show nanoseconds as microseconds).
+     */
+    std::string brief_str(const std::string& unit, double divisor=1.0) const {
+        return std::string() +
+               "n=" + std::to_string(_count) +
+               ", mean_" + unit + "=" + std::to_string(mean() / divisor) +
+               ", p50_" + unit + "=" + std::to_string((double)percentile(50.0) / divisor) +
+               ", p99_" + unit + "=" + std::to_string((double)percentile(99.0) / divisor) +
+               ", max_" + unit + "=" + std::to_string((double)_max / divisor);
+    }
+
+    static unsigned bucket_index(uint64_t value) {
+        if (value < 2 * SUB_COUNT) {
+            return (unsigned)value;
+        }
+        unsigned exp = 63 - (unsigned)__builtin_clzll(value);
+        if (exp >= MAX_EXP) {
+            return N_BUCKETS - 1;
+        }
+        unsigned shift = exp - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + (unsigned)((value >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t bucket_lower_bound(unsigned i) {
+        if (i < 2 * SUB_COUNT) {
+            return i;
+        }
+        unsigned shift = i / SUB_COUNT - 1;
+        return (uint64_t)(SUB_COUNT + i % SUB_COUNT) << shift;
+    }
+
+    static uint64_t bucket_upper_bound(unsigned i) {
+        if (i < 2 * SUB_COUNT) {
+            return i;
+        }
+        unsigned shift = i / SUB_COUNT - 1;
+        return bucket_lower_bound(i) + ((uint64_t)1 << shift) - 1;
+    }
+};
@@ -0,0 +1,191 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A minimal streaming JSON writer that builds a document in a string, inserting commas and (optionally)
+ *        indentation automatically.
+ *
+ * Usage: w.begin_object(); w.key("n"); w.value(42); w.end_object(); then w.str().
+ */
+class JsonWriter {
+private:
+    std::string _out;
+    std::vector<bool> _first;      // Per open container: true until its first member is written
+    bool _after_key = false;       // A key has been written and its value is next
+    int _indent;                   // Spaces per level, or 0 for a compact document
+
+public:
+    explicit JsonWriter(int indent=2) :
+        _indent(indent)
+    {
+    }
+
+    const std::string& str() const {
+        return _out;
+    }
+
+    JsonWriter& begin_object() {
+        start_value();
+        _out += '{';
+        _first.push_back(true);
+        return *this;
+    }
+
+    JsonWriter& end_object() {
+        end_container('}');
+        return *this;
+    }
+
+    JsonWriter& begin_array() {
+        start_value();
+        _out += '[';
+        _first.push_back(true);
+        return *this;
+    }
+
+    JsonWriter& end_array() {
+        end_container(']');
+        return *this;
+    }
+
+    JsonWriter& key(const std::string& name) {
+        start_member();
+        append_string(name);
+        _out += _indent > 0 ? ": " : ":";
+        _after_key = true;
+        return *this;
+    }
+
+    JsonWriter& value(const std::string& s) {
+        start_value();
+        append_string(s);
+        return *this;
+    }
+
+    JsonWriter& value(const char *s) {
+        return value(std::string(s));
+    }
+
+    JsonWriter& value(bool b) {
+        start_value();
+        _out += b ? "true" : "false";
+        return *this;
+    }
+
+    JsonWriter& value(int64_t n) {
+        start_value();
+        _out += std::to_string(n);
+        return *this;
+    }
+
+    JsonWriter& value(uint64_t n) {
+        start_value();
+        _out += std::to_string(n);
+        return *this;
+    }
+
+    JsonWriter& value(int n) {
+        return value((int64_t)n);
+    }
+
+    JsonWriter& value(unsigned n) {
+        return value((uint64_t)n);
+    }
+
+    /**
+     * @brief Write a number. Non-finite values, which JSON cannot represent, are written as null.
+     */
+    JsonWriter& value(double d) {
+        start_value();
+        if (!std::isfinite(d)) {
+            _out += "null";
+        } else {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.17g", d);
+            _out += buf;
+        }
+        return *this;
+    }
+
+    JsonWriter& null() {
+        start_value();
+        _out += "null";
+        return *this;
+    }
+
+    /**
+     * @brief Shorthand for key(name) followed by value(v).
+     */
+    template<class _V>
+    JsonWriter& member(const std::string& name, const _V& v) {
+        key(name);
+        return value(v);
+    }
+
+protected:
+    void newline() {
+        if (_indent > 0) {
+            _out += '\n';
+            _out.append(_first.size() * (size_t)_indent, ' ');
+        }
+    }
+
+    void start_member() {
+        if (!_first.empty()) {
+            if (!_first.back()) {
+                _out += ',';
+            }
+            _first.back() = false;
+            newline();
+        }
+    }
+
+    void start_value() {
+        if (_after_key) {
+            _after_key = false;
+        } else {
+            start_member();
+        }
+    }
+
+    void end_container(char c) {
+        bool empty = _first.back();
+        _first.pop_back();
+        if (!empty) {
+            newline();
+        }
+        _out += c;
+    }
+
+    void append_string(const std::string& s) {
+        _out += '"';
+        for (char c : s) {
+            switch (c) {
+                case '"':  _out += "\\\""; break;
+                case '\\': _out += "\\\\"; break;
+                case '\n': _out += "\\n"; break;
+                case '\r': _out += "\\r"; break;
+                case '\t': _out += "\\t"; break;
+                default:
+                    if ((unsigned char)c < 0x20) {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)(unsigned char)c);
+                        _out += buf;
+                    } else {
+                        _out += c;
+                    }
+            }
+        }
+        _out += '"';
+    }
+};
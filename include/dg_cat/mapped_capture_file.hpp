@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "datagram_metadata.hpp"
+#include "framing_codec.hpp"
+
+#include <boost/endian/conversion.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief A length-prefixed capture file that is memory-mapped in its entirety and indexed once, so that its
+ *        datagrams can be replayed (repeatedly) without further I/O.
+ *
+ * The mapping is read-only and shared with the page cache, unless the capture is opened writable, in which case
+ * it is a private copy-on-write mapping, so sequence fields can be rewritten in place between replays without
+ * modifying the file.
+ */
+class MappedCaptureFile {
+public:
+    /**
+     * @brief Location of a datagram within the mapping.
+     */
+    struct Entry {
+        uint64_t offset;     // Offset of the datagram payload (after the length prefix and any metadata header)
+        uint32_t len;        // Length of the datagram payload
+    };
+
+private:
+    std::string _filename;
+    size_t _metadata_len;
+    char *_data = nullptr;
+    size_t _size = 0;
+    bool _locked = false;
+    bool _writable;
+    size_t _datagram_size_limit;     // Longer datagrams are rejected as corrupt
+    std::vector<Entry> _entries;
+    size_t _max_datagram_size = 0;
+
+public:
+    /**
+     * @brief Map and index a capture file.
+     *
+     * @param filename   The capture file to map. Must be a regular file.
+     * @param metadata   If true, each record begins with a METADATA_LEN-byte metadata header.
+     * @param lock       If true, lock the mapping into memory with mlock(). Failure to lock is logged, not fatal.
+     * @param framing    How records are delimited in the file. Must not be FramingType::RAW.
+     * @param writable   If true, map a private copy-on-write view of the file, as add_to_sequence_field() requires.
+     * @param max_datagram_size  A record whose datagram (not including metadata) is longer than this is rejected
+     *                           as corrupt.
+     */
+    MappedCaptureFile(const std::string& filename, bool metadata, bool lock=false, FramingType framing=FramingType::BE32, bool writable=false,
+                      size_t max_datagram_size=DEFAULT_MAX_DATAGRAM_SIZE) :
+        _filename(filename),
+        _metadata_len(metadata ? METADATA_LEN : 0),
+        _writable(writable),
+        _datagram_size_limit(max_datagram_size)
+    {
+        if (framing == FramingType::RAW) {
+            throw std::runtime_error("Cannot index an unframed (raw) capture: " + filename);
+        }
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("Failed to open file: " + filename + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::system_category(), "fstat() failed");
+        }
+        if (!S_ISREG(st.st_mode)) {
+            ::close(fd);
+            throw std::runtime_error("Cannot preload capture that is not a regular file: " + filename);
+        }
+        _size = (size_t)st.st_size;
+        if (_size > 0) {
+            int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+            int flags = writable ? MAP_PRIVATE : MAP_SHARED;
+            void *p = mmap(nullptr, _size, prot, flags | MAP_POPULATE, fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::system_category(), "mmap() of capture file failed");
+            }
+            _data = (char *)p;
+        }
+        ::close(fd);
+
+        try {
+            if (lock && _size > 0) {
+                if (mlock(_data, _size) == 0) {
+                    _locked = true;
+                } else {
+                    BOOST_LOG_TRIVIAL(warning) << "mlock() of " << _size << "-byte capture failed (" << strerror(errno) << "); continuing unlocked\n";
+                }
+            }
+            madvise(_data, _size, MADV_SEQUENTIAL);
+            with_framing_codec(framing, [this](auto codec) {
+                this->index<decltype(codec)>();
+            });
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    MappedCaptureFile(const MappedCaptureFile&) = delete;
+    MappedCaptureFile& operator=(const MappedCaptureFile&) = delete;
+
+    ~MappedCaptureFile() {
+        unmap();
+    }
+
+    const std::string& filename() const {
+        return _filename;
+    }
+
+    /**
+     * @brief The number of datagrams in the capture.
+     */
+    size_t size() const {
+        return _entries.size();
+    }
+
+    size_t max_datagram_size() const {
+        return _max_datagram_size;
+    }
+
+    bool has_metadata() const {
+        return _metadata_len != 0;
+    }
+
+    const Entry& entry(size_t i) const {
+        return _entries[i];
+    }
+
+    const char *datagram_data(size_t i) const {
+        return _data + _entries[i].offset;
+    }
+
+    size_t datagram_len(size_t i) const {
+        return _entries[i].len;
+    }
+
+    /**
+     * @brief Decode the metadata header of a datagram. Only valid if has_metadata() is true.
+     */
+    DatagramMetadata metadata(size_t i) const {
+        return DatagramMetadata::decode(_data + _entries[i].offset - _metadata_len);
+    }
+
+    /**
+     * @brief Add a value to an unsigned big-endian sequence field in every datagram long enough to contain it.
+     *        Used to keep sequence numbers increasing across replays of the same capture.
+     *
+     * @param offset   Offset of the field within the datagram payload
+     * @param width    Width of the field in bytes (1, 2, 4, or 8)
+     * @param delta    Value to add (modulo 2^(8*width))
+     */
+    void add_to_sequence_field(size_t offset, size_t width, uint64_t delta) {
+        if (!_writable) {
+            throw std::runtime_error("Capture " + _filename + " was not mapped writable; cannot rewrite sequence fields");
+        }
+        for (auto& e : _entries) {
+            if (offset + width > e.len) {
+                continue;
+            }
+            unsigned char *p = (unsigned char *)_data + e.offset + offset;
+            uint64_t value = 0;
+            for (size_t j = 0; j < width; ++j) {
+                value = (value << 8) | p[j];
+            }
+            value += delta;
+            for (size_t j = width; j > 0; --j) {
+                p[j - 1] = (unsigned char)(value & 0xff);
+                value >>= 8;
+            }
+        }
+    }
+
+protected:
+    template <typename Codec>
+    void index() {
+        size_t pos = 0;
+        size_t nb_prefix;
+        size_t nb_record;
+        while (Codec::decode(_data + pos, _size - pos, _size, nb_prefix, nb_record)) {
+            if (pos + nb_prefix + nb_record > _size) {
+                break;
+            }
+            if (nb_record < _metadata_len) {
+                throw std::runtime_error("Capture record too short to contain metadata: " + std::to_string(nb_record) + " bytes");
+            }
+            if (nb_record - _metadata_len > _datagram_size_limit) {
+                throw std::runtime_error("Invalid record length " + std::to_string(nb_record) + " in " + _filename + " at offset " +
+                                         std::to_string(pos) + " (datagram longer than --max-datagram-size " +
+                                         std::to_string(_datagram_size_limit) + ")");
+            }
+            Entry e;
+            e.offset = pos + nb_prefix + _metadata_len;
+            e.len = (uint32_t)(nb_record - _metadata_len);
+            _max_datagram_size = std::max(_max_datagram_size, (size_t)e.len);
+            _entries.push_back(e);
+            pos += nb_prefix + nb_record;
+        }
+        if (pos != _size) {
+            BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram in " << _filename << "; ignoring last " << (_size - pos) << " bytes";
+        }
+        BOOST_LOG_TRIVIAL(debug) << "Indexed " << _entries.size() << " datagrams in " << _size << "-byte capture " << _filename << "\n";
+    }
+
+    void unmap() {
+        if (_data != nullptr) {
+            if (_locked) {
+                munlock(_data, _size);
+                _locked = false;
+            }
+            munmap(_data, _size);
+            _data = nullptr;
+        }
+    }
+};
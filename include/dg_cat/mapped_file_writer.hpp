@@ -0,0 +1,175 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Appends to a regular file through a sliding, shared memory-mapped window instead of write().
+ *
+ * The file is extended with posix_fallocate() one window at a time, so that the window's blocks are reserved
+ * before it is mapped (prefaulted) over the new space; running out of space is then an error from
+ * posix_fallocate() rather than a SIGBUS on a later store into a sparse page. Writes are plain memory copies,
+ * so a batch costs no system calls until the window fills. A full window is handed to the kernel for
+ * asynchronous writeback (msync(MS_ASYNC) and sync_file_range()) and unmapped, and the next window is mapped.
+ * finish() trims the file back to the length actually written.
+ *
+ * If the process dies before finish(), the file is left with a zero-filled tail up to the end of the last
+ * window; a zero length prefix reads as an empty datagram.
+ */
+class MappedFileWriter {
+private:
+    int _fd;
+    size_t _window_size;
+    uint64_t _pos;                   // Logical end of the file (bytes written)
+    uint64_t _file_size;             // Size the file has been extended to
+    uint64_t _window_offset = 0;     // File offset of the current window
+    char *_window = nullptr;         // Current window, or nullptr if none is mapped
+    uint64_t _n_windows = 0;
+    bool _finished = false;
+
+public:
+    /**
+     * @brief Construct a writer that appends at a given offset.
+     *
+     * @param fd           The file, opened read-write. Must be a regular file. Not owned.
+     * @param window_size  Size of the mapped window. Rounded up to a multiple of the page size.
+     * @param offset       File offset at which to start writing (e.g., the current size when appending).
+     */
+    MappedFileWriter(int fd, size_t window_size, uint64_t offset) :
+        _fd(fd),
+        _pos(offset),
+        _file_size(offset)
+    {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        _window_size = std::max((window_size + page_size - 1) / page_size * page_size, page_size);
+    }
+
+    MappedFileWriter(const MappedFileWriter&) = delete;
+    MappedFileWriter& operator=(const MappedFileWriter&) = delete;
+
+    ~MappedFileWriter() {
+        try {
+            finish();
+        } catch (const std::exception& e) {
+            BOOST_LOG_TRIVIAL(error) << "Failed to finish mapped file output: " << e.what() << "\n";
+        }
+    }
+
+    size_t window_size() const {
+        return _window_size;
+    }
+
+    /**
+     * @brief The number of windows that have been mapped.
+     */
+    uint64_t n_windows() const {
+        return _n_windows;
+    }
+
+    /**
+     * @brief Append the contents of an array of iovecs to the file. Returns the number of bytes written.
+     */
+    size_t write(const struct iovec *iov, size_t n_iov) {
+        size_t n_total = 0;
+        for (size_t i = 0; i < n_iov; ++i) {
+            const char *src = (const char *)iov[i].iov_base;
+            size_t n = iov[i].iov_len;
+            while (n > 0) {
+                if (_window == nullptr || _pos >= _window_offset + _window_size) {
+                    advance_window();
+                }
+                size_t i_window = (size_t)(_pos - _window_offset);
+                size_t nb = std::min(n, _window_size - i_window);
+                memcpy(_window + i_window, src, nb);
+                _pos += nb;
+                src += nb;
+                n -= nb;
+                n_total += nb;
+            }
+        }
+        return n_total;
+    }
+
+    /**
+     * @brief Unmap the current window and truncate the file to the length written. Idempotent.
+     */
+    void finish() {
+        if (_finished) {
+            return;
+        }
+        _finished = true;
+        retire_window();
+        if (_file_size != _pos && ftruncate(_fd, (off_t)_pos) != 0) {
+            throw std::system_error(errno, std::system_category(), "ftruncate() of mapped output failed");
+        }
+        _file_size = _pos;
+    }
+
+protected:
+    /**
+     * @brief Start asynchronous writeback of the current window's dirty pages and unmap it.
+     */
+    void retire_window() {
+        if (_window == nullptr) {
+            return;
+        }
+        size_t n_dirty = (size_t)(std::min(_pos, _window_offset + _window_size) - _window_offset);
+        int err = 0;
+        const char *failed = nullptr;
+        if (n_dirty > 0) {
+            // On Linux MS_ASYNC does not itself start writeback; sync_file_range() does, without waiting
+            if (msync(_window, n_dirty, MS_ASYNC) != 0) {
+                err = errno;
+                failed = "msync() of mapped output failed";
+            } else if (sync_file_range(_fd, (off_t)_window_offset, (off_t)n_dirty, SYNC_FILE_RANGE_WRITE) != 0) {
+                err = errno;
+                failed = "sync_file_range() of mapped output failed";
+            }
+        }
+        munmap(_window, _window_size);
+        _window = nullptr;
+        if (failed != nullptr) {
+            throw std::system_error(err, std::system_category(), failed);
+        }
+    }
+
+    /**
+     * @brief Retire the current window, extend the file if necessary, and map the window containing _pos.
+     */
+    void advance_window() {
+        retire_window();
+        _window_offset = _pos / _window_size * _window_size;
+        uint64_t window_end = _window_offset + _window_size;
+        if (_file_size < window_end) {
+            // Unlike ftruncate(), this allocates the blocks, so the stores into the window cannot fail
+            int ret = posix_fallocate(_fd, (off_t)_window_offset, (off_t)_window_size);
+            if (ret != 0) {
+                throw std::system_error(ret, std::system_category(), "posix_fallocate() to extend mapped output failed");
+            }
+            _file_size = window_end;
+        }
+        void *p = mmap(nullptr, _window_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, (off_t)_window_offset);
+        if (p == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "mmap() of output window failed");
+        }
+        _window = (char *)p;
+        madvise(_window, _window_size, MADV_SEQUENTIAL);
+        ++_n_windows;
+    }
+};
@@ -0,0 +1,345 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "datagram_source.hpp"
+#include "buffer_queue.hpp"
+#include "config.hpp"
+#include "timespec_math.hpp"
+#include "datagram_metadata.hpp"
+#include "bpf_program.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+#include "object_closer.hpp"
+
+#include <boost/endian/conversion.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <map>
+
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+
+/**
+ * @brief Capture-only datagram source that receives UDP datagrams addressed to a port on a network interface
+ *        through an AF_PACKET TPACKET_V3 memory-mapped ring. A BPF filter selects the datagrams in the kernel,
+ *        and the payloads of each retired ring block are committed to the BufferQueue in a single batch, with no
+ *        per-packet system calls. Works on physical NICs, veth pairs and loopback, and does not need anything to
+ *        be bound to the port. Requires CAP_NET_RAW.
+ *
+ * Path format: "packet://<interface>[?<arg>=<value>[&...]]". Arguments:
+ *
+ *     port=<n>            UDP destination port to capture. Default is all UDP datagrams.
+ *     block_size=<n>      Size of each ring block in bytes (a multiple of the page size). Default 1 MiB.
+ *     block_count=<n>     Number of ring blocks. Default 64.
+ *     block_timeout=<ms>  Time after which the kernel hands over a partially filled block. Default 10 ms.
+ *
+ * Fragmented IPv4 datagrams and IPv6 datagrams with extension headers are not captured. Packets dropped by the
+ * kernel because the ring was full are reported in the source stats as n_kernel_drops.
+ */
+class PacketDatagramSource : public DatagramSource {
+private:
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _interface;
+    uint16_t _port = 0;
+    int _sock = -1;
+    int _wake_fd = -1;                         // eventfd used by force_eof() to wake a blocked poll()
+    bool _force_eof = false;
+    bool _closed = false;
+    char *_ring = nullptr;
+    size_t _ring_size = 0;
+    size_t _block_size = DEFAULT_PACKET_BLOCK_SIZE;
+    size_t _block_count = DEFAULT_PACKET_BLOCK_COUNT;
+    unsigned _block_timeout_ms = DEFAULT_PACKET_BLOCK_TIMEOUT_MS;
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<struct iovec> _iovs;
+    std::vector<DatagramMetadata> _metadata;   // Only used if metadata is enabled
+
+public:
+    PacketDatagramSource(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path)
+    {
+        std::map<std::string, std::string> args;
+        _interface = parse_path_args(_path, "packet://", args);
+        for (auto& arg : args) {
+            if (arg.first == "port") {
+                auto port = std::stoul(arg.second);
+                if (port > 65535) {
+                    throw std::runtime_error("Invalid UDP port: " + arg.second);
+                }
+                _port = (uint16_t)port;
+            } else if (arg.first == "block_size") {
+                _block_size = std::stoul(arg.second);
+            } else if (arg.first == "block_count") {
+                _block_count = std::stoul(arg.second);
+            } else if (arg.first == "block_timeout") {
+                _block_timeout_ms = (unsigned)std::stoul(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to packet://: " + arg.first);
+            }
+        }
+        if (_interface.empty()) {
+            throw std::runtime_error("Network interface required for packet:// source: " + path);
+        }
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        if (_block_size == 0 || _block_size % page_size != 0 || _block_count == 0) {
+            throw std::runtime_error("Invalid packet ring geometry: block_size must be a nonzero multiple of " +
+                std::to_string(page_size) + " and block_count must be nonzero");
+        }
+        unsigned ifindex = if_nametoindex(_interface.c_str());
+        if (ifindex == 0) {
+            throw std::system_error(errno, std::system_category(), "Unknown network interface " + _interface);
+        }
+
+        ObjectCloser closer(this);  // release everything on failure
+
+        _wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_wake_fd == -1) {
+            throw std::system_error(errno, std::system_category(), "eventfd() failed");
+        }
+
+        // Protocol 0 receives nothing until bind(), so the filter is in place before any packets arrive
+        _sock = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (_sock == -1) {
+            throw std::system_error(errno, std::system_category(), "socket(AF_PACKET) failed");
+        }
+
+        int version = TPACKET_V3;
+        if (setsockopt(_sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+            throw std::system_error(errno, std::system_category(), "setsockopt(PACKET_VERSION) failed");
+        }
+
+        BpfProgram::udp_dst_port_filter(_port).attach(_sock);
+
+        struct tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = (unsigned)_block_size;
+        req.tp_block_nr = (unsigned)_block_count;
+        req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+        req.tp_frame_nr = (unsigned)(_block_size / req.tp_frame_size * _block_count);
+        req.tp_retire_blk_tov = _block_timeout_ms;
+        if (setsockopt(_sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+            throw std::system_error(errno, std::system_category(), "setsockopt(PACKET_RX_RING) failed");
+        }
+
+        _ring_size = _block_size * _block_count;
+        void *p = mmap(nullptr, _ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _sock, 0);
+        if (p == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "mmap() of packet ring failed");
+        }
+        _ring = (char *)p;
+
+        struct sockaddr_ll sll;
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_ALL);
+        sll.sll_ifindex = (int)ifindex;
+        if (bind(_sock, (struct sockaddr *)&sll, sizeof(sll)) != 0) {
+            throw std::system_error(errno, std::system_category(), "bind() to interface " + _interface + " failed");
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "Capturing UDP port " << _port << " on " << _interface << " with " << _block_count << " x " << _block_size << "-byte ring blocks\n";
+        closer.detach();
+    }
+
+    /**
+     * @brief factory-invoked static method to create a PacketDatagramSource
+     *
+     * @param config   The configuration object
+     * @param path     The path to the source
+     *
+     * @return unique_ptr<DatagramSource>
+     */
+    static std::unique_ptr<DatagramSource> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<PacketDatagramSource>(config, path);
+    }
+
+    ~PacketDatagramSource() override
+    {
+        close();
+    }
+
+    /**
+     * @brief Copy datagrams from the ring until an EOF is encountered or force_eof() is called.
+     *
+     * @param buffer_queue The buffer queue to write datagrams to.
+     */
+    void copy_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) override {
+        double first_timeout_secs = (_config.start_timeout > 0.0) ? _config.start_timeout : 0.0;
+        double timeout_secs = (_config.eof_timeout > 0.0) ? _config.eof_timeout : 0.0;
+        uint64_t n_datagrams = 0;
+        uint64_t n_kernel_drops = 0;
+        struct timespec end_time;
+        struct timespec start_time;
+        time_t start_clock_time = 0;
+        size_t i_block = 0;
+        auto last_activity = std::chrono::steady_clock::now();
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_force_eof) {
+                    BOOST_LOG_TRIVIAL(debug) << "Forced EOF; stopping packet capture\n";
+                    break;
+                }
+            }
+
+            auto block = (struct tpacket_block_desc *)(_ring + i_block * _block_size);
+            if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                double t = (n_datagrams == 0) ? first_timeout_secs : timeout_secs;
+                int poll_ms = -1;
+                if (t > 0.0) {
+                    double remaining = t - std::chrono::duration<double>(std::chrono::steady_clock::now() - last_activity).count();
+                    if (remaining <= 0.0) {
+                        BOOST_LOG_TRIVIAL(debug) << "Timeout waiting for datagram; generating EOF\n";
+                        break;
+                    }
+                    poll_ms = (int)(remaining * 1000.0) + 1;
+                }
+                struct pollfd pfds[2];
+                pfds[0].fd = _sock;
+                pfds[0].events = POLLIN | POLLERR;
+                pfds[0].revents = 0;
+                pfds[1].fd = _wake_fd;
+                pfds[1].events = POLLIN;
+                pfds[1].revents = 0;
+                if (poll(pfds, 2, poll_ms) == -1 && errno != EINTR) {
+                    throw std::system_error(errno, std::system_category(), "poll() failed");
+                }
+                continue;
+            }
+
+            size_t n = parse_block(block);
+            clock_gettime(CLOCK_REALTIME, &end_time);
+            if (n > 0) {
+                if (n_datagrams == 0) {
+                    start_time = end_time;
+                    start_clock_time = time(nullptr);
+                    BOOST_LOG_TRIVIAL(debug) << "First datagram received...\n";
+                }
+                buffer_queue.producer_commit_batch(_msgs.data(), n, _metadata.empty() ? nullptr : _metadata.data());
+                n_datagrams += n;
+                last_activity = std::chrono::steady_clock::now();
+            }
+            __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            i_block = (i_block + 1) % _block_count;
+
+            // Reading the statistics resets them, so they are accumulated here
+            struct tpacket_stats_v3 kstats;
+            socklen_t kstats_len = sizeof(kstats);
+            if (getsockopt(_sock, SOL_PACKET, PACKET_STATISTICS, &kstats, &kstats_len) == 0) {
+                n_kernel_drops += kstats.tp_drops;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats.max_clump_size = std::max(stats.max_clump_size, n);
+                stats.start_clock_time = start_clock_time;
+                stats.start_time = start_time;
+                stats.end_time = end_time;
+                stats.n_kernel_drops = n_kernel_drops;
+            }
+        }
+    }
+
+    /**
+     * @brief Force an EOF condition on the source. This method will be called from a different
+     *        thread than copy_to_buffer_queue().
+     */
+    void force_eof() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _force_eof = true;
+        if (_wake_fd != -1) {
+            uint64_t one = 1;
+            ssize_t ret = write(_wake_fd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+        if (_ring != nullptr) {
+            munmap(_ring, _ring_size);
+            _ring = nullptr;
+        }
+        if (_sock != -1) {
+            ::close(_sock);
+            _sock = -1;
+        }
+        if (_wake_fd != -1) {
+            ::close(_wake_fd);
+            _wake_fd = -1;
+        }
+    }
+
+protected:
+    /**
+     * @brief Fill _msgs (and _metadata) with the UDP payloads of the packets in a retired ring block, pointing
+     *        directly into the ring. Packets whose UDP payload was not fully captured are flagged with MSG_TRUNC
+     *        so that the BufferQueue discards and counts them.
+     *
+     * @return size_t  The number of entries filled in.
+     */
+    size_t parse_block(const struct tpacket_block_desc *block) {
+        size_t n_pkts = block->hdr.bh1.num_pkts;
+        if (_msgs.size() < n_pkts) {
+            _msgs.resize(n_pkts);
+            _iovs.resize(n_pkts);
+            for (size_t i = 0; i < n_pkts; ++i) {
+                _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+                _msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            if (_config.metadata) {
+                _metadata.resize(n_pkts);
+            }
+        }
+
+        size_t n = 0;
+        auto hdr = (const struct tpacket3_hdr *)((const char *)block + block->hdr.bh1.offset_to_first_pkt);
+        for (size_t i = 0; i < n_pkts; ++i) {
+            const uint8_t *net = (const uint8_t *)hdr + hdr->tp_net;
+            size_t avail = hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac);
+            UdpPacketView pkt;
+            if (pkt.parse(net, avail)) {
+                auto& msg = _msgs[n];
+                auto& iov = _iovs[n];
+                iov.iov_base = (void *)pkt.payload;
+                iov.iov_len = pkt.payload_len;
+                msg.msg_len = (unsigned)iov.iov_len;
+                msg.msg_hdr.msg_flags = pkt.truncated ? MSG_TRUNC : 0;
+                if (_config.metadata) {
+                    auto& md = _metadata[n];
+                    md.timestamp_ns = (int64_t)hdr->tp_sec * 1000000000 + (int64_t)hdr->tp_nsec;
+                    pkt.get_sender(md);
+                }
+                ++n;
+            }
+            hdr = (const struct tpacket3_hdr *)((const char *)hdr + hdr->tp_next_offset);
+        }
+        return n;
+    }
+};
@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * @brief Receive buffers for recvmmsg(), carved from one contiguous, huge-page-backed slab of fixed-size slots,
+ *        with an optional per-slot overflow area for datagrams larger than a slot.
+ *
+ * Each message gets a 2-part iovec: its slot in the slab, followed (if the slot is smaller than the maximum
+ * datagram size) by its own overflow buffer. The overflow area is a MAP_NORESERVE anonymous mapping, so it
+ * consumes no memory until a jumbo datagram actually spills into it; the kernel fills the slot first, so
+ * datagrams that fit in a slot never touch it.
+ *
+ * The slab is allocated with MAP_HUGETLB if huge pages are reserved, and otherwise as an ordinary anonymous
+ * mapping aligned to and advised for transparent huge pages (MADV_HUGEPAGE). It is prefaulted, so no page
+ * faults occur on the receive path.
+ */
+class ReceiveSlab {
+public:
+    static const size_t HUGE_PAGE_SIZE = 2UL*1024*1024;
+    static const size_t SLOT_ALIGN = 64;
+
+private:
+    size_t _n_slots;
+    size_t _slot_size;
+    size_t _slot_stride;         // _slot_size rounded up to SLOT_ALIGN
+    size_t _overflow_size;
+    char *_slab = nullptr;
+    size_t _slab_map_size = 0;
+    char *_overflow = nullptr;
+    size_t _overflow_map_size = 0;
+    bool _hugetlb = false;
+
+public:
+    /**
+     * @param n_slots           Number of receive slots (the recvmmsg() batch size)
+     * @param slot_size         Bytes per slot, capped at max_datagram_size. Slots start on SLOT_ALIGN boundaries.
+     * @param max_datagram_size Largest datagram to receive without truncation. The excess over slot_size is
+     *                          provided by the overflow area.
+     */
+    ReceiveSlab(size_t n_slots, size_t slot_size, size_t max_datagram_size) :
+        _n_slots(n_slots)
+    {
+        if (n_slots == 0 || slot_size == 0) {
+            throw std::runtime_error("Receive slab requires at least one non-empty slot");
+        }
+        _slot_size = std::min(slot_size, max_datagram_size);
+        _slot_stride = (_slot_size + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1);
+        _overflow_size = (max_datagram_size > _slot_size) ? max_datagram_size - _slot_size : 0;
+
+        size_t slab_size = _n_slots * _slot_stride;
+        _slab_map_size = (slab_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void *p = mmap(nullptr, _slab_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (p != MAP_FAILED) {
+            _hugetlb = true;
+        } else {
+            p = map_thp_aligned(_slab_map_size);
+        }
+        _slab = (char *)p;
+
+        if (_overflow_size > 0) {
+            _overflow_map_size = _n_slots * _overflow_size;
+            p = mmap(nullptr, _overflow_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                unmap();
+                throw std::system_error(err, std::system_category(), "mmap() of receive overflow area failed");
+            }
+            _overflow = (char *)p;
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "Receive slab: " << _n_slots << " slots of " << _slot_size << " bytes (" << _slab_map_size << " bytes, "
+                                 << (_hugetlb ? "hugetlbfs" : "transparent huge pages") << "), overflow " << _overflow_size << " bytes/slot\n";
+    }
+
+    ReceiveSlab(const ReceiveSlab&) = delete;
+    ReceiveSlab& operator=(const ReceiveSlab&) = delete;
+
+    ~ReceiveSlab() {
+        unmap();
+    }
+
+    size_t n_slots() const {
+        return _n_slots;
+    }
+
+    size_t slot_size() const {
+        return _slot_size;
+    }
+
+    size_t overflow_size() const {
+        return _overflow_size;
+    }
+
+    bool is_hugetlb() const {
+        return _hugetlb;
+    }
+
+    /**
+     * @brief The number of iovecs needed per message: 1, or 2 if there is an overflow area.
+     */
+    size_t iovecs_per_slot() const {
+        return (_overflow_size > 0) ? 2 : 1;
+    }
+
+    /**
+     * @brief Point each message at its slot (and overflow buffer).
+     *
+     * @param msgs  The recvmmsg() headers; must have n_slots() entries
+     * @param iovs  Storage for the iovecs; must have n_slots() * iovecs_per_slot() entries, and outlive msgs
+     */
+    void init_msgs(std::vector<struct mmsghdr>& msgs, std::vector<struct iovec>& iovs) {
+        size_t n_iov = iovecs_per_slot();
+        if (msgs.size() != _n_slots || iovs.size() != _n_slots * n_iov) {
+            throw std::runtime_error("Receive slab message/iovec count mismatch");
+        }
+        for (size_t i = 0; i < _n_slots; ++i) {
+            struct iovec *iov = &iovs[i * n_iov];
+            iov[0].iov_base = _slab + i * _slot_stride;
+            iov[0].iov_len = _slot_size;
+            if (n_iov > 1) {
+                iov[1].iov_base = _overflow + i * _overflow_size;
+                iov[1].iov_len = _overflow_size;
+            }
+            msgs[i].msg_hdr.msg_iov = iov;
+            msgs[i].msg_hdr.msg_iovlen = n_iov;
+        }
+    }
+
+protected:
+    /**
+     * @brief Map an anonymous region aligned to HUGE_PAGE_SIZE and ask for transparent huge pages.
+     */
+    static void *map_thp_aligned(size_t size) {
+        size_t map_size = size + HUGE_PAGE_SIZE;
+        void *p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "mmap() of receive slab failed");
+        }
+        uintptr_t base = (uintptr_t)p;
+        uintptr_t aligned = (base + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+        if (aligned > base) {
+            munmap(p, aligned - base);
+        }
+        size_t tail = (base + map_size) - (aligned + size);
+        if (tail > 0) {
+            munmap((void *)(aligned + size), tail);
+        }
+        madvise((void *)aligned, size, MADV_HUGEPAGE);
+        // Prefault after the advice so the faults are served with huge pages where possible
+        for (size_t off = 0; off < size; off += 4096) {
+            ((volatile char *)aligned)[off] = 0;
+        }
+        return (void *)aligned;
+    }
+
+    void unmap() {
+        if (_slab != nullptr) {
+            munmap(_slab, _slab_map_size);
+            _slab = nullptr;
+        }
+        if (_overflow != nullptr) {
+            munmap(_overflow, _overflow_map_size);
+            _overflow = nullptr;
+        }
+    }
+};
@@ -0,0 +1,208 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+/**
+ * @brief Paces datagram sends at a fixed rate, or (in adaptive mode) at a rate adjusted by additive-increase/
+ *        multiplicative-decrease (AIMD) to the highest rate the local network stack sustains without
+ *        backpressure (EAGAIN/ENOBUFS).
+ *
+ * In adaptive mode the rate starts at the configured maximum rate (or DEFAULT_ADAPTIVE_INITIAL_RATE if there
+ * is none), is increased by DEFAULT_ADAPTIVE_RATE_STEP for each DEFAULT_ADAPTIVE_RATE_INTERVAL of sending
+ * without backpressure, and is multiplied by DEFAULT_ADAPTIVE_DECREASE_FACTOR on backpressure (at most once
+ * per interval, so one burst of errors counts as one congestion event). A configured maximum rate is never
+ * exceeded.
+ */
+class SendRateController {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    bool _adaptive;
+    double _max_rate;                // Upper bound in datagrams/second; <= 0.0 means no limit
+    double _rate;                    // Current pacing rate in datagrams/second; <= 0.0 means unpaced
+    Clock::duration _interval{0};    // 1 / _rate
+    Clock::time_point _next_send_time;
+    Clock::time_point _last_adjust_time;
+    bool _started = false;
+    bool _waited = false;            // The last wait_until_due() had to wait for the next send time
+    bool _wait_pending = false;      // The last wait_until_due() reached its deadline before the next send time
+    Clock::time_point _first_send_time;
+    Clock::time_point _last_send_time;
+    uint64_t _n_sent = 0;
+
+public:
+    /**
+     * @param max_rate  Maximum rate in datagrams/second. <= 0.0 means no limit (unpaced unless adaptive).
+     * @param adaptive  If true, adapt the rate with AIMD.
+     */
+    SendRateController(double max_rate, bool adaptive) :
+        _adaptive(adaptive),
+        _max_rate(max_rate)
+    {
+        if (_adaptive) {
+            _rate = (_max_rate > 0.0) ? _max_rate : DEFAULT_ADAPTIVE_INITIAL_RATE;
+        } else {
+            _rate = _max_rate;
+        }
+        set_rate(_rate);
+    }
+
+    bool is_paced() const {
+        return _rate > 0.0;
+    }
+
+    bool is_adaptive() const {
+        return _adaptive;
+    }
+
+    /**
+     * @brief The current pacing rate in datagrams/second, or 0.0 if unpaced.
+     */
+    double rate() const {
+        return std::max(_rate, 0.0);
+    }
+
+    /**
+     * @brief The mean rate actually achieved, from the first to the most recent send, in datagrams/second.
+     */
+    double achieved_rate() const {
+        double secs = std::chrono::duration<double>(_last_send_time - _first_send_time).count();
+        return (_n_sent > 1 && secs > 0.0) ? (double)(_n_sent - 1) / secs : 0.0;
+    }
+
+    /**
+     * @brief Wait until the next datagram is due, and return the number of datagrams (at most n_max) that are due.
+     *        Returns 0 if the deadline passes first, so that the caller can check for a shutdown while waiting
+     *        for a slow send.
+     */
+    size_t wait_until_due(size_t n_max, Clock::time_point deadline = Clock::time_point::max()) {
+        auto now = Clock::now();
+        if (!_started) {
+            _started = true;
+            _next_send_time = now;
+            _last_adjust_time = now;
+        }
+        if (!_wait_pending) {
+            _waited = false;
+        }
+        _wait_pending = false;
+        if (!is_paced()) {
+            return n_max;
+        }
+        while (now < _next_send_time) {
+            _waited = true;
+            if (deadline < _next_send_time) {
+                if (now >= deadline) {
+                    _wait_pending = true;
+                    return 0;
+                }
+                std::this_thread::sleep_until(deadline);
+            } else {
+                std::this_thread::sleep_until(_next_send_time);
+            }
+            now = Clock::now();
+        }
+        // After a stall (an idle source, or a paused destination), don't burst to catch up on the whole gap
+        auto max_catchup = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(DEFAULT_SEND_MAX_CATCHUP_SECS));
+        if (now - _next_send_time > max_catchup) {
+            _next_send_time = now - max_catchup;
+        }
+        return std::min(n_max, (size_t)((now - _next_send_time) / _interval) + 1);
+    }
+
+    /**
+     * @brief The time at which the first datagram allowed by the last wait_until_due() was due.
+     */
+    Clock::time_point due_time() const {
+        return _next_send_time;
+    }
+
+    /**
+     * @brief True if the last wait_until_due() had to wait, i.e., the first datagram was ready before it was due,
+     *        so it should have been sent exactly at due_time().
+     */
+    bool waited() const {
+        return _waited;
+    }
+
+    /**
+     * @brief Account for n datagrams sent (or discarded) since the last call.
+     */
+    void on_sent(size_t n) {
+        if (n == 0) {
+            return;
+        }
+        auto now = Clock::now();
+        if (_n_sent == 0) {
+            _first_send_time = now;
+        }
+        _n_sent += n;
+        _last_send_time = now;
+        if (is_paced()) {
+            _next_send_time += _interval * n;
+        }
+        if (_adaptive && now - _last_adjust_time >= adjust_interval()) {
+            _last_adjust_time = now;
+            double rate = _rate + DEFAULT_ADAPTIVE_RATE_STEP;
+            set_rate((_max_rate > 0.0) ? std::min(rate, _max_rate) : rate);
+        }
+    }
+
+    /**
+     * @brief Change the maximum rate. In fixed-rate mode this is the new pacing rate; in adaptive mode the current
+     *        rate is clamped to it. Pacing restarts from now, so a higher rate does not send a catch-up burst.
+     *
+     * @param max_rate  Maximum rate in datagrams/second. <= 0.0 means no limit.
+     */
+    void set_max_rate(double max_rate) {
+        _max_rate = max_rate;
+        if (!_adaptive) {
+            set_rate(_max_rate);
+        } else if (_max_rate > 0.0 && _rate > _max_rate) {
+            set_rate(_max_rate);
+        }
+        if (_started) {
+            _next_send_time = Clock::now();
+        }
+    }
+
+    /**
+     * @brief Account for a send that failed with EAGAIN or ENOBUFS.
+     */
+    void on_backpressure() {
+        auto now = Clock::now();
+        if (_adaptive && now - _last_adjust_time >= adjust_interval()) {
+            _last_adjust_time = now;
+            set_rate(std::max(_rate * DEFAULT_ADAPTIVE_DECREASE_FACTOR, DEFAULT_ADAPTIVE_MIN_RATE));
+        }
+        // Don't try to catch up on the time lost waiting for the socket
+        if (now > _next_send_time) {
+            _next_send_time = now;
+        }
+    }
+
+protected:
+    static Clock::duration adjust_interval() {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(DEFAULT_ADAPTIVE_RATE_INTERVAL));
+    }
+
+    void set_rate(double rate) {
+        _rate = rate;
+        if (_rate > 0.0) {
+            _interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / _rate));
+            if (_interval.count() == 0) {
+                _interval = Clock::duration(1);
+            }
+        }
+    }
+};
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "datagram_metadata.hpp"
+#include "sender_table.hpp"
+#include "stats.hpp"
+#include "timespec_math.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <time.h>
+
+/**
+ * @brief Per-sender-address datagram and byte counters kept in a bounded SenderTable on the receive path.
+ *
+ * add() is a single hash lookup and two increments per datagram. Rates and the top-K view are only computed
+ * by report(), which the source calls about once per reporting interval. Senders are keyed by address only
+ * (not port), and datagrams from new senders beyond the table limit are counted as untracked.
+ */
+class SenderStatsTracker {
+private:
+    struct Counters {
+        uint64_t n_datagrams = 0;
+        uint64_t n_bytes = 0;
+        uint64_t reported_n_datagrams = 0;   // Counts at the previous report, for interval rates
+        uint64_t reported_n_bytes = 0;
+        double datagrams_per_sec = 0.0;
+        double bytes_per_sec = 0.0;
+    };
+
+    SenderTable<Counters> _table;
+    size_t _top_k;
+    uint64_t _n_untracked_datagrams = 0;
+    struct timespec _last_report_time{0, 0};
+
+public:
+    /**
+     * @param top_k        Number of senders to include in the top-K view
+     * @param max_senders  Maximum number of sender addresses to track
+     */
+    SenderStatsTracker(size_t top_k, size_t max_senders) :
+        _table(max_senders),
+        _top_k(top_k)
+    {
+    }
+
+    /**
+     * @brief Count a datagram from a sender.
+     */
+    void add(const DatagramMetadata& sender, size_t nb_payload) {
+        SenderKey key(sender);
+        key.port = 0;
+        bool inserted;
+        Counters *counters = _table.find_or_insert(key, inserted);
+        if (counters == nullptr) {
+            _n_untracked_datagrams++;
+            return;
+        }
+        counters->n_datagrams++;
+        counters->n_bytes += nb_payload;
+    }
+
+    size_t n_senders() const {
+        return _table.size();
+    }
+
+    uint64_t n_untracked_datagrams() const {
+        return _n_untracked_datagrams;
+    }
+
+    /**
+     * @brief Update interval rates and return the top-K senders by total bytes.
+     *
+     * @param now  Current time (CLOCK_REALTIME). Rates cover the time since the previous report.
+     */
+    std::vector<SenderStats> report(const struct timespec& now) {
+        double dt = timespec_to_secs(timespec_subtract(now, _last_report_time));
+        bool have_interval = (_last_report_time.tv_sec != 0 || _last_report_time.tv_nsec != 0) && dt > 0.0;
+        for (auto& entry : _table.entries()) {
+            auto& c = entry.value;
+            if (have_interval) {
+                c.datagrams_per_sec = (double)(c.n_datagrams - c.reported_n_datagrams) / dt;
+                c.bytes_per_sec = (double)(c.n_bytes - c.reported_n_bytes) / dt;
+            }
+            c.reported_n_datagrams = c.n_datagrams;
+            c.reported_n_bytes = c.n_bytes;
+        }
+        _last_report_time = now;
+
+        auto& entries = _table.entries();
+        std::vector<const SenderTable<Counters>::Entry *> order;
+        order.reserve(entries.size());
+        for (auto& entry : entries) {
+            order.push_back(&entry);
+        }
+        size_t k = std::min(_top_k, order.size());
+        std::partial_sort(order.begin(), order.begin() + k, order.end(),
+            [](const SenderTable<Counters>::Entry *a, const SenderTable<Counters>::Entry *b) {
+                return a->value.n_bytes > b->value.n_bytes;
+            });
+
+        std::vector<SenderStats> result(k);
+        for (size_t i = 0; i < k; ++i) {
+            auto& c = order[i]->value;
+            result[i].sender = order[i]->key.to_metadata().sender_addr_string();
+            result[i].n_datagrams = c.n_datagrams;
+            result[i].n_bytes = c.n_bytes;
+            result[i].datagrams_per_sec = c.datagrams_per_sec;
+            result[i].bytes_per_sec = c.bytes_per_sec;
+        }
+        return result;
+    }
+};
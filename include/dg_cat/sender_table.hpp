@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "bounded_hash_table.hpp"
+#include "datagram_metadata.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Key identifying a datagram sender: address family, address and port.
+ */
+struct SenderKey {
+    uint16_t family;
+    uint16_t port;
+    uint8_t addr[16];
+
+    SenderKey() :
+        family(AF_UNSPEC),
+        port(0)
+    {
+        memset(addr, 0, sizeof(addr));
+    }
+
+    explicit SenderKey(const DatagramMetadata& metadata) :
+        family(metadata.family),
+        port(metadata.port)
+    {
+        memcpy(addr, metadata.addr, sizeof(addr));
+    }
+
+    bool operator==(const SenderKey& other) const {
+        return family == other.family && port == other.port && memcmp(addr, other.addr, sizeof(addr)) == 0;
+    }
+
+    /**
+     * @brief Convert back to metadata (with no timestamp), e.g., to format the sender as a string.
+     */
+    DatagramMetadata to_metadata() const {
+        DatagramMetadata metadata;
+        metadata.family = family;
+        metadata.port = port;
+        memcpy(metadata.addr, addr, sizeof(addr));
+        return metadata;
+    }
+
+    uint64_t hash() const {
+        uint64_t words[2];
+        memcpy(words, addr, sizeof(words));
+        uint64_t h = splitmix64(((uint64_t)family << 16) | port);
+        h = splitmix64(h ^ words[0]);
+        h = splitmix64(h ^ words[1]);
+        return h;
+    }
+};
+
+/**
+ * @brief A bounded hash table from SenderKey to a value, used to look up per-sender state on every datagram
+ *        without allocation once a sender has been seen.
+ *
+ * @tparam _V  The value type. Must be default-constructible.
+ */
+template<class _V> using SenderTable = BoundedHashTable<SenderKey, _V>;
@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include "histogram.hpp"
 #include "timespec_math.hpp"
 
 #include <cstdint>
@@ -13,6 +14,7 @@
 #include <string>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 
 #include <unistd.h>
@@ -60,6 +62,26 @@ public:
     }
 };
 
+/**
+ * @brief Traffic statistics for a single sender address, as reported in the source stats.
+ */
+struct SenderStats {
+    std::string sender;                 // Numeric sender address
+    uint64_t n_datagrams = 0;           // Total datagrams received from the sender
+    uint64_t n_bytes = 0;               // Total payload bytes received from the sender
+    double datagrams_per_sec = 0.0;     // Datagram rate over the most recent reporting interval
+    double bytes_per_sec = 0.0;         // Byte rate over the most recent reporting interval
+
+    std::string brief_str() const {
+        return sender +
+               " (n_datagrams=" + std::to_string(n_datagrams) +
+               ", n_bytes=" + std::to_string(n_bytes) +
+               ", datagrams_per_sec=" + std::to_string(datagrams_per_sec) +
+               ", bytes_per_sec=" + std::to_string(bytes_per_sec) +
+               ")";
+    }
+};
+
 /**
  * @brief Stats provided by the datagram source
  */
@@ -69,10 +91,17 @@ public:
     time_t start_clock_time;            // Clock time the first datagram was produced
     struct timespec start_time;         // System elapsed time the first datagram was produced
     struct timespec end_time;           // Time the last datagram was produced
+    uint64_t n_kernel_drops;            // Number of packets dropped by the kernel before they were received (if known)
+    uint64_t n_senders;                 // Number of distinct sender addresses seen (if sender stats are enabled)
+    uint64_t n_untracked_datagrams;     // Datagrams from senders beyond the sender stats table limit
+    std::vector<SenderStats> top_senders;  // Top senders by bytes received (if sender stats are enabled)
 
     DgSourceStats() :
         max_clump_size(0),
-        start_clock_time(0)
+        start_clock_time(0),
+        n_kernel_drops(0),
+        n_senders(0),
+        n_untracked_datagrams(0)
     {
         memset(&start_time, 0, sizeof(start_time));
         memset(&end_time, 0, sizeof(end_time));
@@ -89,11 +118,24 @@ public:
 
 
     std::string brief_str() const {
-        return std::string() +
+        std::string result = std::string() +
                "max_clump_size=" + std::to_string(max_clump_size) +
                ", start_clock time=" +  time_t_to_utc_string(start_clock_time) +
                ", elapsed_secs=" + std::to_string(elapsed_secs()) +
+               (n_kernel_drops == 0 ? std::string() : ", n_kernel_drops=" + std::to_string(n_kernel_drops)) +
                "";
+        if (n_senders != 0) {
+            result += ", n_senders=" + std::to_string(n_senders);
+            if (n_untracked_datagrams != 0) {
+                result += ", n_untracked_datagrams=" + std::to_string(n_untracked_datagrams);
+            }
+            result += ", top_senders=[";
+            for (size_t i = 0; i < top_senders.size(); ++i) {
+                result += (i == 0 ? "" : ", ") + top_senders[i].brief_str();
+            }
+            result += "]";
+        }
+        return result;
     }
 };
 
@@ -104,8 +146,49 @@ typedef LockableStats<DgSourceStats> LockableDgSourceStats;
  */
 class DgDestinationStats {
 public:
-
-    DgDestinationStats()
+    uint64_t n_datagrams_sent;          // Number of datagrams sent by a UDP destination
+    uint64_t n_datagrams_refused;       // Number of datagrams discarded because the receiver refused them (ECONNREFUSED)
+    uint64_t n_send_stalls;             // Number of nonblocking UDP sends that failed with EAGAIN/ENOBUFS and were retried
+    uint64_t n_tx_timestamps;           // Number of kernel transmit timestamps read back by a UDP destination
+    uint64_t n_tx_timestamps_lost;      // Number of sent datagrams whose transmit timestamp never arrived (known at the end)
+    std::shared_ptr<const Histogram> tx_gap_ns;           // Snapshot of intervals between consecutive datagrams' transmit timestamps
+    std::shared_ptr<const Histogram> tx_pacing_error_ns;  // Snapshot of |transmit time - due time| for paced datagrams that were ready early
+    double send_rate;                   // Final adaptive UDP send rate in datagrams/second (0 if not adaptive)
+    double achieved_send_rate;          // Mean UDP send rate actually achieved, in datagrams/second
+    uint64_t n_syncs;                   // Number of background syncs of a file output to stable storage
+    uint64_t max_unsynced_bytes;        // Largest amount of written data committed by a single background sync
+    std::shared_ptr<const Histogram> sync_latency_ns;  // Snapshot of background sync latencies (if durability is enabled)
+    uint64_t n_outputs;                 // Number of per-sender outputs opened by a demux destination
+    uint64_t n_datagrams_unrouted;      // Number of datagrams discarded by a demux destination because its output limit was reached
+    uint64_t n_dumps;                   // Number of flight recorder dumps written
+    uint64_t n_dump_bytes;              // Total bytes written to flight recorder dumps
+    uint64_t n_rotations;               // Number of times a file output was closed and reopened on request
+    uint64_t n_summaries;               // Number of interval summaries written by a summary destination
+    uint64_t n_summary_rows;            // Number of per-key rows in those summaries
+    uint64_t n_stripe_chunks;           // Number of chunks written by a stripe destination
+    uint64_t n_arrow_batches;           // Number of record batches written by an arrow destination
+    uint64_t n_arrow_rows;              // Number of rows (datagrams) in those record batches
+
+    DgDestinationStats() :
+        n_datagrams_sent(0),
+        n_datagrams_refused(0),
+        n_send_stalls(0),
+        n_tx_timestamps(0),
+        n_tx_timestamps_lost(0),
+        send_rate(0.0),
+        achieved_send_rate(0.0),
+        n_syncs(0),
+        max_unsynced_bytes(0),
+        n_outputs(0),
+        n_datagrams_unrouted(0),
+        n_dumps(0),
+        n_dump_bytes(0),
+        n_rotations(0),
+        n_summaries(0),
+        n_summary_rows(0),
+        n_stripe_chunks(0),
+        n_arrow_batches(0),
+        n_arrow_rows(0)
     {
     }
 
@@ -115,9 +198,68 @@ public:
     DgDestinationStats& operator=(DgDestinationStats&&) = default;
 
     std::string brief_str() const {
-        return std::string("");
+        std::string result;
+        if (n_datagrams_sent != 0 || n_datagrams_refused != 0) {
+            result += "n_datagrams_sent=" + std::to_string(n_datagrams_sent) +
+                      ", n_datagrams_refused=" + std::to_string(n_datagrams_refused) +
+                      ", achieved_send_rate=" + std::to_string(achieved_send_rate);
+            if (n_send_stalls != 0 || send_rate != 0.0) {
+                result += ", n_send_stalls=" + std::to_string(n_send_stalls);
+            }
+            if (send_rate != 0.0) {
+                result += ", send_rate=" + std::to_string(send_rate);
+            }
+        }
+        if (n_tx_timestamps != 0 || n_tx_timestamps_lost != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_tx_timestamps=" + std::to_string(n_tx_timestamps) +
+                      ", n_tx_timestamps_lost=" + std::to_string(n_tx_timestamps_lost);
+            if (tx_gap_ns) {
+                result += ", tx_gap=[" + tx_gap_ns->brief_str("us", 1.0e3) + "]";
+            }
+            if (tx_pacing_error_ns) {
+                result += ", tx_pacing_error=[" + tx_pacing_error_ns->brief_str("us", 1.0e3) + "]";
+            }
+        }
+        if (n_syncs != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_syncs=" + std::to_string(n_syncs) +
+                      ", max_unsynced_bytes=" + std::to_string(max_unsynced_bytes);
+            if (sync_latency_ns) {
+                result += ", sync_latency=[" + sync_latency_ns->brief_str("ms", 1.0e6) + "]";
+            }
+        }
+        if (n_outputs != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_outputs=" + std::to_string(n_outputs) +
+                      ", n_datagrams_unrouted=" + std::to_string(n_datagrams_unrouted);
+        }
+        if (n_dumps != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_dumps=" + std::to_string(n_dumps) +
+                      ", n_dump_bytes=" + std::to_string(n_dump_bytes);
+        }
+        if (n_rotations != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_rotations=" + std::to_string(n_rotations);
+        }
+        if (n_summaries != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_summaries=" + std::to_string(n_summaries) +
+                      ", n_summary_rows=" + std::to_string(n_summary_rows);
+        }
+        if (n_stripe_chunks != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_stripe_chunks=" + std::to_string(n_stripe_chunks);
+        }
+        if (n_arrow_batches != 0) {
+            result += std::string(result.empty() ? "" : ", ") +
+                      "n_arrow_batches=" + std::to_string(n_arrow_batches) +
+                      ", n_arrow_rows=" + std::to_string(n_arrow_rows);
+        }
+        return result;
     }
-  
+
 };
 
 typedef LockableStats<DgDestinationStats> LockableDgDestinationStats;
@@ -134,6 +276,9 @@ public:
     size_t min_datagram_size;           // Minimum datagram size produced
     size_t max_datagram_size;           // Maximum datagram size produced
     size_t first_datagram_size;         // Size of the first datagram produced
+    uint64_t n_datagrams_overwritten;   // Number of datagrams discarded from a flight recorder history to make room
+    uint64_t n_triggers;                // Number of flight recorder triggers
+    std::shared_ptr<const Histogram> residency_ns;  // Snapshot of the times datagrams spent in the backlog, enqueue to consume
 
     DgBufferStats() :
         max_backlog_bytes(0),
@@ -142,7 +287,9 @@ public:
         n_datagram_bytes(0),
         min_datagram_size(0),
         max_datagram_size(0),
-        first_datagram_size(0)
+        first_datagram_size(0),
+        n_datagrams_overwritten(0),
+        n_triggers(0)
     {
     }
 
@@ -151,6 +298,19 @@ public:
     DgBufferStats& operator=(const DgBufferStats&) = default;
     DgBufferStats& operator=(DgBufferStats&&) = default;
 
+    /**
+     * @brief Account for a datagram of the given size being produced.
+     */
+    void add_datagram(size_t dg_len) {
+        max_datagram_size = std::max(max_datagram_size, dg_len);
+        min_datagram_size = (n_datagrams == 0) ? dg_len : std::min(min_datagram_size, dg_len);
+        if (n_datagrams == 0) {
+            first_datagram_size = dg_len;
+        }
+        n_datagrams++;
+        n_datagram_bytes += dg_len;
+    }
+
     std::string brief_str() const {
         return std::string() +
                "max_backlog_bytes=" + std::to_string(max_backlog_bytes) +
@@ -160,6 +320,11 @@ public:
                ", min_datagram_size=" + std::to_string(min_datagram_size) +
                ", max_datagram_size=" + std::to_string(max_datagram_size) +
                ", first_datagram_size=" + std::to_string(first_datagram_size) +
+               ((n_datagrams_overwritten != 0 || n_triggers != 0) ?
+                   ", n_datagrams_overwritten=" + std::to_string(n_datagrams_overwritten) +
+                   ", n_triggers=" + std::to_string(n_triggers) : std::string()) +
+               ((residency_ns && residency_ns->count() != 0) ?
+                   ", residency=[" + residency_ns->brief_str("us", 1.0e3) + "]" : std::string()) +
                "";
     }
 
@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DG_CAT_HAVE_STREAM_COPY 1
+#endif
+
+/**
+ * @brief Copy kernels that use non-temporal (streaming) stores, for writing data that will not be read again
+ *        soon (e.g., into a deep backlog) without evicting the hot working set from the cache.
+ *
+ * stream_copy() dispatches at runtime, once, to the widest kernel the CPU supports (AVX-512, AVX2, or SSE2).
+ * The destination is aligned with an ordinary copy of the head; the tail is also copied ordinarily. Each call
+ * ends with a store fence, so the data is globally visible before the caller publishes it to another thread
+ * (a mutex release does not order non-temporal stores). On other architectures it is a plain memcpy().
+ */
+namespace stream_copy_detail {
+
+typedef void (*CopyFn)(char *dst, const char *src, size_t n);
+
+#ifdef DG_CAT_HAVE_STREAM_COPY
+
+/**
+ * @brief Copy the unaligned head of dst ordinarily, and return the number of bytes copied.
+ */
+inline size_t copy_head(char *dst, const char *src, size_t n, size_t align) {
+    size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+    if (head > n) {
+        head = n;
+    }
+    memcpy(dst, src, head);
+    return head;
+}
+
+__attribute__((target("sse2")))
+inline void copy_sse2(char *dst, const char *src, size_t n) {
+    size_t i = copy_head(dst, src, n, 16);
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        _mm_stream_si128((__m128i *)(dst + i), a);
+        _mm_stream_si128((__m128i *)(dst + i + 16), b);
+        _mm_stream_si128((__m128i *)(dst + i + 32), c);
+        _mm_stream_si128((__m128i *)(dst + i + 48), d);
+    }
+    for (; i + 16 <= n; i += 16) {
+        _mm_stream_si128((__m128i *)(dst + i), _mm_loadu_si128((const __m128i *)(src + i)));
+    }
+    memcpy(dst + i, src + i, n - i);
+    _mm_sfence();
+}
+
+__attribute__((target("avx2")))
+inline void copy_avx2(char *dst, const char *src, size_t n) {
+    size_t i = copy_head(dst, src, n, 32);
+    for (; i + 128 <= n; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(src + i + 96));
+        _mm256_stream_si256((__m256i *)(dst + i), a);
+        _mm256_stream_si256((__m256i *)(dst + i + 32), b);
+        _mm256_stream_si256((__m256i *)(dst + i + 64), c);
+        _mm256_stream_si256((__m256i *)(dst + i + 96), d);
+    }
+    for (; i + 32 <= n; i += 32) {
+        _mm256_stream_si256((__m256i *)(dst + i), _mm256_loadu_si256((const __m256i *)(src + i)));
+    }
+    memcpy(dst + i, src + i, n - i);
+    _mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+inline void copy_avx512(char *dst, const char *src, size_t n) {
+    size_t i = copy_head(dst, src, n, 64);
+    for (; i + 256 <= n; i += 256) {
+        __m512i a = _mm512_loadu_si512((const void *)(src + i));
+        __m512i b = _mm512_loadu_si512((const void *)(src + i + 64));
+        __m512i c = _mm512_loadu_si512((const void *)(src + i + 128));
+        __m512i d = _mm512_loadu_si512((const void *)(src + i + 192));
+        _mm512_stream_si512((__m512i *)(dst + i), a);
+        _mm512_stream_si512((__m512i *)(dst + i + 64), b);
+        _mm512_stream_si512((__m512i *)(dst + i + 128), c);
+        _mm512_stream_si512((__m512i *)(dst + i + 192), d);
+    }
+    for (; i + 64 <= n; i += 64) {
+        _mm512_stream_si512((__m512i *)(dst + i), _mm512_loadu_si512((const void *)(src + i)));
+    }
+    memcpy(dst + i, src + i, n - i);
+    _mm_sfence();
+}
+
+#endif // DG_CAT_HAVE_STREAM_COPY
+
+inline void copy_scalar(char *dst, const char *src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+inline CopyFn select_kernel() {
+#ifdef DG_CAT_HAVE_STREAM_COPY
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return copy_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return copy_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return copy_sse2;
+    }
+#endif
+    return copy_scalar;
+}
+
+inline const char *kernel_name(CopyFn fn) {
+#ifdef DG_CAT_HAVE_STREAM_COPY
+    if (fn == copy_avx512) {
+        return "avx512";
+    }
+    if (fn == copy_avx2) {
+        return "avx2";
+    }
+    if (fn == copy_sse2) {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+inline CopyFn kernel() {
+    static const CopyFn fn = select_kernel();
+    return fn;
+}
+
+} // namespace stream_copy_detail
+
+/**
+ * @brief Copy n bytes from src to dst with non-temporal stores where supported. The regions must not overlap.
+ */
+inline void stream_copy(void *dst, const void *src, size_t n) {
+    stream_copy_detail::kernel()((char *)dst, (const char *)src, n);
+}
+
+/**
+ * @brief The name of the kernel stream_copy() uses on this CPU ("avx512", "avx2", "sse2" or "scalar").
+ */
+inline const char *stream_copy_kernel_name() {
+    return stream_copy_detail::kernel_name(stream_copy_detail::kernel());
+}
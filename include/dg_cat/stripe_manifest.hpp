@@ -0,0 +1,151 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+/**
+ * @brief The manifest of a striped capture: which files hold the stripes, and the order in which their chunks
+ *        make up the capture.
+ *
+ * Each stripe file is an ordinary be32 capture (with metadata headers if the capture has them) made of the
+ * stripe's chunks back to back, and every chunk holds whole records. The manifest is a text file:
+ *
+ *     dg-cat-stripes 1
+ *     metadata <0|1>
+ *     stripe <path>              One line per stripe; stripe 0 first
+ *     ...
+ *     chunk <stripe> <length>    One line per chunk, in capture order
+ *     ...
+ *
+ * A chunk line is only appended once the chunk's data has been synced to stable storage, so after a crash or
+ * power failure the manifest describes a prefix of the capture; a final line without a newline is ignored.
+ */
+class StripeManifest {
+public:
+    struct Chunk {
+        size_t stripe;
+        uint64_t length;
+    };
+
+    static constexpr const char *MAGIC = "dg-cat-stripes";
+    static const unsigned VERSION = 1;
+
+    bool metadata = false;
+    std::vector<std::string> paths;
+    std::vector<Chunk> chunks;
+
+    /**
+     * @brief The header lines of a manifest, up to the first chunk line.
+     */
+    std::string header_str() const {
+        std::string result = std::string(MAGIC) + " " + std::to_string(VERSION) + "\n" +
+                             "metadata " + (metadata ? "1" : "0") + "\n";
+        for (auto& path : paths) {
+            result += "stripe " + path + "\n";
+        }
+        return result;
+    }
+
+    static std::string chunk_line(size_t stripe, uint64_t length) {
+        return "chunk " + std::to_string(stripe) + " " + std::to_string(length) + "\n";
+    }
+
+    /**
+     * @brief The total length of the chunks listed for a stripe, i.e., the valid length of its file.
+     */
+    uint64_t stripe_length(size_t stripe) const {
+        uint64_t length = 0;
+        for (auto& chunk : chunks) {
+            if (chunk.stripe == stripe) {
+                length += chunk.length;
+            }
+        }
+        return length;
+    }
+
+    /**
+     * @brief Read and validate a manifest file.
+     */
+    static StripeManifest read(const std::string& filename) {
+        std::ifstream f(filename, std::ios::binary);
+        if (!f) {
+            throw std::runtime_error("Failed to open stripe manifest: " + filename + ": " + strerror(errno));
+        }
+        std::stringstream ss;
+        ss << f.rdbuf();
+        std::string text = ss.str();
+        size_t last_newline = text.find_last_of('\n');
+        size_t n_complete = (last_newline == std::string::npos) ? 0 : last_newline + 1;
+        if (n_complete < text.size()) {
+            BOOST_LOG_TRIVIAL(warning) << "Ignoring incomplete last line of stripe manifest " << filename << "\n";
+        }
+
+        StripeManifest manifest;
+        std::istringstream is(text.substr(0, n_complete));
+        std::string line;
+        bool have_header = false;
+        size_t line_number = 0;
+        while (std::getline(is, line)) {
+            ++line_number;
+            size_t space_pos = line.find(' ');
+            std::string keyword = line.substr(0, space_pos);
+            std::string value = (space_pos == std::string::npos) ? std::string() : line.substr(space_pos + 1);
+            if (!have_header) {
+                if (keyword != MAGIC || value != std::to_string(VERSION)) {
+                    throw std::runtime_error("Not a version " + std::to_string(VERSION) + " stripe manifest: " + filename);
+                }
+                have_header = true;
+            } else if (keyword == "metadata") {
+                manifest.metadata = std::stoul(value) != 0;
+            } else if (keyword == "stripe" && !value.empty() && manifest.chunks.empty()) {
+                manifest.paths.push_back(value);
+            } else if (keyword == "chunk") {
+                std::istringstream cs(value);
+                Chunk chunk;
+                if (!(cs >> chunk.stripe >> chunk.length) || chunk.stripe >= manifest.paths.size()) {
+                    throw std::runtime_error("Invalid chunk in stripe manifest " + filename + " line " + std::to_string(line_number) + ": " + line);
+                }
+                manifest.chunks.push_back(chunk);
+            } else {
+                throw std::runtime_error("Invalid line in stripe manifest " + filename + " line " + std::to_string(line_number) + ": " + line);
+            }
+        }
+        if (!have_header) {
+            throw std::runtime_error("Empty stripe manifest: " + filename);
+        }
+        if (manifest.paths.empty()) {
+            throw std::runtime_error("Stripe manifest lists no stripes: " + filename);
+        }
+        return manifest;
+    }
+
+    /**
+     * @brief Make a relative stripe path absolute, so that the manifest can be read from any directory.
+     */
+    static std::string absolute_path(const std::string& path) {
+        if (!path.empty() && path[0] == '/') {
+            return path;
+        }
+        char cwd[4096];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+            throw std::system_error(errno, std::system_category(), "getcwd() failed");
+        }
+        return std::string(cwd) + "/" + path;
+    }
+};
@@ -0,0 +1,464 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "buffer_queue.hpp"
+#include "datagram_destination.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "object_closer.hpp"
+#include "stripe_manifest.hpp"
+#include "util.hpp"
+
+/**
+ * @brief A stripe file with its own writer thread, which writes one chunk at a time on request, so that writes
+ *        to the stripes of a round proceed in parallel.
+ */
+class StripeWriter {
+private:
+    std::string _path;
+    int _fd = -1;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::thread _thread;
+    struct iovec _iov[2];
+    size_t _n_iov = 0;                   // 0 for a sync request
+    bool _pending = false;               // A request has been started and has not completed
+    bool _stop = false;
+    int _error = 0;                      // errno from a failed request, or 0
+
+public:
+    /**
+     * @brief Open a stripe file. The writer thread is started by start().
+     *
+     * @param path          The stripe file
+     * @param append        If true, keep the first valid_length bytes of an existing file and write after them
+     * @param valid_length  With append, the length of the stripe's chunks listed in the manifest. Anything after
+     *                      them (e.g., a chunk whose write was interrupted) is discarded.
+     */
+    StripeWriter(const std::string& path, bool append, uint64_t valid_length) :
+        _path(path)
+    {
+        _fd = ::open(_path.c_str(), append ? (O_WRONLY | O_CREAT) : (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+        if (_fd == -1) {
+            throw std::runtime_error("Failed to open stripe file: " + _path + ": " + strerror(errno));
+        }
+        if (append) {
+            if (ftruncate(_fd, (off_t)valid_length) != 0 || lseek(_fd, (off_t)valid_length, SEEK_SET) == (off_t)-1) {
+                int err = errno;
+                ::close(_fd);
+                throw std::system_error(err, std::system_category(), "Failed to truncate stripe file " + _path);
+            }
+        }
+    }
+
+    StripeWriter(const StripeWriter&) = delete;
+    StripeWriter& operator=(const StripeWriter&) = delete;
+
+    ~StripeWriter() {
+        stop();
+        if (_fd != -1) {
+            ::close(_fd);
+        }
+    }
+
+    const std::string& path() const {
+        return _path;
+    }
+
+    /**
+     * @brief Start the writer thread. Called from the copying thread, so that it inherits its signal mask.
+     */
+    void start() {
+        _thread = std::thread(&StripeWriter::run, this);
+    }
+
+    /**
+     * @brief Start writing a chunk given as 1 or 2 iovecs, which must stay valid until wait() returns.
+     */
+    void start_write(const struct iovec *iov, size_t n_iov) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (size_t i = 0; i < n_iov; ++i) {
+            _iov[i] = iov[i];
+        }
+        _n_iov = n_iov;
+        _pending = true;
+        _cv.notify_all();
+    }
+
+    /**
+     * @brief Start syncing the stripe file to stable storage.
+     */
+    void start_sync() {
+        start_write(nullptr, 0);
+    }
+
+    /**
+     * @brief Wait for the current request to complete. Throws if it failed.
+     */
+    void wait() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this]() { return !_pending; });
+        if (_error != 0) {
+            throw std::system_error(_error, std::system_category(), (_n_iov == 0 ? "fdatasync() failed for " : "writev() failed for ") + _path);
+        }
+    }
+
+    /**
+     * @brief Stop the writer thread after any current request.
+     */
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _cv.notify_all();
+        }
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+protected:
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cv.wait(lock, [this]() { return _stop || _pending; });
+            if (!_pending) {
+                break;
+            }
+            struct iovec iov[2];
+            size_t n_iov = _n_iov;
+            for (size_t i = 0; i < n_iov; ++i) {
+                iov[i] = _iov[i];
+            }
+            lock.unlock();
+            int err = (n_iov == 0) ? ((fdatasync(_fd) == 0) ? 0 : errno) : write_fully(iov, n_iov);
+            lock.lock();
+            _error = err;
+            _pending = false;
+            _cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief writev() all of an iovec list, continuing after short writes. Returns 0 or an errno.
+     */
+    int write_fully(struct iovec *iov, size_t n_iov) {
+        while (n_iov > 0) {
+            ssize_t ret = writev(_fd, iov, (int)n_iov);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            size_t nb = (size_t)ret;
+            while (n_iov > 0 && nb >= iov[0].iov_len) {
+                nb -= iov[0].iov_len;
+                ++iov;
+                --n_iov;
+            }
+            if (n_iov > 0) {
+                iov[0].iov_base = (char *)iov[0].iov_base + nb;
+                iov[0].iov_len -= nb;
+            }
+        }
+        return 0;
+    }
+};
+
+/**
+ * @brief Datagram Destination that stripes a capture across several files, typically on different devices, so
+ *        that their write bandwidth adds up.
+ *
+ * Path format: "stripe://<manifest>?paths=<path>,<path>[,...][&chunk=<size>]". Arguments:
+ *
+ *     paths=<list>   Comma-separated stripe files, one per device. Required.
+ *     chunk=<size>   Target chunk size (e.g., "16M"). Default 8M. Chunks are cut at record boundaries, so a
+ *                    chunk holds whole records; a record larger than the chunk size gets a chunk of its own.
+ *
+ * The queue is cut into chunks that are assigned to the stripes round-robin. Each stripe has its own writer
+ * thread, so a round of chunks (one per stripe) is written and synced to all the devices at once; when the round
+ * is on stable storage, its chunks are appended to the manifest (see StripeManifest), which the stripe:// source
+ * uses to read the capture back in order. Partial chunks are only written when the input is idle or at EOF.
+ *
+ * With --append, chunks are added to an existing striped capture, which must have the same stripes.
+ */
+class StripedDatagramDestination : public DatagramDestination {
+private:
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _filename;                     // The manifest
+    size_t _chunk_size = DEFAULT_STRIPE_CHUNK_SIZE;
+    StripeManifest _manifest;                  // Stripes, and in append mode the chunks already written
+    uint64_t _n_chunks = 0;                    // Chunks in the capture; the next chunk goes to stripe _n_chunks % n
+    int _manifest_fd = -1;
+    std::vector<std::unique_ptr<StripeWriter>> _writers;
+    bool _closed = false;
+
+public:
+    StripedDatagramDestination(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path)
+    {
+        ObjectCloser closer(this);
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(_path, "stripe://", args);
+        for (auto& arg : args) {
+            if (arg.first == "paths") {
+                size_t start = 0;
+                while (start <= arg.second.size()) {
+                    size_t comma_pos = arg.second.find(',', start);
+                    if (comma_pos == std::string::npos) {
+                        comma_pos = arg.second.size();
+                    }
+                    std::string stripe_path = arg.second.substr(start, comma_pos - start);
+                    if (stripe_path.empty()) {
+                        throw std::runtime_error("Empty stripe path in stripe:// paths: " + arg.second);
+                    }
+                    _manifest.paths.push_back(StripeManifest::absolute_path(stripe_path));
+                    start = comma_pos + 1;
+                }
+            } else if (arg.first == "chunk") {
+                _chunk_size = parse_byte_size(arg.second);
+                if (_chunk_size == 0) {
+                    throw std::runtime_error("Stripe chunk size must be positive: " + arg.second);
+                }
+            } else {
+                throw std::runtime_error("Invalid argument to stripe://: " + arg.first);
+            }
+        }
+        if (_manifest.paths.empty()) {
+            throw std::runtime_error("stripe:// requires paths=<path>,<path>[,...]: " + path);
+        }
+        _manifest.metadata = _config.metadata;
+
+        bool append = false;
+        struct stat st;
+        if (_config.append && ::stat(_filename.c_str(), &st) == 0 && st.st_size > 0) {
+            StripeManifest existing = StripeManifest::read(_filename);
+            if (existing.paths != _manifest.paths || existing.metadata != _manifest.metadata) {
+                throw std::runtime_error("Cannot append to striped capture " + _filename + " with different stripes or metadata");
+            }
+            _manifest.chunks = std::move(existing.chunks);
+            _n_chunks = _manifest.chunks.size();
+            append = true;
+        }
+
+        // Rewriting the manifest also drops the incomplete last line that an interrupted capture may have left
+        _manifest_fd = ::open(_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (_manifest_fd == -1) {
+            throw std::runtime_error("Failed to open stripe manifest: " + _path + ": " + strerror(errno));
+        }
+        std::string text = _manifest.header_str();
+        for (auto& chunk : _manifest.chunks) {
+            text += StripeManifest::chunk_line(chunk.stripe, chunk.length);
+        }
+        write_manifest(text);
+
+        for (size_t i = 0; i < _manifest.paths.size(); ++i) {
+            _writers.push_back(std::make_unique<StripeWriter>(_manifest.paths[i], append, _manifest.stripe_length(i)));
+        }
+        closer.detach();
+    }
+
+    ~StripedDatagramDestination() override {
+        close();
+    }
+
+    /**
+     * @brief Copy datagrams from the BufferQueue until an EOF is encountered.
+     *
+     * On exit the files will be closed, even on exception.
+     *
+     * @param buffer_queue The buffer queue to read datagrams from.
+     * @param stats        The threadsafe stats object to update with real-time progress.
+     */
+    void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
+        ObjectCloser closer(this);  // close the files before returning
+        auto idle_interval = std::chrono::nanoseconds(static_cast<int64_t>(DEFAULT_POLLING_INTERVAL * 1e9));
+        size_t n_stripes = _writers.size();
+
+        // Leave room in the backlog for the producer while a round is being written
+        size_t chunk_size = std::max(std::min(_chunk_size, _config.max_backlog / (2 * n_stripes)), (size_t)1);
+        if (chunk_size < _chunk_size) {
+            BOOST_LOG_TRIVIAL(warning) << "Stripe chunk size reduced to " << chunk_size << " bytes to fit the backlog\n";
+        }
+        size_t n_round = n_stripes * chunk_size;
+
+        for (auto& writer : _writers) {
+            writer->start();
+        }
+
+        DgDestinationStats local_stats;
+        std::vector<StripeManifest::Chunk> round;
+        while (true) {
+            auto deadline = std::chrono::steady_clock::now() + idle_interval;
+            BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(deadline, n_round);
+            if (batch.n == 0) {
+                if (buffer_queue.is_eof() && !buffer_queue.is_consumer_paused()) {
+                    break;
+                }
+                continue;
+            }
+            // Short of a full round, the input is idle or at EOF; write what there is rather than waiting
+            bool partial_ok = batch.n < n_round;
+
+            round.clear();
+            size_t pos = 0;
+            while (round.size() < n_stripes) {
+                size_t end = pos;
+                bool at_end = false;
+                while (true) {
+                    if (batch.n - end < PREFIX_LEN) {
+                        at_end = true;
+                        break;
+                    }
+                    uint32_t nbo_prefix;
+                    batch.peek(end, &nbo_prefix, PREFIX_LEN);
+                    size_t nb_record = PREFIX_LEN + ntohl(nbo_prefix);
+                    if (nb_record > batch.n - end) {
+                        at_end = true;
+                        break;
+                    }
+                    if (end > pos && end - pos + nb_record > chunk_size) {
+                        break;
+                    }
+                    end += nb_record;
+                }
+                if (end == pos || (at_end && !partial_ok && !round.empty())) {
+                    // Leave a partial chunk to fill up
+                    break;
+                }
+                size_t stripe = (size_t)((_n_chunks + round.size()) % n_stripes);
+                struct iovec iov[2];
+                size_t n_iov = slice_batch(batch, pos, end - pos, iov);
+                _writers[stripe]->start_write(iov, n_iov);
+                round.push_back(StripeManifest::Chunk{stripe, end - pos});
+                pos = end;
+            }
+            if (round.empty()) {
+                if (buffer_queue.is_eof()) {
+                    // EOF is only set after the final datagram, so the queue can no longer grow
+                    auto final_batch = buffer_queue.consumer_start_batch(0);
+                    if (final_batch.n != 0) {
+                        BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
+                    }
+                    break;
+                }
+                continue;
+            }
+
+            // Sync the round's chunks before listing them, so that the manifest never lists unsynced data
+            for (auto& chunk : round) {
+                _writers[chunk.stripe]->wait();
+                _writers[chunk.stripe]->start_sync();
+            }
+            std::string text;
+            for (auto& chunk : round) {
+                _writers[chunk.stripe]->wait();
+                text += StripeManifest::chunk_line(chunk.stripe, chunk.length);
+            }
+            write_manifest(text);
+            _n_chunks += round.size();
+            buffer_queue.consumer_commit_batch(pos);
+
+            local_stats.n_stripe_chunks += round.size();
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats = local_stats;
+            }
+        }
+
+        if (fsync(_manifest_fd) != 0) {
+            throw std::system_error(errno, std::system_category(), "fsync() failed for stripe manifest " + _filename);
+        }
+    }
+
+    /**
+     * @brief Stop the writer threads and close the files.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_closed) {
+            _closed = true;
+            _writers.clear();
+            if (_manifest_fd != -1) {
+                ::close(_manifest_fd);
+                _manifest_fd = -1;
+            }
+        }
+    }
+
+    /**
+     * @brief static factory method to create a typed DatagramDestination based on a pathname
+     *
+     * @param config   The configuration object
+     * @param path     The path to the destination
+     *
+     * @return unique_ptr<DatagramDestination>
+     */
+    static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<StripedDatagramDestination>(config, path);
+    }
+
+protected:
+    /**
+     * @brief Describe nb bytes starting offset bytes into a batch as 1 or 2 iovecs. Returns the number used.
+     */
+    static size_t slice_batch(const BufferQueue::ConsumerBatch& batch, size_t offset, size_t nb, struct iovec *iov) {
+        size_t n0 = batch.iov[0].iov_len;
+        if (offset + nb <= n0) {
+            iov[0].iov_base = (char *)batch.iov[0].iov_base + offset;
+            iov[0].iov_len = nb;
+            return 1;
+        }
+        if (offset >= n0) {
+            iov[0].iov_base = (char *)batch.iov[1].iov_base + (offset - n0);
+            iov[0].iov_len = nb;
+            return 1;
+        }
+        iov[0].iov_base = (char *)batch.iov[0].iov_base + offset;
+        iov[0].iov_len = n0 - offset;
+        iov[1].iov_base = batch.iov[1].iov_base;
+        iov[1].iov_len = nb - iov[0].iov_len;
+        return 2;
+    }
+
+    void write_manifest(const std::string& text) {
+        const char *p = text.data();
+        size_t n = text.size();
+        while (n > 0) {
+            ssize_t ret = ::write(_manifest_fd, p, n);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "write() failed for stripe manifest " + _filename);
+            }
+            p += ret;
+            n -= (size_t)ret;
+        }
+    }
+};
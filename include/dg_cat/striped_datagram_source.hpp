@@ -0,0 +1,331 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "datagram_source.hpp"
+#include "buffer_queue.hpp"
+#include "config.hpp"
+#include "datagram_metadata.hpp"
+#include "object_closer.hpp"
+#include "stripe_manifest.hpp"
+#include "util.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/**
+ * @brief Datagram source that reads back a striped capture written by the stripe:// destination.
+ *
+ * Path format: "stripe://<manifest>". Each stripe has a reader thread that reads the stripe's chunks in order,
+ * up to DEFAULT_STRIPE_READ_AHEAD chunks ahead of the copying thread, so all the devices are read in parallel
+ * while the chunks are replayed in manifest order. A capture written with metadata must be read with metadata,
+ * and vice versa.
+ */
+class StripedDatagramSource : public DatagramSource {
+private:
+    struct StripeReader {
+        std::string path;
+        int fd = -1;
+        std::vector<uint64_t> chunk_lengths;     // This stripe's chunks, in capture order
+        std::deque<std::vector<char>> filled;    // Chunks read and not yet replayed
+        std::vector<std::vector<char>> spare;    // Replayed chunk buffers, for reuse
+        size_t n_outstanding = 0;                // Chunks being read, or read and not yet replayed
+        std::thread thread;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _filename;                     // The manifest
+    StripeManifest _manifest;
+    std::vector<std::unique_ptr<StripeReader>> _readers;
+    bool _force_eof = false;
+    bool _closed = false;
+    std::exception_ptr _error;                 // The first failure of a reader thread
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<struct iovec> _iovs;
+    std::vector<DatagramMetadata> _metadata;   // Only used if metadata is enabled
+
+public:
+    StripedDatagramSource(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path)
+    {
+        ObjectCloser closer(this);
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(_path, "stripe://", args);
+        for (auto& arg : args) {
+            throw std::runtime_error("Invalid argument to stripe://: " + arg.first);
+        }
+        _manifest = StripeManifest::read(_filename);
+        if (_manifest.metadata != _config.metadata) {
+            throw std::runtime_error("Striped capture " + _filename + (_manifest.metadata ?
+                " has metadata; it must be read with --metadata" : " has no metadata; it cannot be read with --metadata"));
+        }
+        for (size_t i = 0; i < _manifest.paths.size(); ++i) {
+            auto reader = std::make_unique<StripeReader>();
+            reader->path = _manifest.paths[i];
+            reader->fd = ::open(reader->path.c_str(), O_RDONLY);
+            if (reader->fd == -1) {
+                throw std::runtime_error("Failed to open stripe file: " + reader->path + ": " + strerror(errno));
+            }
+            posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            _readers.push_back(std::move(reader));
+        }
+        for (auto& chunk : _manifest.chunks) {
+            _readers[chunk.stripe]->chunk_lengths.push_back(chunk.length);
+        }
+        for (size_t i = 0; i < _readers.size(); ++i) {
+            struct stat st;
+            uint64_t length = _manifest.stripe_length(i);
+            if (fstat(_readers[i]->fd, &st) != 0 || (uint64_t)st.st_size < length) {
+                throw std::runtime_error("Stripe file " + _readers[i]->path + " is shorter than its " +
+                                         std::to_string(length) + " bytes of chunks in " + _filename);
+            }
+        }
+
+        size_t max_records = std::max(_config.max_read_size / PREFIX_LEN, (size_t)1);
+        _msgs.resize(max_records);
+        _iovs.resize(max_records);
+        if (_config.metadata) {
+            _metadata.resize(max_records);
+        }
+        for (size_t i = 0; i < max_records; ++i) {
+            _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+            _msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        closer.detach();
+    }
+
+    /**
+     * @brief factory-invoked static method to create a StripedDatagramSource
+     *
+     * @param config   The configuration object
+     * @param path     The path to the source
+     *
+     * @return unique_ptr<DatagramSource>
+     */
+    static std::unique_ptr<DatagramSource> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<StripedDatagramSource>(config, path);
+    }
+
+    ~StripedDatagramSource() override
+    {
+        close();
+    }
+
+    /**
+     * @brief Copy datagrams from the source until the end of the capture or until force_eof() is called.
+     *
+     * @param buffer_queue The buffer queue to write datagrams to.
+     */
+    void copy_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) override {
+        ObjectCloser closer(this);  // stop the reader threads before returning
+        for (auto& reader : _readers) {
+            reader->thread = std::thread(&StripedDatagramSource::read_stripe, this, reader.get());
+        }
+
+        uint64_t n_datagrams = 0;
+        struct timespec end_time;
+        struct timespec start_time;
+        time_t start_clock_time = 0;
+        for (auto& chunk : _manifest.chunks) {
+            StripeReader& reader = *_readers[chunk.stripe];
+            std::vector<char> buffer;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this, &reader]() { return _force_eof || _error || !reader.filled.empty(); });
+                if (_error) {
+                    std::rethrow_exception(_error);
+                }
+                if (_force_eof) {
+                    BOOST_LOG_TRIVIAL(debug) << "Forced EOF; shutting down\n";
+                    break;
+                }
+                buffer = std::move(reader.filled.front());
+                reader.filled.pop_front();
+            }
+
+            size_t pos = 0;
+            while (pos < buffer.size()) {
+                size_t n_batch_datagrams = parse_records(buffer, pos);
+
+                clock_gettime(CLOCK_REALTIME, &end_time);
+                if (n_datagrams == 0) {
+                    start_time = end_time;
+                    start_clock_time = time(nullptr);
+
+                    BOOST_LOG_TRIVIAL(debug) << "First datagram received...\n";
+                }
+
+                buffer_queue.producer_commit_batch(_msgs.data(), n_batch_datagrams, _config.metadata ? _metadata.data() : nullptr);
+                n_datagrams += n_batch_datagrams;
+
+                {
+                    // update stats here
+                    std::lock_guard<std::mutex> lock(stats._mutex);
+                    stats.max_clump_size = std::max(stats.max_clump_size, n_batch_datagrams);
+                    stats.start_clock_time = start_clock_time;
+                    stats.start_time = start_time;
+                    stats.end_time = end_time;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                reader.spare.push_back(std::move(buffer));
+                reader.n_outstanding--;
+            }
+            _cv.notify_all();
+        }
+        BOOST_LOG_TRIVIAL(debug) << "EOF; shutting down\n";
+    }
+
+    /**
+     * @brief Force an EOF condition on the source. This method will be called from a different
+     *        thread than copy_to_buffer_queue().
+     */
+    void force_eof() override {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _force_eof = true;
+        }
+        _cv.notify_all();
+    }
+
+    /**
+     * @brief Stop the reader threads and close the stripe files.
+     */
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_closed) {
+                return;
+            }
+            _closed = true;
+            _force_eof = true;
+        }
+        _cv.notify_all();
+        for (auto& reader : _readers) {
+            if (reader->thread.joinable()) {
+                reader->thread.join();
+            }
+            if (reader->fd != -1) {
+                ::close(reader->fd);
+                reader->fd = -1;
+            }
+        }
+    }
+
+protected:
+    /**
+     * @brief Reader thread for one stripe: read its chunks in order into buffers, staying at most
+     *        DEFAULT_STRIPE_READ_AHEAD chunks ahead of the copying thread.
+     */
+    void read_stripe(StripeReader *reader) {
+        try {
+            for (uint64_t length : reader->chunk_lengths) {
+                std::vector<char> buffer;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cv.wait(lock, [this, reader]() { return _force_eof || reader->n_outstanding < DEFAULT_STRIPE_READ_AHEAD; });
+                    if (_force_eof) {
+                        return;
+                    }
+                    reader->n_outstanding++;
+                    if (!reader->spare.empty()) {
+                        buffer = std::move(reader->spare.back());
+                        reader->spare.pop_back();
+                    }
+                }
+                buffer.resize(length);
+                size_t n_read = 0;
+                while (n_read < length) {
+                    ssize_t nb = ::read(reader->fd, buffer.data() + n_read, length - n_read);
+                    if (nb < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        throw std::system_error(errno, std::system_category(), "read() failed for stripe file " + reader->path);
+                    }
+                    if (nb == 0) {
+                        throw std::runtime_error("Unexpected EOF in stripe file " + reader->path);
+                    }
+                    n_read += (size_t)nb;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    reader->filled.push_back(std::move(buffer));
+                }
+                _cv.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error) {
+                _error = std::current_exception();
+            }
+            _cv.notify_all();
+        }
+    }
+
+    /**
+     * @brief Describe the records of a chunk starting at pos in _msgs, _iovs and (with metadata) _metadata, up to
+     *        the capacity of _msgs or max_read_size bytes, and advance pos past them.
+     *
+     * @return size_t  The number of records found. At least 1.
+     */
+    size_t parse_records(const std::vector<char>& chunk, size_t& pos) {
+        size_t n_batch_datagrams = 0;
+        size_t n_batch_bytes = 0;
+        while (pos < chunk.size() && n_batch_datagrams < _msgs.size()) {
+            if (chunk.size() - pos < PREFIX_LEN) {
+                throw std::runtime_error("Corrupt striped capture " + _filename + ": chunk ends within a length prefix");
+            }
+            size_t nb_datagram = read_length_prefix(chunk.data() + pos);
+            if (nb_datagram > chunk.size() - pos - PREFIX_LEN) {
+                throw std::runtime_error("Corrupt striped capture " + _filename + ": record crosses the end of a chunk");
+            }
+            if (n_batch_datagrams > 0 && n_batch_bytes + PREFIX_LEN + nb_datagram > _config.max_read_size) {
+                break;
+            }
+            const char *record = chunk.data() + pos + PREFIX_LEN;
+            _iovs[n_batch_datagrams].iov_base = (void *)record;
+            _iovs[n_batch_datagrams].iov_len = nb_datagram;
+            _msgs[n_batch_datagrams].msg_len = nb_datagram;
+            if (_config.metadata) {
+                // The record begins with a metadata header, which is passed separately to the queue
+                if (nb_datagram < METADATA_LEN) {
+                    throw std::runtime_error("Capture record too short to contain metadata: " + std::to_string(nb_datagram) + " bytes");
+                }
+                _metadata[n_batch_datagrams] = DatagramMetadata::decode(record);
+                _iovs[n_batch_datagrams].iov_base = (void *)(record + METADATA_LEN);
+                _iovs[n_batch_datagrams].iov_len = nb_datagram - METADATA_LEN;
+                _msgs[n_batch_datagrams].msg_len = nb_datagram - METADATA_LEN;
+            }
+            pos += PREFIX_LEN + nb_datagram;
+            n_batch_bytes += PREFIX_LEN + nb_datagram;
+            ++n_batch_datagrams;
+        }
+        return n_batch_datagrams;
+    }
+};
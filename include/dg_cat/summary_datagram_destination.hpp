@@ -0,0 +1,343 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <boost/endian/conversion.hpp>
+#include <boost/log/trivial.hpp>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "bounded_hash_table.hpp"
+#include "buffer_queue.hpp"
+#include "datagram_destination.hpp"
+#include "config.hpp"
+#include "stats.hpp"
+#include "object_closer.hpp"
+#include "tsc_clock.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Datagram Destination that writes only per-interval counts of datagrams and payload bytes for each value
+ *        of a key field, rather than the datagrams themselves.
+ *
+ * The key is the <width> bytes (1 to 8) at byte <offset> of each payload, e.g., a message type field; without a
+ * key, all datagrams are counted together. Datagrams are assigned to intervals by their metadata timestamp if
+ * metadata is enabled (so a capture can be summarized after the fact), and by the time they are consumed
+ * otherwise. Datagrams that arrive out of order are counted in the current interval.
+ *
+ * When an interval ends (a datagram for a later interval is seen, the input has been idle past the end of the
+ * interval when timing by consumption, or EOF), one CSV line per key is written, ordered by key:
+ *
+ *     interval_start,key,datagrams,bytes
+ *     1760788800.000000,0041,18231,2005410
+ *
+ * interval_start is in seconds since the epoch, and key is the key's bytes in hex. Datagrams too short to hold
+ * the key are counted under "short", and keys beyond the first <max-keys> in an interval under "other".
+ *
+ * Path format: "summary://<filename>[?key=<offset>:<width>][&interval=<duration>][&max=<max-keys>]", where
+ * <filename> may be "-" or "stdout". The default interval is 1s.
+ */
+class SummaryDatagramDestination : public DatagramDestination {
+private:
+    struct Counts {
+        uint64_t n_datagrams = 0;
+        uint64_t n_bytes = 0;
+    };
+
+    // Counts by key for one interval; cleared (keeping its memory) as each interval is written
+    typedef BoundedHashTable<uint64_t, Counts> KeyCounts;
+
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _filename;
+    int _fd = -1;
+    bool _closed = false;
+    size_t _key_offset = 0;
+    size_t _key_width = 0;               // 0 if all datagrams are counted together
+    int64_t _interval_ns;
+    KeyCounts _counts;
+    Counts _short_counts;                // Datagrams too short to hold the key
+    Counts _other_counts;                // Datagrams whose key did not fit in _counts
+    bool _have_interval = false;         // True if datagrams have been counted in the current interval
+    int64_t _interval_start_ns = 0;      // Start of the current interval, in nanoseconds since the epoch
+    TscClock _clock;                     // Time of consumption, if datagrams have no metadata timestamp
+    std::string _out;                    // Pending output
+    DgDestinationStats _stats;
+
+public:
+    SummaryDatagramDestination(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path),
+        _interval_ns((int64_t)(DEFAULT_SUMMARY_INTERVAL_SECS * 1.0e9)),
+        _counts(DEFAULT_SUMMARY_MAX_KEYS)
+    {
+        ObjectCloser fd_closer(this);
+        std::map<std::string, std::string> args;
+        _filename = parse_path_args(path, "summary://", args);
+        size_t max_keys = DEFAULT_SUMMARY_MAX_KEYS;
+        for (auto& arg : args) {
+            if (arg.first == "key") {
+                size_t colon_pos = arg.second.find(':');
+                if (colon_pos == std::string::npos) {
+                    throw std::runtime_error("Invalid summary:// key (must be <offset>:<width>): " + arg.second);
+                }
+                _key_offset = std::stoul(arg.second.substr(0, colon_pos));
+                _key_width = std::stoul(arg.second.substr(colon_pos + 1));
+                if (_key_width < 1 || _key_width > sizeof(uint64_t)) {
+                    throw std::runtime_error("summary:// key width must be 1 to 8 bytes: " + arg.second);
+                }
+            } else if (arg.first == "interval") {
+                _interval_ns = (int64_t)(parse_duration_secs(arg.second) * 1.0e9);
+            } else if (arg.first == "max") {
+                max_keys = std::stoul(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to summary://: " + arg.first);
+            }
+        }
+        if (_interval_ns < 1000) {
+            throw std::runtime_error("summary:// interval must be at least 1us");
+        }
+        if (max_keys == 0) {
+            throw std::runtime_error("summary:// max must be > 0");
+        }
+        _counts = KeyCounts(max_keys);
+
+        if (_filename.empty()) {
+            throw std::runtime_error("Output filename required for summary:// destination: " + path);
+        }
+        if (_filename == "-" || _filename == "stdout") {
+            _filename = "stdout";
+            _fd = dup(STDOUT_FILENO);
+        } else {
+            int oflags = O_WRONLY | O_CREAT | O_CLOEXEC | (config.append ? O_APPEND : O_TRUNC);
+            _fd = ::open(_filename.c_str(), oflags, 0644);
+        }
+        if (_fd == -1) {
+            throw std::runtime_error("Failed to open file: " + path + ": " + strerror(errno));
+        }
+        fd_closer.detach();
+    }
+
+    ~SummaryDatagramDestination() override {
+        close();
+    }
+
+    /**
+     * @brief Count datagrams from the BufferQueue until an EOF is encountered, writing a summary as each interval
+     *        ends. Only the length prefix, timestamp and key of each datagram are read from the queue.
+     *
+     * On exit the file handle will be closed, even on exception.
+     *
+     * @param buffer_queue The buffer queue to read datagrams from.
+     * @param stats        The threadsafe stats object to update with real-time progress.
+     */
+    void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
+        ObjectCloser fd_closer(this);  // close the file descriptor before returning
+        double poll_secs = std::min(DEFAULT_POLLING_INTERVAL, (double)_interval_ns / 1.0e9);
+        auto poll_interval = std::chrono::nanoseconds(static_cast<int64_t>(poll_secs * 1e9));
+        size_t metadata_len = _config.metadata ? METADATA_LEN : 0;
+
+        // An appended file already has a header
+        if (lseek(_fd, 0, SEEK_END) <= 0) {
+            _out += "interval_start,key,datagrams,bytes\n";
+        }
+
+        size_t n_min = PREFIX_LEN;
+        while (true) {
+            auto deadline = std::chrono::steady_clock::now() + poll_interval;
+            BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(deadline, n_min);
+            int64_t now_ns = _clock.realtime_ns(TscClock::ticks());
+            size_t n_consumed = 0;
+            while (batch.n - n_consumed >= PREFIX_LEN) {
+                uint32_t nbo_prefix;
+                batch.peek(n_consumed, &nbo_prefix, PREFIX_LEN);
+                size_t nb_record = ntohl(nbo_prefix);
+                if (batch.n - n_consumed - PREFIX_LEN < nb_record) {
+                    break;
+                }
+                if (nb_record < metadata_len) {
+                    throw std::runtime_error("Datagram record too short to contain metadata: " + std::to_string(nb_record) + " bytes");
+                }
+                int64_t timestamp_ns = now_ns;
+                if (metadata_len != 0) {
+                    int64_t ts_nbo;
+                    batch.peek(n_consumed + PREFIX_LEN, &ts_nbo, sizeof(ts_nbo));
+                    int64_t metadata_ns = boost::endian::big_to_native(ts_nbo);
+                    if (metadata_ns != 0) {
+                        timestamp_ns = metadata_ns;
+                    }
+                }
+                count_datagram(batch, n_consumed + PREFIX_LEN + metadata_len, nb_record - metadata_len, timestamp_ns);
+                n_consumed += PREFIX_LEN + nb_record;
+            }
+            buffer_queue.consumer_commit_batch(n_consumed);
+
+            if (n_consumed == 0) {
+                if (batch.n >= PREFIX_LEN) {
+                    // Wait for the rest of a partially buffered datagram
+                    uint32_t nbo_prefix;
+                    batch.peek(0, &nbo_prefix, PREFIX_LEN);
+                    n_min = PREFIX_LEN + ntohl(nbo_prefix);
+                }
+                if (buffer_queue.is_eof()) {
+                    // EOF is only set after the final datagram, so the queue can no longer grow
+                    auto final_batch = buffer_queue.consumer_start_batch(0);
+                    if (final_batch.n < n_min) {
+                        if (final_batch.n != 0) {
+                            BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
+                        }
+                        break;
+                    }
+                    continue;
+                }
+                // Input is idle; report the current interval once it is over. Metadata timestamps are not
+                // comparable with the consume clock, so with metadata an interval is only ended by a datagram
+                // from a later one, or by EOF.
+                if (metadata_len == 0 && _have_interval && now_ns >= _interval_start_ns + _interval_ns) {
+                    write_interval();
+                }
+            } else {
+                n_min = PREFIX_LEN;
+            }
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats = _stats;
+            }
+        }
+        write_interval();
+        {
+            std::lock_guard<std::mutex> lock(stats._mutex);
+            stats = _stats;
+        }
+    }
+
+    /**
+     * @brief Close the file descriptor.
+     */
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_closed) {
+            _closed = true;
+            if (_fd != -1) {
+                ::close(_fd);
+                _fd = -1;
+            }
+        }
+    }
+
+    /**
+     * @brief static factory method to create a typed DatagramDestination based on a pathname
+     *
+     * @param config   The configuration object
+     * @param path     The path to the destination
+     *
+     * @return unique_ptr<DatagramDestination>
+     */
+    static std::unique_ptr<DatagramDestination> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<SummaryDatagramDestination>(config, path);
+    }
+
+protected:
+    /**
+     * @brief Count a datagram whose payload is at payload_pos in the batch, first ending the current interval if
+     *        the datagram belongs to a later one.
+     */
+    inline void count_datagram(const BufferQueue::ConsumerBatch& batch, size_t payload_pos, size_t nb_payload, int64_t timestamp_ns) {
+        int64_t remainder = timestamp_ns % _interval_ns;
+        int64_t start_ns = timestamp_ns - ((remainder < 0) ? remainder + _interval_ns : remainder);
+        if (!_have_interval) {
+            _interval_start_ns = start_ns;
+            _have_interval = true;
+        } else if (start_ns > _interval_start_ns) {
+            write_interval();
+            _interval_start_ns = start_ns;
+            _have_interval = true;
+        }
+        Counts *counts;
+        bool inserted;
+        if (_key_width == 0) {
+            counts = _counts.find_or_insert(0, inserted);
+        } else if (nb_payload < _key_offset + _key_width) {
+            counts = &_short_counts;
+        } else {
+            unsigned char key_bytes[sizeof(uint64_t)];
+            batch.peek(payload_pos + _key_offset, key_bytes, _key_width);
+            uint64_t key = 0;
+            for (size_t i = 0; i < _key_width; ++i) {
+                key = (key << 8) | key_bytes[i];
+            }
+            counts = _counts.find_or_insert(key, inserted);
+            if (counts == nullptr) {
+                counts = &_other_counts;
+            }
+        }
+        counts->n_datagrams++;
+        counts->n_bytes += nb_payload;
+    }
+
+    /**
+     * @brief Write the summary of the current interval (if any datagrams were counted) and start a new one.
+     */
+    void write_interval() {
+        if (_have_interval) {
+            char interval_start[32];
+            snprintf(interval_start, sizeof(interval_start), "%lld.%06lld",
+                     (long long)(_interval_start_ns / 1000000000), (long long)(_interval_start_ns % 1000000000 / 1000));
+            auto& entries = _counts.entries();
+            std::sort(entries.begin(), entries.end(),
+                      [](const KeyCounts::Entry& a, const KeyCounts::Entry& b) { return a.key < b.key; });
+            for (auto& entry : entries) {
+                if (_key_width == 0) {
+                    append_row(interval_start, "all", entry.value);
+                } else {
+                    char key[24];
+                    snprintf(key, sizeof(key), "%0*llx", (int)(2 * _key_width), (unsigned long long)entry.key);
+                    append_row(interval_start, key, entry.value);
+                }
+            }
+            append_row(interval_start, "short", _short_counts);
+            append_row(interval_start, "other", _other_counts);
+            _counts.clear();
+            _short_counts = Counts();
+            _other_counts = Counts();
+            _have_interval = false;
+            _stats.n_summaries++;
+        }
+        write_all();
+    }
+
+    void append_row(const char *interval_start, const char *key, const Counts& counts) {
+        if (counts.n_datagrams != 0) {
+            _out += std::string(interval_start) + "," + key + "," + std::to_string(counts.n_datagrams) + "," +
+                    std::to_string(counts.n_bytes) + "\n";
+            _stats.n_summary_rows++;
+        }
+    }
+
+    void write_all() {
+        size_t pos = 0;
+        while (pos < _out.size()) {
+            ssize_t nb = ::write(_fd, _out.data() + pos, _out.size() - pos);
+            if (nb < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::system_category(), "write() to " + _filename + " failed");
+            }
+            pos += (size_t)nb;
+        }
+        _out.clear();
+    }
+};
@@ -78,3 +78,18 @@ inline struct timespec secs_to_timespec(double secs) {
     return normalize_timespec(sec, nsec);
 }
 
+
+/**
+ * @brief Compare two normalized timespec values
+ *
+ * @return int  Negative if time1 < time2, zero if equal, positive if time1 > time2
+ */
+inline int timespec_compare(const struct timespec& time1, const struct timespec& time2) {
+    if (time1.tv_sec != time2.tv_sec) {
+        return (time1.tv_sec < time2.tv_sec) ? -1 : 1;
+    }
+    if (time1.tv_nsec != time2.tv_nsec) {
+        return (time1.tv_nsec < time2.tv_nsec) ? -1 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "constants.hpp"
+#include "timespec_math.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstdint>
+
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define DG_CAT_HAVE_TSC 1
+#endif
+
+/**
+ * @brief A cheap timestamp source for stamping datagrams, based on the CPU's invariant time stamp counter.
+ *
+ * Reading the TSC takes a few nanoseconds, several times less than clock_gettime() even through the vDSO. The
+ * counter's rate is calibrated once per process against CLOCK_MONOTONIC, and tick differences are converted
+ * to nanoseconds with a 32.32 fixed-point multiply, so durations (e.g., how long a datagram waited in the
+ * backlog) can be measured at full rate.
+ *
+ * Wall-clock time is extrapolated from an anchor pair of (ticks, CLOCK_REALTIME) readings, which each instance
+ * refreshes every DEFAULT_TSC_REANCHOR_SECS; this bounds the drift due to calibration error, and follows NTP
+ * adjustments and steps of the real-time clock. Instances are not thread-safe; each stamping thread should own
+ * one.
+ *
+ * If the CPU does not advertise an invariant TSC (or on other architectures), ticks are CLOCK_MONOTONIC
+ * nanoseconds read through the vDSO, and everything else works the same way.
+ */
+class TscClock {
+public:
+    static const unsigned FRAC_BITS = 32;          // Fraction bits of the ticks-to-nanoseconds multiplier
+
+private:
+    struct Calibration {
+        bool use_tsc = false;
+        uint64_t ns_per_tick = (uint64_t)1 << FRAC_BITS;   // 32.32 fixed point
+        double ticks_per_sec = 1.0e9;
+    };
+
+    uint64_t _reanchor_ticks;            // Ticks between re-anchors
+    uint64_t _anchor_ticks = 0;          // Ticks at the last anchor
+    int64_t _anchor_ns = 0;              // CLOCK_REALTIME nanoseconds at the last anchor
+
+public:
+    TscClock() :
+        _reanchor_ticks((uint64_t)(DEFAULT_TSC_REANCHOR_SECS * calibration().ticks_per_sec))
+    {
+        anchor();
+    }
+
+    /**
+     * @brief True if ticks come from the invariant TSC rather than from clock_gettime().
+     */
+    static bool tsc_available() {
+        return calibration().use_tsc;
+    }
+
+    static double ticks_per_sec() {
+        return calibration().ticks_per_sec;
+    }
+
+    /**
+     * @brief The current tick count. Only differences between tick counts are meaningful.
+     */
+    static inline uint64_t ticks() {
+#ifdef DG_CAT_HAVE_TSC
+        if (calibration().use_tsc) {
+            return __rdtsc();
+        }
+#endif
+        return monotonic_ns(CLOCK_MONOTONIC);
+    }
+
+    /**
+     * @brief Convert a difference between tick counts to nanoseconds.
+     */
+    static inline uint64_t ticks_to_ns(uint64_t delta_ticks) {
+        return (uint64_t)(((unsigned __int128)delta_ticks * calibration().ns_per_tick) >> FRAC_BITS);
+    }
+
+    /**
+     * @brief The CLOCK_REALTIME time, in nanoseconds since the epoch, at which ticks() returned t. t should be
+     *        recent and must not precede the previous call.
+     */
+    inline int64_t realtime_ns(uint64_t t) {
+        uint64_t delta_ticks = t - _anchor_ticks;
+        if (delta_ticks >= _reanchor_ticks) {
+            anchor();
+            delta_ticks = t - _anchor_ticks;
+            if ((int64_t)delta_ticks < 0) {
+                // t was read just before the new anchor
+                return _anchor_ns - (int64_t)ticks_to_ns(_anchor_ticks - t);
+            }
+        }
+        return _anchor_ns + (int64_t)ticks_to_ns(delta_ticks);
+    }
+
+    inline struct timespec realtime(uint64_t t) {
+        int64_t ns = realtime_ns(t);
+        return normalize_timespec((long)(ns / 1000000000), (long)(ns % 1000000000));
+    }
+
+    /**
+     * @brief The current CLOCK_REALTIME time.
+     */
+    inline struct timespec now() {
+        return realtime(ticks());
+    }
+
+protected:
+    static inline uint64_t monotonic_ns(clockid_t clock_id) {
+        struct timespec ts;
+        clock_gettime(clock_id, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    }
+
+    /**
+     * @brief Take a (ticks, CLOCK_REALTIME) pair, at the midpoint of the tightest of a few tick brackets around
+     *        the clock read, so that a preemption or interrupt between the two reads does not skew the anchor.
+     */
+    void anchor() {
+        uint64_t best_bracket = UINT64_MAX;
+        for (int i = 0; i < 3; ++i) {
+            struct timespec ts;
+            uint64_t t0 = ticks();
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t t1 = ticks();
+            if (t1 - t0 < best_bracket) {
+                best_bracket = t1 - t0;
+                _anchor_ticks = t0 + (t1 - t0) / 2;
+                _anchor_ns = (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+            }
+        }
+    }
+
+    static const Calibration& calibration() {
+        static const Calibration c = calibrate();
+        return c;
+    }
+
+#ifdef DG_CAT_HAVE_TSC
+    /**
+     * @brief Take a bracketed (TSC, CLOCK_MONOTONIC) pair, as in anchor().
+     */
+    static void sample(uint64_t& tsc, uint64_t& ns) {
+        uint64_t best_bracket = UINT64_MAX;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t t0 = __rdtsc();
+            uint64_t clock_ns = monotonic_ns(CLOCK_MONOTONIC);
+            uint64_t t1 = __rdtsc();
+            if (t1 - t0 < best_bracket) {
+                best_bracket = t1 - t0;
+                tsc = t0 + (t1 - t0) / 2;
+                ns = clock_ns;
+            }
+        }
+    }
+#endif
+
+    static Calibration calibrate() {
+        Calibration c;
+#ifdef DG_CAT_HAVE_TSC
+        // CPUID leaf 0x80000007 EDX bit 8: the TSC runs at a constant rate in all P-, C- and T-states
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || (edx & (1u << 8)) == 0) {
+            BOOST_LOG_TRIVIAL(debug) << "No invariant TSC; timestamps use clock_gettime()\n";
+            return c;
+        }
+        uint64_t tsc0 = 0, ns0 = 0, tsc1 = 0, ns1 = 0;
+        sample(tsc0, ns0);
+        struct timespec delay = normalize_timespec(0, (long)(DEFAULT_TSC_CALIBRATION_SECS * 1.0e9));
+        while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+        }
+        sample(tsc1, ns1);
+        if (tsc1 <= tsc0 || ns1 <= ns0) {
+            BOOST_LOG_TRIVIAL(warning) << "TSC calibration failed; timestamps use clock_gettime()\n";
+            return c;
+        }
+        double ns_per_tick = (double)(ns1 - ns0) / (double)(tsc1 - tsc0);
+        c.use_tsc = true;
+        c.ns_per_tick = (uint64_t)(ns_per_tick * (double)((uint64_t)1 << FRAC_BITS) + 0.5);
+        c.ticks_per_sec = 1.0e9 / ns_per_tick;
+        BOOST_LOG_TRIVIAL(debug) << "Timestamps use the invariant TSC at " << c.ticks_per_sec / 1.0e9 << " GHz\n";
+#endif
+        return c;
+    }
+};
@@ -5,23 +5,50 @@
  */
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
+#include <chrono>
 #include <boost/log/trivial.hpp>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include "addrinfo.hpp"
 #include "buffer_queue.hpp"
 #include "datagram_destination.hpp"
 #include "config.hpp"
 #include "stats.hpp"
+#include "histogram.hpp"
 #include "object_closer.hpp"
+#include "send_rate_controller.hpp"
+#include "util.hpp"
 
 /**
- * @brief Datagram Destination that writes to a file.
+ * @brief Datagram Destination that sends to a UDP address.
+ *
+ * Path format: "udp://<remote-addr>:<remote-port>[?<arg>=<value>[&...]]". Arguments:
+ *
+ *     nonblock=1         Send on a nonblocking socket. When the local stack pushes back (EAGAIN or ENOBUFS),
+ *                        wait for POLLOUT and retry instead of failing.
+ *     adaptive=1         Implies nonblock=1. Adapt the pacing rate with AIMD to the highest rate that sends without
+ *                        backpressure, starting from (and never exceeding) --max-datagram-rate if given.
+ *     txstamp=1          Ask the kernel for a software transmit timestamp of each datagram (SO_TIMESTAMPING), taken
+ *                        as the driver hands it to the device, and read them back from the socket error queue.
+ *
+ * The achieved send rate is reported in the destination stats. With txstamp=1, the stats also report the intervals
+ * between the transmit timestamps of consecutive datagrams, i.e., the spacing actually produced on the wire, and
+ * the pacing error: how far from its due time a paced datagram was transmitted, counting only datagrams that were
+ * ready before they were due (so that an idle source does not count against the pacer).
  */
 class UdpDatagramDestination : public DatagramDestination {
 private:
@@ -30,6 +57,36 @@ private:
     std::string _path;
     int _sock = -1;
     bool _closed = false;
+    bool _nonblock = false;
+    std::unique_ptr<SendRateController> _rate_controller;
+    std::atomic<bool> _max_rate_changed{false};    // Set by set_max_datagram_rate(); checked before each send
+    std::atomic<double> _new_max_rate{0.0};
+
+    // Transmit timestamping. Sends are numbered from 0 like the kernel's SOF_TIMESTAMPING_OPT_ID keys, and the due
+    // times of recent sends are kept by number, so that each timestamp can be matched with its send.
+    struct TxSend {
+        uint32_t id;
+        int64_t due_ns;                        // CLOCK_MONOTONIC due time, or 0 if not measured
+    };
+    bool _tx_timestamps = false;
+    std::vector<TxSend> _tx_sends;
+    uint32_t _tx_next_id = 0;
+    size_t _n_tx_undrained = 0;                // Sends since the error queue was last read
+    bool _have_tx_prev = false;
+    uint32_t _tx_prev_id = 0;
+    int64_t _tx_prev_ns = 0;
+    Histogram _tx_gap_ns;
+    Histogram _tx_pacing_error_ns;
+    SendRateController::Clock::time_point _tx_publish_time;
+    SendRateController::Clock::time_point _stats_publish_time;   // When _stats was last copied to the shared stats
+    std::vector<struct mmsghdr> _tx_mmsgs;
+    std::vector<char> _tx_control;
+
+    // State for sending directly from a mapped capture
+    bool _mapped_send_started = false;
+    std::vector<struct mmsghdr> _mmsgs;
+    std::vector<struct iovec> _iovs;
+    DgDestinationStats _stats;
 
 public:
     UdpDatagramDestination(const DgCatConfig& config, const std::string& path) :
@@ -37,10 +94,24 @@ public:
         _path(path)
     {
         ObjectCloser sock_closer(this);
-        auto host_and_port = _path;
-        if (host_and_port.compare(0, 6, "udp://") == 0) {
-            host_and_port.erase(0, 6);
+        std::map<std::string, std::string> args;
+        auto host_and_port = parse_path_args(_path, "udp://", args);
+        bool adaptive = false;
+        for (auto& arg : args) {
+            if (arg.first == "nonblock") {
+                _nonblock = std::stoul(arg.second) != 0;
+            } else if (arg.first == "adaptive") {
+                adaptive = std::stoul(arg.second) != 0;
+            } else if (arg.first == "txstamp") {
+                _tx_timestamps = std::stoul(arg.second) != 0;
+            } else {
+                throw std::runtime_error("Invalid argument to udp://: " + arg.first);
+            }
         }
+        if (adaptive) {
+            _nonblock = true;
+        }
+        _rate_controller = std::make_unique<SendRateController>(_config.max_datagram_rate, adaptive);
 
         std::string addr_s;
         uint64_t port;
@@ -92,6 +163,17 @@ public:
 
         BOOST_LOG_TRIVIAL(debug) << "Bound to " << matching_entry.addr_string() << ":" << port << "\n";
 
+        if (_nonblock) {
+            int flags = fcntl(_sock, F_GETFL);
+            if (flags == -1 || fcntl(_sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+                throw std::system_error(errno, std::system_category(), "fcntl(O_NONBLOCK) failed");
+            }
+        }
+
+        if (_tx_timestamps) {
+            init_tx_timestamps();
+        }
+
         sock_closer.detach();
     }
 
@@ -109,16 +191,16 @@ public:
      */
     void copy_from_buffer_queue(BufferQueue& buffer_queue, LockableDgDestinationStats& stats) override {
         ObjectCloser fd_closer(this);  // close the file descriptor before returning
-        auto next_send_time = std::chrono::steady_clock::now();
-        double send_interval_secs = (_config.max_datagram_rate <= 0.0) ? 0.0 : (1.0 / _config.max_datagram_rate);
-        auto send_interval = std::chrono::nanoseconds(static_cast<int64_t>(send_interval_secs * 1e9));
-
         struct msghdr msg{0};
         size_t n_min = PREFIX_LEN;
         bool done = false;
         while (!done) {
             BufferQueue::ConsumerBatch batch = buffer_queue.consumer_start_batch(n_min);
             if (batch.n < n_min) {
+                if (!buffer_queue.is_eof()) {
+                    // Paused or woken without data
+                    continue;
+                }
                 if (batch.n != 0) {
                     BOOST_LOG_TRIVIAL(error) << "Unexpected EOF with partial datagram";
                 }
@@ -128,39 +210,133 @@ public:
 
             uint32_t nbo_prefix;
             batch.copy_and_remove_bytes(&nbo_prefix, PREFIX_LEN);
-            size_t nb_datagram = ntohl(nbo_prefix);
-            if (batch.n < nb_datagram) {
-                n_min = nb_datagram + PREFIX_LEN;
+            size_t nb_record = ntohl(nbo_prefix);
+            if (batch.n < nb_record) {
+                n_min = nb_record + PREFIX_LEN;
                 continue;
             }
-            batch.limit_size(nb_datagram);
+            n_min = PREFIX_LEN;
+            batch.limit_size(nb_record);
+            if (_config.metadata) {
+                // Only the payload is sent; the metadata header is discarded
+                if (nb_record < METADATA_LEN) {
+                    throw std::runtime_error("Datagram record too short to contain metadata: " + std::to_string(nb_record) + " bytes");
+                }
+                char metadata_buffer[METADATA_LEN];
+                batch.copy_and_remove_bytes(metadata_buffer, METADATA_LEN);
+            }
 
             msg.msg_iov = batch.iov;
             msg.msg_iovlen = batch.n_iov;
 
-            if (send_interval_secs != 0.0) {
-                while (std::chrono::steady_clock::now() < next_send_time) {
-                    std::this_thread::sleep_until(next_send_time);
-                }
-            }
+            apply_max_rate_change();
+            _rate_controller->wait_until_due(1);
             ssize_t ret = sendmsg(_sock, &msg, 0);
+            if (ret < 0 && is_backpressure(errno)) {
+                wait_for_send_space();
+                continue;   // Retry the same datagram
+            }
             if (ret < 0) {
                 if (errno == ECONNREFUSED) {
                     BOOST_LOG_TRIVIAL(debug) << "sendmsg() got ECONNREFUSED; discarding\n";
+                    _stats.n_datagrams_refused++;
                 } else {
                     throw std::system_error(errno, std::system_category(), "sendmsg() failed");
                 }
+            } else {
+                _stats.n_datagrams_sent++;
+                if (_tx_timestamps) {
+                    note_tx_sends(1);
+                }
             }
-            buffer_queue.consumer_commit_batch(batch.n + PREFIX_LEN);
-            if (send_interval_secs != 0.0) {
-                next_send_time += send_interval;
+            buffer_queue.consumer_commit_batch(nb_record + PREFIX_LEN);
+            _rate_controller->on_sent(1);
+
+            maybe_publish_stats(stats);
+        }
+        if (_tx_timestamps) {
+            finish_tx_timestamps();
+        }
+        publish_stats(stats);
+    }
+
+    bool supports_mapped_send() const override {
+        return true;
+    }
+
+    /**
+     * @brief Send a range of datagrams straight out of a mapped capture with sendmmsg(), using iovecs that point
+     *        into the mapping. With a rate limit, each call sends all datagrams whose send time has arrived, and
+     *        returns early if the deadline passes while waiting for the next one.
+     */
+    size_t send_mapped_datagrams(const MappedCaptureFile& capture, size_t begin, size_t end,
+                                 std::chrono::steady_clock::time_point deadline, LockableDgDestinationStats& stats) override {
+        if (!_mapped_send_started) {
+            _mapped_send_started = true;
+            _mmsgs.resize(_config.max_iovecs);
+            _iovs.resize(_config.max_iovecs);
+            for (size_t j = 0; j < _mmsgs.size(); ++j) {
+                _mmsgs[j].msg_hdr.msg_iov = &_iovs[j];
+                _mmsgs[j].msg_hdr.msg_iovlen = 1;
             }
+        }
 
-            {
-                // update stats here
-                // std::lock_guard<std::mutex> lock(stats._mutex);
+        size_t i = begin;
+        while (i < end) {
+            apply_max_rate_change();
+            size_t n_due = _rate_controller->wait_until_due(_mmsgs.size(), deadline);
+            if (n_due == 0) {
+                break;
             }
+            size_t n_batch = std::min(n_due, end - i);
+            for (size_t j = 0; j < n_batch; ++j) {
+                _iovs[j].iov_base = (void *)capture.datagram_data(i + j);
+                _iovs[j].iov_len = capture.datagram_len(i + j);
+            }
+            int ret = sendmmsg(_sock, _mmsgs.data(), (unsigned int)n_batch, 0);
+            size_t n_sent;
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (is_backpressure(errno)) {
+                    wait_for_send_space();
+                    continue;
+                }
+                if (errno != ECONNREFUSED) {
+                    throw std::system_error(errno, std::system_category(), "sendmmsg() failed");
+                }
+                // The first datagram was refused; discard it and carry on with the rest
+                BOOST_LOG_TRIVIAL(debug) << "sendmmsg() got ECONNREFUSED; discarding\n";
+                _stats.n_datagrams_refused++;
+                n_sent = 1;
+            } else {
+                _stats.n_datagrams_sent += (uint64_t)ret;
+                n_sent = (size_t)ret;
+                if (_tx_timestamps) {
+                    note_tx_sends(n_sent);
+                }
+            }
+            i += n_sent;
+            _rate_controller->on_sent(n_sent);
         }
+
+        maybe_publish_stats(stats);
+        return i;
+    }
+
+    void finish_mapped_send(LockableDgDestinationStats& stats) override {
+        if (_tx_timestamps && _mapped_send_started) {
+            finish_tx_timestamps();
+        }
+        publish_stats(stats);
+        close();
+    }
+
+    bool set_max_datagram_rate(double max_datagram_rate) override {
+        _new_max_rate.store(max_datagram_rate, std::memory_order_relaxed);
+        _max_rate_changed.store(true, std::memory_order_release);
+        return true;
     }
 
     /**
@@ -177,6 +353,220 @@ public:
         }
     }
 
+protected:
+    /**
+     * @brief Apply a rate change requested with set_max_datagram_rate(). Costs one relaxed load if there is none.
+     */
+    void apply_max_rate_change() {
+        if (_max_rate_changed.load(std::memory_order_relaxed) && _max_rate_changed.exchange(false, std::memory_order_acquire)) {
+            double max_rate = _new_max_rate.load(std::memory_order_relaxed);
+            _rate_controller->set_max_rate(max_rate);
+            BOOST_LOG_TRIVIAL(info) << "UDP destination max datagram rate set to " << max_rate << "\n";
+        }
+    }
+
+    bool is_backpressure(int err) const {
+        return _nonblock && (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS);
+    }
+
+    /**
+     * @brief After a nonblocking send fails with EAGAIN or ENOBUFS, back off the send rate and wait (boundedly,
+     *        since ENOBUFS does not reliably produce a POLLOUT edge) for room in the socket send buffer.
+     */
+    void wait_for_send_space() {
+        _stats.n_send_stalls++;
+        _rate_controller->on_backpressure();
+        if (_tx_timestamps) {
+            // Pending timestamps would make poll() return POLLERR at once
+            drain_tx_timestamps();
+        }
+        struct pollfd pfd;
+        pfd.fd = _sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, DEFAULT_SEND_BACKPRESSURE_POLL_MS) == -1 && errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "poll() failed");
+        }
+    }
+
+    void init_tx_timestamps() {
+        unsigned flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                         SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(_sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+            throw std::system_error(errno, std::system_category(), "setsockopt(SO_TIMESTAMPING) failed");
+        }
+        _tx_sends.resize(DEFAULT_TX_TIMESTAMP_MAX_PENDING);
+        size_t control_len = CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                             CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6));
+        _tx_mmsgs.resize(DEFAULT_TX_TIMESTAMP_DRAIN_SENDS);
+        _tx_control.resize(_tx_mmsgs.size() * control_len);
+        for (size_t i = 0; i < _tx_mmsgs.size(); ++i) {
+            _tx_mmsgs[i].msg_hdr.msg_control = _tx_control.data() + i * control_len;
+            _tx_mmsgs[i].msg_hdr.msg_controllen = control_len;
+        }
+    }
+
+    /**
+     * @brief Number n successful sends, remembering the due time of the first if the rate controller had to wait
+     *        for it, and read any timestamps that have arrived every DEFAULT_TX_TIMESTAMP_DRAIN_SENDS sends.
+     */
+    void note_tx_sends(size_t n) {
+        int64_t due_ns = 0;
+        if (_rate_controller->waited()) {
+            due_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                _rate_controller->due_time().time_since_epoch()).count();
+        }
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t id = _tx_next_id++;
+            _tx_sends[id % _tx_sends.size()] = TxSend{id, (i == 0) ? due_ns : 0};
+        }
+        _n_tx_undrained += n;
+        if (_n_tx_undrained >= DEFAULT_TX_TIMESTAMP_DRAIN_SENDS) {
+            drain_tx_timestamps();
+        }
+    }
+
+    /**
+     * @brief Read all the transmit timestamps waiting in the socket error queue without blocking, and record them.
+     *
+     * @return size_t  The number of timestamps read
+     */
+    size_t drain_tx_timestamps() {
+        _n_tx_undrained = 0;
+        size_t n_read = 0;
+        // Timestamps are CLOCK_REALTIME; due times are steady_clock (CLOCK_MONOTONIC)
+        struct timespec realtime_now;
+        clock_gettime(CLOCK_REALTIME, &realtime_now);
+        int64_t monotonic_offset_ns = (int64_t)realtime_now.tv_sec * 1000000000 + realtime_now.tv_nsec -
+            std::chrono::duration_cast<std::chrono::nanoseconds>(SendRateController::Clock::now().time_since_epoch()).count();
+        while (true) {
+            for (auto& mmsg : _tx_mmsgs) {
+                mmsg.msg_hdr.msg_controllen = _tx_control.size() / _tx_mmsgs.size();
+            }
+            int ret = recvmmsg(_sock, _tx_mmsgs.data(), (unsigned int)_tx_mmsgs.size(), MSG_ERRQUEUE | MSG_DONTWAIT, nullptr);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                throw std::system_error(errno, std::system_category(), "recvmmsg(MSG_ERRQUEUE) failed");
+            }
+            for (int i = 0; i < ret; ++i) {
+                if (record_tx_timestamp(_tx_mmsgs[i].msg_hdr, monotonic_offset_ns)) {
+                    n_read++;
+                }
+            }
+            if ((size_t)ret < _tx_mmsgs.size()) {
+                break;
+            }
+        }
+        auto now = SendRateController::Clock::now();
+        if (n_read != 0 && now - _tx_publish_time >= std::chrono::duration<double>(DEFAULT_TX_TIMESTAMP_PUBLISH_SECS)) {
+            _tx_publish_time = now;
+            snapshot_tx_histograms();
+        }
+        return n_read;
+    }
+
+    /**
+     * @brief Record the transmit timestamp in a message from the error queue. Returns false if it holds none.
+     */
+    bool record_tx_timestamp(const struct msghdr& hdr, int64_t monotonic_offset_ns) {
+        const struct scm_timestamping *tss = nullptr;
+        const struct sock_extended_err *serr = nullptr;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR((struct msghdr *)&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                tss = (const struct scm_timestamping *)CMSG_DATA(cmsg);
+            } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                       (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                serr = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+            }
+        }
+        if (tss == nullptr || serr == nullptr || serr->ee_errno != ENOMSG ||
+            serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || serr->ee_info != SCM_TSTAMP_SND) {
+            return false;
+        }
+        _stats.n_tx_timestamps++;
+        uint32_t id = serr->ee_data;
+        int64_t ts_ns = (int64_t)tss->ts[0].tv_sec * 1000000000 + tss->ts[0].tv_nsec;
+        if (_have_tx_prev && id == _tx_prev_id + 1 && ts_ns >= _tx_prev_ns) {
+            _tx_gap_ns.record((uint64_t)(ts_ns - _tx_prev_ns));
+        }
+        _have_tx_prev = true;
+        _tx_prev_id = id;
+        _tx_prev_ns = ts_ns;
+        const TxSend& send = _tx_sends[id % _tx_sends.size()];
+        if (send.id == id && send.due_ns != 0) {
+            int64_t error_ns = ts_ns - (send.due_ns + monotonic_offset_ns);
+            _tx_pacing_error_ns.record((uint64_t)((error_ns < 0) ? -error_ns : error_ns));
+        }
+        return true;
+    }
+
+    /**
+     * @brief After the last send, wait a little for the remaining transmit timestamps, and count any that never
+     *        arrived as lost.
+     */
+    void finish_tx_timestamps() {
+        auto deadline = SendRateController::Clock::now() + std::chrono::milliseconds(DEFAULT_TX_TIMESTAMP_FINAL_WAIT_MS);
+        while (true) {
+            drain_tx_timestamps();
+            auto now = SendRateController::Clock::now();
+            if (_stats.n_tx_timestamps >= _stats.n_datagrams_sent || now >= deadline) {
+                break;
+            }
+            // An empty error queue is reported as POLLERR once a timestamp arrives
+            struct pollfd pfd;
+            pfd.fd = _sock;
+            pfd.events = 0;
+            pfd.revents = 0;
+            int timeout_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+            if (poll(&pfd, 1, timeout_ms) == -1 && errno != EINTR) {
+                throw std::system_error(errno, std::system_category(), "poll() failed");
+            }
+        }
+        if (_stats.n_datagrams_sent > _stats.n_tx_timestamps) {
+            _stats.n_tx_timestamps_lost = _stats.n_datagrams_sent - _stats.n_tx_timestamps;
+        }
+        snapshot_tx_histograms();
+    }
+
+    /**
+     * @brief Copy the transmit timestamp histograms into _stats, skipping any that has not changed since its
+     *        last copy.
+     */
+    void snapshot_tx_histograms() {
+        if (!_stats.tx_gap_ns || _stats.tx_gap_ns->count() != _tx_gap_ns.count()) {
+            _stats.tx_gap_ns = std::make_shared<const Histogram>(_tx_gap_ns);
+        }
+        if (_tx_pacing_error_ns.count() != 0 &&
+            (!_stats.tx_pacing_error_ns || _stats.tx_pacing_error_ns->count() != _tx_pacing_error_ns.count())) {
+            _stats.tx_pacing_error_ns = std::make_shared<const Histogram>(_tx_pacing_error_ns);
+        }
+    }
+
+    /**
+     * @brief Copy the stats to the shared stats if DEFAULT_SEND_STATS_PUBLISH_SECS have passed since the last
+     *        copy, so that the send loop does not take the shared stats lock for every datagram.
+     */
+    void maybe_publish_stats(LockableDgDestinationStats& stats) {
+        auto now = SendRateController::Clock::now();
+        if (now - _stats_publish_time >= std::chrono::duration<double>(DEFAULT_SEND_STATS_PUBLISH_SECS)) {
+            _stats_publish_time = now;
+            publish_stats(stats);
+        }
+    }
+
+    void publish_stats(LockableDgDestinationStats& stats) {
+        _stats.send_rate = _rate_controller->is_adaptive() ? _rate_controller->rate() : 0.0;
+        _stats.achieved_send_rate = _rate_controller->achieved_rate();
+        std::lock_guard<std::mutex> lock(stats._mutex);
+        stats = _stats;
+    }
+
+public:
     /**
      * @brief static factory method to create a typed DatagramDestination based on a pathname
      * 
@@ -10,6 +10,10 @@
 #include "config.hpp"
 #include "timespec_math.hpp"
 #include "addrinfo.hpp"
+#include "datagram_filter.hpp"
+#include "receive_slab.hpp"
+#include "sender_stats.hpp"
+#include "util.hpp"
 
 #include <boost/endian/conversion.hpp>
 #include <boost/log/trivial.hpp>
@@ -20,6 +24,7 @@
 #include <condition_variable>
 #include <memory>
 #include <string>
+#include <map>
 #include <cassert>
 
 #include <sys/socket.h>
@@ -30,6 +35,16 @@ typedef int SockFd;
 
 /**
  * @brief Datagram source that reads from a UDP socket.
+ *
+ * Path format: "udp://[<local-bind-ip-addr>:]<port>[?<arg>=<value>[&...]]". Arguments:
+ *
+ *     filter=<expr>      In-kernel filter expression (see DatagramFilter).
+ *     top=<k>            Track per-sender-address datagram/byte counts and rates, and report the top <k>
+ *                        senders by bytes in the source stats.
+ *     senders=<n>        Maximum number of sender addresses tracked with top=. Default 4096.
+ *     slot=<bytes>       Receive slot size. Default 2048. Datagrams up to this size are received into one
+ *                        contiguous huge-page-backed slab; larger ones (up to --max-datagram-size) spill into
+ *                        a per-slot overflow buffer that only consumes memory when used.
  */
 class UdpDatagramSource : public DatagramSource {
 private:
@@ -40,23 +55,46 @@ private:
     SockFd _sock = -1;
     bool _force_eof = false;
     bool _closed = false;
-    std::vector<std::vector<char>> _buffers;
+    std::unique_ptr<ReceiveSlab> _slab;
     std::vector<struct mmsghdr> _msgs;
     std::vector<struct iovec> _iovs;
+    std::vector<struct sockaddr_storage> _sender_addrs;  // Only allocated if metadata or sender stats are enabled
+    std::unique_ptr<DatagramFilter> _filter;             // Optional in-kernel filter
+    std::unique_ptr<SenderStatsTracker> _sender_stats;   // Optional per-sender stats
 
 public:
     UdpDatagramSource(const DgCatConfig& config, const std::string& path) :
         _config(config),
         _path(path),
-        _buffers(config.max_iovecs),
-        _msgs(config.max_iovecs),
-        _iovs(config.max_iovecs)
+        _msgs(config.max_iovecs)
     {
-        // Parse "udp://<local-bind-ip-addr>:<port" or "udp://<port>"
-        auto addr_and_port = path;
-
-        if (addr_and_port.compare(0, 6, "udp://") == 0) {
-            addr_and_port.erase(0, 6);
+        // Parse "udp://<local-bind-ip-addr>:<port" or "udp://<port>", with optional "?<arg>=<value>&..."
+        std::map<std::string, std::string> args;
+        auto addr_and_port = parse_path_args(path, "udp://", args);
+        size_t top_k = 0;
+        size_t max_senders = DEFAULT_MAX_TRACKED_SENDERS;
+        size_t slot_size = DEFAULT_RECV_SLOT_SIZE;
+        for (auto& arg : args) {
+            if (arg.first == "filter") {
+                _filter = std::make_unique<DatagramFilter>(arg.second);
+            } else if (arg.first == "top") {
+                top_k = std::stoul(arg.second);
+            } else if (arg.first == "slot") {
+                slot_size = std::stoul(arg.second);
+                if (slot_size == 0) {
+                    throw std::runtime_error("Invalid slot argument to udp://: " + arg.second);
+                }
+            } else if (arg.first == "senders") {
+                max_senders = std::stoul(arg.second);
+                if (max_senders == 0) {
+                    throw std::runtime_error("Invalid senders argument to udp://: " + arg.second);
+                }
+            } else {
+                throw std::runtime_error("Invalid argument to udp://: " + arg.first);
+            }
+        }
+        if (top_k > 0) {
+            _sender_stats = std::make_unique<SenderStatsTracker>(top_k, max_senders);
         }
         std::string addr_s;
         uint64_t port;
@@ -96,6 +134,11 @@ public:
                     continue;
                 }
 
+                // Attach the filter before binding so that no unfiltered datagrams are queued
+                if (_filter) {
+                    _filter->attach(s);
+                }
+
                 if (bind(s, entry->ai_addr, entry->ai_addrlen) == 0) {
                     matching_entry = entry;
                     break;
@@ -109,17 +152,21 @@ public:
             }
 
             BOOST_LOG_TRIVIAL(debug) << "Bound to " << matching_entry.addr_string() << ":" << port << "\n";
+            if (_filter) {
+                BOOST_LOG_TRIVIAL(debug) << "Attached filter \"" << _filter->expression() << "\" (" << _filter->compile().size() << " BPF instructions)\n";
+            }
 
             // Allocate reusable buffers for recvmmsg
-            for (size_t i = 0; i < _config.max_iovecs; ++i) {
-                auto& buffer = _buffers[i];
-                auto& msg = _msgs[i];
-                auto& iov = _iovs[i];
-                buffer.resize(_config.bufsize);
-                iov.iov_base = buffer.data();
-                iov.iov_len = buffer.size();
-                msg.msg_hdr.msg_iov = &iov;
-                msg.msg_hdr.msg_iovlen = 1;
+            _slab = std::make_unique<ReceiveSlab>(_config.max_iovecs, slot_size, _config.bufsize);
+            _iovs.resize(_config.max_iovecs * _slab->iovecs_per_slot());
+            _slab->init_msgs(_msgs, _iovs);
+
+            // Capture sender addresses in msg_name if they will be recorded in per-datagram metadata or counted
+            if (_config.metadata || _sender_stats) {
+                _sender_addrs.resize(_config.max_iovecs);
+                for (size_t i = 0; i < _config.max_iovecs; ++i) {
+                    _msgs[i].msg_hdr.msg_name = &_sender_addrs[i];
+                }
             }
 
             _sock = s;
@@ -176,6 +223,8 @@ public:
             struct timespec start_time;
             time_t start_clock_time = 0;
             struct timespec *current_timeout = nullptr;
+            struct timespec next_sender_report_time{0, 0};
+            struct timespec sender_report_interval = secs_to_timespec(DEFAULT_POLLING_INTERVAL);
             while (true) {
                 auto old_n_datagrams = n_datagrams;
                 auto timeout = (n_datagrams == 0) ? &first_dg_timespec : &dg_timespec;
@@ -184,6 +233,12 @@ public:
                     setsockopt(_sock, SOL_SOCKET, SO_RCVTIMEO, timeout, sizeof(*timeout));
                     current_timeout = timeout;
                 }
+                if (!_sender_addrs.empty()) {
+                    // recvmmsg() overwrites msg_namelen with the actual address length
+                    for (auto& msg : _msgs) {
+                        msg.msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+                    }
+                }
                 int n = recvmmsg(_sock, _msgs.data(), _msgs.size(), MSG_WAITFORONE, nullptr);
                 if (n == -1) {
                     if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -219,6 +274,9 @@ public:
                 }
                 buffer_queue.producer_commit_batch(_msgs.data(), n);
                 n_datagrams += n;
+                if (_sender_stats) {
+                    count_senders(n);
+                }
                 {
                     std::lock_guard<std::mutex> lock(stats._mutex);
                     stats.max_clump_size = std::max(stats.max_clump_size, n_datagrams - old_n_datagrams);
@@ -226,6 +284,13 @@ public:
                     stats.start_time = start_time;
                     stats.end_time = end_time;
                 }
+                if (_sender_stats && timespec_compare(end_time, next_sender_report_time) >= 0) {
+                    report_senders(stats, end_time);
+                    next_sender_report_time = timespec_add(end_time, sender_report_interval);
+                }
+            }
+            if (_sender_stats && n_datagrams > 0) {
+                report_senders(stats, end_time);
             }
         }
     }
@@ -238,6 +303,10 @@ public:
         {
             std::unique_lock<std::mutex> lock(_mutex);
             _force_eof = true;
+            // On Linux, closing the socket does not wake a thread blocked in recvmmsg(); shutting it down does
+            if (_sock != -1) {
+                shutdown(_sock, SHUT_RDWR);
+            }
         }
 
         // This will wake up the thread that is blocked on recvmmsg(). It will see _force_eof and not
@@ -264,5 +333,29 @@ public:
             _cv.notify_all();
         }
     }
-};
 
+protected:
+    /**
+     * @brief Count the first n received datagrams in the per-sender stats. Truncated datagrams are not counted,
+     *        consistent with their being discarded by the BufferQueue.
+     */
+    void count_senders(size_t n) {
+        DatagramMetadata sender;
+        for (size_t i = 0; i < n; ++i) {
+            const auto& msg = _msgs[i];
+            if (msg.msg_hdr.msg_flags & MSG_TRUNC) {
+                continue;
+            }
+            sender.set_sender(msg.msg_hdr.msg_name, msg.msg_hdr.msg_namelen);
+            _sender_stats->add(sender, msg.msg_len);
+        }
+    }
+
+    void report_senders(LockableDgSourceStats& stats, const struct timespec& now) {
+        auto top_senders = _sender_stats->report(now);
+        std::lock_guard<std::mutex> lock(stats._mutex);
+        stats.n_senders = _sender_stats->n_senders();
+        stats.n_untracked_datagrams = _sender_stats->n_untracked_datagrams();
+        stats.top_senders.swap(top_senders);
+    }
+};
@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "datagram_metadata.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#include <sys/socket.h>
+
+/**
+ * @brief The location of the UDP payload and sender within a raw IPv4 or IPv6 packet, as captured by the
+ *        packet:// and xdp:// sources.
+ */
+struct UdpPacketView {
+    const uint8_t *payload;      // Start of the UDP payload
+    size_t payload_len;          // Length of the UDP payload according to the UDP header
+    bool truncated;              // True if the captured bytes do not contain the whole payload
+    uint16_t family;             // AF_INET or AF_INET6
+    const uint8_t *src_addr;     // Source address (4 or 16 bytes, depending on family)
+    uint16_t src_port;           // Source port, in host byte order
+
+    /**
+     * @brief Parse a packet starting at the IP header. IPv6 extension headers are not followed.
+     *
+     * @param net    Start of the IP header
+     * @param avail  Number of captured bytes starting at net
+     *
+     * @return bool  true if the packet is a UDP datagram whose UDP header was captured.
+     */
+    bool parse(const uint8_t *net, size_t avail) {
+        size_t ip_hdr_len;
+        if (avail >= 20 && (net[0] >> 4) == 4 && net[9] == IPPROTO_UDP) {
+            ip_hdr_len = (size_t)(net[0] & 0x0f) * 4;
+            family = AF_INET;
+            src_addr = net + 12;
+        } else if (avail >= 40 && (net[0] >> 4) == 6 && net[6] == IPPROTO_UDP) {
+            ip_hdr_len = 40;
+            family = AF_INET6;
+            src_addr = net + 8;
+        } else {
+            return false;
+        }
+        if (ip_hdr_len < 20 || avail < ip_hdr_len + 8) {
+            return false;
+        }
+        const uint8_t *udp = net + ip_hdr_len;
+        size_t udp_len = ((size_t)udp[4] << 8) | udp[5];
+        src_port = (uint16_t)(((uint16_t)udp[0] << 8) | udp[1]);
+        payload = udp + 8;
+        payload_len = (udp_len >= 8) ? udp_len - 8 : 0;
+        truncated = (udp_len < 8 || ip_hdr_len + udp_len > avail);
+        return true;
+    }
+
+    /**
+     * @brief Fill in the sender fields of a metadata header.
+     */
+    void get_sender(DatagramMetadata& metadata) const {
+        metadata.family = family;
+        metadata.port = src_port;
+        memset(metadata.addr, 0, sizeof(metadata.addr));
+        memcpy(metadata.addr, src_addr, (family == AF_INET6) ? 16 : 4);
+    }
+};
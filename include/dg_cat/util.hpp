@@ -9,6 +9,8 @@
 #include <sys/uio.h>
 
 #include <stdexcept>
+#include <string>
+#include <map>
 
 /**
  * @brief Writes a 4-byte network-byte-order length prefix to a buffer
@@ -51,3 +53,108 @@ inline size_t total_iovec_len(const struct iovec *iov, size_t n_iovecs) {
     return len;
 }
 
+/**
+ * @brief Split a "<scheme><body>[?<key>=<value>[&<key>=<value>...]]" path into its body and its arguments.
+ * 
+ * @param path     The path to parse
+ * @param scheme   The scheme prefix (e.g., "file://") to strip from the body if present
+ * @param args     Receives the key/value arguments
+ * @return std::string The body of the path, without the scheme prefix or arguments
+ */
+inline std::string parse_path_args(const std::string& path, const std::string& scheme, std::map<std::string, std::string>& args) {
+    std::string body = path;
+    if (body.compare(0, scheme.size(), scheme) == 0) {
+        body.erase(0, scheme.size());
+    }
+    size_t qmark_pos = body.find('?');
+    if (qmark_pos == std::string::npos) {
+        return body;
+    }
+    std::string argstr = body.substr(qmark_pos + 1);
+    body.erase(qmark_pos);
+    while (!argstr.empty()) {
+        size_t ampersand_pos = argstr.find('&');
+        std::string key_val;
+        if (ampersand_pos == std::string::npos) {
+            key_val = argstr;
+            argstr.clear();
+        } else {
+            key_val = argstr.substr(0, ampersand_pos);
+            argstr.erase(0, ampersand_pos + 1);
+        }
+        if (key_val.empty()) {
+            continue;
+        }
+        size_t eq_pos = key_val.find('=');
+        if (eq_pos == std::string::npos) {
+            throw std::runtime_error(std::string("Invalid argument to ") + scheme + " (missing '='): " + key_val);
+        }
+        args[key_val.substr(0, eq_pos)] = key_val.substr(eq_pos + 1);
+    }
+    return body;
+}
+
+/**
+ * @brief Parse a duration such as "100ms", "2.5s", "500us", "1000ns" or "1m". A bare number is in seconds.
+ * 
+ * @param s        The duration string
+ * @return double  The duration in seconds
+ */
+inline double parse_duration_secs(const std::string& s) {
+    size_t pos = 0;
+    double value;
+    try {
+        value = std::stod(s, &pos);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid duration: " + s);
+    }
+    std::string unit = s.substr(pos);
+    double scale;
+    if (unit.empty() || unit == "s") {
+        scale = 1.0;
+    } else if (unit == "ms") {
+        scale = 1.0e-3;
+    } else if (unit == "us") {
+        scale = 1.0e-6;
+    } else if (unit == "ns") {
+        scale = 1.0e-9;
+    } else if (unit == "m") {
+        scale = 60.0;
+    } else {
+        throw std::runtime_error("Invalid duration unit (must be ns, us, ms, s or m): " + s);
+    }
+    if (value < 0.0) {
+        throw std::runtime_error("Negative duration: " + s);
+    }
+    return value * scale;
+}
+
+/**
+ * @brief Parse a byte count such as "4096", "64K", "64M" or "1G" (binary multiples).
+ * 
+ * @param s        The size string
+ * @return size_t  The number of bytes
+ */
+inline size_t parse_byte_size(const std::string& s) {
+    size_t pos = 0;
+    unsigned long long value;
+    try {
+        value = std::stoull(s, &pos);
+    } catch (const std::exception&) {
+        throw std::runtime_error("Invalid byte size: " + s);
+    }
+    std::string unit = s.substr(pos);
+    unsigned shift;
+    if (unit.empty()) {
+        shift = 0;
+    } else if (unit == "K" || unit == "k") {
+        shift = 10;
+    } else if (unit == "M" || unit == "m") {
+        shift = 20;
+    } else if (unit == "G" || unit == "g") {
+        shift = 30;
+    } else {
+        throw std::runtime_error("Invalid byte size unit (must be K, M or G): " + s);
+    }
+    return (size_t)(value << shift);
+}
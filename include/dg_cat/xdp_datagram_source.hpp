@@ -0,0 +1,285 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include "datagram_source.hpp"
+#include "buffer_queue.hpp"
+#include "config.hpp"
+#include "timespec_math.hpp"
+#include "datagram_metadata.hpp"
+#include "udp_packet.hpp"
+#include "xdp_socket.hpp"
+#include "util.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <chrono>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <map>
+
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+/**
+ * @brief Capture-only datagram source that receives UDP datagrams addressed to a port through an AF_XDP socket
+ *        bound to one receive queue of a network interface. Frames are parsed to UDP payloads in the UMEM and
+ *        committed to the BufferQueue in batches of everything available in the RX ring, then recycled to the
+ *        fill ring. Native (driver) mode is used where available, and generic (SKB) mode otherwise, which works
+ *        on veth and loopback. Requires CAP_NET_ADMIN and CAP_BPF (or root).
+ *
+ * Path format: "xdp://<interface>[?<arg>=<value>[&...]]". Arguments:
+ *
+ *     queue=<n>          Receive queue to bind to. Default 0. Only traffic steered to this queue is captured.
+ *     port=<n>           UDP destination port to capture. Default is all UDP datagrams.
+ *     mode=<mode>        "auto" (default), "native" or "skb".
+ *     frame_size=<n>     UMEM frame size, 2048 or 4096 (default). Larger frames are dropped by the kernel.
+ *     frames=<n>         Number of UMEM frames (a power of 2). Default 4096.
+ *
+ * Packets dropped because the RX ring was full or no free frames were available are reported in the source
+ * stats as n_kernel_drops.
+ */
+class XdpDatagramSource : public DatagramSource {
+private:
+    std::mutex _mutex;
+    const DgCatConfig& _config;
+    std::string _path;
+    std::string _interface;
+    std::unique_ptr<XdpSocket> _xsk;
+    int _wake_fd = -1;                         // eventfd used by force_eof() to wake a blocked poll()
+    bool _force_eof = false;
+    bool _closed = false;
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<struct iovec> _iovs;
+    std::vector<DatagramMetadata> _metadata;   // Only used if metadata is enabled
+
+public:
+    XdpDatagramSource(const DgCatConfig& config, const std::string& path) :
+        _config(config),
+        _path(path)
+    {
+        std::map<std::string, std::string> args;
+        _interface = parse_path_args(_path, "xdp://", args);
+        uint32_t queue = 0;
+        uint16_t port = 0;
+        XdpSocket::Mode mode = XdpSocket::Mode::AUTO;
+        size_t frame_size = DEFAULT_XDP_FRAME_SIZE;
+        size_t n_frames = DEFAULT_XDP_NUM_FRAMES;
+        for (auto& arg : args) {
+            if (arg.first == "queue") {
+                queue = (uint32_t)std::stoul(arg.second);
+            } else if (arg.first == "port") {
+                auto port_arg = std::stoul(arg.second);
+                if (port_arg > 65535) {
+                    throw std::runtime_error("Invalid UDP port: " + arg.second);
+                }
+                port = (uint16_t)port_arg;
+            } else if (arg.first == "mode") {
+                if (arg.second == "auto") {
+                    mode = XdpSocket::Mode::AUTO;
+                } else if (arg.second == "native") {
+                    mode = XdpSocket::Mode::NATIVE;
+                } else if (arg.second == "skb") {
+                    mode = XdpSocket::Mode::SKB;
+                } else {
+                    throw std::runtime_error("Invalid XDP mode (must be auto, native or skb): " + arg.second);
+                }
+            } else if (arg.first == "frame_size") {
+                frame_size = std::stoul(arg.second);
+            } else if (arg.first == "frames") {
+                n_frames = std::stoul(arg.second);
+            } else {
+                throw std::runtime_error("Invalid argument to xdp://: " + arg.first);
+            }
+        }
+        if (_interface.empty()) {
+            throw std::runtime_error("Network interface required for xdp:// source: " + path);
+        }
+        unsigned ifindex = if_nametoindex(_interface.c_str());
+        if (ifindex == 0) {
+            throw std::system_error(errno, std::system_category(), "Unknown network interface " + _interface);
+        }
+
+        _wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (_wake_fd == -1) {
+            throw std::system_error(errno, std::system_category(), "eventfd() failed");
+        }
+        try {
+            _xsk = std::make_unique<XdpSocket>(ifindex, queue, port, mode, frame_size, n_frames);
+        } catch (...) {
+            ::close(_wake_fd);
+            _wake_fd = -1;
+            throw;
+        }
+
+        _msgs.resize(n_frames);
+        _iovs.resize(n_frames);
+        for (size_t i = 0; i < n_frames; ++i) {
+            _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+            _msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        if (_config.metadata) {
+            _metadata.resize(n_frames);
+        }
+
+        BOOST_LOG_TRIVIAL(debug) << "Capturing UDP port " << port << " on " << _interface << " queue " << queue << " with AF_XDP in " << (_xsk->is_native() ? "native" : "generic") << " mode\n";
+    }
+
+    /**
+     * @brief factory-invoked static method to create an XdpDatagramSource
+     *
+     * @param config   The configuration object
+     * @param path     The path to the source
+     *
+     * @return unique_ptr<DatagramSource>
+     */
+    static std::unique_ptr<DatagramSource> create(const DgCatConfig& config, const std::string& path) {
+        return std::make_unique<XdpDatagramSource>(config, path);
+    }
+
+    ~XdpDatagramSource() override
+    {
+        close();
+    }
+
+    /**
+     * @brief Copy datagrams from the AF_XDP socket until an EOF is encountered or force_eof() is called.
+     *
+     * @param buffer_queue The buffer queue to write datagrams to.
+     */
+    void copy_to_buffer_queue(BufferQueue& buffer_queue, LockableDgSourceStats& stats) override {
+        double first_timeout_secs = (_config.start_timeout > 0.0) ? _config.start_timeout : 0.0;
+        double timeout_secs = (_config.eof_timeout > 0.0) ? _config.eof_timeout : 0.0;
+        uint64_t n_datagrams = 0;
+        struct timespec end_time;
+        struct timespec start_time;
+        time_t start_clock_time = 0;
+        auto last_activity = std::chrono::steady_clock::now();
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_force_eof) {
+                    BOOST_LOG_TRIVIAL(debug) << "Forced EOF; stopping XDP capture\n";
+                    break;
+                }
+            }
+
+            size_t n_avail = _xsk->rx_available();
+            if (n_avail == 0) {
+                double t = (n_datagrams == 0) ? first_timeout_secs : timeout_secs;
+                int poll_ms = -1;
+                if (t > 0.0) {
+                    double remaining = t - std::chrono::duration<double>(std::chrono::steady_clock::now() - last_activity).count();
+                    if (remaining <= 0.0) {
+                        BOOST_LOG_TRIVIAL(debug) << "Timeout waiting for datagram; generating EOF\n";
+                        break;
+                    }
+                    poll_ms = (int)(remaining * 1000.0) + 1;
+                }
+                struct pollfd pfds[2];
+                pfds[0].fd = _xsk->fd();
+                pfds[0].events = POLLIN;
+                pfds[0].revents = 0;
+                pfds[1].fd = _wake_fd;
+                pfds[1].events = POLLIN;
+                pfds[1].revents = 0;
+                if (poll(pfds, 2, poll_ms) == -1 && errno != EINTR) {
+                    throw std::system_error(errno, std::system_category(), "poll() failed");
+                }
+                continue;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &end_time);
+            size_t n = parse_frames(n_avail, end_time);
+            if (n > 0) {
+                if (n_datagrams == 0) {
+                    start_time = end_time;
+                    start_clock_time = time(nullptr);
+                    BOOST_LOG_TRIVIAL(debug) << "First datagram received...\n";
+                }
+                buffer_queue.producer_commit_batch(_msgs.data(), n, _metadata.empty() ? nullptr : _metadata.data());
+                n_datagrams += n;
+                last_activity = std::chrono::steady_clock::now();
+            }
+            _xsk->rx_release(n_avail);
+
+            uint64_t n_kernel_drops = _xsk->n_drops();
+            {
+                std::lock_guard<std::mutex> lock(stats._mutex);
+                stats.max_clump_size = std::max(stats.max_clump_size, n);
+                stats.start_clock_time = start_clock_time;
+                stats.start_time = start_time;
+                stats.end_time = end_time;
+                stats.n_kernel_drops = n_kernel_drops;
+            }
+        }
+    }
+
+    /**
+     * @brief Force an EOF condition on the source. This method will be called from a different
+     *        thread than copy_to_buffer_queue().
+     */
+    void force_eof() override {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _force_eof = true;
+        if (_wake_fd != -1) {
+            uint64_t one = 1;
+            ssize_t ret = write(_wake_fd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+        _xsk.reset();
+        if (_wake_fd != -1) {
+            ::close(_wake_fd);
+            _wake_fd = -1;
+        }
+    }
+
+protected:
+    /**
+     * @brief Fill _msgs (and _metadata) with the UDP payloads of the first n_avail received frames, pointing
+     *        directly into the UMEM.
+     *
+     * @return size_t  The number of entries filled in.
+     */
+    size_t parse_frames(size_t n_avail, const struct timespec& rx_time) {
+        size_t n = 0;
+        for (size_t i = 0; i < n_avail; ++i) {
+            const struct xdp_desc& desc = _xsk->rx_desc(i);
+            const uint8_t *frame = (const uint8_t *)_xsk->frame_data(desc);
+            UdpPacketView pkt;
+            if (desc.len < ETH_HLEN || !pkt.parse(frame + ETH_HLEN, desc.len - ETH_HLEN)) {
+                continue;
+            }
+            auto& msg = _msgs[n];
+            auto& iov = _iovs[n];
+            iov.iov_base = (void *)pkt.payload;
+            iov.iov_len = pkt.payload_len;
+            msg.msg_len = (unsigned)iov.iov_len;
+            msg.msg_hdr.msg_flags = pkt.truncated ? MSG_TRUNC : 0;
+            if (_config.metadata) {
+                auto& md = _metadata[n];
+                md.set_timestamp(rx_time);
+                pkt.get_sender(md);
+            }
+            ++n;
+        }
+        return n;
+    }
+};
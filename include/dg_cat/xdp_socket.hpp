@@ -0,0 +1,468 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+#pragma once
+
+#include <boost/log/trivial.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/if_ether.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/**
+ * @brief An AF_XDP socket bound to one receive queue of a network interface, together with its UMEM, rings,
+ *        XSKMAP and the XDP program that redirects matching UDP datagrams to it. Everything is set up with raw
+ *        bpf() system calls, so no libbpf/libxdp is needed. The XDP program is attached with a BPF link, so it
+ *        is detached automatically when the socket is closed (or the process exits).
+ *
+ * Only IPv4 datagrams without IP options or fragmentation, and IPv6 datagrams whose first next header is UDP,
+ * are redirected; all other traffic is passed on to the kernel stack unchanged.
+ */
+class XdpSocket {
+public:
+    enum class Mode {
+        AUTO,       // Native (driver) mode if the driver supports it, otherwise generic (SKB) mode
+        NATIVE,     // Native mode only
+        SKB,        // Generic mode, which works on any interface including veth and loopback
+    };
+
+private:
+    /**
+     * @brief Producer/consumer ring shared with the kernel.
+     */
+    struct Ring {
+        void *map = nullptr;
+        size_t map_len = 0;
+        uint32_t *producer = nullptr;
+        uint32_t *consumer = nullptr;
+        void *desc = nullptr;
+        uint32_t mask = 0;
+    };
+
+    /**
+     * @brief Minimal eBPF assembler with forward labels.
+     */
+    class EbpfAssembler {
+    public:
+        std::vector<struct bpf_insn> insns;
+        std::vector<int> label_targets;
+        std::vector<std::pair<size_t, int>> fixups;
+
+        int new_label() {
+            label_targets.push_back(-1);
+            return (int)label_targets.size() - 1;
+        }
+        void bind(int label) {
+            label_targets[label] = (int)insns.size();
+        }
+        void emit(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+            struct bpf_insn insn;
+            memset(&insn, 0, sizeof(insn));
+            insn.code = code;
+            insn.dst_reg = dst;
+            insn.src_reg = src;
+            insn.off = off;
+            insn.imm = imm;
+            insns.push_back(insn);
+        }
+        void jump(uint8_t code, uint8_t dst, uint8_t src, int32_t imm, int label) {
+            fixups.push_back(std::make_pair(insns.size(), label));
+            emit(code, dst, src, 0, imm);
+        }
+        void load_map_fd(uint8_t dst, int map_fd) {
+            emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map_fd);
+            emit(0, 0, 0, 0, 0);
+        }
+        std::vector<struct bpf_insn> finish() {
+            for (auto& fixup : fixups) {
+                int target = label_targets[fixup.second];
+                if (target <= (int)fixup.first) {
+                    throw std::runtime_error("eBPF jump to unbound or backward label");
+                }
+                insns[fixup.first].off = (int16_t)(target - (int)fixup.first - 1);
+            }
+            return insns;
+        }
+    };
+
+    int _sock = -1;
+    int _map_fd = -1;
+    int _prog_fd = -1;
+    int _link_fd = -1;
+    char *_umem = nullptr;
+    size_t _umem_size = 0;
+    size_t _frame_size;
+    size_t _n_frames;
+    Ring _rx;
+    Ring _fill;
+    Ring _completion;
+    bool _native = false;
+
+public:
+    /**
+     * @brief Create and bind the socket and attach the redirect program.
+     *
+     * @param ifindex     Interface index
+     * @param queue       Receive queue of the interface to bind to
+     * @param port        UDP destination port to redirect, or 0 for all UDP
+     * @param mode        XDP attach mode
+     * @param frame_size  UMEM frame size (2048 or 4096). Larger frames are dropped by the kernel.
+     * @param n_frames    Number of UMEM frames; also the fill and RX ring sizes. Must be a power of 2.
+     */
+    XdpSocket(unsigned ifindex, uint32_t queue, uint16_t port, Mode mode, size_t frame_size, size_t n_frames) :
+        _frame_size(frame_size),
+        _n_frames(n_frames)
+    {
+        if (frame_size != 2048 && frame_size != 4096) {
+            throw std::runtime_error("Invalid XDP frame size (must be 2048 or 4096): " + std::to_string(frame_size));
+        }
+        if (n_frames == 0 || (n_frames & (n_frames - 1)) != 0) {
+            throw std::runtime_error("Invalid XDP frame count (must be a power of 2): " + std::to_string(n_frames));
+        }
+        try {
+            setup_socket(ifindex, queue, mode);
+            setup_program(ifindex, queue, port, mode);
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    XdpSocket(const XdpSocket&) = delete;
+    XdpSocket& operator=(const XdpSocket&) = delete;
+
+    ~XdpSocket() {
+        close();
+    }
+
+    int fd() const {
+        return _sock;
+    }
+
+    bool is_native() const {
+        return _native;
+    }
+
+    /**
+     * @brief The number of received frames ready to be consumed.
+     */
+    size_t rx_available() const {
+        uint32_t prod = __atomic_load_n(_rx.producer, __ATOMIC_ACQUIRE);
+        return prod - *_rx.consumer;
+    }
+
+    /**
+     * @brief The i-th received descriptor past the consumer position. i < rx_available().
+     */
+    const struct xdp_desc& rx_desc(size_t i) const {
+        return ((const struct xdp_desc *)_rx.desc)[(*_rx.consumer + i) & _rx.mask];
+    }
+
+    const char *frame_data(const struct xdp_desc& desc) const {
+        return _umem + desc.addr;
+    }
+
+    /**
+     * @brief Consume n received frames and return them to the fill ring.
+     */
+    void rx_release(size_t n) {
+        uint32_t cons = *_rx.consumer;
+        uint32_t fill_prod = *_fill.producer;
+        auto fill_desc = (uint64_t *)_fill.desc;
+        for (size_t i = 0; i < n; ++i) {
+            const struct xdp_desc& desc = ((const struct xdp_desc *)_rx.desc)[(cons + i) & _rx.mask];
+            // In aligned mode, the frame base is the address rounded down to the frame size
+            fill_desc[(fill_prod + i) & _fill.mask] = desc.addr & ~(uint64_t)(_frame_size - 1);
+        }
+        __atomic_store_n(_fill.producer, fill_prod + (uint32_t)n, __ATOMIC_RELEASE);
+        __atomic_store_n(_rx.consumer, cons + (uint32_t)n, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Total number of packets dropped by the kernel because the RX ring was full or no fill
+     *        frames were available.
+     */
+    uint64_t n_drops() const {
+        struct xdp_statistics xstats;
+        memset(&xstats, 0, sizeof(xstats));
+        socklen_t len = sizeof(xstats);
+        if (getsockopt(_sock, SOL_XDP, XDP_STATISTICS, &xstats, &len) != 0) {
+            return 0;
+        }
+        return xstats.rx_dropped + xstats.rx_ring_full;
+    }
+
+    void close() {
+        if (_link_fd != -1) {
+            ::close(_link_fd);
+            _link_fd = -1;
+        }
+        if (_prog_fd != -1) {
+            ::close(_prog_fd);
+            _prog_fd = -1;
+        }
+        if (_map_fd != -1) {
+            ::close(_map_fd);
+            _map_fd = -1;
+        }
+        for (Ring *ring : {&_rx, &_fill, &_completion}) {
+            if (ring->map != nullptr) {
+                munmap(ring->map, ring->map_len);
+                ring->map = nullptr;
+            }
+        }
+        if (_sock != -1) {
+            ::close(_sock);
+            _sock = -1;
+        }
+        if (_umem != nullptr) {
+            munmap(_umem, _umem_size);
+            _umem = nullptr;
+        }
+    }
+
+protected:
+    static int bpf(int cmd, union bpf_attr& attr) {
+        return (int)syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+    }
+
+    void map_ring(Ring& ring, const struct xdp_ring_offset& off, size_t n_entries, size_t desc_size, off_t pgoff) {
+        ring.map_len = off.desc + n_entries * desc_size;
+        void *p = mmap(nullptr, ring.map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _sock, pgoff);
+        if (p == MAP_FAILED) {
+            ring.map = nullptr;
+            throw std::system_error(errno, std::system_category(), "mmap() of AF_XDP ring failed");
+        }
+        ring.map = p;
+        ring.producer = (uint32_t *)((char *)p + off.producer);
+        ring.consumer = (uint32_t *)((char *)p + off.consumer);
+        ring.desc = (char *)p + off.desc;
+        ring.mask = (uint32_t)(n_entries - 1);
+    }
+
+    void set_ring_size(int optname, size_t n_entries, const char *name) {
+        int n = (int)n_entries;
+        if (setsockopt(_sock, SOL_XDP, optname, &n, sizeof(n)) != 0) {
+            throw std::system_error(errno, std::system_category(), std::string("setsockopt(") + name + ") failed");
+        }
+    }
+
+    void setup_socket(unsigned ifindex, uint32_t queue, Mode mode) {
+        _umem_size = _frame_size * _n_frames;
+        void *p = mmap(nullptr, _umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "mmap() of AF_XDP UMEM failed");
+        }
+        _umem = (char *)p;
+
+        _sock = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+        if (_sock == -1) {
+            throw std::system_error(errno, std::system_category(), "socket(AF_XDP) failed");
+        }
+
+        struct xdp_umem_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uint64_t)(uintptr_t)_umem;
+        reg.len = _umem_size;
+        reg.chunk_size = (uint32_t)_frame_size;
+        reg.headroom = 0;
+        if (setsockopt(_sock, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0) {
+            throw std::system_error(errno, std::system_category(), "setsockopt(XDP_UMEM_REG) failed");
+        }
+        set_ring_size(XDP_UMEM_FILL_RING, _n_frames, "XDP_UMEM_FILL_RING");
+        set_ring_size(XDP_UMEM_COMPLETION_RING, _n_frames, "XDP_UMEM_COMPLETION_RING");
+        set_ring_size(XDP_RX_RING, _n_frames, "XDP_RX_RING");
+
+        struct xdp_mmap_offsets off;
+        socklen_t off_len = sizeof(off);
+        if (getsockopt(_sock, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) != 0) {
+            throw std::system_error(errno, std::system_category(), "getsockopt(XDP_MMAP_OFFSETS) failed");
+        }
+        map_ring(_rx, off.rx, _n_frames, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING);
+        map_ring(_fill, off.fr, _n_frames, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING);
+        map_ring(_completion, off.cr, _n_frames, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING);
+
+        // Give every frame to the kernel for receiving
+        auto fill_desc = (uint64_t *)_fill.desc;
+        for (size_t i = 0; i < _n_frames; ++i) {
+            fill_desc[i] = i * _frame_size;
+        }
+        __atomic_store_n(_fill.producer, (uint32_t)_n_frames, __ATOMIC_RELEASE);
+
+        struct sockaddr_xdp sxdp;
+        memset(&sxdp, 0, sizeof(sxdp));
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = ifindex;
+        sxdp.sxdp_queue_id = queue;
+        sxdp.sxdp_flags = (mode == Mode::SKB) ? XDP_COPY : 0;
+        if (bind(_sock, (struct sockaddr *)&sxdp, sizeof(sxdp)) != 0) {
+            throw std::system_error(errno, std::system_category(), "bind() of AF_XDP socket to queue " + std::to_string(queue) + " failed");
+        }
+    }
+
+    void setup_program(unsigned ifindex, uint32_t queue, uint16_t port, Mode mode) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(uint32_t);
+        attr.max_entries = queue + 1;
+        _map_fd = bpf(BPF_MAP_CREATE, attr);
+        if (_map_fd < 0) {
+            _map_fd = -1;
+            throw std::system_error(errno, std::system_category(), "bpf(BPF_MAP_CREATE) of XSKMAP failed");
+        }
+
+        uint32_t key = queue;
+        uint32_t value = (uint32_t)_sock;
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = (uint32_t)_map_fd;
+        attr.key = (uint64_t)(uintptr_t)&key;
+        attr.value = (uint64_t)(uintptr_t)&value;
+        if (bpf(BPF_MAP_UPDATE_ELEM, attr) != 0) {
+            throw std::system_error(errno, std::system_category(), "bpf(BPF_MAP_UPDATE_ELEM) of XSKMAP failed");
+        }
+
+        auto insns = redirect_program(port);
+        char log_buf[4096];
+        log_buf[0] = '\0';
+        const char *license = "GPL";
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uint64_t)(uintptr_t)insns.data();
+        attr.insn_cnt = (uint32_t)insns.size();
+        attr.license = (uint64_t)(uintptr_t)license;
+        attr.log_buf = (uint64_t)(uintptr_t)log_buf;
+        attr.log_size = sizeof(log_buf);
+        attr.log_level = 1;
+        attr.expected_attach_type = BPF_XDP;
+        _prog_fd = bpf(BPF_PROG_LOAD, attr);
+        if (_prog_fd < 0) {
+            _prog_fd = -1;
+            int err = errno;
+            BOOST_LOG_TRIVIAL(error) << "XDP program verifier log:\n" << log_buf;
+            throw std::system_error(err, std::system_category(), "bpf(BPF_PROG_LOAD) of XDP program failed");
+        }
+
+        if (mode != Mode::SKB) {
+            _link_fd = attach_program(ifindex, XDP_FLAGS_DRV_MODE);
+            if (_link_fd != -1) {
+                _native = true;
+            } else if (mode == Mode::NATIVE) {
+                throw std::system_error(errno, std::system_category(), "Native XDP attach failed");
+            } else {
+                BOOST_LOG_TRIVIAL(info) << "Native XDP not available (" << strerror(errno) << "); using generic mode\n";
+            }
+        }
+        if (_link_fd == -1) {
+            _link_fd = attach_program(ifindex, XDP_FLAGS_SKB_MODE);
+            if (_link_fd == -1) {
+                throw std::system_error(errno, std::system_category(), "Generic XDP attach failed");
+            }
+        }
+    }
+
+    int attach_program(unsigned ifindex, uint32_t flags) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = (uint32_t)_prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = flags;
+        int fd = bpf(BPF_LINK_CREATE, attr);
+        return (fd < 0) ? -1 : fd;
+    }
+
+    /**
+     * @brief Assemble the XDP program that redirects matching UDP datagrams on the receiving queue to the XSKMAP,
+     *        passing everything else (and everything, if no socket is bound to the queue) to the kernel stack.
+     */
+    std::vector<struct bpf_insn> redirect_program(uint16_t port) const {
+        const uint8_t R0 = BPF_REG_0, R1 = BPF_REG_1, R2 = BPF_REG_2, R3 = BPF_REG_3,
+                      R4 = BPF_REG_4, R5 = BPF_REG_5, R6 = BPF_REG_6;
+        // Values loaded from the packet are in network byte order, so constants are compared in network order too
+        const int32_t eth_p_ip = htons(ETH_P_IP);
+        const int32_t eth_p_ipv6 = htons(ETH_P_IPV6);
+        const int32_t frag_mask = htons(0x3fff);
+        const int32_t nbo_port = htons(port);
+
+        EbpfAssembler a;
+        int pass = a.new_label();
+        int ipv4 = a.new_label();
+        int ipv6 = a.new_label();
+        int check_port = a.new_label();
+
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_X, R6, R1, 0, 0);
+        a.emit(BPF_LDX | BPF_W | BPF_MEM, R2, R6, offsetof(struct xdp_md, data), 0);
+        a.emit(BPF_LDX | BPF_W | BPF_MEM, R3, R6, offsetof(struct xdp_md, data_end), 0);
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0);
+        a.emit(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, ETH_HLEN);
+        a.jump(BPF_JMP | BPF_JGT | BPF_X, R4, R3, 0, pass);
+        a.emit(BPF_LDX | BPF_H | BPF_MEM, R5, R2, 12, 0);
+        a.jump(BPF_JMP | BPF_JEQ | BPF_K, R5, 0, eth_p_ip, ipv4);
+        a.jump(BPF_JMP | BPF_JEQ | BPF_K, R5, 0, eth_p_ipv6, ipv6);
+        a.jump(BPF_JMP | BPF_JA, 0, 0, 0, pass);
+
+        // IPv4 without options: version/IHL is 0x45, protocol is UDP, not a fragment
+        a.bind(ipv4);
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0);
+        a.emit(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, ETH_HLEN + 20 + 8);
+        a.jump(BPF_JMP | BPF_JGT | BPF_X, R4, R3, 0, pass);
+        a.emit(BPF_LDX | BPF_B | BPF_MEM, R5, R2, ETH_HLEN, 0);
+        a.jump(BPF_JMP | BPF_JNE | BPF_K, R5, 0, 0x45, pass);
+        a.emit(BPF_LDX | BPF_B | BPF_MEM, R5, R2, ETH_HLEN + 9, 0);
+        a.jump(BPF_JMP | BPF_JNE | BPF_K, R5, 0, IPPROTO_UDP, pass);
+        a.emit(BPF_LDX | BPF_H | BPF_MEM, R5, R2, ETH_HLEN + 6, 0);
+        a.emit(BPF_ALU64 | BPF_AND | BPF_K, R5, 0, 0, frag_mask);
+        a.jump(BPF_JMP | BPF_JNE | BPF_K, R5, 0, 0, pass);
+        a.emit(BPF_LDX | BPF_H | BPF_MEM, R5, R2, ETH_HLEN + 20 + 2, 0);
+        a.jump(BPF_JMP | BPF_JA, 0, 0, 0, check_port);
+
+        // IPv6 with UDP as the first next header
+        a.bind(ipv6);
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_X, R4, R2, 0, 0);
+        a.emit(BPF_ALU64 | BPF_ADD | BPF_K, R4, 0, 0, ETH_HLEN + 40 + 8);
+        a.jump(BPF_JMP | BPF_JGT | BPF_X, R4, R3, 0, pass);
+        a.emit(BPF_LDX | BPF_B | BPF_MEM, R5, R2, ETH_HLEN + 6, 0);
+        a.jump(BPF_JMP | BPF_JNE | BPF_K, R5, 0, IPPROTO_UDP, pass);
+        a.emit(BPF_LDX | BPF_H | BPF_MEM, R5, R2, ETH_HLEN + 40 + 2, 0);
+
+        a.bind(check_port);
+        if (port != 0) {
+            a.jump(BPF_JMP | BPF_JNE | BPF_K, R5, 0, nbo_port, pass);
+        }
+        a.emit(BPF_LDX | BPF_W | BPF_MEM, R2, R6, offsetof(struct xdp_md, rx_queue_index), 0);
+        a.load_map_fd(R1, _map_fd);
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_K, R3, 0, 0, XDP_PASS);     // action if no socket is bound to the queue
+        a.emit(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+        a.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+        a.bind(pass);
+        a.emit(BPF_ALU64 | BPF_MOV | BPF_K, R0, 0, 0, XDP_PASS);
+        a.emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+        return a.finish();
+    }
+};
@@ -0,0 +1,66 @@
+#!/bin/bash
+#
+# Training workload for profile-guided optimization of dg-cat. Exercises the hot paths of the BufferQueue and
+# the common sources and destinations: random -> null, file -> file, and loopback UDP -> file, with and
+# without per-datagram metadata.
+#
+# Usage: pgo-train.sh <dg-cat-binary>
+#
+# Environment:
+#   DG_CAT_PGO_PORT   Loopback UDP port to use (default 47999)
+#   DG_CAT_PGO_N      Number of datagrams per workload (default 200000)
+
+set -eo pipefail
+
+DG_CAT="$1"
+if [ -z "$DG_CAT" ] || [ ! -x "$DG_CAT" ]; then
+    echo >&2 "Usage: $0 <dg-cat-binary>"
+    exit 1
+fi
+
+PORT="${DG_CAT_PGO_PORT:-47999}"
+N="${DG_CAT_PGO_N:-200000}"
+BACKLOG=64000000
+# Random payload generation is slow under instrumentation and is not itself a hot path
+RANDOM_N=$((N / 4))
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+run() {
+    echo "pgo-train: $*" >&2
+    "$DG_CAT" -b "$BACKLOG" --log-level warning "$@" 2>/dev/null
+}
+
+# random -> null, small and MTU-sized datagrams
+run "random://?n=$RANDOM_N&min_size=16&max_size=128" /dev/null
+run "random://?n=$RANDOM_N&min_size=512&max_size=1472" /dev/null
+run --metadata "random://?n=$RANDOM_N&min_size=16&max_size=1472" /dev/null
+
+# random -> file, to make captures for the following workloads
+run "random://?n=$RANDOM_N&min_size=16&max_size=1472&seed=1" "$WORK_DIR/capture.dgs"
+
+# file -> file, through the buffered and preloaded paths
+run "$WORK_DIR/capture.dgs" "$WORK_DIR/copy.dgs"
+run "file://$WORK_DIR/capture.dgs?preload=1&loop=4" "$WORK_DIR/copy.dgs"
+cat "$WORK_DIR/capture.dgs" | run - - > "$WORK_DIR/copy.dgs"
+
+# loopback UDP -> file: a file replayed directly from its mapping, and a pipe replayed through the BufferQueue
+udp_to_file() {
+    local src="$1"
+    shift
+    run -t 1 --start-timeout 10 "$@" "udp://127.0.0.1:$PORT" "$WORK_DIR/udp.dgs" &
+    local receiver=$!
+    sleep 0.5
+    if [ "$src" == "-" ]; then
+        cat "$WORK_DIR/capture.dgs" | run -r 200000 - "udp://127.0.0.1:$PORT"
+    else
+        run -r 200000 "$src" "udp://127.0.0.1:$PORT"
+    fi
+    wait "$receiver"
+}
+udp_to_file "$WORK_DIR/capture.dgs"
+udp_to_file -
+udp_to_file "$WORK_DIR/capture.dgs" --metadata
+
+echo "pgo-train: done" >&2
@@ -6,11 +6,26 @@
 #include "dg_cat/datagram_destination.hpp"
 #include "dg_cat/file_datagram_destination.hpp"
 #include "dg_cat/udp_datagram_destination.hpp"
+#include "dg_cat/arrow_datagram_destination.hpp"
+#include "dg_cat/demux_datagram_destination.hpp"
+#include "dg_cat/flight_recorder_destination.hpp"
+#include "dg_cat/summary_datagram_destination.hpp"
+#include "dg_cat/striped_datagram_destination.hpp"
 
 std::unique_ptr<DatagramDestination> DatagramDestination::create(const DgCatConfig& config, const std::string& path)
 {
     if (path.compare(0, 6, "udp://") == 0) {
         return UdpDatagramDestination::create(config, path);
+    } else if (path.compare(0, 8, "arrow://") == 0) {
+        return ArrowDatagramDestination::create(config, path);
+    } else if (path.compare(0, 8, "demux://") == 0) {
+        return DemuxDatagramDestination::create(config, path);
+    } else if (path.compare(0, 9, "flight://") == 0) {
+        return FlightRecorderDestination::create(config, path);
+    } else if (path.compare(0, 10, "summary://") == 0) {
+        return SummaryDatagramDestination::create(config, path);
+    } else if (path.compare(0, 9, "stripe://") == 0) {
+        return StripedDatagramDestination::create(config, path);
     } else {
         return FileDatagramDestination::create(config, path);
     }
@@ -7,13 +7,22 @@
 #include "dg_cat/udp_datagram_source.hpp"
 #include "dg_cat/random_datagram_source.hpp"
 #include "dg_cat/file_datagram_source.hpp"
+#include "dg_cat/packet_datagram_source.hpp"
+#include "dg_cat/xdp_datagram_source.hpp"
+#include "dg_cat/striped_datagram_source.hpp"
 
 std::unique_ptr<DatagramSource> DatagramSource::create(const DgCatConfig& config, const std::string& path)
 {
     if (path.compare(0, 6, "udp://") == 0) {
         return UdpDatagramSource::create(config, path);
+    } else if (path.compare(0, 9, "packet://") == 0) {
+        return PacketDatagramSource::create(config, path);
+    } else if (path.compare(0, 6, "xdp://") == 0) {
+        return XdpDatagramSource::create(config, path);
     } else if (path.compare(0, 9, "random://") == 0) {
         return RandomDatagramSource::create(config, path);
+    } else if (path.compare(0, 9, "stripe://") == 0) {
+        return StripedDatagramSource::create(config, path);
     } else {
         return FileDatagramSource::create(config, path);
     }
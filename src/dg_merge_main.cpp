@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+
+#include "dg_cat/version.hpp"
+#include "dg_cat/capture_merger.hpp"
+
+#include <argparse/argparse.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/utility/setup/console.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace logging = boost::log;
+
+static void init_logging(const std::string& log_level) {
+    auto lc_str = boost::algorithm::to_lower_copy(log_level);
+    logging::trivial::severity_level severity;
+    if (!logging::trivial::from_string(lc_str.c_str(), lc_str.size(), severity)) {
+        throw std::runtime_error(std::string("Invalid log level: ") + log_level);
+    }
+    logging::core::get()->set_filter(logging::trivial::severity >= severity);
+    // The merged capture may go to stdout, so keep log messages out of it
+    logging::add_console_log(std::cerr);
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser parser("dg-merge", DG_CAT_VERSION);
+
+    parser.add_description(
+        "Merge timestamped dg-cat captures into a single capture ordered by timestamp.\n\n"
+        "The inputs must have been captured with --metadata, and each should already be in timestamp\n"
+        "order (as dg-cat writes them). Records with equal timestamps are output in input order."
+    );
+
+    parser.add_argument("-o", "--output")
+        .default_value(std::string("-"))
+        .help(std::string(
+            "The merged capture file, or \"-\" for stdout.")
+        );
+
+    parser.add_argument("-a", "--append")
+        .flag()
+        .help(std::string(
+            "Append to the output file instead of truncating it.")
+        );
+
+    parser.add_argument("-R", "--read-ahead")
+        .default_value(DEFAULT_MERGE_READ_AHEAD)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "The number of bytes to read from each input in a single system call.")
+        );
+
+    parser.add_argument("-w", "--max-write-size")
+        .default_value(DEFAULT_MERGE_WRITE_SIZE)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "The number of bytes of merged output to accumulate before each write.")
+        );
+
+    parser.add_argument("-d", "--max-datagram-size")
+        .default_value(DEFAULT_MAX_DATAGRAM_SIZE)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "Records longer than this (not including metadata) are treated as corruption.")
+        );
+
+    parser.add_argument("-l", "--log-level")
+        .default_value(std::string("warning"))
+        .help(std::string(
+              "Set the logging level. Choices are ('debug', 'info', 'warning', 'error',\n"
+              "or 'critical').")
+        );
+
+    parser.add_argument("captures")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .help("The capture files to merge. \"-\" reads one capture from stdin.");
+
+    parser.add_epilog(
+            "Examples:\n"
+            "    dg-merge -o all.dgs host1.dgs host2.dgs host3.dgs\n"
+            "        Merge three timestamped captures into all.dgs.\n"
+        );
+
+    try {
+        parser.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    init_logging(parser.get<std::string>("log-level"));
+
+    CaptureMergerOptions options;
+    options.read_ahead = parser.get<size_t>("read-ahead");
+    options.max_write_size = parser.get<size_t>("max-write-size");
+    options.max_datagram_size = parser.get<size_t>("max-datagram-size");
+    auto output = parser.get<std::string>("output");
+    auto append = parser.get<bool>("append");
+    auto captures = parser.get<std::vector<std::string>>("captures");
+    if (std::count(captures.begin(), captures.end(), std::string("-")) > 1) {
+        std::cerr << "stdin can only be merged once" << std::endl;
+        return 1;
+    }
+
+    try {
+        int out_fd = 1;
+        if (output != "-") {
+            out_fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+            if (out_fd == -1) {
+                throw std::runtime_error("Failed to open file: " + output + ": " + strerror(errno));
+            }
+        }
+        CaptureMerger merger(options);
+        CaptureMergerStats stats = merger.merge(captures, out_fd, output);
+        if (out_fd != 1 && ::close(out_fd) != 0) {
+            throw std::system_error(errno, std::system_category(), "close() of " + output + " failed");
+        }
+        BOOST_LOG_TRIVIAL(info) << "Merged " << stats.n_datagrams << " datagrams (" << stats.n_bytes << " bytes) from "
+                                << stats.n_inputs << " captures with " << stats.n_reads << " reads and "
+                                << stats.n_writes << " writes\n";
+        if (stats.n_out_of_order != 0) {
+            BOOST_LOG_TRIVIAL(warning) << stats.n_out_of_order << " input records were out of timestamp order\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "dg-merge: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) 2024 Samuel J. McKelvie
+ *
+ * MIT License - See LICENSE file accompanying this package.
+ */
+
+#include "dg_cat/version.hpp"
+#include "dg_cat/capture_analyzer.hpp"
+#include "dg_cat/cgroup_limits.hpp"
+#include "dg_cat/json_writer.hpp"
+
+#include <argparse/argparse.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/utility/setup/console.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace logging = boost::log;
+
+static void init_logging(const std::string& log_level) {
+    auto lc_str = boost::algorithm::to_lower_copy(log_level);
+    logging::trivial::severity_level severity;
+    if (!logging::trivial::from_string(lc_str.c_str(), lc_str.size(), severity)) {
+        throw std::runtime_error(std::string("Invalid log level: ") + log_level);
+    }
+    logging::core::get()->set_filter(logging::trivial::severity >= severity);
+    // The JSON report goes to stdout, so keep log messages out of it
+    logging::add_console_log(std::cerr);
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser parser("dg-stat", DG_CAT_VERSION);
+
+    parser.add_description(
+        "Analyze dg-cat capture files and print statistics as JSON.\n\n"
+        "Each capture is memory-mapped and analyzed on multiple threads: datagram counts, a size\n"
+        "histogram, framing errors, rate over time (for captures with --metadata timestamps), and\n"
+        "optionally gaps in a big-endian sequence field."
+    );
+
+    parser.add_argument("-m", "--metadata")
+        .flag()
+        .help(std::string(
+            "Each record begins with the 32-byte metadata header written by dg-cat --metadata.")
+        );
+
+    parser.add_argument("-j", "--threads")
+        .default_value((size_t)0)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "The number of threads to use per capture. 0 means the number of CPUs available, as limited\n"
+            "by CPU affinity and any cgroup CPU quota.")
+        );
+
+    parser.add_argument("-i", "--interval")
+        .default_value(1.0)
+        .scan<'g', double>()
+        .help(std::string(
+            "The width in seconds of the rate-over-time bins. Requires --metadata.")
+        );
+
+    parser.add_argument("--seq-offset")
+        .scan<'u', size_t>()
+        .help(std::string(
+            "Offset within each datagram of an unsigned big-endian sequence field to check for gaps\n"
+            "and reordering.")
+        );
+
+    parser.add_argument("--seq-width")
+        .default_value((size_t)4)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "Width of the sequence field in bytes (1, 2, 4, or 8).")
+        );
+
+    parser.add_argument("-d", "--max-datagram-size")
+        .default_value(DEFAULT_MAX_DATAGRAM_SIZE)
+        .scan<'u', size_t>()
+        .help(std::string(
+            "Records longer than this (not including metadata) are counted as framing errors.")
+        );
+
+    parser.add_argument("-c", "--compact")
+        .flag()
+        .help(std::string(
+            "Print compact JSON on a single line.")
+        );
+
+    parser.add_argument("-l", "--log-level")
+        .default_value(std::string("warning"))
+        .help(std::string(
+              "Set the logging level. Choices are ('debug', 'info', 'warning', 'error',\n"
+              "or 'critical').")
+        );
+
+    parser.add_argument("captures")
+        .nargs(argparse::nargs_pattern::at_least_one)
+        .help("The capture files to analyze.");
+
+    parser.add_epilog(
+            "Examples:\n"
+            "    dg-stat --metadata --seq-offset 0 capture.dgs\n"
+            "        Analyze a timestamped capture whose datagrams begin with a 4-byte sequence number.\n"
+        );
+
+    try {
+        parser.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+    if (parser.is_used("--interval") && !parser.get<bool>("metadata")) {
+        std::cerr << "--interval requires --metadata" << std::endl;
+        std::cerr << parser;
+        return 1;
+    }
+
+    init_logging(parser.get<std::string>("log-level"));
+
+    CaptureAnalyzerOptions options;
+    options.metadata = parser.get<bool>("metadata");
+    options.rate_interval_secs = parser.get<double>("interval");
+    if (parser.present<size_t>("seq-offset")) {
+        options.seq = true;
+        options.seq_offset = parser.get<size_t>("seq-offset");
+    }
+    options.seq_width = parser.get<size_t>("seq-width");
+    options.max_datagram_size = parser.get<size_t>("max-datagram-size");
+    size_t n_threads = parser.get<size_t>("threads");
+    if (n_threads == 0) {
+        n_threads = CgroupLimits::detect().available_cpus();
+    }
+    auto captures = parser.get<std::vector<std::string>>("captures");
+
+    CaptureAnalyzer analyzer(options);
+    JsonWriter w(parser.get<bool>("compact") ? 0 : 2);
+    CaptureStats total;
+    w.begin_object();
+    w.key("captures").begin_array();
+    for (auto& filename : captures) {
+        BOOST_LOG_TRIVIAL(info) << "Analyzing " << filename << " with " << n_threads << " threads\n";
+        CaptureStats stats = analyzer.analyze(filename, n_threads);
+        w.begin_object();
+        w.member("file", filename);
+        stats.write_json_members(w, options);
+        w.end_object();
+        total.merge_following(stats, ~(uint64_t)0);
+    }
+    w.end_array();
+    if (captures.size() > 1) {
+        // Sequence continuity is not meaningful across separate captures
+        CaptureAnalyzerOptions total_options = options;
+        total_options.seq = false;
+        w.key("total").begin_object();
+        total.write_json_members(w, total_options);
+        w.end_object();
+    }
+    w.end_object();
+    std::cout << w.str() << std::endl;
+
+    return 0;
+}
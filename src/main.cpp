@@ -84,7 +84,8 @@ int main(int argc, char* argv[]) {
         .default_value(DEFAULT_MAX_DATAGRAM_SIZE)
         .scan<'u', size_t>()
         .help(std::string(
-            "For UDP input, the per-datagram buffer size. Datagrams larger than this are discarded.\n ")
+            "For UDP input, the per-datagram buffer size. Datagrams larger than this are discarded.\n"
+            "A preloaded or directly replayed capture file with a longer datagram is rejected.\n ")
          // + " Default is " + std::to_string(DEFAULT_MAX_DATAGRAM_SIZE) + "."
             );
 
@@ -165,12 +166,37 @@ int main(int argc, char* argv[]) {
             "For file outputs, append to the file instead of truncating it.")
         );
 
+    parser.add_argument("-m", "--metadata")
+        .flag()
+        .help(std::string(
+            "Carry a 32-byte metadata header (receive timestamp and sender address) with each\n"
+            "datagram. File outputs are written as timestamped captures that include the header,\n"
+            "and file inputs are expected to contain it. UDP outputs send only the payload.")
+        );
+
     parser.add_argument("--no-handle-signals")
         .flag()
         .help(std::string(
-            "Do not intercept SIGINT and SIGUSR1.  By default, SIGINT will cleanly drain\n"
-            "buffered datagrams before shutting down, and SIGUSR1 will cause a brief summary\n"
-            "of progress statistics to be printed to stderr.")
+            "Do not intercept SIGINT, SIGUSR1 and SIGUSR2.  By default, SIGINT will cleanly drain\n"
+            "buffered datagrams before shutting down, SIGUSR1 will cause a brief summary\n"
+            "of progress statistics to be printed to stderr, and SIGUSR2 will trigger a\n"
+            "flight recorder dump.")
+        );
+
+    parser.add_argument("--no-auto-size")
+        .flag()
+        .help(std::string(
+            "Do not size the backlog and UDP receive buffers to fit a cgroup v2 memory limit. By default,\n"
+            "--max-backlog and --max-iovecs are reduced if necessary (unless given explicitly) so that\n"
+            "together they use at most half of the limit. Run with '-l info' to see the values chosen.")
+        );
+
+    parser.add_argument("--control-socket")
+        .default_value(std::string(""))
+        .help(std::string(
+            "Listen on a unix-domain socket at this path for runtime control commands, one per line:\n"
+            "'rate <datagrams/sec>', 'pause', 'resume', 'rotate', 'stats', 'trigger', or 'eof'.\n"
+            "Each command is answered with a line beginning with 'ok' or 'error:'.")
         );
 
     // NOTE: argparse in this version seems to have a bug in choices() such that all remaining
@@ -195,10 +221,13 @@ int main(int argc, char* argv[]) {
         .default_value(std::string("stdin"))
         .help("The source of datagrams. Can be one of: \n"
                 "    \"<filename>\"\n"
-                "    \"file://<filename>\"\n"
-                "    \"udp://<local-port\"\n"
-                "    \"udp://<local-bind-addr>:<local-port>\"\n"
+                "    \"file://<filename>[?preload=1][&lock=1][&loop=<n>][&seq_offset=<offset>][&seq_width=<bytes>][&follow=1][&framing=<codec>]\"\n"
+                "    \"udp://<local-port>[?filter=<expression>][&top=<k>][&senders=<n>][&slot=<bytes>]\"\n"
+                "    \"udp://<local-bind-addr>:<local-port>[?filter=<expression>][&top=<k>][&senders=<n>][&slot=<bytes>]\"\n"
+                "    \"packet://<interface>[?port=<udp-port>][&block_size=<bytes>][&block_count=<n>][&block_timeout=<ms>]\"\n"
+                "    \"xdp://<interface>[?queue=<n>][&port=<udp-port>][&mode=auto|native|skb][&frame_size=<bytes>][&frames=<n>]\"\n"
                 "    \"random://[?][n=<num-datagrams>][&min=<min-bytes>][&max=<max-bytes>][&seed=<seed>]\"\n"
+                "    \"stripe://<manifest>\"\n"
                 "    \"stdin\"\n"
                 "    \"-\"        (alias for stdin)\n"
                 "If omitted, \"stdin\" is used.");
@@ -207,8 +236,13 @@ int main(int argc, char* argv[]) {
         .default_value(std::string("stdout"))
         .help("The destination of datagrams. Can be one of: \n"
               "    \"<filename>\"\n"
-              "    \"file://<filename>\"\n"
-              "    \"udp://<remote-addr>:<remote-port>\"\n"
+              "    \"file://<filename>[?durability=none|interval:<duration>|bytes:<size>][&mmap=1][&window=<size>][&framing=<codec>]\"\n"
+              "    \"udp://<remote-addr>:<remote-port>[?nonblock=1][&adaptive=1][&txstamp=1]\"\n"
+              "    \"arrow://<filename>[?rows=<max-batch-rows>][&bytes=<max-batch-bytes>]\"\n"
+              "    \"demux://<template>[?strip=1][&max=<max-outputs>]\"  (requires --metadata)\n"
+              "    \"flight://<template>[?history=<size>][&age=<duration>][&post=<duration>][&trigger=<expression>]\"\n"
+              "    \"summary://<filename>[?key=<offset>:<width>][&interval=<duration>][&max=<max-keys>]\"\n"
+              "    \"stripe://<manifest>?paths=<path>,<path>[,...][&chunk=<size>]\"\n"
               "    \"stdout\"\n"
               "    \"-\"       (alias for stdout)\n"
               "If omitted, stdout is used.");
@@ -248,6 +282,9 @@ int main(int argc, char* argv[]) {
     auto max_iovecs = parser.get<size_t>("max-iovecs");
     auto append = parser.get<bool>("append");
     auto no_handle_signals = parser.get<bool>("no-handle-signals");
+    auto metadata = parser.get<bool>("metadata");
+    auto no_auto_size = parser.get<bool>("no-auto-size");
+    auto control_socket = parser.get<std::string>("control-socket");
     auto src = parser.get<std::string>("src");
     auto dst = parser.get<std::string>("dst");
 
@@ -262,9 +299,15 @@ int main(int argc, char* argv[]) {
         max_write_size,
         max_iovecs,
         append,
-        !no_handle_signals
+        !no_handle_signals,
+        metadata,
+        control_socket
     );
 
+    if (!no_auto_size) {
+        CgroupLimits::detect().fit_config(config, !parser.is_used("--max-backlog"), !parser.is_used("--max-iovecs"));
+    }
+
     BOOST_LOG_TRIVIAL(debug) <<
         "Starting dg-cat with " << config.to_string() << "\n";
     BOOST_LOG_TRIVIAL(info) << "PID: " << getpid() << "\n";